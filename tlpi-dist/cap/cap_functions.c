@@ -16,6 +16,7 @@
 */
 
 #include <stdio.h>
+#include <errno.h>
 #include "cap_functions.h"
 
 /* Change the 'setting' of the specified 'capability' in the capability set
@@ -62,3 +63,65 @@ modifyCapSetting(cap_flag_t flag, int capability, int setting)
 
     return 0;
 }
+
+void
+capCacheInit(struct capCache *cc)
+{
+    cc->numStates = 0;
+    cc->current = -1;
+}
+
+int
+capCacheAdd(struct capCache *cc, const char *text)
+{
+    cap_t caps;
+
+    if (cc->numStates == CAP_CACHE_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    caps = cap_from_text(text);
+    if (caps == NULL)
+        return -1;
+
+    cc->state[cc->numStates] = caps;
+    return cc->numStates++;
+}
+
+int
+capCacheSwitch(struct capCache *cc, int idx)
+{
+    if (idx < 0 || idx >= cc->numStates) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (idx == cc->current)             /* Already installed */
+        return 0;
+
+    if (cap_set_proc(cc->state[idx]) == -1) {
+        cc->current = -1;               /* State is now unknown */
+        return -1;
+    }
+
+    cc->current = idx;
+    return 0;
+}
+
+void
+capCacheInvalidate(struct capCache *cc)
+{
+    cc->current = -1;
+}
+
+void
+capCacheFree(struct capCache *cc)
+{
+    int j;
+
+    for (j = 0; j < cc->numStates; j++)
+        cap_free(cc->state[j]);
+    cc->numStates = 0;
+    cc->current = -1;
+}
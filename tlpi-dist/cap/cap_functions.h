@@ -30,4 +30,41 @@
 
 int modifyCapSetting(cap_flag_t flag, int capability, int setting);
 
+/* A cache of prepared capability states. Each state is built once, by
+   capCacheAdd(), and thereafter installed by capCacheSwitch() with a
+   single capset() system call, rather than by retrieving, modifying, and
+   pushing back the caller's capabilities as modifyCapSetting() does.
+
+   capCacheSwitch() records which state it last installed, and does
+   nothing if asked to install that state again; so a caller that changes
+   its capabilities by other means must then call capCacheInvalidate(). */
+
+#define CAP_CACHE_MAX 8
+
+struct capCache {
+    cap_t state[CAP_CACHE_MAX];
+    int numStates;
+    int current;                /* Index of installed state, or -1 */
+};
+
+void capCacheInit(struct capCache *cc);
+
+/* Add the state described by 'text' (in the form accepted by
+   cap_from_text(), for example "cap_dac_read_search=p").
+
+   Returns: index of the new state on success or -1 on error. */
+
+int capCacheAdd(struct capCache *cc, const char *text);
+
+/* Install state 'idx'. Returns: 0 on success or -1 on error. */
+
+int capCacheSwitch(struct capCache *cc, int idx);
+
+/* Forget which state is installed, so that the next capCacheSwitch()
+   call installs its state unconditionally. */
+
+void capCacheInvalidate(struct capCache *cc);
+
+void capCacheFree(struct capCache *cc);
+
 #endif
@@ -0,0 +1,252 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 39 */
+
+/* cap_switch_bench.c
+
+   Compare ways of performing an operation that needs a capability, for
+   a program that otherwise runs with that capability only in its
+   permitted set (as check_password_caps.c does).
+
+   Usage: cap_switch_bench [-n reps] [-f file]
+
+   The privileged operation is to open 'file' (default: /etc/shadow),
+   read from it, and close it, which needs CAP_DAC_READ_SEARCH if the
+   caller doesn't otherwise have read permission. Each method is timed
+   over 'reps' (default: 100000) requests, both with the operation and
+   with the operation omitted (to show the cost of the mechanism alone):
+
+        modify      raise the capability in the effective set before the
+                    operation and drop it afterward, each time using
+                    modifyCapSetting() (cap_get_proc(), cap_set_flag(),
+                    cap_set_proc(), cap_free())
+        cached      switch between two states prepared in advance in a
+                    'struct capCache', with one capset() per switch
+        helper      send the request over a UNIX domain socket to a
+                    helper process, forked at startup, that keeps the
+                    capability in its effective set; the caller drops
+                    its own capabilities entirely
+        none        perform the operation with the capability permanently
+                    effective (the lower bound)
+
+   The program must be run with CAP_DAC_READ_SEARCH in its permitted set:
+   for example, as root, or after
+
+        $ sudo setcap "cap_dac_read_search=p" cap_switch_bench
+
+   (Note that, if the program is run as root, root may own 'file', in
+   which case the operation succeeds even without the capability.)
+
+   This program is Linux-specific.
+*/
+#include <sys/capability.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include "cap_functions.h"
+#include "tlpi_hdr.h"
+
+#define LOWERED "cap_dac_read_search=p"
+#define RAISED  "cap_dac_read_search=ep"
+
+static const char *file;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The privileged operation. Returns the number of bytes read, or -1 on
+   error. */
+
+static ssize_t
+privOp(void)
+{
+    char buf[512];
+    ssize_t numRead;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    numRead = read(fd, buf, sizeof(buf));
+    close(fd);
+    return numRead;
+}
+
+/* Body of the helper process: perform requests arriving on 'sfd' until
+   end of file. A request is an int that says whether to perform the
+   operation; the reply is the result of the operation. */
+
+static void
+helperLoop(int sfd)
+{
+    ssize_t result;
+    int req;
+
+    while (recv(sfd, &req, sizeof(req), 0) == sizeof(req)) {
+        result = req ? privOp() : 0;
+        if (send(sfd, &result, sizeof(result), 0) != sizeof(result))
+            break;
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void
+printResult(const char *method, double withOp, double noOp, long reps)
+{
+    printf("%-8s %12.0f %12.0f\n", method, withOp * 1e9 / reps,
+            noOp * 1e9 / reps);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct capCache cc;
+    double t[2], start;
+    ssize_t result;
+    long reps, j;
+    int opt, lowered, raised, sv[2], withOp, req;
+    pid_t helper;
+
+    reps = 100000;
+    file = "/etc/shadow";
+
+    while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+        switch (opt) {
+        case 'n': reps = getLong(optarg, GN_GT_0, "reps");      break;
+        case 'f': file = optarg;                                break;
+        default:  usageErr("%s [-n reps] [-f file]\n", argv[0]);
+        }
+    }
+
+    capCacheInit(&cc);
+    lowered = capCacheAdd(&cc, LOWERED);
+    raised = capCacheAdd(&cc, RAISED);
+    if (lowered == -1 || raised == -1)
+        errExit("capCacheAdd");
+
+    /* Start with the capability only in the permitted set */
+
+    if (capCacheSwitch(&cc, lowered) == -1)
+        errExit("capCacheSwitch (is CAP_DAC_READ_SEARCH permitted?)");
+
+    if (privOp() != -1)
+        printf("Note: %s is readable without CAP_DAC_READ_SEARCH\n", file);
+    if (capCacheSwitch(&cc, raised) == -1)
+        errExit("capCacheSwitch");
+    if (privOp() == -1)
+        errExit("open/read %s with CAP_DAC_READ_SEARCH", file);
+    if (capCacheSwitch(&cc, lowered) == -1)
+        errExit("capCacheSwitch");
+
+    /* Create the helper now, while we still have the capability.
+       The helper makes the capability effective. */
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1)
+        errExit("socketpair");
+    helper = fork();
+    if (helper == -1)
+        errExit("fork");
+    if (helper == 0) {
+        close(sv[0]);
+        if (capCacheSwitch(&cc, raised) == -1)
+            errExit("capCacheSwitch");
+        helperLoop(sv[1]);
+    }
+    close(sv[1]);
+
+    printf("%-8s %12s %12s   (ns per request, %ld requests)\n", "method",
+            "with op", "switch only", reps);
+
+    /* modifyCapSetting() on each request */
+
+    for (withOp = 1; withOp >= 0; withOp--) {
+        start = nowSecs();
+        for (j = 0; j < reps; j++) {
+            if (modifyCapSetting(CAP_EFFECTIVE, CAP_DAC_READ_SEARCH,
+                                 CAP_SET) == -1)
+                errExit("modifyCapSetting");
+            if (withOp && privOp() == -1)
+                errExit("privOp");
+            if (modifyCapSetting(CAP_EFFECTIVE, CAP_DAC_READ_SEARCH,
+                                 CAP_CLEAR) == -1)
+                errExit("modifyCapSetting");
+        }
+        t[withOp] = nowSecs() - start;
+    }
+    printResult("modify", t[1], t[0], reps);
+
+    /* Cached states. modifyCapSetting() left the capability lowered, but
+       the cache doesn't know that, so reinstall the lowered state. */
+
+    capCacheInvalidate(&cc);
+    if (capCacheSwitch(&cc, lowered) == -1)
+        errExit("capCacheSwitch");
+
+    for (withOp = 1; withOp >= 0; withOp--) {
+        start = nowSecs();
+        for (j = 0; j < reps; j++) {
+            if (capCacheSwitch(&cc, raised) == -1)
+                errExit("capCacheSwitch");
+            if (withOp && privOp() == -1)
+                errExit("privOp");
+            if (capCacheSwitch(&cc, lowered) == -1)
+                errExit("capCacheSwitch");
+        }
+        t[withOp] = nowSecs() - start;
+    }
+    printResult("cached", t[1], t[0], reps);
+
+    /* Operation with the capability permanently effective */
+
+    if (capCacheSwitch(&cc, raised) == -1)
+        errExit("capCacheSwitch");
+    start = nowSecs();
+    for (j = 0; j < reps; j++)
+        if (privOp() == -1)
+            errExit("privOp");
+    t[1] = nowSecs() - start;
+    printResult("none", t[1], 0, reps);
+
+    /* Privileged helper; we no longer need any capabilities */
+
+    capCacheFree(&cc);
+    if (capCacheAdd(&cc, "=") == -1 || capCacheSwitch(&cc, 0) == -1)
+        errExit("dropping capabilities");
+
+    for (withOp = 1; withOp >= 0; withOp--) {
+        req = withOp;
+        start = nowSecs();
+        for (j = 0; j < reps; j++) {
+            if (send(sv[0], &req, sizeof(req), 0) != sizeof(req))
+                errExit("send");
+            if (recv(sv[0], &result, sizeof(result), 0) != sizeof(result))
+                errExit("recv");
+            if (result == -1)
+                fatal("helper's operation failed");
+        }
+        t[withOp] = nowSecs() - start;
+    }
+    printResult("helper", t[1], t[0], reps);
+
+    close(sv[0]);                       /* Helper sees EOF and exits */
+    if (waitpid(helper, NULL, 0) == -1)
+        errExit("waitpid");
+    capCacheFree(&cc);
+
+    exit(EXIT_SUCCESS);
+}
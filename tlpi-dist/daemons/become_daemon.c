@@ -17,12 +17,13 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "become_daemon.h"
+#include "close_fds.h"
 #include "tlpi_hdr.h"
 
 int                                     /* Returns 0 on success, -1 on error */
 becomeDaemon(int flags)
 {
-    int maxfd, fd;
+    int fd;
 
     switch (fork()) {                   /* Become background process */
     case -1: return -1;
@@ -45,14 +46,9 @@ becomeDaemon(int flags)
     if (!(flags & BD_NO_CHDIR))
         chdir("/");                     /* Change to root directory */
 
-    if (!(flags & BD_NO_CLOSE_FILES)) { /* Close all open files */
-        maxfd = sysconf(_SC_OPEN_MAX);
-        if (maxfd == -1)                /* Limit is indeterminate... */
-            maxfd = BD_MAX_CLOSE;       /* so take a guess */
-
-        for (fd = 0; fd < maxfd; fd++)
-            close(fd);
-    }
+    if (!(flags & BD_NO_CLOSE_FILES))   /* Close all open files */
+        closeFdsFrom(0, 0);             /* Rather than close() on every
+                                           possible fd; see close_fds.c */
 
     if (!(flags & BD_NO_REOPEN_STD_FDS)) {
         close(STDIN_FILENO);            /* Reopen standard fd's to /dev/null */
@@ -25,7 +25,9 @@
                                        stderr to /dev/null */
 #define BD_NO_UMASK0         010    /* Don't do a umask(0) */
 
-#define BD_MAX_CLOSE  8192          /* Maximum file descriptors to close if
+#include "close_fds.h"
+
+#define BD_MAX_CLOSE  CFD_MAX_GUESS /* Maximum file descriptors to close if
                                        sysconf(_SC_OPEN_MAX) is indeterminate */
 
 int becomeDaemon(int flags);
@@ -0,0 +1,372 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 14 */
+
+/* fs_monitor.c
+
+   Monitor the space and inode usage of all mounted file systems, and
+   publish the figures, together with forecasts of when each file system
+   will fill, in a POSIX shared memory object (see fs_monitor.h).
+
+   Usage: fs_monitor [-i interval] [-w window] [-s shm-name] [-a] [-v]
+
+   The list of mounts is read from /proc/self/mountinfo. Rather than
+   rereading that file on every sample, the program keeps it open and
+   waits for it with poll(): the kernel reports POLLPRI (and POLLERR)
+   on the file descriptor when a mount is added, removed, or changed in
+   the caller's mount namespace. The list is reread only then.
+
+   Every 'interval' seconds (default: 5), statvfs() is called once for
+   each file system. Bind mounts of a file system already in the list
+   (same device number) are not sampled again, and nor (unless -a is
+   specified) are file systems that report no blocks (proc, sysfs, and
+   so on). Note that statvfs() on an unreachable network file system may
+   block, delaying all samples.
+
+   The rate of change of used space (and inodes) is smoothed with an
+   exponentially weighted moving average over about 'window' (default:
+   12) samples, and the time until the file system fills at that rate is
+   published as a forecast.
+
+   The shared memory object ('shm-name', default FSM_SHM_NAME) is removed
+   when the program is terminated by SIGINT or SIGTERM. -v logs mount
+   table changes and the cost of each sample.
+
+   See also fs_monitor_read.c.
+*/
+#define _GNU_SOURCE
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include "fs_monitor.h"
+#include "tlpi_hdr.h"
+
+struct mount {
+    int id;                     /* Mount ID from mountinfo */
+    unsigned int major, minor;  /* Device */
+    char mountPoint[PATH_MAX];
+    char fsType[FSM_TYPE_LEN];
+    Boolean haveSample, haveRate;
+    double lastTime;
+    uint64_t lastAvailBytes, lastAvailInodes;
+    struct fsmEntry pub;        /* As last published */
+};
+
+static struct mount mounts[FSM_MAX_MOUNTS];
+static int numMounts;
+
+static Boolean verbose = FALSE;
+static volatile sig_atomic_t gotTerm = 0;
+
+static void
+handler(int sig)
+{
+    gotTerm = 1;
+}
+
+static double
+nowSecs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Replace the octal escapes (e.g., "\040" for space) that mountinfo
+   uses in pathnames by the characters they represent */
+
+static void
+unescape(char *s)
+{
+    char *d;
+
+    for (d = s; *s != '\0'; s++, d++) {
+        if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+                s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+            *d = (s[1] - '0') * 64 + (s[2] - '0') * 8 + (s[3] - '0');
+            s += 3;
+        } else {
+            *d = *s;
+        }
+    }
+    *d = '\0';
+}
+
+/* Reread the mount table from 'fp', keeping the history of mounts that
+   are still present */
+
+static void
+readMounts(FILE *fp)
+{
+    static struct mount old[FSM_MAX_MOUNTS];
+    static char *line = NULL;
+    static size_t lineSize = 0;
+    struct mount *m;
+    int numOld, j, k;
+    Boolean dup;
+    char *sep;
+
+    memcpy(old, mounts, numMounts * sizeof(struct mount));
+    numOld = numMounts;
+    numMounts = 0;
+
+    rewind(fp);
+    while (getline(&line, &lineSize, fp) != -1) {
+        if (numMounts == FSM_MAX_MOUNTS) {
+            fprintf(stderr, "Too many mounts; ignoring the rest\n");
+            break;
+        }
+
+        m = &mounts[numMounts];
+        memset(m, 0, sizeof(struct mount));
+        sep = strstr(line, " - ");
+        if (sep == NULL ||
+                sscanf(line, "%d %*d %u:%u %*s %4095s", &m->id, &m->major,
+                       &m->minor, m->mountPoint) != 4 ||
+                sscanf(sep + 3, "%31s", m->fsType) != 1)
+            continue;           /* Unexpected format */
+        unescape(m->mountPoint);
+
+        /* Skip further mounts of a device that's already listed */
+
+        dup = FALSE;
+        for (k = 0; k < numMounts && !dup; k++)
+            dup = mounts[k].major == m->major && mounts[k].minor == m->minor;
+        if (dup)
+            continue;
+
+        /* If this mount was present before, keep its history (but not
+           its mount point, which changes if the mount has been moved) */
+
+        for (j = 0; j < numOld; j++) {
+            if (old[j].id == m->id) {
+                m->haveSample = old[j].haveSample;
+                m->haveRate = old[j].haveRate;
+                m->lastTime = old[j].lastTime;
+                m->lastAvailBytes = old[j].lastAvailBytes;
+                m->lastAvailInodes = old[j].lastAvailInodes;
+                m->pub.bytesPerSec = old[j].pub.bytesPerSec;
+                m->pub.inodesPerSec = old[j].pub.inodesPerSec;
+                break;
+            }
+        }
+        if (verbose && j == numOld)
+            printf("New mount: %s (%s)\n", m->mountPoint, m->fsType);
+
+        numMounts++;
+    }
+    if (ferror(fp))
+        errExit("getline");
+
+    if (verbose) {
+        for (j = 0; j < numOld; j++) {
+            for (k = 0; k < numMounts; k++)
+                if (mounts[k].id == old[j].id)
+                    break;
+            if (k == numMounts)
+                printf("Removed mount: %s\n", old[j].mountPoint);
+        }
+    }
+}
+
+/* Return the time until 'avail' reaches zero at 'rate' per second, or -1
+   if it is not decreasing */
+
+static double
+timeToFull(uint64_t avail, double rate)
+{
+    return (rate > 0) ? avail / rate : -1;
+}
+
+/* Call statvfs() for each mount, and update its figures. 'alpha' is the
+   smoothing factor for the fill rates. */
+
+static void
+sampleMounts(double alpha, Boolean all)
+{
+    struct statvfs sb;
+    struct fsmEntry *e;
+    struct mount *m;
+    double now, dt, bytesRate, inodesRate;
+    int j;
+
+    for (j = 0, m = mounts; j < numMounts; j++, m++) {
+        e = &m->pub;
+        if (statvfs(m->mountPoint, &sb) == -1 ||
+                (sb.f_blocks == 0 && !all)) {
+            e->mountPoint[0] = '\0';    /* Not published */
+            continue;
+        }
+        now = nowSecs(CLOCK_MONOTONIC);
+
+        snprintf(e->mountPoint, FSM_PATH_LEN, "%.*s", FSM_PATH_LEN - 1,
+                m->mountPoint);
+        snprintf(e->fsType, FSM_TYPE_LEN, "%s", m->fsType);
+        e->totalBytes = (uint64_t) sb.f_blocks * sb.f_frsize;
+        e->availBytes = (uint64_t) sb.f_bavail * sb.f_frsize;
+        e->totalInodes = sb.f_files;
+        e->availInodes = sb.f_favail;
+
+        if (m->haveSample && now > m->lastTime) {
+            dt = now - m->lastTime;
+            bytesRate = ((double) m->lastAvailBytes - e->availBytes) / dt;
+            inodesRate = ((double) m->lastAvailInodes - e->availInodes) / dt;
+            if (m->haveRate) {
+                e->bytesPerSec += alpha * (bytesRate - e->bytesPerSec);
+                e->inodesPerSec += alpha * (inodesRate - e->inodesPerSec);
+            } else {
+                e->bytesPerSec = bytesRate;
+                e->inodesPerSec = inodesRate;
+                m->haveRate = TRUE;
+            }
+        } else {
+            e->bytesPerSec = 0;
+            e->inodesPerSec = 0;
+        }
+        e->secsToFull = timeToFull(e->availBytes, e->bytesPerSec);
+        e->secsToInodesFull = timeToFull(e->availInodes, e->inodesPerSec);
+
+        m->haveSample = TRUE;
+        m->lastTime = now;
+        m->lastAvailBytes = e->availBytes;
+        m->lastAvailInodes = e->availInodes;
+    }
+}
+
+/* Copy the current figures into the shared memory object */
+
+static void
+publish(struct fsmShared *shm, uint64_t mountGen, double interval)
+{
+    uint32_t seq;
+    int j, n;
+
+    seq = shm->seq;
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (n = 0, j = 0; j < numMounts; j++)
+        if (mounts[j].pub.mountPoint[0] != '\0')
+            shm->ent[n++] = mounts[j].pub;
+    shm->numMounts = n;
+    shm->mountGen = mountGen;
+    shm->sampleTime = nowSecs(CLOCK_REALTIME);
+    shm->interval = interval;
+
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct fsmShared *shm;
+    struct sigaction sa;
+    struct pollfd pfd;
+    double interval, alpha, nextSample, now, start;
+    uint64_t mountGen;
+    Boolean all;
+    char *shmName;
+    FILE *fp;
+    int opt, window, fd, ready, timeout;
+
+    interval = 5;
+    window = 12;
+    shmName = FSM_SHM_NAME;
+    all = FALSE;
+
+    while ((opt = getopt(argc, argv, "i:w:s:av")) != -1) {
+        switch (opt) {
+        case 'i': interval = getInt(optarg, GN_GT_0, "interval");  break;
+        case 'w': window = getInt(optarg, GN_GT_0, "window");      break;
+        case 's': shmName = optarg;                                break;
+        case 'a': all = TRUE;                                      break;
+        case 'v': verbose = TRUE;                                  break;
+        default:
+            usageErr("%s [-i interval] [-w window] [-s shm-name] [-a] [-v]\n",
+                    argv[0]);
+        }
+    }
+    alpha = 2.0 / (window + 1);
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = handler;
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    fd = shm_open(shmName, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR |
+                                             S_IRGRP | S_IROTH);
+    if (fd == -1)
+        errExit("shm_open");
+    if (ftruncate(fd, sizeof(struct fsmShared)) == -1)
+        errExit("ftruncate");
+    shm = mmap(NULL, sizeof(struct fsmShared), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        errExit("mmap");
+    close(fd);
+
+    fp = fopen("/proc/self/mountinfo", "r");
+    if (fp == NULL)
+        errExit("fopen /proc/self/mountinfo");
+    pfd.fd = fileno(fp);
+    pfd.events = POLLPRI;
+
+    readMounts(fp);
+    mountGen = 1;
+    nextSample = nowSecs(CLOCK_MONOTONIC);
+
+    while (!gotTerm) {
+        now = nowSecs(CLOCK_MONOTONIC);
+        timeout = (nextSample > now) ? (int) ((nextSample - now) * 1000) + 1
+                                     : 0;
+        ready = poll(&pfd, 1, timeout);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+
+        /* If the mount table changed, reread it, and sample now */
+
+        if (ready > 0 && (pfd.revents & (POLLPRI | POLLERR))) {
+            readMounts(fp);
+            mountGen++;
+            nextSample = nowSecs(CLOCK_MONOTONIC);
+        }
+
+        now = nowSecs(CLOCK_MONOTONIC);
+        if (now < nextSample)
+            continue;
+
+        start = now;
+        sampleMounts(alpha, all);
+        publish(shm, mountGen, interval);
+        if (verbose)
+            printf("Sampled %d mounts in %.1f us\n", numMounts,
+                    (nowSecs(CLOCK_MONOTONIC) - start) * 1e6);
+
+        nextSample += interval;
+        if (nextSample <= now)          /* We fell behind */
+            nextSample = now + interval;
+    }
+
+    if (shm_unlink(shmName) == -1)
+        errExit("shm_unlink");
+    exit(EXIT_SUCCESS);
+}
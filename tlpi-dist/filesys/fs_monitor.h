@@ -0,0 +1,69 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 14 */
+
+/* fs_monitor.h
+
+   Header file for fs_monitor.c and fs_monitor_read.c, defining the
+   layout of the POSIX shared memory object in which fs_monitor publishes
+   file system statistics.
+
+   The object consists of a 'struct fsmShared'. fs_monitor is the only
+   writer. Readers map the object read-only, and use the sequence counter
+   'seq' to obtain a consistent copy without any locking or system calls:
+
+        do {
+            s1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+            copy the data;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            s2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+        } while (s1 != s2 || (s1 & 1));
+
+   The writer makes 'seq' odd before it changes the data, and even again
+   afterward.
+*/
+#ifndef FS_MONITOR_H
+#define FS_MONITOR_H
+
+#include <stdint.h>
+
+#define FSM_SHM_NAME "/tlpi_fs_monitor"
+
+#define FSM_MAX_MOUNTS 256
+#define FSM_PATH_LEN 256        /* Longer mount points are truncated */
+#define FSM_TYPE_LEN 32
+
+struct fsmEntry {
+    char mountPoint[FSM_PATH_LEN];
+    char fsType[FSM_TYPE_LEN];
+    uint64_t totalBytes;
+    uint64_t availBytes;        /* Available to unprivileged users */
+    uint64_t totalInodes;
+    uint64_t availInodes;
+    double bytesPerSec;         /* Smoothed rate of change of used space
+                                   (positive when filling) */
+    double inodesPerSec;        /* Likewise, for inodes */
+    double secsToFull;          /* Forecast time until no space is
+                                   available, or -1 if not filling */
+    double secsToInodesFull;    /* Likewise, for inodes */
+};
+
+struct fsmShared {
+    uint32_t seq;               /* Odd while the writer is updating */
+    uint32_t numMounts;
+    uint64_t mountGen;          /* Incremented when the mount table
+                                   changes */
+    double sampleTime;          /* CLOCK_REALTIME of last sample */
+    double interval;            /* Seconds between samples */
+    struct fsmEntry ent[FSM_MAX_MOUNTS];
+};
+
+#endif
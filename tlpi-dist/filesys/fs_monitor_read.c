@@ -0,0 +1,204 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 14 */
+
+/* fs_monitor_read.c
+
+   Display the file system statistics published by fs_monitor.c.
+
+   Usage: fs_monitor_read [-s shm-name] [-b reads]
+
+   The program maps the shared memory object read-only, takes a
+   consistent snapshot of it using the sequence counter protocol
+   described in fs_monitor.h, and displays the snapshot. No system calls
+   are needed after the object has been mapped, unless the writer appears
+   to be stuck in the middle of an update (because it was killed there),
+   in which case the program gives up after MAX_STALL_SECS seconds.
+
+   With -b, the program instead takes 'reads' snapshots and displays the
+   mean time per snapshot and the number of retries (caused by the
+   snapshot overlapping an update by the writer).
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include "fs_monitor.h"
+#include "tlpi_hdr.h"
+
+#define MAX_STALL_SECS 2        /* An update takes microseconds */
+#define STALL_CHECK 100000      /* Retries between checks of the clock */
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Copy a consistent snapshot of 'shm' into 'snap'. Only the entries
+   in use are copied. Returns the number of retries that were needed, or
+   -1 (with errno set to ETIMEDOUT) if no consistent snapshot could be
+   taken within MAX_STALL_SECS. */
+
+static long
+snapshot(const struct fsmShared *shm, struct fsmShared *snap)
+{
+    uint32_t s1, s2;
+    long retries;
+    double giveUp;
+
+    giveUp = 0;
+    for (retries = 0; ; retries++) {
+        if (retries > 0 && retries % STALL_CHECK == 0) {
+            if (giveUp == 0) {
+                giveUp = nowSecs() + MAX_STALL_SECS;
+            } else if (nowSecs() > giveUp) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+
+        s1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+            continue;           /* Writer is active */
+        memcpy(snap, shm, offsetof(struct fsmShared, ent));
+        if (snap->numMounts > FSM_MAX_MOUNTS)   /* Torn read */
+            snap->numMounts = 0;
+        memcpy(snap->ent, shm->ent,
+                snap->numMounts * sizeof(struct fsmEntry));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+        if (s1 == s2)
+            return retries;
+    }
+}
+
+/* Format 'n' (bytes or a count) in 'buf' using a K/M/G/T suffix */
+
+static char *
+human(char *buf, size_t len, double n)
+{
+    const char *units = " KMGTPE";
+
+    while (n >= 1024 && units[1] != '\0') {
+        n /= 1024;
+        units++;
+    }
+    if (*units == ' ')
+        snprintf(buf, len, "%.0f", n);
+    else
+        snprintf(buf, len, "%.1f%c", n, *units);
+    return buf;
+}
+
+/* Format a forecast of 'secs' seconds in 'buf' */
+
+static char *
+forecast(char *buf, size_t len, double secs)
+{
+    if (secs < 0)
+        snprintf(buf, len, "-");
+    else if (secs < 3600)
+        snprintf(buf, len, "%.0fm", secs / 60);
+    else if (secs < 2 * 86400)
+        snprintf(buf, len, "%.1fh", secs / 3600);
+    else if (secs < 1000 * 86400)
+        snprintf(buf, len, "%.0fd", secs / 86400);
+    else
+        snprintf(buf, len, ">1000d");
+    return buf;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct fsmShared snap;
+    const struct fsmShared *shm;
+    const struct fsmEntry *e;
+    struct timespec start, end, now;
+    char b1[16], b2[16], b3[16], b4[16], b5[16];
+    long reads, retries, n, j;
+    char *shmName;
+    int opt, fd;
+
+    shmName = FSM_SHM_NAME;
+    reads = 0;
+
+    while ((opt = getopt(argc, argv, "s:b:")) != -1) {
+        switch (opt) {
+        case 's': shmName = optarg;                             break;
+        case 'b': reads = getLong(optarg, GN_GT_0, "reads");    break;
+        default:  usageErr("%s [-s shm-name] [-b reads]\n", argv[0]);
+        }
+    }
+
+    fd = shm_open(shmName, O_RDONLY, 0);
+    if (fd == -1)
+        errExit("shm_open (is fs_monitor running?)");
+    shm = mmap(NULL, sizeof(struct fsmShared), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        errExit("mmap");
+    close(fd);
+
+    if (reads > 0) {
+        retries = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (j = 0; j < reads; j++) {
+            n = snapshot(shm, &snap);
+            if (n == -1)
+                errExit("snapshot (writer died during an update?)");
+            retries += n;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%ld snapshots of %u mounts: %.1f ns each; %ld retries\n",
+                reads, (unsigned int) snap.numMounts,
+                ((end.tv_sec - start.tv_sec) * 1e9 +
+                 end.tv_nsec - start.tv_nsec) / reads, retries);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (snapshot(shm, &snap) == -1)
+        errExit("snapshot (writer died during an update?)");
+    if (snap.seq == 0)
+        fatal("No data published yet");
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    printf("Sampled %.1f seconds ago (every %.0f s); mount table "
+            "generation %llu\n",
+            now.tv_sec + now.tv_nsec / 1e9 - snap.sampleTime,
+            snap.interval, (unsigned long long) snap.mountGen);
+    printf("%-24s %-8s %7s %5s %7s %6s %9s %7s %7s\n", "mount point", "type",
+            "size", "use%", "avail", "iuse%", "rate/h", "full", "ifull");
+
+    for (j = 0; j < snap.numMounts; j++) {
+        e = &snap.ent[j];
+        printf("%-24s %-8s %7s %4.0f%% %7s ", e->mountPoint, e->fsType,
+                human(b1, sizeof(b1), e->totalBytes),
+                (e->totalBytes > 0) ? 100.0 *
+                    (e->totalBytes - e->availBytes) / e->totalBytes : 0.0,
+                human(b2, sizeof(b2), e->availBytes));
+        if (e->totalInodes > 0)
+            printf("%5.0f%% ", 100.0 * (e->totalInodes - e->availInodes) /
+                    e->totalInodes);
+        else
+            printf("%6s ", "-");
+        printf("%9s %7s %7s\n", (e->bytesPerSec < 0) ? "shrink" :
+                human(b3, sizeof(b3), e->bytesPerSec * 3600),
+                forecast(b4, sizeof(b4), e->secsToFull),
+                forecast(b5, sizeof(b5), e->secsToInodesFull));
+    }
+
+    exit(EXIT_SUCCESS);
+}
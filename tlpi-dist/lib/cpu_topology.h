@@ -0,0 +1 @@
+../procpri/cpu_topology.h
\ No newline at end of file
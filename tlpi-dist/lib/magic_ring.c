@@ -0,0 +1 @@
+../mmap/magic_ring.c
\ No newline at end of file
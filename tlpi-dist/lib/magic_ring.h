@@ -0,0 +1 @@
+../mmap/magic_ring.h
\ No newline at end of file
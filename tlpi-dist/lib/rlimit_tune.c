@@ -0,0 +1 @@
+../procres/rlimit_tune.c
\ No newline at end of file
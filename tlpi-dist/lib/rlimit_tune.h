@@ -0,0 +1 @@
+../procres/rlimit_tune.h
\ No newline at end of file
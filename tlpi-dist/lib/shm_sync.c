@@ -0,0 +1 @@
+../pshm/shm_sync.c
\ No newline at end of file
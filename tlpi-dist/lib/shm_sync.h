@@ -0,0 +1 @@
+../pshm/shm_sync.h
\ No newline at end of file
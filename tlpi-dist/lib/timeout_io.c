@@ -0,0 +1 @@
+../timers/timeout_io.c
\ No newline at end of file
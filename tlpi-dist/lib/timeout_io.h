@@ -0,0 +1 @@
+../timers/timeout_io.h
\ No newline at end of file
@@ -0,0 +1,235 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* magic_ring.c
+
+   A ring buffer for one producer and one consumer (in the same or
+   different processes) whose contents are always contiguous in memory,
+   even when they wrap past the end of the ring.
+
+   The ring is held in a memory-backed file created with memfd_create(),
+   which is mapped twice, with the second mapping immediately following
+   the first, so that the byte at address 'data + size + i' is the same
+   as that at 'data + i'. Data that wraps past the end of the ring can
+   thus be read or written with a single access starting anywhere in the
+   first mapping, so that, for example, a single read() can fill all of
+   the free space, and a variable-length message can be parsed in place
+   rather than being copied together from the two ends of the ring. (This
+   takes the place of the nonlinear mappings that remap_file_pages()
+   provided; see t_remap_file_pages.c.)
+
+   The two mappings are placed by first reserving enough address space
+   with a PROT_NONE mapping, and then mapping the file over the reserved
+   range with MAP_FIXED.
+
+   The first page of the file holds the producer and consumer positions,
+   which only ever increase; the ring occupies the rest of the file. The
+   producer changes only 'tail', and the consumer only 'head', so no
+   locking is needed.
+
+   Since the positions are in memory shared with a process that we need
+   not trust, a ring whose positions are inconsistent (more data than the
+   ring can hold) is rejected with EIO, rather than allowing an access
+   beyond the double mapping. Likewise, the file is sealed against
+   shrinking and growing (as in memfd_xfr.c), and magicRingAttach()
+   insists on these seals, so that the peer can't ftruncate() the file
+   and cause SIGBUS in this process.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "magic_ring.h"
+#include "tlpi_hdr.h"
+
+struct magicRingCtl {           /* First page of the file */
+    uint64_t head;              /* Position of unconsumed data */
+    char pad[64 - sizeof(uint64_t)];    /* Keep on separate cache lines */
+    uint64_t tail;              /* Position of free space */
+};
+
+/* Map the file 'fd', whose ring is 'size' bytes, filling in 'mr' */
+
+static int
+mapRing(struct magicRing *mr, int fd, size_t size)
+{
+    long pageSize;
+    char *addr;
+    int savedErrno;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+
+    addr = mmap(NULL, pageSize + 2 * size, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+        return -1;
+
+    if (mmap(addr, pageSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(addr + pageSize, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, pageSize) == MAP_FAILED ||
+            mmap(addr + pageSize + size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, pageSize) == MAP_FAILED) {
+        savedErrno = errno;
+        munmap(addr, pageSize + 2 * size);
+        errno = savedErrno;
+        return -1;
+    }
+
+    mr->ctl = (struct magicRingCtl *) addr;
+    mr->data = addr + pageSize;
+    mr->size = size;
+    mr->fd = fd;
+    return 0;
+}
+
+int
+magicRingCreate(struct magicRing *mr, size_t size)
+{
+    long pageSize;
+    int fd, savedErrno;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    size = (size + pageSize - 1) / pageSize * pageSize;
+    if (size == 0)
+        size = pageSize;
+
+    fd = memfd_create("magic_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, pageSize + size) == -1 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1 ||
+            mapRing(mr, fd, size) == -1) {
+        savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+        return -1;
+    }
+    return 0;                   /* New file is zero-filled: ring is empty */
+}
+
+int
+magicRingAttach(struct magicRing *mr, int fd)
+{
+    struct stat sb;
+    long pageSize;
+    int seals;
+
+    seals = fcntl(fd, F_GET_SEALS);     /* Fails unless 'fd' is a memfd */
+    if (seals == -1 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) !=
+            (F_SEAL_SHRINK | F_SEAL_GROW)) {
+        errno = EPERM;
+        return -1;
+    }
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (fstat(fd, &sb) == -1)
+        return -1;
+    if (sb.st_size <= pageSize || sb.st_size % pageSize != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return mapRing(mr, fd, sb.st_size - pageSize);
+}
+
+void
+magicRingDetach(struct magicRing *mr)
+{
+    munmap(mr->ctl, sysconf(_SC_PAGESIZE) + 2 * mr->size);
+    close(mr->fd);
+}
+
+char *
+magicRingWritePtr(struct magicRing *mr, size_t *availp)
+{
+    uint64_t head, tail;
+
+    head = __atomic_load_n(&mr->ctl->head, __ATOMIC_ACQUIRE);
+    tail = mr->ctl->tail;               /* Only we change it */
+    if (tail - head > mr->size) {       /* Corrupted by the peer */
+        *availp = 0;
+        errno = EIO;
+        return NULL;
+    }
+    *availp = mr->size - (tail - head);
+    return mr->data + tail % mr->size;
+}
+
+void
+magicRingProduce(struct magicRing *mr, size_t n)
+{
+    __atomic_store_n(&mr->ctl->tail, mr->ctl->tail + n, __ATOMIC_RELEASE);
+}
+
+const char *
+magicRingReadPtr(struct magicRing *mr, size_t *availp)
+{
+    uint64_t head, tail;
+
+    tail = __atomic_load_n(&mr->ctl->tail, __ATOMIC_ACQUIRE);
+    head = mr->ctl->head;               /* Only we change it */
+    if (tail - head > mr->size) {       /* Corrupted by the peer */
+        *availp = 0;
+        errno = EIO;
+        return NULL;
+    }
+    *availp = tail - head;
+    return mr->data + head % mr->size;
+}
+
+void
+magicRingConsume(struct magicRing *mr, size_t n)
+{
+    __atomic_store_n(&mr->ctl->head, mr->ctl->head + n, __ATOMIC_RELEASE);
+}
+
+ssize_t
+magicRingFill(struct magicRing *mr, int fd)
+{
+    size_t avail;
+    ssize_t n;
+    char *p;
+
+    p = magicRingWritePtr(mr, &avail);
+    if (p == NULL)
+        return -1;
+    if (avail == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    n = read(fd, p, avail);
+    if (n > 0)
+        magicRingProduce(mr, n);
+    return n;
+}
+
+ssize_t
+magicRingDrain(struct magicRing *mr, int fd)
+{
+    const char *p;
+    size_t avail;
+    ssize_t n;
+
+    p = magicRingReadPtr(mr, &avail);
+    if (p == NULL)
+        return -1;
+    if (avail == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    n = write(fd, p, avail);
+    if (n > 0)
+        magicRingConsume(mr, n);
+    return n;
+}
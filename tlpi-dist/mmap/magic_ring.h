@@ -0,0 +1,74 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* magic_ring.h
+
+   Header file for magic_ring.c.
+*/
+#ifndef MAGIC_RING_H
+#define MAGIC_RING_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct magicRingCtl;            /* Shared positions; see magic_ring.c */
+
+struct magicRing {
+    struct magicRingCtl *ctl;
+    char *data;                 /* Ring, mapped twice in succession */
+    size_t size;                /* Size of ring (a multiple of page size) */
+    int fd;                     /* memfd holding 'ctl' and ring */
+};
+
+/* Create a ring of at least 'size' bytes. The ring may be shared with
+   another process by passing it 'mr->fd' (via fork() or SCM_RIGHTS), so
+   that it can call magicRingAttach(). Returns: 0 on success, or -1 on
+   error. */
+
+int magicRingCreate(struct magicRing *mr, size_t size);
+
+/* Map the ring in the memfd 'fd' (which 'mr' takes over). Returns: 0 on
+   success, or -1 on error (EPERM if 'fd' is not a memfd sealed against
+   shrinking and growing). */
+
+int magicRingAttach(struct magicRing *mr, int fd);
+
+/* Unmap the ring and close its file descriptor */
+
+void magicRingDetach(struct magicRing *mr);
+
+/* Producer: return the address of the free space in the ring, and its
+   size in '*availp'; the space is contiguous even if it wraps. Returns
+   NULL, with errno set to EIO, if the ring's positions are inconsistent.
+   Make 'n' bytes written there available to the consumer. */
+
+char *magicRingWritePtr(struct magicRing *mr, size_t *availp);
+void magicRingProduce(struct magicRing *mr, size_t n);
+
+/* Consumer: return the address of the unconsumed data, and its size in
+   '*availp'; the data is contiguous even if it wraps. Returns NULL, with
+   errno set to EIO, if the ring's positions are inconsistent. Free 'n'
+   bytes of the data. */
+
+const char *magicRingReadPtr(struct magicRing *mr, size_t *availp);
+void magicRingConsume(struct magicRing *mr, size_t n);
+
+/* Producer: read() from 'fd' into the free space. Consumer: write() the
+   unconsumed data to 'fd'. Returns: as for read() and write(), or -1
+   with errno set to EAGAIN if the ring is full (read) or empty (write),
+   or to EIO if its positions are inconsistent. */
+
+ssize_t magicRingFill(struct magicRing *mr, int fd);
+ssize_t magicRingDrain(struct magicRing *mr, int fd);
+
+#endif
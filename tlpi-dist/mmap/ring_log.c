@@ -0,0 +1,556 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* ring_log.c
+
+   An append-only log of records, held in a fixed-size file that is
+   accessed through a shared file mapping (as in t_mmap.c). When the file
+   is full, the oldest records are discarded to make room for new ones.
+
+   The first page of the file holds two copies of a header that records
+   the positions of the oldest record ('head') and of the end of the last
+   committed record ('tail'); positions increase forever, and a record at
+   position 'pos' is stored at offset 'pos % capacity' of the record area
+   that follows the first page. Each header copy lies in its own disk
+   sector, and carries a generation number and a checksum. A commit
+   (ringLogCommit()) first flushes the new records with msync(), and then
+   overwrites the older of the two header copies; if the system crashes
+   while the header is being written, the other copy is still intact. On
+   opening the log, the valid copy with the higher generation is used.
+
+   Each record has a header giving its length, its position, and a
+   checksum of both and of the record's contents. When the log is opened,
+   the committed records are checked, and the log is truncated at the
+   first that fails the check. This protects against a crash where the
+   kernel wrote the header before the records (which msync() with
+   MS_ASYNC, or writeback by the kernel, may do). Before the writer
+   overwrites the space occupied by old records, it commits a header that
+   no longer includes those records, always with MS_SYNC (this happens
+   only once per eighth of the log), since if the old header were still
+   the one on disk after a crash, its oldest record might already have
+   been overwritten, and recovery would discard the whole log.
+
+   A record that would not fit before the end of the record area is
+   preceded by a padding record that fills the rest of the area, so that
+   records never wrap.
+
+   Readers map the file read-only, and follow copies of 'head' and 'tail'
+   that the writer updates (without checksums) in the first page after
+   each append, so that a reader sees records as soon as they are
+   appended, whether or not they have been committed, without making any
+   system calls. A reader that falls so far behind that the writer
+   overwrites the record it is reading detects this (by checking 'head'
+   after copying the record), and skips to the oldest record.
+
+   There may be only one writer, which holds an flock() lock on the file.
+*/
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include "ring_log.h"
+#include "tlpi_hdr.h"
+
+#define RL_MAGIC 0x524c4f47
+
+#define SLOT_SIZE 512           /* Each header copy in its own sector */
+#define LIVE_OFF (2 * SLOT_SIZE)
+
+#define REC_ALIGN 16
+#define REC_PAD UINT32_MAX      /* 'len' of padding record */
+
+struct logHdr {                 /* A copy of the header */
+    uint32_t magic;
+    uint32_t spare;
+    uint64_t gen;               /* Incremented on every commit */
+    uint64_t capacity;          /* Size of record area */
+    uint64_t head;
+    uint64_t tail;
+    uint32_t crc;               /* Checksum of preceding fields */
+};
+
+struct liveWords {              /* Current 'head' and 'tail', for readers */
+    uint64_t head;
+    uint64_t tail;
+};
+
+struct recHdr {                 /* Precedes each record */
+    uint32_t len;               /* Length of contents, or REC_PAD */
+    uint32_t crc;               /* Checksum of 'pos', 'len', contents */
+    uint64_t pos;               /* Position of this record */
+};
+
+/* Compute the CRC-32 (as used by zlib) of 'len' bytes at 'buf', continuing
+   from 'crc' (0 for the first call) */
+
+static uint32_t
+crc32(uint32_t crc, const void *buf, size_t len)
+{
+    static uint32_t table[256];
+    const unsigned char *p = buf;
+    uint32_t c;
+    int j, k;
+
+    if (table[1] == 0) {
+        for (j = 0; j < 256; j++) {
+            for (c = j, k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[j] = c;
+        }
+    }
+
+    crc = ~crc;
+    while (len-- > 0)
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t
+recCrc(const struct recHdr *r, const void *contents, size_t len)
+{
+    uint32_t crc;
+
+    crc = crc32(0, &r->pos, sizeof(r->pos));
+    crc = crc32(crc, &r->len, sizeof(r->len));
+    return crc32(crc, contents, len);
+}
+
+static uint64_t
+recSize(size_t len)
+{
+    return (sizeof(struct recHdr) + len + REC_ALIGN - 1) /
+           REC_ALIGN * REC_ALIGN;
+}
+
+static struct recHdr *
+recAt(const char *data, uint64_t capacity, uint64_t pos)
+{
+    return (struct recHdr *) (data + pos % capacity);
+}
+
+static struct liveWords *
+liveOf(const char *addr)
+{
+    return (struct liveWords *) (addr + LIVE_OFF);
+}
+
+/* Return the valid header copy with the highest generation in the first
+   page of a log at 'addr' whose record area has 'capacity' bytes, or
+   NULL if there is none */
+
+static const struct logHdr *
+bestHeader(const char *addr, uint64_t capacity)
+{
+    const struct logHdr *h, *best;
+    int j;
+
+    best = NULL;
+    for (j = 0; j < 2; j++) {
+        h = (const struct logHdr *) (addr + j * SLOT_SIZE);
+        if (h->magic != RL_MAGIC || h->capacity != capacity ||
+                h->crc != crc32(0, h, offsetof(struct logHdr, crc)) ||
+                h->head > h->tail || h->tail - h->head > capacity)
+            continue;
+        if (best == NULL || h->gen > best->gen)
+            best = h;
+    }
+    return best;
+}
+
+/* Return the position following the record at 'pos', or 0 if the record
+   is not valid or extends beyond 'end' */
+
+static uint64_t
+checkRecord(const char *data, uint64_t capacity, uint64_t pos, uint64_t end)
+{
+    const struct recHdr *r;
+    uint64_t next;
+
+    r = recAt(data, capacity, pos);
+    if (r->pos != pos)
+        return 0;
+
+    if (r->len == REC_PAD) {
+        next = pos + capacity - pos % capacity;
+        if (r->crc != recCrc(r, NULL, 0))
+            return 0;
+    } else {
+        if (r->len > capacity / 4 ||
+                pos % capacity + recSize(r->len) > capacity)
+            return 0;
+        next = pos + recSize(r->len);
+        if (r->crc != recCrc(r, r + 1, r->len))
+            return 0;
+    }
+    return (next <= end) ? next : 0;
+}
+
+/* Flush the pages containing the 'len' bytes at offset 'off' in the
+   mapping */
+
+static int
+syncRange(struct ringLog *rl, uint64_t off, uint64_t len, int msFlags)
+{
+    uint64_t start;
+
+    if (len == 0)
+        return 0;
+    start = off - off % sysconf(_SC_PAGESIZE);
+    return msync(rl->addr + start, off + len - start, msFlags);
+}
+
+/* Flush the records between positions 'from' and 'to' */
+
+static int
+syncRecords(struct ringLog *rl, uint64_t from, uint64_t to, int msFlags)
+{
+    uint64_t dataOff, a, b;
+
+    dataOff = rl->data - rl->addr;
+    if (to - from >= rl->capacity)
+        return syncRange(rl, dataOff, rl->capacity, msFlags);
+
+    a = from % rl->capacity;
+    b = a + (to - from);
+    if (b <= rl->capacity)
+        return syncRange(rl, dataOff + a, b - a, msFlags);
+
+    if (syncRange(rl, dataOff + a, rl->capacity - a, msFlags) == -1)
+        return -1;
+    return syncRange(rl, dataOff, b - rl->capacity, msFlags);
+}
+
+/* Write and flush a new header copy, replacing the older one */
+
+static int
+writeHeader(struct ringLog *rl, int msFlags)
+{
+    struct logHdr *h;
+
+    rl->gen++;
+    h = (struct logHdr *) (rl->addr + (rl->gen % 2) * SLOT_SIZE);
+    h->magic = RL_MAGIC;
+    h->spare = 0;
+    h->gen = rl->gen;
+    h->capacity = rl->capacity;
+    h->head = rl->head;
+    h->tail = rl->tail;
+    h->crc = crc32(0, h, offsetof(struct logHdr, crc));
+
+    return syncRange(rl, (char *) h - rl->addr, sizeof(struct logHdr),
+                     msFlags);
+}
+
+int
+ringLogCommit(struct ringLog *rl, int msFlags)
+{
+    uint64_t from;
+
+    from = (rl->syncedTail > rl->head) ? rl->syncedTail : rl->head;
+    if (syncRecords(rl, from, rl->tail, msFlags) == -1)
+        return -1;
+    if (writeHeader(rl, msFlags) == -1)
+        return -1;
+
+    rl->syncedTail = rl->tail;
+    rl->pending = 0;
+    return 0;
+}
+
+/* Discard old records until there are at least 'need' free bytes after
+   'tail'. To avoid a commit for every append, a further eighth of the
+   log is freed at the same time. */
+
+static int
+makeRoom(struct ringLog *rl, uint64_t need)
+{
+    const struct recHdr *r;
+    uint64_t target, head;
+
+    if (rl->tail + need - rl->head <= rl->capacity)
+        return 0;
+
+    target = rl->tail + need - rl->capacity + rl->capacity / 8;
+    for (head = rl->head; head < target && head < rl->tail; ) {
+        r = recAt(rl->data, rl->capacity, head);
+        head += (r->len == REC_PAD) ? rl->capacity - head % rl->capacity :
+                                      recSize(r->len);
+    }
+
+    /* Tell readers, and then commit (durably, whatever the sync policy),
+       before overwriting anything */
+
+    rl->head = head;
+    __atomic_store_n(&liveOf(rl->addr)->head, head, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return ringLogCommit(rl, MS_SYNC);
+}
+
+int
+ringLogAppend(struct ringLog *rl, const void *buf, size_t len)
+{
+    struct recHdr *r;
+    uint64_t size, pad, phys;
+
+    if (len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (len > rl->capacity / 4) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    size = recSize(len);
+    phys = rl->tail % rl->capacity;
+    pad = (phys + size > rl->capacity) ? rl->capacity - phys : 0;
+    if (makeRoom(rl, pad + size) == -1)
+        return -1;
+
+    if (pad != 0) {
+        r = recAt(rl->data, rl->capacity, rl->tail);
+        r->pos = rl->tail;
+        r->len = REC_PAD;
+        r->crc = recCrc(r, NULL, 0);
+        rl->tail += pad;
+    }
+
+    r = recAt(rl->data, rl->capacity, rl->tail);
+    r->pos = rl->tail;
+    r->len = len;
+    memcpy(r + 1, buf, len);
+    r->crc = recCrc(r, buf, len);
+    rl->tail += size;
+
+    __atomic_store_n(&liveOf(rl->addr)->tail, rl->tail, __ATOMIC_RELEASE);
+
+    rl->pending++;
+    if (rl->batch > 0 && rl->pending >= rl->batch)
+        return ringLogCommit(rl, rl->syncFlags);
+    return 0;
+}
+
+void
+ringLogSetSync(struct ringLog *rl, int batch, int syncFlags)
+{
+    rl->batch = batch;
+    rl->syncFlags = syncFlags;
+}
+
+struct ringLog *
+ringLogOpen(const char *path, size_t capacity, mode_t perms)
+{
+    const struct logHdr *h;
+    struct ringLog *rl;
+    struct stat sb;
+    Boolean created;
+    long pageSize;
+    uint64_t pos, next;
+    int savedErrno;
+
+    rl = calloc(1, sizeof(struct ringLog));
+    if (rl == NULL)
+        return NULL;
+    rl->addr = MAP_FAILED;
+    rl->syncFlags = MS_SYNC;
+
+    rl->fd = open(path, O_RDWR | O_CREAT, perms);
+    if (rl->fd == -1)
+        goto fail;
+    if (flock(rl->fd, LOCK_EX | LOCK_NB) == -1)
+        goto fail;
+    if (fstat(rl->fd, &sb) == -1)
+        goto fail;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    created = sb.st_size == 0;
+    if (created) {
+        capacity = (capacity + pageSize - 1) / pageSize * pageSize;
+        if (capacity < (size_t) 4 * pageSize)
+            capacity = 4 * pageSize;
+        sb.st_size = pageSize + capacity;
+        if (ftruncate(rl->fd, sb.st_size) == -1)
+            goto fail;
+    } else if (sb.st_size <= pageSize || sb.st_size % pageSize != 0) {
+        errno = EINVAL;                 /* Not a log */
+        goto fail;
+    }
+
+    rl->addr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    rl->fd, 0);
+    if (rl->addr == MAP_FAILED)
+        goto fail;
+    rl->data = rl->addr + pageSize;
+    rl->capacity = sb.st_size - pageSize;
+
+    h = bestHeader(rl->addr, rl->capacity);
+    if (h == NULL) {
+        if (!created) {
+            errno = EINVAL;             /* Existing file isn't a log */
+            goto fail;
+        }
+
+        /* Make the new log, and its size, durable at once */
+
+        if (writeHeader(rl, MS_SYNC) == -1 || fsync(rl->fd) == -1)
+            goto fail;
+    } else {
+
+        /* Keep the committed records that are intact */
+
+        rl->gen = h->gen;
+        rl->head = h->head;
+        for (pos = h->head; pos < h->tail; pos = next) {
+            next = checkRecord(rl->data, rl->capacity, pos, h->tail);
+            if (next == 0)
+                break;
+            if (recAt(rl->data, rl->capacity, pos)->len != REC_PAD)
+                rl->recovered++;
+        }
+        rl->tail = pos;
+    }
+
+    rl->syncedTail = rl->tail;
+    liveOf(rl->addr)->head = rl->head;
+    __atomic_store_n(&liveOf(rl->addr)->tail, rl->tail, __ATOMIC_RELEASE);
+    return rl;
+
+fail:
+    savedErrno = errno;
+    if (rl->addr != MAP_FAILED)
+        munmap(rl->addr, sb.st_size);
+    if (rl->fd != -1)
+        close(rl->fd);
+    free(rl);
+    errno = savedErrno;
+    return NULL;
+}
+
+void
+ringLogClose(struct ringLog *rl)
+{
+    munmap(rl->addr, sysconf(_SC_PAGESIZE) + rl->capacity);
+    close(rl->fd);                      /* Releases lock */
+    free(rl);
+}
+
+struct ringLogReader *
+ringLogReaderOpen(const char *path, int fromStart)
+{
+    const struct logHdr *h;
+    struct ringLogReader *rd;
+    struct stat sb;
+    long pageSize;
+    int savedErrno;
+
+    rd = calloc(1, sizeof(struct ringLogReader));
+    if (rd == NULL)
+        return NULL;
+    rd->addr = MAP_FAILED;
+
+    rd->fd = open(path, O_RDONLY);
+    if (rd->fd == -1)
+        goto fail;
+    if (fstat(rd->fd, &sb) == -1)
+        goto fail;
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (sb.st_size <= pageSize) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    rd->addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, rd->fd, 0);
+    if (rd->addr == MAP_FAILED)
+        goto fail;
+    rd->data = rd->addr + pageSize;
+    rd->capacity = sb.st_size - pageSize;
+
+    h = bestHeader(rd->addr, rd->capacity);
+    if (h == NULL) {
+        errno = EINVAL;                 /* Not a log */
+        goto fail;
+    }
+
+    rd->pos = fromStart ?
+              __atomic_load_n(&liveOf(rd->addr)->head, __ATOMIC_ACQUIRE) :
+              __atomic_load_n(&liveOf(rd->addr)->tail, __ATOMIC_ACQUIRE);
+    return rd;
+
+fail:
+    savedErrno = errno;
+    if (rd->addr != MAP_FAILED)
+        munmap((void *) rd->addr, sb.st_size);
+    if (rd->fd != -1)
+        close(rd->fd);
+    free(rd);
+    errno = savedErrno;
+    return NULL;
+}
+
+ssize_t
+ringLogRead(struct ringLogReader *rd, void *buf, size_t max)
+{
+    const struct recHdr *r;
+    struct liveWords *live;
+    uint64_t pos;
+    uint32_t len;
+
+    live = liveOf(rd->addr);
+    for (;;) {
+        if (rd->pos >= __atomic_load_n(&live->tail, __ATOMIC_ACQUIRE))
+            return 0;
+
+        r = recAt(rd->data, rd->capacity, rd->pos);
+        pos = __atomic_load_n(&r->pos, __ATOMIC_RELAXED);
+        len = __atomic_load_n(&r->len, __ATOMIC_RELAXED);
+        if (pos == rd->pos && len != REC_PAD && len <= max &&
+                len <= rd->capacity / 4 &&
+                pos % rd->capacity + recSize(len) <= rd->capacity)
+            memcpy(buf, r + 1, len);
+
+        /* If the writer has discarded the record, what we copied may be
+           part of a newer one */
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&live->head, __ATOMIC_RELAXED) > rd->pos) {
+            rd->pos = __atomic_load_n(&live->head, __ATOMIC_RELAXED);
+            rd->overruns++;
+            continue;
+        }
+
+        if (pos != rd->pos || (len != REC_PAD && (len > rd->capacity / 4 ||
+                pos % rd->capacity + recSize(len) > rd->capacity))) {
+            errno = EBADMSG;
+            return -1;
+        }
+        if (len == REC_PAD) {
+            rd->pos += rd->capacity - rd->pos % rd->capacity;
+            continue;
+        }
+        if (len > max) {
+            errno = ERANGE;
+            return -1;
+        }
+        rd->pos += recSize(len);
+        return len;
+    }
+}
+
+void
+ringLogReaderClose(struct ringLogReader *rd)
+{
+    munmap((void *) rd->addr, sysconf(_SC_PAGESIZE) + rd->capacity);
+    close(rd->fd);
+    free(rd);
+}
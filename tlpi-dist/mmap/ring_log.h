@@ -0,0 +1,95 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* ring_log.h
+
+   Header file for ring_log.c.
+*/
+#ifndef RING_LOG_H
+#define RING_LOG_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ringLog {                /* Handle for the (single) writer */
+    int fd;
+    char *addr;                 /* Mapping of whole file */
+    char *data;                 /* Start of record area in mapping */
+    uint64_t capacity;          /* Size of record area */
+    uint64_t head;              /* Position of oldest record */
+    uint64_t tail;              /* Position at which next record goes */
+    uint64_t syncedTail;        /* 'tail' at last commit */
+    uint64_t gen;               /* Generation of last header written */
+    uint64_t recovered;         /* Records found when log was opened */
+    int batch;                  /* Commit after this many records (0 =
+                                   only when ringLogCommit() is called) */
+    int syncFlags;              /* MS_SYNC or MS_ASYNC, for auto-commit */
+    int pending;                /* Records appended since last commit */
+};
+
+struct ringLogReader {
+    int fd;
+    const char *addr;
+    const char *data;
+    uint64_t capacity;
+    uint64_t pos;               /* Position of next record to read */
+    uint64_t overruns;          /* Times the writer overtook the reader */
+};
+
+/* Open the log in 'path', creating it, with room for 'capacity' bytes of
+   records, if it doesn't exist ('capacity' is otherwise ignored). Only
+   committed records that pass their checksums are kept.
+   Returns: pointer to handle, or NULL on error (EWOULDBLOCK if another
+   process has the log open for writing). */
+
+struct ringLog *ringLogOpen(const char *path, size_t capacity, mode_t perms);
+
+/* Arrange that every 'batch' appends are committed with
+   ringLogCommit(rl, syncFlags); 'batch' == 0 disables this */
+
+void ringLogSetSync(struct ringLog *rl, int batch, int syncFlags);
+
+/* Append a record of 'len' bytes, discarding the oldest records if
+   there is not enough room (which commits the records already appended,
+   with MS_SYNC).
+   Returns: 0 on success, or -1 on error (EMSGSIZE if the record is
+   larger than a quarter of the log). */
+
+int ringLogAppend(struct ringLog *rl, const void *buf, size_t len);
+
+/* Make the records appended so far part of the log that is found when
+   the log is next opened. With MS_SYNC, returns once the records are on
+   disk; with MS_ASYNC, only schedules the writes. Returns: 0 on success,
+   or -1 on error. */
+
+int ringLogCommit(struct ringLog *rl, int msFlags);
+
+/* Close the log. Records that have not been committed are lost. */
+
+void ringLogClose(struct ringLog *rl);
+
+/* Open the log in 'path' for reading, starting at the oldest record, or,
+   if 'fromStart' is 0, at the next record to be appended.
+   Returns: pointer to handle, or NULL on error. */
+
+struct ringLogReader *ringLogReaderOpen(const char *path, int fromStart);
+
+/* Copy the next record, if there is one, into 'buf', whose size is 'max'.
+   Makes no system calls. Returns: length of record, 0 if there are no
+   more records yet, or -1 on error (ERANGE if 'max' is too small). */
+
+ssize_t ringLogRead(struct ringLogReader *rd, void *buf, size_t max);
+
+void ringLogReaderClose(struct ringLogReader *rd);
+
+#endif
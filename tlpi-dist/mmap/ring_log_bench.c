@@ -0,0 +1,609 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* ring_log_bench.c
+
+   Compare the throughput and durability latency of appending records to
+   the memory-mapped log of ring_log.c, with various msync() policies,
+   with those of appending records to a file with write() and making them
+   durable with fdatasync(). Then measure a reader tailing the log from
+   another process, and check that the log recovers from a writer that is
+   killed, from a damaged header, and from crashes in which some of the
+   file's pages did not reach the disk.
+
+   Usage: ring_log_bench [-f file] [-c capacity-kB] [-l len] [-b batch]
+                         [-t secs]
+
+   Each test appends records of 'len' bytes (default: 128) to 'file'
+   (default: "ring_log_bench.log" in the current directory, which should
+   be on the file system of interest) for 'secs' seconds (default: 2).
+   The log has room for 'capacity-kB' kilobytes (default: 4096) of
+   records, so the longer tests wrap around it. The policies are: commit
+   with MS_SYNC after every record, and after every 'batch' (default: 64)
+   records; commit with MS_ASYNC after every 'batch' records; and never
+   commit. The durability latency of a record is the time from the start
+   of its append until the return of the commit (or fdatasync()) that
+   makes it durable.
+
+   Killing the writer leaves the page cache intact, so that test shows
+   only that the log is consistent at every instant as seen through the
+   mapping; it exercises none of the ordering that msync() provides. The
+   lost-write tests simulate what a crash may leave on disk by copying
+   parts of earlier snapshots of the file back over it: the records of
+   the last commit without the records themselves (as if the kernel had
+   written the header page first), and the header of the last MS_SYNC
+   commit with all of the records written since (as if none of the later
+   MS_ASYNC commits had reached the disk, though writeback of the record
+   pages had).
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include "ring_log.h"
+#include "tlpi_hdr.h"
+
+#define END_SEQ UINT64_MAX      /* Sequence number of final record */
+
+enum { M_MMAP, M_WRITE };
+
+struct policy {
+    const char *name;
+    int method;                 /* M_MMAP or M_WRITE */
+    int batch;                  /* Records per commit; 0 = never; -1 =
+                                   use 'batch' option */
+    int msFlags;
+};
+
+static const struct policy policies[] = {
+    { "mmap, MS_SYNC each",         M_MMAP,   1, MS_SYNC },
+    { "mmap, MS_SYNC batch",        M_MMAP,  -1, MS_SYNC },
+    { "mmap, MS_ASYNC batch",       M_MMAP,  -1, MS_ASYNC },
+    { "mmap, no msync",             M_MMAP,   0, 0 },
+    { "write+fdatasync each",       M_WRITE,  1, 0 },
+    { "write+fdatasync batch",      M_WRITE, -1, 0 },
+};
+
+#define NUM_POLICIES (int) (sizeof(policies) / sizeof(policies[0]))
+
+static const char *path = "ring_log_bench.log";
+static size_t capacity = 4096 * 1024;
+static size_t recLen = 128;
+static int batchSize = 64;
+static double secs = 2;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fill 'buf' with record number 'seq' */
+
+static void
+makeRecord(char *buf, uint64_t seq)
+{
+    memset(buf, seq & 0xff, recLen);
+    memcpy(buf, &seq, sizeof(seq));
+}
+
+static Boolean
+recordOk(const char *buf, size_t len, uint64_t *seqp)
+{
+    size_t j;
+
+    *seqp = 0;
+    if (len != recLen)
+        return FALSE;
+    memcpy(seqp, buf, sizeof(*seqp));
+    if (*seqp == END_SEQ)
+        return TRUE;
+    for (j = sizeof(*seqp); j < len; j++)
+        if ((unsigned char) buf[j] != (*seqp & 0xff))
+            return FALSE;
+    return TRUE;
+}
+
+static struct ringLog *
+freshLog(void)
+{
+    struct ringLog *rl;
+
+    unlink(path);
+    rl = ringLogOpen(path, capacity, S_IRUSR | S_IWUSR);
+    if (rl == NULL)
+        errExit("ringLogOpen");
+    return rl;
+}
+
+/* Append records for 'secs' seconds according to policy 'p'. Returns
+   the number of records appended; '*latp' receives the mean durability
+   latency in microseconds (0 if the records were not made durable). */
+
+static long
+runPolicy(const struct policy *p, double *latp)
+{
+    struct ringLog *rl;
+    double start, end, now, startSum, latSum;
+    long n, sinceSync, synced;
+    char *buf;
+    int fd, batch;
+
+    buf = malloc(recLen);
+    if (buf == NULL)
+        errExit("malloc");
+    batch = (p->batch == -1) ? batchSize : p->batch;
+
+    rl = NULL;
+    fd = -1;
+    if (p->method == M_MMAP) {
+        rl = freshLog();
+    } else {
+        unlink(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                  S_IRUSR | S_IWUSR);
+        if (fd == -1)
+            errExit("open");
+    }
+
+    /* Commit here, rather than with ringLogSetSync(), so as to time each
+       commit */
+
+    startSum = latSum = 0;
+    sinceSync = synced = 0;
+    start = nowSecs();
+    end = start + secs;
+    for (n = 0, now = start; now < end; n++) {
+        makeRecord(buf, n);
+        startSum += now;
+        sinceSync++;
+
+        if (p->method == M_MMAP) {
+            if (ringLogAppend(rl, buf, recLen) == -1)
+                errExit("ringLogAppend");
+        } else {
+            if (write(fd, buf, recLen) != (ssize_t) recLen)
+                errExit("write");
+        }
+
+        if (batch > 0 && sinceSync == batch) {
+            if (p->method == M_MMAP) {
+                if (ringLogCommit(rl, p->msFlags) == -1)
+                    errExit("ringLogCommit");
+            } else {
+                if (fdatasync(fd) == -1)
+                    errExit("fdatasync");
+            }
+            now = nowSecs();
+            latSum += sinceSync * now - startSum;
+            synced += sinceSync;
+            startSum = 0;
+            sinceSync = 0;
+        } else {
+            now = nowSecs();
+        }
+    }
+    end = nowSecs();
+
+    if (rl != NULL)
+        ringLogClose(rl);
+    if (fd != -1)
+        close(fd);
+    free(buf);
+
+    *latp = (p->msFlags == MS_SYNC || p->method == M_WRITE) && synced > 0 ?
+            latSum / synced * 1e6 : 0;
+    return n / (end - start);           /* Records per second */
+}
+
+/* Append records as fast as possible, without msync(), while a child
+   tails the log */
+
+static void
+runTailer(void)
+{
+    struct ringLogReader *rd;
+    struct ringLog *rl;
+    long n, count, errors, idle;
+    uint64_t seq, prev;
+    double start, t;
+    int pfd[2];
+    ssize_t len;
+    pid_t pid;
+    char *buf, ch;
+
+    buf = malloc(recLen);
+    if (buf == NULL)
+        errExit("malloc");
+    rl = freshLog();
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        rd = ringLogReaderOpen(path, 1);
+        if (rd == NULL)
+            errExit("ringLogReaderOpen");
+        close(pfd[0]);
+        close(pfd[1]);                  /* Tell parent that we're ready */
+
+        count = errors = idle = 0;
+        prev = 0;
+        start = nowSecs();
+        for (;;) {
+            len = ringLogRead(rd, buf, recLen);
+            if (len == -1)
+                errExit("ringLogRead");
+            if (len == 0) {             /* Nothing to read yet */
+                idle++;
+                sched_yield();
+                continue;
+            }
+            if (!recordOk(buf, len, &seq) ||
+                    (count > 0 && seq != END_SEQ && seq <= prev))
+                errors++;
+            if (seq == END_SEQ)
+                break;
+            prev = seq;
+            count++;
+        }
+        t = nowSecs() - start;
+
+        printf("Tailing reader: %ld records (%.0f/s), %llu overruns, "
+                "%ld empty polls, %ld bad records\n", count, count / t,
+                (unsigned long long) rd->overruns, idle, errors);
+        fflush(stdout);
+        ringLogReaderClose(rd);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(pfd[1]);
+    if (read(pfd[0], &ch, 1) == -1)
+        errExit("read");
+    close(pfd[0]);
+
+    start = nowSecs();
+    for (n = 0; nowSecs() - start < secs; n++) {
+        makeRecord(buf, n);
+        if (ringLogAppend(rl, buf, recLen) == -1)
+            errExit("ringLogAppend");
+    }
+    makeRecord(buf, END_SEQ);
+    if (ringLogAppend(rl, buf, recLen) == -1)
+        errExit("ringLogAppend");
+    printf("Writer appended %ld records (%.0f/s)\n", n,
+            n / (nowSecs() - start));
+
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+    ringLogClose(rl);
+    free(buf);
+}
+
+/* Read back the whole log, checking that it holds records 'first' and
+   onward in sequence. Returns the number of the last record, or -1 if
+   the log is empty. */
+
+static long
+checkLog(long first, Boolean *okp)
+{
+    struct ringLogReader *rd;
+    struct ringLog *rl;
+    uint64_t seq;
+    ssize_t len;
+    long last;
+    char *buf;
+
+    buf = malloc(recLen);
+    if (buf == NULL)
+        errExit("malloc");
+
+    rl = ringLogOpen(path, 0, 0);       /* Performs recovery */
+    if (rl == NULL)
+        errExit("ringLogOpen");
+    rd = ringLogReaderOpen(path, 1);
+    if (rd == NULL)
+        errExit("ringLogReaderOpen");
+
+    *okp = TRUE;
+    last = -1;
+    while ((len = ringLogRead(rd, buf, recLen)) > 0) {
+        if (!recordOk(buf, len, &seq) ||
+                (last == -1 && first >= 0 && seq != (uint64_t) first) ||
+                (last != -1 && seq != (uint64_t) last + 1))
+            *okp = FALSE;
+        last = seq;
+    }
+    if (len == -1)
+        errExit("ringLogRead");
+
+    ringLogReaderClose(rd);
+    ringLogClose(rl);
+    free(buf);
+    return last;
+}
+
+/* Kill a writer in mid-stream, and check that what it committed
+   survives (which, since the page cache survives the kill, tests only
+   the consistency of the log as seen through the mapping); then damage
+   the newest header copy and check that the log falls back to the
+   previous commit */
+
+static void
+checkRecovery(void)
+{
+    struct ringLog *rl;
+    long *committed, *appended, last, afterDamage;
+    Boolean ok, ok2;
+    unsigned char *hdr;
+    char *buf;
+    int fd, gen;
+    long n;
+    pid_t pid;
+
+    committed = mmap(NULL, 2 * sizeof(long), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (committed == MAP_FAILED)
+        errExit("mmap");
+    appended = committed + 1;
+    *committed = *appended = -1;
+
+    rl = freshLog();
+    ringLogClose(rl);
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        buf = malloc(recLen);
+        if (buf == NULL)
+            errExit("malloc");
+        rl = ringLogOpen(path, 0, 0);
+        if (rl == NULL)
+            errExit("ringLogOpen");
+        for (n = 0; ; n++) {
+            makeRecord(buf, n);
+            if (ringLogAppend(rl, buf, recLen) == -1)
+                errExit("ringLogAppend");
+            *appended = n;
+            if (n % 16 == 15) {
+                if (ringLogCommit(rl, MS_ASYNC) == -1)
+                    errExit("ringLogCommit");
+                *committed = n;
+            }
+        }
+    }
+
+    usleep(200000);
+    kill(pid, SIGKILL);
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    /* Every record up to the last commit must be present. (Later records
+       may be too, since making room for a record commits the records
+       before it, and the writer may have been killed between a commit
+       and the update of '*committed'.) */
+
+    last = checkLog(-1, &ok);
+    ok = ok && last >= *committed && last <= *appended;
+    printf("Recovery after killed writer (page cache intact): %s "
+            "(last committed record %ld, last recovered %ld)\n",
+            ok ? "OK" : "FAILED", *committed, last);
+
+    /* Commit twice more, and then damage the header copy written by the
+       second commit; the log should come back as of the first */
+
+    buf = malloc(recLen);
+    if (buf == NULL)
+        errExit("malloc");
+    rl = ringLogOpen(path, 0, 0);
+    if (rl == NULL)
+        errExit("ringLogOpen");
+    makeRecord(buf, last + 1);
+    if (ringLogAppend(rl, buf, recLen) == -1 ||
+            ringLogCommit(rl, MS_SYNC) == -1)
+        errExit("ringLogAppend");
+    makeRecord(buf, last + 2);
+    if (ringLogAppend(rl, buf, recLen) == -1 ||
+            ringLogCommit(rl, MS_SYNC) == -1)
+        errExit("ringLogAppend");
+    gen = rl->gen % 2;
+    ringLogClose(rl);
+
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+        errExit("open");
+    hdr = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+        errExit("mmap");
+    /* Each header copy occupies 512 bytes, and its 'capacity' field
+       bytes 16 to 23 (see ring_log.c) */
+
+    hdr[gen * 512 + 20] ^= 0xff;
+    munmap(hdr, sysconf(_SC_PAGESIZE));
+    close(fd);
+
+    afterDamage = checkLog(-1, &ok2);
+    ok2 = ok2 && afterDamage == last + 1;
+    printf("Recovery from damaged header: %s (last recovered %ld, "
+            "expected %ld)\n", ok2 ? "OK" : "FAILED", afterDamage, last + 1);
+
+    munmap(committed, 2 * sizeof(long));
+    free(buf);
+}
+
+/* Copy 'len' bytes of the file at offset 'off' to or from 'buf' */
+
+static void
+snapshot(int fd, char *buf, size_t len, off_t off)
+{
+    if (pread(fd, buf, len, off) != (ssize_t) len)
+        errExit("pread");
+}
+
+static void
+revert(int fd, const char *buf, size_t len, off_t off)
+{
+    if (pwrite(fd, buf, len, off) != (ssize_t) len)
+        errExit("pwrite");
+}
+
+/* Simulate crashes in which only some of the file's pages were written,
+   by copying parts of snapshots of the file back over it. The header
+   copies occupy the first 1024 bytes of the file, and the records start
+   at the second page (see ring_log.c). */
+
+#define HDR_BYTES 1024
+
+static void
+checkLostWrites(void)
+{
+    struct ringLog *rl;
+    long pageSize, n, last, snapLast, half, limit;
+    char *buf, *snap, hdrSnap[HDR_BYTES];
+    uint64_t prevHead;
+    Boolean ok;
+    int fd;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    buf = malloc(recLen);
+    snap = malloc(capacity);
+    if (buf == NULL || snap == NULL)
+        errExit("malloc");
+
+    /* The header of a commit reaches the disk, but not the records that
+       the commit added: the log should end at the previous commit. (Use
+       few enough records that none are discarded; each has a header of
+       16 bytes, and may need up to 15 bytes of alignment.) */
+
+    half = capacity / (recLen + 32) / 4;
+    if (half < 1)
+        half = 1;
+
+    rl = freshLog();
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+        errExit("open");
+    for (n = 0; n < 2 * half; n++) {
+        makeRecord(buf, n);
+        if (ringLogAppend(rl, buf, recLen) == -1)
+            errExit("ringLogAppend");
+        if (n == half - 1) {
+            if (ringLogCommit(rl, MS_SYNC) == -1)
+                errExit("ringLogCommit");
+            snapshot(fd, snap, capacity, pageSize);
+        }
+    }
+    if (ringLogCommit(rl, MS_ASYNC) == -1)
+        errExit("ringLogCommit");
+    ringLogClose(rl);
+
+    revert(fd, snap, capacity, pageSize);
+    close(fd);
+    last = checkLog(0, &ok);
+    ok = ok && last == half - 1;
+    printf("Recovery with unwritten records: %s (last recovered %ld, "
+            "expected %ld)\n", ok ? "OK" : "FAILED", last, half - 1);
+
+    /* Wrap around the log several times committing only with MS_ASYNC,
+       so that the only commits known to be durable are the MS_SYNC ones
+       made when the writer discards old records (which we detect by a
+       change of 'head'). Then put back the header from the last of those
+       commits, leaving the records that were written since. */
+
+    rl = freshLog();
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+        errExit("open");
+    limit = 5 * (capacity / (recLen + 16)) / 2;     /* 2.5 times round */
+    prevHead = rl->head;
+    snapLast = -1;
+    snapshot(fd, hdrSnap, HDR_BYTES, 0);
+    for (n = 0; n < limit; n++) {
+        makeRecord(buf, n);
+        if (ringLogAppend(rl, buf, recLen) == -1)
+            errExit("ringLogAppend");
+        if (rl->head != prevHead) {     /* Committed records before 'n' */
+            prevHead = rl->head;
+            snapshot(fd, hdrSnap, HDR_BYTES, 0);
+            snapLast = n - 1;
+        }
+        if (n % batchSize == batchSize - 1 &&
+                ringLogCommit(rl, MS_ASYNC) == -1)
+            errExit("ringLogCommit");
+    }
+    ringLogClose(rl);
+
+    revert(fd, hdrSnap, HDR_BYTES, 0);
+    close(fd);
+    last = checkLog(-1, &ok);
+    ok = ok && snapLast != -1 && last == snapLast;
+    printf("Recovery with only MS_SYNC commits durable: %s "
+            "(last recovered %ld, expected %ld)\n",
+            ok ? "OK" : "FAILED", last, snapLast);
+
+    free(snap);
+    free(buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+    double lat;
+    long rate;
+    int opt, j;
+
+    while ((opt = getopt(argc, argv, "f:c:l:b:t:")) != -1) {
+        switch (opt) {
+        case 'f': path = optarg;                                        break;
+        case 'c': capacity = getLong(optarg, GN_GT_0, "capacity") * 1024;
+                  break;
+        case 'l': recLen = getLong(optarg, GN_GT_0, "len");             break;
+        case 'b': batchSize = getInt(optarg, GN_GT_0, "batch");         break;
+        case 't': secs = getInt(optarg, GN_GT_0, "secs");               break;
+        default:
+            usageErr("%s [-f file] [-c capacity-kB] [-l len] [-b batch] "
+                    "[-t secs]\n", argv[0]);
+        }
+    }
+    if (recLen < sizeof(uint64_t))
+        recLen = sizeof(uint64_t);
+
+    printf("%-24s %12s %10s %16s\n", "", "records/s", "MB/s",
+            "durable lat (us)");
+    for (j = 0; j < NUM_POLICIES; j++) {
+        rate = runPolicy(&policies[j], &lat);
+        printf("%-24s %12ld %10.1f", policies[j].name, rate,
+                rate * (double) recLen / 1e6);
+        if (lat > 0)
+            printf(" %16.1f\n", lat);
+        else
+            printf(" %16s\n", "-");
+    }
+    printf("(batch = %d records of %zu bytes)\n\n", batchSize, recLen);
+    fflush(stdout);                     /* Before creating children */
+
+    runTailer();
+    checkRecovery();
+    checkLostWrites();
+
+    unlink(path);
+    exit(EXIT_SUCCESS);
+}
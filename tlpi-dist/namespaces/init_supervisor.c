@@ -0,0 +1,520 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* init_supervisor.c
+
+   An init program for a PID namespace that runs a set of services,
+   restarts them when they fail, and reaps all other processes that
+   become its children.
+
+   Usage: init_supervisor [-v] [-p proc-mount] [-r policy] [-b min-ms]
+                          [-B max-ms] [-t grace-secs] 'command'...
+
+   Each 'command' argument is a service: a simple command plus arguments,
+   which (as in simple_init.c) undergoes wordexp() expansion. Each service
+   is run in its own process group.
+
+   -r policy    When to restart a service that terminates: 'always',
+                'failure' (the default: after a nonzero exit status or
+                termination by a signal), or 'never'.
+   -b min-ms    The delay before the first restart of a service (default:
+                100 milliseconds). The delay doubles after each further
+                failure, up to 'max-ms' (-B; default: 30000), and returns
+                to 'min-ms' once the service has run for STABLE_SECS.
+   -t secs      After a termination signal, wait this long (default: 10)
+                for the services to exit before killing them.
+   -p path      Mount a procfs at 'path', as in simple_init.c.
+   -v           Log the reaping of every process, not just services.
+
+   SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR2, and SIGWINCH are forwarded
+   to the process group of each running service. SIGINT, SIGQUIT, and
+   SIGTERM additionally begin a shutdown: services are no longer
+   restarted, and the program terminates once they have all exited.
+   SIGUSR1 displays the per-service resource counters (accumulated, from
+   wait4(), over all runs of the service) and the reaper statistics.
+
+   All signals are received via a signalfd. Since the kernel delivers a
+   blocked signal even to the init process of a PID namespace, this also
+   avoids the need for handlers for signals that would otherwise be
+   discarded. Standard signals don't queue, so a single pending SIGCHLD
+   may stand for many terminated children, and its siginfo record names
+   only one of them. On each wakeup, the program therefore reaps with
+   wait4(-1, WNOHANG) until no terminated children remain.
+
+   If the program is not the init process of a PID namespace, it makes
+   itself a child subreaper (prctl(PR_SET_CHILD_SUBREAPER)), so that
+   orphaned descendants are reparented to it rather than to the real
+   init.
+*/
+#define _GNU_SOURCE
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/prctl.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <wordexp.h>
+#include <poll.h>
+#include <time.h>
+#include "close_fds.h"
+#include "print_wait_status.h"
+#include "tlpi_hdr.h"
+
+#define STABLE_SECS 10          /* A run this long resets the backoff */
+#define MAX_SIGINFO 64          /* Records read from signalfd at once */
+#define MAX_TIMEOUT_MS 3600000  /* Longest single poll() sleep */
+
+enum { RESTART_ALWAYS, RESTART_FAILURE, RESTART_NEVER };
+enum { SVC_RUNNING, SVC_WAITING, SVC_DONE };
+
+struct service {
+    char *cmd;
+    wordexp_t words;
+    int state;
+    pid_t pid;                  /* If SVC_RUNNING */
+    double startTime;           /* If SVC_RUNNING */
+    double restartTime;         /* If SVC_WAITING */
+    long backoffMs;             /* Delay before next restart */
+    unsigned long starts, failures;
+    int lastStatus;             /* Wait status from the last run */
+    struct rusage ru;           /* Accumulated over completed runs */
+};
+
+static struct service *svc;
+static int numSvc;
+
+static int restartPolicy = RESTART_FAILURE;
+static long minBackoffMs = 100, maxBackoffMs = 30000;
+static Boolean verbose = FALSE;
+static sigset_t origMask;
+
+static struct {
+    unsigned long orphans;      /* Non-service processes reaped */
+    unsigned long batches;      /* Wakeups that reaped something */
+    unsigned long maxBatch;     /* Most processes reaped in one wakeup */
+    struct rusage ru;           /* Accumulated for orphans */
+} reaper;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+tvSecs(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Add the resource usage in 'ru' to the running total in 'sum' */
+
+static void
+addRusage(struct rusage *sum, const struct rusage *ru)
+{
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    if (ru->ru_maxrss > sum->ru_maxrss)
+        sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_inblock += ru->ru_inblock;
+    sum->ru_oublock += ru->ru_oublock;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+static void
+printCounters(void)
+{
+    static const char *stateName[] = { "running", "waiting", "done" };
+    struct rusage *ru;
+    int j;
+
+    printf("init: reaped %lu orphans in %lu batches (largest %lu)\n",
+            reaper.orphans, reaper.batches, reaper.maxBatch);
+    printf("%3s %7s %-8s %6s %6s %8s %8s %9s %8s %6s %8s %8s  %s\n",
+            "svc", "pid", "state", "starts", "fails", "user-s", "sys-s",
+            "maxrss-kB", "minflt", "majflt", "vcsw", "ivcsw", "command");
+
+    for (j = 0; j <= numSvc; j++) {
+        ru = (j < numSvc) ? &svc[j].ru : &reaper.ru;
+        if (j < numSvc)
+            printf("%3d %7ld %-8s %6lu %6lu ", j,
+                    (svc[j].state == SVC_RUNNING) ? (long) svc[j].pid : 0L,
+                    stateName[svc[j].state], svc[j].starts,
+                    svc[j].failures);
+        else
+            printf("%3s %7s %-8s %6lu %6s ", "-", "-", "-",
+                    reaper.orphans, "-");
+        printf("%8.2f %8.2f %9ld %8ld %6ld %8ld %8ld  %s\n",
+                tvSecs(&ru->ru_utime), tvSecs(&ru->ru_stime),
+                ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt,
+                ru->ru_nvcsw, ru->ru_nivcsw,
+                (j < numSvc) ? svc[j].cmd : "(orphans)");
+    }
+    fflush(stdout);
+}
+
+/* Schedule a restart of service 's' after its current backoff delay,
+   and double the delay for next time */
+
+static void
+scheduleRestart(struct service *s)
+{
+    s->state = SVC_WAITING;
+    s->restartTime = nowSecs() + s->backoffMs / 1000.0;
+    if (s->backoffMs > maxBackoffMs / 2)      /* Also avoids overflow */
+        s->backoffMs = maxBackoffMs;
+    else
+        s->backoffMs *= 2;
+}
+
+/* Start (or restart) service 's' */
+
+static void
+startService(struct service *s)
+{
+    pid_t pid;
+
+    pid = fork();
+    if (pid == -1) {
+        errMsg("fork");         /* Treat as a failure, and retry later */
+        scheduleRestart(s);
+        return;
+    }
+
+    if (pid == 0) {
+        if (setpgid(0, 0) == -1)
+            errExit("setpgid");
+        if (sigprocmask(SIG_SETMASK, &origMask, NULL) == -1)
+            errExit("sigprocmask");
+
+        /* Don't pass on descriptors that we inherited from our own
+           parent; the service gets just stdin, stdout, and stderr */
+
+        if (closeFdsFrom(STDERR_FILENO + 1, CFD_CLOEXEC) == -1)
+            errExit("closeFdsFrom");
+        execvp(s->words.we_wordv[0], s->words.we_wordv);
+        errExit("execvp: %s", s->words.we_wordv[0]);
+    }
+
+    /* Also call setpgid() in the parent, so that the process group
+       exists before we might try to send a signal to it */
+
+    setpgid(pid, pid);
+
+    s->pid = pid;
+    s->state = SVC_RUNNING;
+    s->startTime = nowSecs();
+    s->starts++;
+    if (verbose)
+        printf("init: started service %ld (%s): PID %ld\n",
+                (long) (s - svc), s->cmd, (long) pid);
+}
+
+/* Record the termination, with wait status 'status', of the process
+   'pid'. 'shuttingDown' says whether a termination signal has been
+   received. */
+
+static void
+childDone(pid_t pid, int status, const struct rusage *ru,
+          Boolean shuttingDown)
+{
+    struct service *s;
+    Boolean failed;
+    char msg[128];
+
+    for (s = svc; s < svc + numSvc; s++)
+        if (s->state == SVC_RUNNING && s->pid == pid)
+            break;
+
+    if (s == svc + numSvc) {            /* Not a service */
+        reaper.orphans++;
+        addRusage(&reaper.ru, ru);
+        if (verbose) {
+            snprintf(msg, sizeof(msg), "init: reaped PID %ld: ", (long) pid);
+            printWaitStatus(msg, status);
+        }
+        return;
+    }
+
+    addRusage(&s->ru, ru);
+    s->lastStatus = status;
+    failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    if (failed)
+        s->failures++;
+
+    snprintf(msg, sizeof(msg), "init: service %ld (%s) PID %ld: ",
+            (long) (s - svc), s->cmd, (long) pid);
+    printWaitStatus(msg, status);
+
+    if (nowSecs() - s->startTime >= STABLE_SECS)
+        s->backoffMs = minBackoffMs;
+
+    if (shuttingDown || restartPolicy == RESTART_NEVER ||
+            (restartPolicy == RESTART_FAILURE && !failed)) {
+        s->state = SVC_DONE;
+        return;
+    }
+
+    printf("init: restarting service %ld in %ld ms\n",
+            (long) (s - svc), s->backoffMs);
+    scheduleRestart(s);
+}
+
+/* Reap all terminated children */
+
+static void
+reapChildren(Boolean shuttingDown)
+{
+    struct rusage ru;
+    unsigned long reaped;
+    pid_t pid;
+    int status;
+
+    reaped = 0;
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+        childDone(pid, status, &ru, shuttingDown);
+        reaped++;
+    }
+    if (pid == -1 && errno != ECHILD)
+        errMsg("wait4");
+
+    if (reaped > 0) {
+        reaper.batches++;
+        if (reaped > reaper.maxBatch)
+            reaper.maxBatch = reaped;
+    }
+}
+
+/* Send 'sig' to the process group of each running service */
+
+static void
+forwardSignal(int sig)
+{
+    int j;
+
+    for (j = 0; j < numSvc; j++)
+        if (svc[j].state == SVC_RUNNING)
+            if (kill(-svc[j].pid, sig) == -1 && errno != ESRCH)
+                errMsg("kill %ld", (long) -svc[j].pid);
+}
+
+static void
+mountProc(const char *path)
+{
+    /* See simple_init.c for why we make the mount point a slave */
+
+    if (mount("none", path, NULL, MS_SLAVE, NULL) == -1 && errno != EINVAL)
+        errMsg("mount-make-slave %s", path);
+    if (mount("proc", path, "proc", 0, NULL) == -1)
+        errExit("mount-procfs");
+}
+
+static void
+usageError(const char *pname)
+{
+    fprintf(stderr, "Usage: %s [options] 'command'...\n", pname);
+    fprintf(stderr, "\t-r policy      Restart 'always', on 'failure' "
+                    "(default), or 'never'\n");
+    fprintf(stderr, "\t-b min-ms      Initial restart delay (default: "
+                    "100)\n");
+    fprintf(stderr, "\t-B max-ms      Maximum restart delay (default: "
+                    "30000)\n");
+    fprintf(stderr, "\t-t grace-secs  Time allowed for shutdown "
+                    "(default: 10)\n");
+    fprintf(stderr, "\t-p proc-mount  Mount a procfs at specified path\n");
+    fprintf(stderr, "\t-v             Log every reaped process\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int fwdSigs[] = {
+        SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR2, SIGWINCH, 0
+    };
+    struct signalfd_siginfo si[MAX_SIGINFO];
+    struct pollfd pfd;
+    sigset_t mask;
+    double now, wake, killTime;
+    Boolean shuttingDown, killed, active, gotChld;
+    int opt, j, k, sfd, graceSecs, timeout;
+    char *procPath;
+    ssize_t numRead;
+
+    procPath = NULL;
+    graceSecs = 10;
+
+    while ((opt = getopt(argc, argv, "+r:b:B:t:p:v")) != -1) {
+        switch (opt) {
+        case 'r':
+            if (strcmp(optarg, "always") == 0)
+                restartPolicy = RESTART_ALWAYS;
+            else if (strcmp(optarg, "failure") == 0)
+                restartPolicy = RESTART_FAILURE;
+            else if (strcmp(optarg, "never") == 0)
+                restartPolicy = RESTART_NEVER;
+            else
+                usageError(argv[0]);
+            break;
+        case 'b': minBackoffMs = getLong(optarg, GN_GT_0, "min-ms");  break;
+        case 'B': maxBackoffMs = getLong(optarg, GN_GT_0, "max-ms");  break;
+        case 't': graceSecs = getInt(optarg, GN_NONNEG, "grace-secs"); break;
+        case 'p': procPath = optarg;                                   break;
+        case 'v': verbose = TRUE;                                      break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageError(argv[0]);
+
+    numSvc = argc - optind;
+    svc = calloc(numSvc, sizeof(struct service));
+    if (svc == NULL)
+        errExit("calloc");
+    for (j = 0; j < numSvc; j++) {
+        svc[j].cmd = argv[optind + j];
+        if (wordexp(svc[j].cmd, &svc[j].words, 0) != 0 ||
+                svc[j].words.we_wordc == 0)
+            fatal("bad command: %s", svc[j].cmd);
+        svc[j].backoffMs = minBackoffMs;
+    }
+
+    if (getpid() != 1 && prctl(PR_SET_CHILD_SUBREAPER, 1) == -1)
+        errExit("prctl-PR_SET_CHILD_SUBREAPER");
+
+    if (procPath != NULL)
+        mountProc(procPath);
+
+    /* Receive all signals that we handle via a signalfd */
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
+    for (k = 0; fwdSigs[k] != 0; k++)
+        sigaddset(&mask, fwdSigs[k]);
+    if (sigprocmask(SIG_BLOCK, &mask, &origMask) == -1)
+        errExit("sigprocmask");
+
+    sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1)
+        errExit("signalfd");
+    pfd.fd = sfd;
+    pfd.events = POLLIN;
+
+    if (verbose)
+        printf("init: PID %ld; %d services\n", (long) getpid(), numSvc);
+
+    for (j = 0; j < numSvc; j++)
+        startService(&svc[j]);
+
+    shuttingDown = FALSE;
+    killed = FALSE;
+    killTime = 0;
+
+    for (;;) {
+
+        /* Start services whose restart delay has expired, and work out
+           how long we may sleep */
+
+        now = nowSecs();
+        wake = -1;
+        active = FALSE;
+        for (j = 0; j < numSvc; j++) {
+            if (svc[j].state == SVC_WAITING && svc[j].restartTime <= now)
+                startService(&svc[j]);
+            if (svc[j].state == SVC_WAITING &&
+                    (wake < 0 || svc[j].restartTime < wake))
+                wake = svc[j].restartTime;
+            if (svc[j].state != SVC_DONE)
+                active = TRUE;
+        }
+
+        if (!active)
+            break;
+
+        if (shuttingDown && !killed) {
+            if (now >= killTime) {
+                printf("init: grace period expired; killing services\n");
+                if (getpid() == 1)
+                    kill(-1, SIGKILL);  /* All other processes in the NS */
+                else
+                    forwardSignal(SIGKILL);
+                killed = TRUE;
+            } else if (wake < 0 || killTime < wake) {
+                wake = killTime;
+            }
+        }
+
+        if (wake < 0)
+            timeout = -1;
+        else if (wake - now >= MAX_TIMEOUT_MS / 1000)
+            timeout = MAX_TIMEOUT_MS;
+        else
+            timeout = (int) ((wake - now) * 1000) + 1;
+        if (poll(&pfd, 1, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+
+        /* Drain the signalfd */
+
+        gotChld = FALSE;
+        while ((numRead = read(sfd, si, sizeof(si))) > 0) {
+            for (k = 0; k < numRead / (ssize_t) sizeof(si[0]); k++) {
+                switch (si[k].ssi_signo) {
+                case SIGCHLD:
+                    gotChld = TRUE;
+                    break;
+                case SIGUSR1:
+                    printCounters();
+                    break;
+                default:
+                    forwardSignal(si[k].ssi_signo);
+                    if (!shuttingDown && (si[k].ssi_signo == SIGINT ||
+                            si[k].ssi_signo == SIGQUIT ||
+                            si[k].ssi_signo == SIGTERM)) {
+                        printf("init: received %s; shutting down\n",
+                                strsignal(si[k].ssi_signo));
+                        shuttingDown = TRUE;
+                        killTime = nowSecs() + graceSecs;
+                        for (j = 0; j < numSvc; j++)
+                            if (svc[j].state == SVC_WAITING)
+                                svc[j].state = SVC_DONE;
+                    }
+                }
+            }
+        }
+        if (numRead == -1 && errno != EAGAIN)
+            errExit("read-signalfd");
+
+        if (gotChld)
+            reapChildren(shuttingDown);
+    }
+
+    /* Reap anything that remains, and show the final counters */
+
+    reapChildren(TRUE);
+    printCounters();
+
+    if (procPath != NULL && umount(procPath) == -1)
+        errMsg("umount-procfs");
+
+    exit(EXIT_SUCCESS);
+}
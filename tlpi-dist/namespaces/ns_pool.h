@@ -0,0 +1,67 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* ns_pool.h
+
+   Header file used by ns_pool_sv.c and ns_pool_bench.c.
+
+   The pool server keeps a number of namespace sets ready. Each set
+   consists of a user namespace (in which the server's UID and GID are
+   mapped to 0), and network, IPC, and UTS namespaces owned by that user
+   namespace. No process needs to live in these namespaces: the server
+   holds each set open via file descriptors for the /proc/PID/ns files of
+   the (now terminated) process that created it.
+
+   A client connects to the server's UNIX domain sequenced-packet socket
+   (bound to the abstract name NS_POOL_NAME by default) and sends a
+   'struct nspRequest'. For NSP_GET, the server replies with a 'struct
+   nspReply', followed (if 'status' is 0) by 'numFds' messages, each
+   carrying one namespace file descriptor (sent with sendfd()), in the
+   order given by nspNsOrder[]. If no set is ready, 'status' is EAGAIN,
+   and the client should retry a little later. The client joins the
+   namespaces with setns(), in that order. When it has finished with the
+   set, the client sends NSP_RELEASE (or simply closes the connection), and the server
+   scrubs the namespaces and returns the set to the pool.
+*/
+#ifndef NS_POOL_H
+#define NS_POOL_H
+
+#include "sandbox_functions.h"
+
+#define NS_POOL_NAME "tlpi_ns_pool"     /* Default abstract socket name */
+
+#define NSP_NUM_NS 4            /* Namespaces in a set */
+
+/* The namespaces in a set, in the order in which they are sent and must
+   be joined (the user namespace first) */
+
+static const int nspNsOrder[NSP_NUM_NS] = {
+    CLONE_NEWUSER, CLONE_NEWNET, CLONE_NEWIPC, CLONE_NEWUTS
+};
+
+#define NSP_GET     1           /* Request a namespace set */
+#define NSP_RELEASE 2           /* Return the set obtained on this
+                                   connection */
+
+struct nspRequest {
+    int op;
+};
+
+struct nspReply {
+    int status;                 /* 0, or an errno value */
+    int slot;                   /* Identifies the set (for display) */
+    int numFds;                 /* Number of descriptors that follow */
+};
+
+#define NSP_HOSTNAME "sandbox"  /* Host name in a fresh or scrubbed set */
+
+#endif
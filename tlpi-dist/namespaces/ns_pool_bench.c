@@ -0,0 +1,215 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* ns_pool_bench.c
+
+   Compare the time taken to obtain a namespace set from ns_pool_sv with
+   the time taken to create one.
+
+   Usage: ns_pool_bench [-n count] [-w hold-usecs] [-s name]
+
+   The program obtains 'count' (default: 1000) namespace sets from the
+   pool server listening on the abstract socket 'name' (default:
+   NS_POOL_NAME), and creates the same number of sets directly, using
+   sbCreateHeld(). For each set, it measures:
+
+        obtain      the time to get file descriptors for the set
+                    (including any retries after the server replied
+                    that no set was ready)
+        +join       the time until a child process has joined the
+                    namespaces of the set with setns() and exited
+
+   Between obtaining sets, the program pauses for 'hold-usecs' (default:
+   2000) microseconds, simulating the work done in a sandbox; this gives
+   the server time to scrub returned sets in the background.
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <time.h>
+#include "unix_sockets.h"
+#include "scm_functions.h"
+#include "ns_pool.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Obtain a namespace set from the server on the connected socket 'sfd'.
+   Returns 0 on success, or -1 on error. */
+
+static int
+poolGet(int sfd, int fds[])
+{
+    struct nspRequest req;
+    struct nspReply rep;
+    int j;
+
+    req.op = NSP_GET;
+    if (send(sfd, &req, sizeof(req), 0) != sizeof(req))
+        return -1;
+    if (recv(sfd, &rep, sizeof(rep), 0) != sizeof(rep))
+        return -1;
+    if (rep.status != 0) {
+        errno = rep.status;
+        return -1;
+    }
+
+    for (j = 0; j < NSP_NUM_NS; j++) {
+        fds[j] = recvfd(sfd);
+        if (fds[j] == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* Create a child that joins the namespaces referred to by 'fds', and wait
+   for it */
+
+static void
+joinInChild(int fds[])
+{
+    pid_t pid;
+    int j;
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+
+    if (pid == 0) {
+        for (j = 0; j < NSP_NUM_NS; j++)
+            if (setns(fds[j], nspNsOrder[j]) == -1)
+                errExit("setns-%s", sbNsName(nspNsOrder[j]));
+        _exit(EXIT_SUCCESS);
+    }
+
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Print statistics (in microseconds) for the 'n' times in 't' */
+
+static void
+printTimes(const char *label, double *t, int n)
+{
+    double sum;
+    int j;
+
+    qsort(t, n, sizeof(double), cmpDouble);
+    for (sum = 0, j = 0; j < n; j++)
+        sum += t[j];
+
+    printf("%-14s %10.1f %10.1f %10.1f %10.1f\n", label, sum / n * 1e6,
+            t[n / 2] * 1e6, t[(int) (n * 0.99)] * 1e6, t[n - 1] * 1e6);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct nspRequest req;
+    struct timespec hold, retry;
+    double *obtain, *joined, start;
+    long busy;
+    int fds[NSP_NUM_NS], sfd, opt, count, holdUsecs, j, k;
+    char *name;
+
+    count = 1000;
+    holdUsecs = 2000;
+    name = NS_POOL_NAME;
+
+    while ((opt = getopt(argc, argv, "n:w:s:")) != -1) {
+        switch (opt) {
+        case 'n': count = getInt(optarg, GN_GT_0, "count");          break;
+        case 'w': holdUsecs = getInt(optarg, GN_NONNEG, "hold-usecs"); break;
+        case 's': name = optarg;                                     break;
+        default:
+            usageErr("%s [-n count] [-w hold-usecs] [-s name]\n", argv[0]);
+        }
+    }
+
+    obtain = calloc(count, sizeof(double));
+    joined = calloc(count, sizeof(double));
+    if (obtain == NULL || joined == NULL)
+        errExit("calloc");
+
+    printf("%-14s %10s %10s %10s %10s   (microseconds)\n", "",
+            "mean", "median", "99%", "max");
+
+    /* Sets from the pool */
+
+    sfd = unixConnectAbstract(name, SOCK_SEQPACKET);
+    if (sfd == -1)
+        errExit("unixConnectAbstract (is ns_pool_sv running?)");
+
+    hold.tv_sec = holdUsecs / 1000000;
+    hold.tv_nsec = holdUsecs % 1000000 * 1000;
+    retry.tv_sec = 0;
+    retry.tv_nsec = 100000;
+    req.op = NSP_RELEASE;
+    busy = 0;
+
+    for (j = 0; j < count; j++) {
+        start = nowSecs();
+        while (poolGet(sfd, fds) == -1) {
+            if (errno != EAGAIN)
+                errExit("poolGet");
+            busy++;
+            nanosleep(&retry, NULL);
+        }
+        obtain[j] = nowSecs() - start;
+        joinInChild(fds);
+        joined[j] = nowSecs() - start;
+
+        for (k = 0; k < NSP_NUM_NS; k++)
+            close(fds[k]);
+        if (send(sfd, &req, sizeof(req), 0) != sizeof(req))
+            errExit("send");
+        nanosleep(&hold, NULL);
+    }
+    close(sfd);
+
+    printTimes("pool obtain", obtain, count);
+    printTimes("pool +join", joined, count);
+    if (busy > 0)
+        printf("(server was busy %ld times)\n", busy);
+
+    /* Freshly created sets */
+
+    for (j = 0; j < count; j++) {
+        start = nowSecs();
+        if (sbCreateHeld(NSP_NUM_NS, nspNsOrder, fds, NSP_HOSTNAME) == -1)
+            errExit("sbCreateHeld");
+        obtain[j] = nowSecs() - start;
+        joinInChild(fds);
+        joined[j] = nowSecs() - start;
+
+        for (k = 0; k < NSP_NUM_NS; k++)
+            close(fds[k]);
+    }
+
+    printTimes("fresh create", obtain, count);
+    printTimes("fresh +join", joined, count);
+
+    exit(EXIT_SUCCESS);
+}
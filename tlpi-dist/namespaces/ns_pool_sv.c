@@ -0,0 +1,759 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* ns_pool_sv.c
+
+   A server that keeps a pool of pre-created namespace sets, hands them
+   out to clients, and scrubs and recycles them after use. See ns_pool.h
+   for a description of the namespace sets and of the protocol.
+
+   Usage: ns_pool_sv [-n size] [-s name] [-v]
+
+   The server keeps up to 'size' (default: 8) sets, and listens on the
+   abstract socket 'name' (default: NS_POOL_NAME). Only clients with the
+   same UID as the server (or root) are served, since a namespace set
+   confers privilege (UID 0 in its user namespace).
+
+   Creating a user namespace with UID and GID maps and a network namespace
+   costs on the order of a millisecond (see sandbox_launch.c). The server
+   creates sets while no client request is pending (and, so that steady
+   traffic can't starve the pool, at least every MAINT_INTERVAL seconds
+   regardless), and scrubs returned sets in child processes that it does
+   not wait for, so that a request normally finds a ready set and is
+   satisfied by sending a few file descriptors. A request never waits
+   for a set to be created or scrubbed, since that would stall every
+   other client: if no set is ready, the reply is EAGAIN. If creating a
+   set fails, the server retries after a delay that doubles (up to
+   CREATE_MAX_DELAY seconds) with each further failure.
+
+   A client may not have given up a set when it releases it: it (or a
+   process to which it passed the descriptors) may still hold the
+   namespace file descriptors, or have processes living in the
+   namespaces. Reusing such a set would let that client share namespaces
+   with the next one, so the scrubber first checks, by scanning /proc,
+   that no process other than the server and its scrubbers is a member of
+   one of the namespaces (or of a user namespace nested inside the set's
+   user namespace) or has a descriptor open for one of them. Only
+   processes that the server may inspect (those with its UID, unless it
+   is run as root) can be checked. If the set is still in use, it is
+   discarded.
+
+   Otherwise, the scrubber joins the set's namespaces and:
+
+   * resets the host and domain names;
+   * removes all System V IPC objects (POSIX message queues are not
+     handled, since that requires mounting an mqueue filesystem);
+   * checks that the network namespace contains no interface other than
+     the loopback interface, and no sockets (as listed in /proc/net).
+
+   If the network namespace is not clean, the set is discarded and
+   replaced, rather than attempting to undo arbitrary configuration.
+
+   Sending SIGUSR1 displays statistics; SIGINT or SIGTERM displays them
+   and terminates the server.
+*/
+#define _GNU_SOURCE
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/msg.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <net/if.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include "semun.h"
+#include "unix_sockets.h"
+#include "scm_functions.h"
+#include "ns_pool.h"
+
+#ifndef NS_GET_PARENT
+#define NSIO    0xb7
+#define NS_GET_PARENT           _IO(NSIO, 0x2)
+#endif
+
+#define MAX_CONN 1024
+#define MAX_POOL 1024
+#define MAINT_INTERVAL 0.01     /* Seconds between forced maintenance */
+#define CREATE_MIN_DELAY 0.1    /* Seconds before retrying a failed */
+#define CREATE_MAX_DELAY 10.0   /*   creation, doubling up to this */
+
+enum { SET_EMPTY, SET_FREE, SET_BUSY, SET_DIRTY, SET_SCRUBBING };
+
+struct nsSet {
+    int state;
+    int fd[NSP_NUM_NS];         /* Valid unless state is SET_EMPTY */
+    unsigned long uses;         /* Times handed out since creation */
+    pid_t scrubber;             /* If state is SET_SCRUBBING */
+    double retryTime;           /* If SET_EMPTY: don't create before */
+    double retryDelay;          /* Delay after next failed creation */
+};
+
+static struct nsSet pool[MAX_POOL];
+static int poolSize;
+
+static struct pollfd pfd[MAX_CONN + 1];     /* [0] is listening socket */
+static int connSlot[MAX_CONN + 1];          /* Set held by connection */
+static int nfds;
+
+static Boolean verbose;
+
+static struct {
+    unsigned long created, handedOut, busy, refused, recycled, discarded;
+    double createSecs;
+} stats;
+
+static volatile sig_atomic_t gotChld = 0, gotUsr1 = 0, gotTerm = 0;
+
+static void
+handler(int sig)
+{
+    if (sig == SIGCHLD)
+        gotChld = 1;
+    else if (sig == SIGUSR1)
+        gotUsr1 = 1;
+    else
+        gotTerm = 1;
+}
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+printStats(void)
+{
+    int j, count[SET_SCRUBBING + 1] = { 0 };
+
+    for (j = 0; j < poolSize; j++)
+        count[pool[j].state]++;
+
+    printf("pool: %d sets: %d free, %d busy, %d dirty, %d empty\n",
+            poolSize, count[SET_FREE], count[SET_BUSY],
+            count[SET_DIRTY] + count[SET_SCRUBBING], count[SET_EMPTY]);
+    printf("    handed out %lu (%lu answered busy), %lu clients refused\n",
+            stats.handedOut, stats.busy, stats.refused);
+    printf("    created %lu (mean %.1f us), recycled %lu, discarded %lu\n",
+            stats.created, (stats.created > 0) ?
+                    stats.createSecs * 1e6 / stats.created : 0.0,
+            stats.recycled, stats.discarded);
+    fflush(stdout);
+}
+
+static void
+closeSet(struct nsSet *s)
+{
+    int j;
+
+    for (j = 0; j < NSP_NUM_NS; j++)
+        close(s->fd[j]);
+    s->state = SET_EMPTY;
+}
+
+/* Create the namespaces for an empty set */
+
+static void
+createSet(struct nsSet *s)
+{
+    double start;
+
+    start = nowSecs();
+    if (sbCreateHeld(NSP_NUM_NS, nspNsOrder, s->fd, NSP_HOSTNAME) == -1) {
+        errMsg("sbCreateHeld");
+
+        /* Remains empty; back off before trying again */
+
+        if (s->retryDelay < CREATE_MIN_DELAY)
+            s->retryDelay = CREATE_MIN_DELAY;
+        s->retryTime = nowSecs() + s->retryDelay;
+        s->retryDelay *= 2;
+        if (s->retryDelay > CREATE_MAX_DELAY)
+            s->retryDelay = CREATE_MAX_DELAY;
+        return;
+    }
+    stats.createSecs += nowSecs() - start;
+    stats.created++;
+    s->retryDelay = 0;
+    s->uses = 0;
+    s->state = SET_FREE;
+}
+
+/* Return the number of lines (other than the heading) in 'path' */
+
+static int
+countEntries(const char *path)
+{
+    FILE *fp;
+    int c, lines;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;               /* E.g., IPv6 disabled */
+    lines = 0;
+    while ((c = getc(fp)) != EOF)
+        if (c == '\n')
+            lines++;
+    fclose(fp);
+    return (lines > 0) ? lines - 1 : 0;
+}
+
+/* Return TRUE if the file 'path' is one of the 'n' files (namespaces)
+   identified in 'sb' */
+
+static Boolean
+matchesNs(const char *path, const struct stat sb[], int n)
+{
+    struct stat st;
+    int j;
+
+    if (stat(path, &st) == -1)
+        return FALSE;
+    for (j = 0; j < n; j++)
+        if (st.st_dev == sb[j].st_dev && st.st_ino == sb[j].st_ino)
+            return TRUE;
+    return FALSE;
+}
+
+/* Return TRUE if the user namespace 'path', or one of its ancestors, is
+   the user namespace identified by 'userSb' */
+
+static Boolean
+nestedIn(const char *path, const struct stat *userSb)
+{
+    struct stat st;
+    int fd, pfd;
+    Boolean found;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return FALSE;
+
+    found = FALSE;
+    while (!found && fstat(fd, &st) == 0) {
+        found = st.st_dev == userSb->st_dev && st.st_ino == userSb->st_ino;
+        pfd = ioctl(fd, NS_GET_PARENT);         /* Fails at the top */
+        close(fd);
+        fd = pfd;
+        if (fd == -1)
+            break;
+    }
+    if (fd != -1)
+        close(fd);
+    return found;
+}
+
+/* Return the parent PID of process 'pid', or -1 if it can't be found */
+
+static pid_t
+parentOf(const char *pid)
+{
+    char path[PATH_MAX], line[1024], *p;
+    FILE *fp;
+    long ppid;
+
+    snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    p = fgets(line, sizeof(line), fp);
+    fclose(fp);
+    if (p == NULL)
+        return -1;
+
+    p = strrchr(line, ')');     /* Command name may contain spaces */
+    if (p == NULL || sscanf(p + 1, " %*c %ld", &ppid) != 1)
+        return -1;
+    return ppid;
+}
+
+/* Return TRUE if some process other than the server (our parent) and its
+   scrubbers (the server's other children) is a member of one of the
+   namespaces of 's', or of a user namespace nested inside its user
+   namespace, or has a file descriptor open for one of them */
+
+static Boolean
+setInUse(const struct nsSet *s)
+{
+    static const char *nsNames[] = { "user", "net", "ipc", "uts", NULL };
+    char path[PATH_MAX];
+    struct stat sb[NSP_NUM_NS];
+    struct dirent *dp, *fdp;
+    DIR *dirp, *fdDirp;
+    pid_t server, pid;
+    Boolean found;
+    int j;
+
+    for (j = 0; j < NSP_NUM_NS; j++)
+        if (fstat(s->fd[j], &sb[j]) == -1)
+            return TRUE;                /* Be safe: discard the set */
+
+    server = getppid();
+    dirp = opendir("/proc");
+    if (dirp == NULL)
+        return TRUE;
+
+    found = FALSE;
+    while (!found && (dp = readdir(dirp)) != NULL) {
+        if (dp->d_name[0] < '1' || dp->d_name[0] > '9')
+            continue;                   /* Not a PID directory */
+        pid = atol(dp->d_name);
+        if (pid == getpid() || pid == server ||
+                parentOf(dp->d_name) == server)
+            continue;
+
+        for (j = 0; nsNames[j] != NULL && !found; j++) {
+            snprintf(path, sizeof(path), "/proc/%s/ns/%s", dp->d_name,
+                     nsNames[j]);
+            found = matchesNs(path, sb, NSP_NUM_NS);
+        }
+
+        /* nspNsOrder[0] is CLONE_NEWUSER */
+
+        snprintf(path, sizeof(path), "/proc/%s/ns/user", dp->d_name);
+        found = found || nestedIn(path, &sb[0]);
+
+        snprintf(path, sizeof(path), "/proc/%s/fd", dp->d_name);
+        fdDirp = opendir(path);
+        if (fdDirp == NULL)
+            continue;                   /* Gone, or not ours to inspect */
+        while (!found && (fdp = readdir(fdDirp)) != NULL) {
+            if (fdp->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "/proc/%s/fd/%s", dp->d_name,
+                     fdp->d_name);
+            found = matchesNs(path, sb, NSP_NUM_NS);
+        }
+        closedir(fdDirp);
+    }
+
+    closedir(dirp);
+    return found;
+}
+
+/* Remove all System V IPC objects in the caller's IPC namespace */
+
+static void
+removeSysvIpc(void)
+{
+    struct shm_info shmInfo;
+    struct shmid_ds shmDs;
+    struct msginfo msgInfo;
+    struct msqid_ds msgDs;
+    struct seminfo semInfo;
+    struct semid_ds semDs;
+    union semun arg;
+    int maxInd, ind, id;
+
+    maxInd = shmctl(0, SHM_INFO, (struct shmid_ds *) &shmInfo);
+    for (ind = 0; ind <= maxInd; ind++) {
+        id = shmctl(ind, SHM_STAT, &shmDs);
+        if (id != -1)
+            shmctl(id, IPC_RMID, NULL);
+    }
+
+    maxInd = msgctl(0, MSG_INFO, (struct msqid_ds *) &msgInfo);
+    for (ind = 0; ind <= maxInd; ind++) {
+        id = msgctl(ind, MSG_STAT, &msgDs);
+        if (id != -1)
+            msgctl(id, IPC_RMID, NULL);
+    }
+
+    arg.__buf = &semInfo;
+    maxInd = semctl(0, 0, SEM_INFO, arg);
+    arg.buf = &semDs;
+    for (ind = 0; ind <= maxInd; ind++) {
+        id = semctl(ind, 0, SEM_STAT, arg);
+        if (id != -1)
+            semctl(id, 0, IPC_RMID);
+    }
+}
+
+/* Start a child process that joins the namespaces of a returned set
+   and scrubs them. The child's exit status tells us whether the set can
+   be reused; see finishScrub(). */
+
+static void
+startScrub(struct nsSet *s)
+{
+    static const char *netFiles[] = {
+        "/proc/self/net/tcp", "/proc/self/net/tcp6", "/proc/self/net/udp",
+        "/proc/self/net/udp6", "/proc/self/net/raw", "/proc/self/net/unix",
+        NULL
+    };
+    struct if_nameindex *ifs;
+    pid_t pid;
+    int j;
+
+    pid = fork();
+    if (pid == -1) {
+        errMsg("fork");
+        closeSet(s);
+        stats.discarded++;
+        return;
+    }
+
+    if (pid == 0) {
+
+        /* Check before joining the namespaces, since after joining the
+           user namespace we could no longer inspect other processes */
+
+        if (setInUse(s))
+            _exit(EXIT_FAILURE);
+
+        for (j = 0; j < NSP_NUM_NS; j++)
+            if (setns(s->fd[j], nspNsOrder[j]) == -1)
+                _exit(EXIT_FAILURE);
+
+        if (sethostname(NSP_HOSTNAME, strlen(NSP_HOSTNAME)) == -1 ||
+                setdomainname("(none)", strlen("(none)")) == -1)
+            _exit(EXIT_FAILURE);
+
+        removeSysvIpc();
+
+        ifs = if_nameindex();
+        if (ifs == NULL)
+            _exit(EXIT_FAILURE);
+        for (j = 0; ifs[j].if_index != 0; j++)
+            if (strcmp(ifs[j].if_name, "lo") != 0)
+                _exit(EXIT_FAILURE);
+
+        for (j = 0; netFiles[j] != NULL; j++)
+            if (countEntries(netFiles[j]) > 0)
+                _exit(EXIT_FAILURE);
+
+        if (sbLoopbackUp() == -1)
+            _exit(EXIT_FAILURE);
+        _exit(EXIT_SUCCESS);
+    }
+
+    s->scrubber = pid;
+    s->state = SET_SCRUBBING;
+}
+
+/* Handle the termination, with wait status 'status', of the scrubber
+   process 'pid' */
+
+static void
+finishScrub(pid_t pid, int status)
+{
+    int j;
+
+    for (j = 0; j < poolSize; j++) {
+        if (pool[j].state == SET_SCRUBBING && pool[j].scrubber == pid) {
+            if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+                pool[j].state = SET_FREE;
+                stats.recycled++;
+            } else {
+                if (verbose)
+                    printf("set %d is not clean; discarding\n", j);
+                closeSet(&pool[j]);
+                stats.discarded++;
+            }
+            return;
+        }
+    }
+}
+
+/* Reap any scrubbers that have terminated */
+
+static void
+reapScrubbers(void)
+{
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        finishScrub(pid, status);
+}
+
+/* Return TRUE if set 's' needs maintenance now */
+
+static Boolean
+needsWork(const struct nsSet *s, double now)
+{
+    return s->state == SET_DIRTY ||
+           (s->state == SET_EMPTY && s->retryTime <= now);
+}
+
+/* Perform one unit of pool maintenance: start scrubbing a returned set,
+   or create the namespaces for an empty set that is not backing off
+   after a failed creation. Return FALSE if there was nothing to do. */
+
+static Boolean
+maintain(void)
+{
+    double now;
+    int j;
+
+    for (j = 0; j < poolSize; j++) {
+        if (pool[j].state == SET_DIRTY) {
+            startScrub(&pool[j]);
+            return TRUE;
+        }
+    }
+
+    now = nowSecs();
+    for (j = 0; j < poolSize; j++) {
+        if (needsWork(&pool[j], now)) {
+            createSet(&pool[j]);
+            return pool[j].state != SET_EMPTY;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Return the index of a free set, or -1 if there is none */
+
+static int
+findFree(void)
+{
+    int j;
+
+    for (j = 0; j < poolSize; j++)
+        if (pool[j].state == SET_FREE)
+            return j;
+    return -1;
+}
+
+/* Handle an NSP_GET request on connection 'c'. Only a set that is
+   already free is handed out; creating or scrubbing one here would stall
+   all other clients, so if none is free, the client is told to retry. */
+
+static void
+handOut(int c)
+{
+    struct nspReply rep;
+    int j, slot;
+
+    memset(&rep, 0, sizeof(rep));
+    rep.slot = -1;
+
+    if (connSlot[c] != -1) {
+        rep.status = EALREADY;
+    } else {
+        slot = findFree();
+        if (slot == -1) {
+            rep.status = EAGAIN;
+            stats.busy++;
+        } else {
+            rep.slot = slot;
+            rep.numFds = NSP_NUM_NS;
+        }
+    }
+
+    if (send(pfd[c].fd, &rep, sizeof(rep), MSG_NOSIGNAL) != sizeof(rep))
+        return;                 /* Client has gone; we'll see EOF */
+    if (rep.status != 0)
+        return;
+
+    /* If some descriptors were delivered before an error, the client may
+       hold part of the set; scrub it (which discards it if it is still
+       in use) rather than handing it out again */
+
+    for (j = 0; j < NSP_NUM_NS; j++) {
+        if (sendfd(pfd[c].fd, pool[rep.slot].fd[j]) == -1) {
+            if (j > 0)
+                pool[rep.slot].state = SET_DIRTY;
+            return;
+        }
+    }
+
+    pool[rep.slot].state = SET_BUSY;
+    pool[rep.slot].uses++;
+    connSlot[c] = rep.slot;
+    stats.handedOut++;
+}
+
+/* Release any set held by connection 'c' */
+
+static void
+release(int c)
+{
+    if (connSlot[c] != -1) {
+        pool[connSlot[c]].state = SET_DIRTY;
+        connSlot[c] = -1;
+    }
+}
+
+static void
+closeConn(int c)
+{
+    release(c);
+    close(pfd[c].fd);
+    nfds--;
+    pfd[c] = pfd[nfds];
+    connSlot[c] = connSlot[nfds];
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct nspRequest req;
+    struct sigaction sa;
+    sigset_t blockSet, origMask;
+    struct ucred cred;
+    socklen_t len;
+    char *name;
+    int opt, lfd, cfd, c, ready;
+    ssize_t numRead;
+    Boolean pending;
+    double now, maintDue, wake;
+    struct timespec timeout;
+
+    poolSize = 8;
+    name = NS_POOL_NAME;
+    verbose = FALSE;
+
+    while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+        switch (opt) {
+        case 'n': poolSize = getInt(optarg, GN_GT_0, "size");   break;
+        case 's': name = optarg;                                break;
+        case 'v': verbose = TRUE;                               break;
+        default:  usageErr("%s [-n size] [-s name] [-v]\n", argv[0]);
+        }
+    }
+    if (poolSize > MAX_POOL)
+        fatal("pool size must be no more than %d", MAX_POOL);
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = handler;
+    if (sigaction(SIGCHLD, &sa, NULL) == -1 ||
+            sigaction(SIGUSR1, &sa, NULL) == -1 ||
+            sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    /* The signals are unblocked only while we wait in ppoll(), so that a
+       signal can't slip in between checking the flags and blocking */
+
+    sigemptyset(&blockSet);
+    sigaddset(&blockSet, SIGCHLD);
+    sigaddset(&blockSet, SIGUSR1);
+    sigaddset(&blockSet, SIGINT);
+    sigaddset(&blockSet, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &blockSet, &origMask) == -1)
+        errExit("sigprocmask");
+
+    lfd = unixBindAbstract(name, SOCK_SEQPACKET);
+    if (lfd == -1)
+        errExit("unixBindAbstract");
+    if (listen(lfd, 64) == -1)
+        errExit("listen");
+
+    pfd[0].fd = lfd;
+    pfd[0].events = POLLIN;
+    nfds = 1;
+
+    if (verbose)
+        printf("Listening on @%s; pool size %d\n", name, poolSize);
+
+    maintDue = 0;
+
+    while (!gotTerm) {
+        if (gotChld) {
+            gotChld = 0;
+            reapScrubbers();
+        }
+        if (gotUsr1) {
+            gotUsr1 = 0;
+            printStats();
+        }
+
+        /* If there is maintenance work, poll without blocking, and do
+           the work if no client needs attention, or if none has been done
+           for MAINT_INTERVAL seconds. Scrubbing is done by child
+           processes, so it does not delay client requests. Otherwise,
+           sleep until the earliest retry of a failed creation, if any. */
+
+        now = nowSecs();
+        pending = FALSE;
+        wake = -1;
+        for (c = 0; c < poolSize; c++) {
+            if (needsWork(&pool[c], now))
+                pending = TRUE;
+            else if (pool[c].state == SET_EMPTY &&
+                     (wake < 0 || pool[c].retryTime < wake))
+                wake = pool[c].retryTime;
+        }
+        if (pending)
+            wake = now;
+
+        if (wake >= 0) {
+            timeout.tv_sec = (time_t) (wake - now);
+            timeout.tv_nsec = (long) ((wake - now - timeout.tv_sec) * 1e9);
+        }
+        ready = ppoll(pfd, nfds, (wake >= 0) ? &timeout : NULL, &origMask);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("ppoll");
+        }
+
+        if (pending && (ready == 0 || nowSecs() >= maintDue)) {
+            maintain();
+            maintDue = nowSecs() + MAINT_INTERVAL;
+        }
+        if (ready == 0)
+            continue;
+
+        for (c = nfds - 1; c >= 1; c--) {
+            if (pfd[c].revents == 0)
+                continue;
+
+            numRead = recv(pfd[c].fd, &req, sizeof(req), 0);
+            if (numRead != sizeof(req)) {       /* EOF, error, or junk */
+                closeConn(c);
+                continue;
+            }
+
+            if (req.op == NSP_GET)
+                handOut(c);
+            else if (req.op == NSP_RELEASE)
+                release(c);
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if (cfd == -1) {
+                errMsg("accept4");
+                continue;
+            }
+
+            len = sizeof(cred);
+            if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ||
+                    (cred.uid != getuid() && cred.uid != 0) ||
+                    nfds > MAX_CONN) {
+                close(cfd);
+                stats.refused++;
+                continue;
+            }
+
+            pfd[nfds].fd = cfd;
+            pfd[nfds].events = POLLIN;
+            connSlot[nfds] = -1;
+            nfds++;
+        }
+    }
+
+    printStats();
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,530 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* sandbox_functions.c
+
+   Functions for quickly setting up the namespaces and root filesystem of
+   a sandbox: creating a child with clone3() (falling back to clone()),
+   joining the namespaces of an existing process with setns(), writing
+   UID and GID maps, bringing up the loopback interface, creating
+   namespaces that are held open by file descriptors, and building a root
+   filesystem from a bind mount or an overlay.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/mount.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <signal.h>
+#include <limits.h>
+#include <fcntl.h>
+#include "sandbox_functions.h"  /* Declares functions defined here */
+
+#ifndef CLONE_PIDFD             /* Added in Linux 5.2 */
+#define CLONE_PIDFD 0x00001000
+#endif
+
+#define STACK_SIZE (1024 * 1024)
+
+/* The first (version 0) part of the clone3() argument structure. We
+   define it ourselves, since <linux/sched.h> may conflict with <sched.h>,
+   or be too old to define it. */
+
+struct cloneArgs {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t childTid;
+    uint64_t parentTid;
+    uint64_t exitSignal;
+    uint64_t stack;
+    uint64_t stackSize;
+    uint64_t tls;
+};
+
+static const struct {
+    int flag;
+    const char *name;
+} nsTab[] = {               /* The user namespace must be joined first */
+    { CLONE_NEWUSER, "user" },
+    { CLONE_NEWNS,   "mnt"  },
+    { CLONE_NEWPID,  "pid"  },
+    { CLONE_NEWNET,  "net"  },
+    { CLONE_NEWIPC,  "ipc"  },
+    { CLONE_NEWUTS,  "uts"  },
+};
+
+#define NUM_NS (sizeof(nsTab) / sizeof(nsTab[0]))
+
+static Boolean useClone3 = TRUE;
+
+/* Return TRUE if sbClone() creates children using clone3() */
+
+Boolean
+sbUsedClone3(void)
+{
+    return useClone3;
+}
+
+/* Make sbClone() use clone(), e.g., to compare the two */
+
+void
+sbDisableClone3(void)
+{
+    useClone3 = FALSE;
+}
+
+/* Create a child in the new namespaces specified by 'nsFlags'. The child
+   calls func(arg) and then exits with its return value. If 'pidfd' is
+   not NULL, a PID file descriptor for the child is returned there (or -1
+   if the kernel does not support them).
+
+   We first try clone3(), without a separate stack: the child then
+   continues on a copy of the caller's stack, as with fork(). This avoids
+   the need to allocate a stack for each child. (Since the child does not
+   go through glibc's fork() wrapper, fork handlers are not called, so the
+   child should do little more than set up its environment and exec.)
+   If clone3() is unavailable (before Linux 5.3), we fall back to clone(),
+   with a single stack that is allocated once and reused for every child;
+   that is safe because, without CLONE_VM, each child gets its own copy.
+
+   Returns the child's PID, or -1 on error. */
+
+pid_t
+sbClone(int nsFlags, int *pidfd, int (*func)(void *), void *arg)
+{
+    static char *stack = NULL;
+    struct cloneArgs ca;
+    pid_t pid;
+
+    fflush(NULL);               /* Don't duplicate buffered output */
+
+    if (pidfd != NULL)
+        *pidfd = -1;
+
+    if (useClone3) {
+        memset(&ca, 0, sizeof(ca));
+        ca.flags = nsFlags | ((pidfd != NULL) ? CLONE_PIDFD : 0);
+        ca.pidfd = (uintptr_t) pidfd;
+        ca.exitSignal = SIGCHLD;
+
+        pid = syscall(SYS_clone3, &ca, sizeof(ca));
+        if (pid == 0)
+            _exit(func(arg));
+        if (pid != -1 || errno != ENOSYS)
+            return pid;
+
+        useClone3 = FALSE;
+    }
+
+    if (stack == NULL) {
+        stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) {
+            stack = NULL;
+            return -1;
+        }
+    }
+
+    /* With CLONE_PIDFD, clone() returns the PID file descriptor via its
+       'parent_tid' argument */
+
+    pid = clone(func, stack + STACK_SIZE,
+                nsFlags | SIGCHLD | ((pidfd != NULL) ? CLONE_PIDFD : 0),
+                arg, pidfd);
+    if (pid == -1 && errno == EINVAL && pidfd != NULL)
+        pid = clone(func, stack + STACK_SIZE, nsFlags | SIGCHLD, arg);
+    return pid;
+}
+
+/* Return the name of the /proc/PID/ns file for the namespace type
+   'nsFlag', or NULL if it is not one of the types we handle */
+
+const char *
+sbNsName(int nsFlag)
+{
+    int j;
+
+    for (j = 0; j < NUM_NS; j++)
+        if (nsTab[j].flag == nsFlag)
+            return nsTab[j].name;
+    return NULL;
+}
+
+/* Return the subset of the namespace types in 'nsFlags' for which
+   process 'pid' is in a different namespace from the caller, or -1 on
+   error. Joining a namespace that we are already in fails (e.g., for a
+   user namespace), so callers should join just these. */
+
+int
+sbNsDiffer(pid_t pid, int nsFlags)
+{
+    char path[64];
+    struct stat self, other;
+    int j, differ;
+
+    differ = 0;
+    for (j = 0; j < NUM_NS; j++) {
+        if (!(nsFlags & nsTab[j].flag))
+            continue;
+
+        snprintf(path, sizeof(path), "/proc/self/ns/%s", nsTab[j].name);
+        if (stat(path, &self) == -1)
+            return -1;
+        snprintf(path, sizeof(path), "/proc/%ld/ns/%s", (long) pid,
+                nsTab[j].name);
+        if (stat(path, &other) == -1)
+            return -1;
+
+        if (self.st_dev != other.st_dev || self.st_ino != other.st_ino)
+            differ |= nsTab[j].flag;
+    }
+
+    return differ;
+}
+
+/* Move the caller into the namespaces of process 'pid' specified by
+   'nsFlags'. The caller must be single-threaded. Since Linux 5.8,
+   setns() accepts a PID file descriptor and a set of namespace types,
+   and joins them all in one step; otherwise, we open each /proc/PID/ns
+   file and join the namespaces one at a time. Returns 0 on success, or
+   -1 on error. */
+
+int
+sbJoin(pid_t pid, int nsFlags)
+{
+    int pidfd, fd[NUM_NS], j, savedErrno, status;
+    char path[64];
+
+#ifdef SYS_pidfd_open
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd != -1) {
+        status = setns(pidfd, nsFlags);
+        savedErrno = errno;
+        close(pidfd);
+        if (status == 0 || savedErrno != EINVAL)
+            return status;
+    }
+#endif
+
+    /* Open all of the files before joining any namespace, since joining
+       a user namespace may change our access to /proc/PID */
+
+    for (j = 0; j < NUM_NS; j++)
+        fd[j] = -1;
+    for (j = 0; j < NUM_NS; j++) {
+        if (!(nsFlags & nsTab[j].flag))
+            continue;
+        snprintf(path, sizeof(path), "/proc/%ld/ns/%s", (long) pid,
+                nsTab[j].name);
+        fd[j] = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd[j] == -1)
+            break;
+    }
+
+    status = (j == NUM_NS) ? 0 : -1;
+    for (j = 0; j < NUM_NS && status == 0; j++)
+        if (fd[j] != -1 && setns(fd[j], nsTab[j].flag) == -1)
+            status = -1;
+
+    savedErrno = errno;
+    for (j = 0; j < NUM_NS; j++)
+        if (fd[j] != -1)
+            close(fd[j]);
+    errno = savedErrno;
+
+    return status;
+}
+
+/* Write 'str' to /proc/PID/'file'. Returns 0 on success, or -1 on error. */
+
+static int
+writeProcFile(pid_t pid, const char *file, const char *str)
+{
+    char path[64];
+    int fd, status;
+
+    snprintf(path, sizeof(path), "/proc/%ld/%s", (long) pid, file);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    status = (write(fd, str, strlen(str)) == strlen(str)) ? 0 : -1;
+    close(fd);
+    return status;
+}
+
+/* Map UID 0 and GID 0 in the user namespace of process 'pid' to 'uid'
+   and 'gid' in the caller's namespace. As in userns_child_exec.c, we
+   must first deny setgroups() in the namespace, unless we are privileged.
+   Returns 0 on success, or -1 on error. */
+
+int
+sbWriteIdMaps(pid_t pid, uid_t uid, gid_t gid)
+{
+    char map[64];
+
+    if (writeProcFile(pid, "setgroups", "deny") == -1 && errno != ENOENT)
+        return -1;
+
+    snprintf(map, sizeof(map), "0 %ld 1", (long) uid);
+    if (writeProcFile(pid, "uid_map", map) == -1)
+        return -1;
+
+    snprintf(map, sizeof(map), "0 %ld 1", (long) gid);
+    return writeProcFile(pid, "gid_map", map);
+}
+
+/* Bring up the loopback interface, which is down in a new network
+   namespace. Returns 0 on success, or -1 on error. */
+
+int
+sbLoopbackUp(void)
+{
+    struct ifreq ifr;
+    int sfd, status;
+
+    sfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sfd == -1)
+        return -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, "lo", IFNAMSIZ - 1);
+    status = ioctl(sfd, SIOCGIFFLAGS, &ifr);
+    if (status == 0 && !(ifr.ifr_flags & IFF_UP)) {
+        ifr.ifr_flags |= IFF_UP;
+        status = ioctl(sfd, SIOCSIFFLAGS, &ifr);
+    }
+
+    close(sfd);
+    return status;
+}
+
+struct holdArgs {
+    int nsFlags;
+    const char *hostname;
+    int sockFd[2];              /* [0] is parent's end, [1] is child's */
+};
+
+/* Start function for the child created by sbCreateHeld() */
+
+static int
+holdFunc(void *arg)
+{
+    struct holdArgs *ha = arg;
+    char ch;
+
+    close(ha->sockFd[0]);       /* So that we see EOF when parent closes */
+    if (read(ha->sockFd[1], &ch, 1) != 1)       /* Wait for ID maps */
+        return 1;
+    if ((ha->nsFlags & CLONE_NEWNET) && sbLoopbackUp() == -1)
+        return 1;
+    if ((ha->nsFlags & CLONE_NEWUTS) && ha->hostname != NULL &&
+            sethostname(ha->hostname, strlen(ha->hostname)) == -1)
+        return 1;
+
+    /* Tell the parent we are ready, and stay alive until it has opened
+       our /proc/PID/ns files (it then closes its end of the socket) */
+
+    if (write(ha->sockFd[1], "r", 1) != 1)
+        return 1;
+    read(ha->sockFd[1], &ch, 1);
+    return 0;
+}
+
+/* Create the 'numNs' namespaces whose types are given in 'nsTypes', and
+   return file descriptors referring to them in the corresponding elements
+   of 'fds'. The namespaces are created by a short-lived child; they
+   continue to exist, although no process is a member of them, for as long
+   as the file descriptors remain open. If a user namespace is created,
+   the caller's UID and GID are mapped to 0 in it. A new network namespace
+   has its loopback interface brought up, and a new UTS namespace has its
+   host name set to 'hostname' (if not NULL). Returns 0 on success, or -1
+   on error. */
+
+int
+sbCreateHeld(int numNs, const int nsTypes[], int fds[], const char *hostname)
+{
+    struct holdArgs ha;
+    int sv[2], j, nsFlags, status, savedErrno;
+    char path[64], ch;
+    pid_t pid;
+
+    nsFlags = 0;
+    for (j = 0; j < numNs; j++) {
+        nsFlags |= nsTypes[j];
+        fds[j] = -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+
+    ha.nsFlags = nsFlags;
+    ha.hostname = hostname;
+    ha.sockFd[0] = sv[0];
+    ha.sockFd[1] = sv[1];
+
+    pid = sbClone(nsFlags, NULL, holdFunc, &ha);
+    if (pid == -1) {
+        savedErrno = errno;
+        close(sv[0]);
+        close(sv[1]);
+        errno = savedErrno;
+        return -1;
+    }
+
+    status = 0;
+    if ((nsFlags & CLONE_NEWUSER) &&
+            sbWriteIdMaps(pid, getuid(), getgid()) == -1)
+        status = -1;
+    if (status == 0 && (write(sv[0], "m", 1) != 1 || read(sv[0], &ch, 1) != 1))
+        status = -1;            /* Child failed */
+
+    for (j = 0; j < numNs && status == 0; j++) {
+        snprintf(path, sizeof(path), "/proc/%ld/ns/%s", (long) pid,
+                sbNsName(nsTypes[j]));
+        fds[j] = open(path, O_RDONLY | O_CLOEXEC);
+        if (fds[j] == -1)
+            status = -1;
+    }
+
+    savedErrno = errno;
+    close(sv[0]);               /* Child sees EOF and exits */
+    close(sv[1]);
+    waitpid(pid, NULL, 0);
+    if (status == -1)
+        for (j = 0; j < numNs; j++)
+            if (fds[j] != -1)
+                close(fds[j]);
+    errno = savedErrno;
+
+    return status;
+}
+
+/* Make 'rootDir' the root directory of the caller, which must be in a new
+   mount namespace. If 'overlay' is FALSE, 'rootDir' is bind mounted (read
+   only, if 'readOnly' is TRUE). If 'overlay' is TRUE, a tmpfs is mounted
+   at 'stagingDir' and an overlay with 'rootDir' as its lower layer is
+   created within it, so that the sandbox can modify its root
+   filesystem without affecting 'rootDir'; all changes are discarded with
+   the mount namespace. If 'mountProc' is TRUE, a procfs for the caller's
+   PID namespace is mounted on /proc in the new root. The old root is then
+   detached using pivot_root(). Returns 0 on success, or -1 on error. */
+
+int
+sbBuildRoot(const char *rootDir, const char *stagingDir, Boolean overlay,
+            Boolean readOnly, Boolean mountProc)
+{
+    char newRoot[PATH_MAX], path[PATH_MAX + 16], opts[3 * PATH_MAX];
+    int lowerFd, status, savedErrno;
+
+    /* Stop our mounts from propagating back into the parent namespace */
+
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+        return -1;
+
+    if (overlay) {
+
+        /* 'rootDir' may lie under 'stagingDir', so get a reference to it
+           before the tmpfs hides it, and name it via /proc/self/fd */
+
+        lowerFd = open(rootDir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (lowerFd == -1)
+            return -1;
+
+        /* Every failure from here on must also close 'lowerFd' */
+
+        snprintf(newRoot, sizeof(newRoot), "%s/root", stagingDir);
+        snprintf(path, sizeof(path), "%s/upper", stagingDir);
+        status = mount("tmpfs", stagingDir, "tmpfs", 0, "mode=0755");
+        if (status == 0)
+            status = mkdir(newRoot, 0755);
+        if (status == 0)
+            status = mkdir(path, 0755);
+        if (status == 0) {
+            snprintf(path, sizeof(path), "%s/work", stagingDir);
+            status = mkdir(path, 0755);
+        }
+
+        if (status == 0) {
+            snprintf(opts, sizeof(opts), "lowerdir=/proc/self/fd/%d,"
+                    "upperdir=%s/upper,workdir=%s/work",
+                    lowerFd, stagingDir, stagingDir);
+            status = mount("overlay", newRoot, "overlay",
+                           readOnly ? MS_RDONLY : 0, opts);
+        }
+
+        savedErrno = errno;
+        close(lowerFd);
+        errno = savedErrno;
+        if (status == -1)
+            return -1;
+
+    } else {
+        snprintf(newRoot, sizeof(newRoot), "%s", rootDir);
+        if (mount(rootDir, rootDir, NULL, MS_BIND | MS_REC, NULL) == -1)
+            return -1;
+        if (readOnly && mount(NULL, rootDir, NULL,
+                              MS_REMOUNT | MS_BIND | MS_RDONLY, NULL) == -1)
+            return -1;
+    }
+
+    /* Mount /proc before detaching the old root: in a user namespace,
+       the kernel permits a procfs to be mounted only if an existing one
+       is fully visible in the mount namespace */
+
+    if (mountProc) {
+        snprintf(path, sizeof(path), "%s/proc", newRoot);
+        if (mount("proc", path, "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC,
+                  NULL) == -1)
+            return -1;
+    }
+
+    /* pivot_root(".", ".") stacks the old root on top of the new one, so
+       that it can be detached without needing a directory to put it in */
+
+    if (chdir(newRoot) == -1)
+        return -1;
+    if (syscall(SYS_pivot_root, ".", ".") == 0) {
+        if (umount2(".", MNT_DETACH) == -1)
+            return -1;
+        return chdir("/");
+    }
+
+    /* pivot_root() fails with EINVAL if the current root is the initial
+       ramfs (e.g., the system booted using switch_root(8)). Instead, move
+       the new root over the old one and chroot() into it. The old root
+       then remains reachable by a privileged process, so pivot_root() is
+       preferred. */
+
+    if (errno != EINVAL)
+        return -1;
+    if (mount(".", "/", NULL, MS_MOVE, NULL) == -1)
+        return -1;
+    if (chroot(".") == -1)
+        return -1;
+    return chdir("/");
+}
+
+/* Mount a procfs for the caller's PID namespace at /proc. Returns 0 on
+   success, or -1 on error. */
+
+int
+sbMountProc(void)
+{
+    return mount("proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC,
+                 NULL);
+}
@@ -0,0 +1,60 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* sandbox_functions.h
+
+   Header file for sandbox_functions.c.
+*/
+#ifndef SANDBOX_FUNCTIONS_H     /* Prevent double inclusion */
+#define SANDBOX_FUNCTIONS_H
+
+#include <sys/types.h>
+#include <sched.h>
+#include "tlpi_hdr.h"
+
+/* The namespace types handled by these functions; callers specify them
+   using the CLONE_NEW* flags from <sched.h> (which requires _GNU_SOURCE) */
+
+#define SB_NS_ALL (CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWPID | \
+                   CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS)
+
+/* Namespace types that can usefully be shared by successive sandboxes
+   (the mount and PID namespaces hold per-sandbox state) */
+
+#define SB_NS_SHAREABLE (CLONE_NEWUSER | CLONE_NEWNET | CLONE_NEWIPC | \
+                         CLONE_NEWUTS)
+
+pid_t sbClone(int nsFlags, int *pidfd, int (*func)(void *), void *arg);
+
+Boolean sbUsedClone3(void);
+
+void sbDisableClone3(void);
+
+const char *sbNsName(int nsFlag);
+
+int sbNsDiffer(pid_t pid, int nsFlags);
+
+int sbJoin(pid_t pid, int nsFlags);
+
+int sbWriteIdMaps(pid_t pid, uid_t uid, gid_t gid);
+
+int sbLoopbackUp(void);
+
+int sbCreateHeld(int numNs, const int nsTypes[], int fds[],
+                 const char *hostname);
+
+int sbBuildRoot(const char *rootDir, const char *stagingDir, Boolean overlay,
+                Boolean readOnly, Boolean mountProc);
+
+int sbMountProc(void);
+
+#endif
@@ -0,0 +1,342 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* sandbox_launch.c
+
+   Run a command in a sandbox built from new (or template) namespaces and
+   an optional root filesystem, and measure how long each stage of
+   sandbox startup takes.
+
+   Usage: sandbox_launch [options] cmd [arg...]
+
+   Like ns_child_exec.c and userns_child_exec.c, this program creates a
+   child in new namespaces and executes a command. However, it is meant
+   for launching many short-lived sandboxes, so startup is made cheap:
+
+   * The child is created with clone3(), which, unlike clone(), doesn't
+     need a separately allocated stack (see sandbox_functions.c).
+
+   * Namespaces that are expensive to create (in particular, network
+     namespaces) and that hold no per-sandbox state can be taken from a
+     template process ("-t pid"), which the child joins with setns().
+     Fresh mount and PID namespaces are still created for each sandbox.
+
+   * The root filesystem is built from a bind mount ("-r dir") or, with
+     "-o", from an overlay whose writable layer is a tmpfs, so that each
+     sandbox starts from the same pristine tree.
+
+   With "-c count", the command is run 'count' times, and the mean,
+   minimum, and maximum time of each stage are reported:
+
+        clone       from the parent calling clone3() until the child runs
+        ids         writing UID/GID maps (new user namespace), or joining
+                    the template's namespaces
+        net         bringing up the loopback interface
+        rootfs      building the root filesystem and mounting /proc
+        exec+run    from execve() until the parent has reaped the child
+
+   For example, to compare fresh namespaces with a template:
+
+        $ ./sandbox_launch -Unipu sleep 1000 &  # Note PID of 'sleep'
+        $ ./sandbox_launch -c 500 -Umnpiu true
+        $ ./sandbox_launch -c 500 -mp -t <sleep-pid> true
+*/
+#define _GNU_SOURCE
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include "sandbox_functions.h"
+
+/* Timestamps taken during the startup of a sandbox */
+
+enum { T_CLONE, T_START, T_IDS, T_NET, T_ROOTFS, T_EXIT, NUM_T };
+
+static const char *stageName[NUM_T] = {
+    NULL, "clone", "ids", "net", "rootfs", "exec+run"
+};
+
+struct config {
+    int nsFlags;                /* Namespaces to create */
+    pid_t templatePid;          /* Or 0 */
+    int joinFlags;              /* Namespaces to take from template */
+    char *rootDir;              /* Or NULL */
+    char *stagingDir;
+    Boolean overlay;
+    Boolean readOnly;
+    Boolean verbose;
+    int count;                  /* Number of launches */
+    char **argv;                /* Command to execute */
+    int syncFd[2];              /* Parent closes write end once ID maps
+                                   have been written */
+    int timeFd[2];              /* Child sends its timestamps to parent */
+    struct timespec t[NUM_T];
+};
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [options] cmd [arg...]\n", progName);
+#define fpe(str) fprintf(stderr, "    %s", str);
+    fpe("-U          New user namespace (caller's UID/GID map to root)\n");
+    fpe("-m          New mount namespace\n");
+    fpe("-p          New PID namespace\n");
+    fpe("-n          New network namespace\n");
+    fpe("-i          New IPC namespace\n");
+    fpe("-u          New UTS namespace\n");
+    fpe("-a          All of the above\n");
+    fpe("-t pid      Join the user, network, IPC, and UTS namespaces of\n");
+    fpe("            'pid' instead of creating them\n");
+    fpe("-r dir      Use 'dir' as the root directory (requires -m)\n");
+    fpe("-o          Make the root an overlay on 'dir', with changes\n");
+    fpe("            held in a tmpfs\n");
+    fpe("-s dir      Staging directory for overlay (default: /tmp)\n");
+    fpe("-R          Read-only root\n");
+    fpe("-c count    Launch 'count' times and report stage timings\n");
+    fpe("-L          Use clone() rather than clone3()\n");
+    fpe("-v          Verbose\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Start function for the child. Build the sandbox, recording the time at
+   which each stage is completed, and then exec the command. */
+
+static int
+childFunc(void *arg)
+{
+    struct config *cf = arg;
+    Boolean newProc;
+    pid_t pid;
+    char ch;
+    int status;
+
+    clock_gettime(CLOCK_MONOTONIC, &cf->t[T_START]);
+
+    if (cf->nsFlags & CLONE_NEWUSER) {
+
+        /* Wait until the parent has written our UID and GID maps, so that
+           we have capabilities in the new user namespace */
+
+        close(cf->syncFd[1]);
+        if (read(cf->syncFd[0], &ch, 1) != 0)
+            fatal("child: failed to synchronize with parent");
+        close(cf->syncFd[0]);
+    }
+
+    if (cf->joinFlags != 0) {
+        if (sbJoin(cf->templatePid, cf->joinFlags) == -1)
+            errExit("sbJoin");
+
+        /* Create the mount and PID namespaces now, so that they are owned
+           by the template's user namespace. We must fork in order for the
+           new PID namespace to be used; we then just relay the status of
+           our child (which continues the setup below). */
+
+        if (unshare(cf->nsFlags & (CLONE_NEWNS | CLONE_NEWPID)) == -1)
+            errExit("unshare");
+
+        if (cf->nsFlags & CLONE_NEWPID) {
+            pid = fork();
+            if (pid == -1)
+                errExit("fork");
+            if (pid != 0) {
+                close(cf->timeFd[1]);
+                if (waitpid(pid, &status, 0) == -1)
+                    errExit("waitpid");
+                _exit(WIFEXITED(status) ? WEXITSTATUS(status) :
+                        128 + WTERMSIG(status));
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &cf->t[T_IDS]);
+
+    if ((cf->nsFlags & CLONE_NEWNET) && sbLoopbackUp() == -1)
+        errExit("sbLoopbackUp");
+    clock_gettime(CLOCK_MONOTONIC, &cf->t[T_NET]);
+
+    /* Build the root filesystem, and mount a procfs that reflects the
+       new PID namespace */
+
+    newProc = (cf->nsFlags & (CLONE_NEWNS | CLONE_NEWPID)) ==
+                (CLONE_NEWNS | CLONE_NEWPID);
+    if (cf->rootDir != NULL) {
+        if (sbBuildRoot(cf->rootDir, cf->stagingDir, cf->overlay,
+                        cf->readOnly, newProc) == -1)
+            errExit("sbBuildRoot");
+    } else if (cf->nsFlags & CLONE_NEWNS) {
+        if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+            errExit("mount-make-private");
+        if (newProc && sbMountProc() == -1)
+            errExit("sbMountProc");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &cf->t[T_ROOTFS]);
+
+    /* 'timeFd' is close-on-exec, so it is closed if execvp() succeeds */
+
+    if (write(cf->timeFd[1], cf->t, sizeof(cf->t)) != sizeof(cf->t))
+        errExit("write");
+
+    execvp(cf->argv[0], cf->argv);
+    errExit("execvp");
+}
+
+/* Launch one sandbox and wait for it to terminate. Fill in the
+   timestamps in 'cf', and return the command's wait status. */
+
+static int
+launch(struct config *cf)
+{
+    struct timespec tClone;
+    int cloneFlags, status;
+    pid_t pid;
+
+    if (pipe2(cf->timeFd, O_CLOEXEC) == -1)
+        errExit("pipe2");
+    if ((cf->nsFlags & CLONE_NEWUSER) && pipe2(cf->syncFd, O_CLOEXEC) == -1)
+        errExit("pipe2");
+
+    /* When using a template, the child creates its namespaces itself,
+       after joining the template's user namespace */
+
+    cloneFlags = (cf->joinFlags != 0) ? 0 : cf->nsFlags;
+
+    clock_gettime(CLOCK_MONOTONIC, &tClone);
+    pid = sbClone(cloneFlags, NULL, childFunc, cf);
+    if (pid == -1)
+        errExit("sbClone");
+
+    if (cf->verbose && cf->count == 1)
+        printf("Sandbox PID: %ld\n", (long) pid);
+
+    if (cf->nsFlags & CLONE_NEWUSER) {
+        close(cf->syncFd[0]);
+        if (sbWriteIdMaps(pid, getuid(), getgid()) == -1)
+            errExit("sbWriteIdMaps");
+        close(cf->syncFd[1]);
+    }
+
+    close(cf->timeFd[1]);
+    if (waitpid(pid, &status, 0) == -1)
+        errExit("waitpid");
+
+    memset(cf->t, 0, sizeof(cf->t));
+    if (read(cf->timeFd[0], cf->t, sizeof(cf->t)) != sizeof(cf->t))
+        fatal("sandbox setup failed");
+    close(cf->timeFd[0]);
+
+    cf->t[T_CLONE] = tClone;
+    clock_gettime(CLOCK_MONOTONIC, &cf->t[T_EXIT]);
+
+    return status;
+}
+
+static double
+usecsBetween(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct config cf;
+    double sum[NUM_T], min[NUM_T], max[NUM_T], us;
+    int opt, j, k, status;
+
+    memset(&cf, 0, sizeof(cf));
+    cf.stagingDir = "/tmp";
+    cf.count = 1;
+
+    while ((opt = getopt(argc, argv, "+Umpniuat:r:os:Rc:Lv")) != -1) {
+        switch (opt) {
+        case 'U': cf.nsFlags |= CLONE_NEWUSER;                  break;
+        case 'm': cf.nsFlags |= CLONE_NEWNS;                    break;
+        case 'p': cf.nsFlags |= CLONE_NEWPID;                   break;
+        case 'n': cf.nsFlags |= CLONE_NEWNET;                   break;
+        case 'i': cf.nsFlags |= CLONE_NEWIPC;                   break;
+        case 'u': cf.nsFlags |= CLONE_NEWUTS;                   break;
+        case 'a': cf.nsFlags |= SB_NS_ALL;                      break;
+        case 't': cf.templatePid = getLong(optarg, GN_GT_0, "pid"); break;
+        case 'r': cf.rootDir = optarg;                          break;
+        case 'o': cf.overlay = TRUE;                            break;
+        case 's': cf.stagingDir = optarg;                       break;
+        case 'R': cf.readOnly = TRUE;                           break;
+        case 'c': cf.count = getInt(optarg, GN_GT_0, "count");  break;
+        case 'L': sbDisableClone3();                            break;
+        case 'v': cf.verbose = TRUE;                            break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc || (cf.rootDir != NULL && !(cf.nsFlags & CLONE_NEWNS))
+            || (cf.overlay && cf.rootDir == NULL))
+        usageError(argv[0]);
+    cf.argv = &argv[optind];
+
+    /* With a template, take the shareable namespaces from the template
+       (skipping any that we already share with it), and create only the
+       mount and PID namespaces */
+
+    if (cf.templatePid != 0) {
+        cf.joinFlags = sbNsDiffer(cf.templatePid, SB_NS_SHAREABLE);
+        if (cf.joinFlags == -1)
+            errExit("sbNsDiffer");
+        cf.nsFlags &= CLONE_NEWNS | CLONE_NEWPID;
+        if (cf.verbose)
+            for (j = 0; j < 31; j++)
+                if (cf.joinFlags & (1 << j))
+                    printf("Joining template's %s namespace\n",
+                            sbNsName(1 << j));
+    }
+
+    for (k = 0; k < NUM_T; k++) {
+        sum[k] = max[k] = 0;
+        min[k] = 1e30;
+    }
+
+    status = 0;
+    for (j = 0; j < cf.count; j++) {
+        status = launch(&cf);
+
+        for (k = T_START; k < NUM_T; k++) {
+            us = usecsBetween(&cf.t[k - 1], &cf.t[k]);
+            sum[k] += us;
+            if (us < min[k])
+                min[k] = us;
+            if (us > max[k])
+                max[k] = us;
+        }
+        us = usecsBetween(&cf.t[T_CLONE], &cf.t[T_EXIT]);
+        sum[T_CLONE] += us;
+        if (us < min[T_CLONE])
+            min[T_CLONE] = us;
+        if (us > max[T_CLONE])
+            max[T_CLONE] = us;
+    }
+
+    if (cf.count > 1 || cf.verbose) {
+        fprintf(stderr, "\n%d launch(es) using %s; times in microseconds\n",
+                cf.count, sbUsedClone3() ? "clone3()" : "clone()");
+        fprintf(stderr, "%-10s %10s %10s %10s\n", "stage", "mean", "min",
+                "max");
+        for (k = T_START; k < NUM_T; k++)
+            fprintf(stderr, "%-10s %10.1f %10.1f %10.1f\n", stageName[k],
+                    sum[k] / cf.count, min[k], max[k]);
+        fprintf(stderr, "%-10s %10.1f %10.1f %10.1f\n", "total",
+                sum[T_CLONE] / cf.count, min[T_CLONE], max[T_CLONE]);
+    }
+
+    /* Exit with the status of the (last) command */
+
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+}
@@ -0,0 +1,239 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 6 */
+
+/* env_bench.c
+
+   Compare the time taken to build a large environment with setenv() and
+   unsetenv() (the implementations in setenv.c, which this program is
+   linked with) and with the functions in env_builder.c.
+
+   Usage: env_bench [-x] num-vars...
+
+   For each 'num-vars', starting from the program's own environment, the
+   program sets 'num-vars' new variables, then changes the values of
+   half of them, and then removes a tenth of them. With setenv(), this is
+   done in a child process (so that each test starts with the original
+   environment); with the builder, it is followed by a call to
+   envbMaterialize(), so that both end with an environment list that
+   could be passed to execve().
+
+   With -x, the program finally execs env(1) with the last environment
+   built, so that the result can be inspected.
+*/
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "env_builder.h"
+#include "tlpi_hdr.h"
+
+extern char **environ;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char **names, **values, **newValues;
+
+/* Create the names and values used for 'n' variables */
+
+static void
+makeStrings(int n)
+{
+    char buf[64];
+    int j;
+
+    names = malloc(n * sizeof(char *));
+    values = malloc(n * sizeof(char *));
+    newValues = malloc(n * sizeof(char *));
+    if (names == NULL || values == NULL || newValues == NULL)
+        errExit("malloc");
+
+    for (j = 0; j < n; j++) {
+        snprintf(buf, sizeof(buf), "BENCH_VAR_%d", j);
+        names[j] = strdup(buf);
+        snprintf(buf, sizeof(buf), "value-%d", j);
+        values[j] = strdup(buf);
+        snprintf(buf, sizeof(buf), "new-value-%d", j);
+        newValues[j] = strdup(buf);
+        if (names[j] == NULL || values[j] == NULL || newValues[j] == NULL)
+            errExit("strdup");
+    }
+}
+
+static void
+freeStrings(int n)
+{
+    int j;
+
+    for (j = 0; j < n; j++) {
+        free(names[j]);
+        free(values[j]);
+        free(newValues[j]);
+    }
+    free(names);
+    free(values);
+    free(newValues);
+}
+
+/* Return the time taken to build the environment with setenv() and
+   unsetenv(), measured in a child process */
+
+static double
+timeSetenv(int n, volatile double *result)
+{
+    double start;
+    int j, status;
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        start = nowSecs();
+        for (j = 0; j < n; j++)
+            if (setenv(names[j], values[j], 1) == -1)
+                _exit(EXIT_FAILURE);
+        for (j = 0; j < n; j += 2)
+            if (setenv(names[j], newValues[j], 1) == -1)
+                _exit(EXIT_FAILURE);
+        for (j = 1; j < n; j += 10)
+            if (unsetenv(names[j]) == -1)
+                _exit(EXIT_FAILURE);
+        *result = nowSecs() - start;
+        _exit(EXIT_SUCCESS);
+
+    default:
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("setenv() child failed");
+        return *result;
+    }
+}
+
+/* Build the environment with the builder. Returns the time taken, and
+   the builder in '*ebp'. */
+
+static double
+timeBuilder(int n, struct envBuilder **ebp)
+{
+    struct envBuilder *eb;
+    double start;
+    int j;
+
+    start = nowSecs();
+    eb = envbCreate(environ);
+    if (eb == NULL)
+        errExit("envbCreate");
+    for (j = 0; j < n; j++)
+        if (envbSet(eb, names[j], values[j], 1) == -1)
+            errExit("envbSet");
+    for (j = 0; j < n; j += 2)
+        if (envbSet(eb, names[j], newValues[j], 1) == -1)
+            errExit("envbSet");
+    for (j = 1; j < n; j += 10)
+        if (envbUnset(eb, names[j]) == -1)
+            errExit("envbUnset");
+    if (envbMaterialize(eb) == NULL)
+        errExit("envbMaterialize");
+
+    *ebp = eb;
+    return nowSecs() - start;
+}
+
+/* Check that the builder's contents are as expected */
+
+static void
+check(struct envBuilder *eb, int n)
+{
+    const char *v;
+    char **ep;
+    int j, count, base;
+
+    for (base = 0, ep = environ; *ep != NULL; ep++)
+        base++;
+    for (count = 0, ep = envbMaterialize(eb); *ep != NULL; ep++)
+        count++;
+    if (count != base + n - (n + 8) / 10)
+        fatal("expected %d variables; found %d", base + n - (n + 8) / 10,
+                count);
+
+    for (j = 0; j < n; j++) {
+        v = envbGet(eb, names[j]);
+        if (j % 10 == 1) {
+            if (v != NULL)
+                fatal("%s should have been removed", names[j]);
+        } else if (v == NULL ||
+                strcmp(v, (j % 2 == 0) ? newValues[j] : values[j]) != 0) {
+            fatal("%s has wrong value", names[j]);
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    volatile double *result;
+    struct envBuilder *eb;
+    double tSetenv, tBuilder;
+    Boolean execEnv;
+    int opt, n, j;
+
+    execEnv = FALSE;
+    while ((opt = getopt(argc, argv, "x")) != -1) {
+        switch (opt) {
+        case 'x': execEnv = TRUE;                               break;
+        default:  usageErr("%s [-x] num-vars...\n", argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-x] num-vars...\n", argv[0]);
+
+    result = mmap(NULL, sizeof(double), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (result == MAP_FAILED)
+        errExit("mmap");
+
+    printf("%8s %12s %12s %8s\n", "vars", "setenv (ms)", "builder (ms)",
+            "speedup");
+
+    eb = NULL;
+    for (j = optind; j < argc; j++) {
+        n = getInt(argv[j], GN_GT_0, "num-vars");
+        makeStrings(n);
+
+        tSetenv = timeSetenv(n, result);
+        if (eb != NULL)
+            envbFree(eb);
+        tBuilder = timeBuilder(n, &eb);
+        check(eb, n);
+
+        printf("%8d %12.3f %12.3f %8.1f\n", n, tSetenv * 1e3,
+                tBuilder * 1e3, (tBuilder > 0) ? tSetenv / tBuilder : 0.0);
+
+        freeStrings(n);                 /* Builder has its own copies */
+    }
+
+    if (execEnv) {
+        fflush(stdout);
+        execle("/usr/bin/env", "env", (char *) NULL, envbMaterialize(eb));
+        errExit("execle");
+    }
+
+    envbFree(eb);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,362 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 6 */
+
+/* env_builder.c
+
+   Functions for building an environment list (e.g., for a child
+   process) without modifying 'environ'.
+
+   setenv() and unsetenv() (see setenv.c) must scan the whole of
+   'environ' on every call, so building an environment of N variables
+   with them takes time proportional to N squared. Here, the variables
+   are instead indexed by a hash table (open addressing with linear
+   probing), so that each operation takes constant time on average, and
+   the 'envp' array is built only once, when it is needed.
+
+   The strings of the initial environment are referred to, not copied;
+   a string is allocated only when a variable is set. Such strings are
+   carved out of large chunks of memory (an "arena") rather than being
+   individually allocated, and are freed all at once by envbFree(). (So
+   memory used by a value that is later replaced or removed is not
+   reclaimed until then.)
+
+   The order of the variables is preserved: a variable that is changed
+   keeps its position, and new variables are added at the end.
+*/
+#include "env_builder.h"
+
+#define EB_EMPTY    -1          /* Values in 'index' that aren't */
+#define EB_DELETED  -2          /* indexes of entries */
+
+#define CHUNK_SIZE 65536        /* Usual size of an arena chunk */
+
+struct envbChunk {
+    struct envbChunk *next;
+    size_t used, size;
+    char data[];
+};
+
+static unsigned int
+hashName(const char *name, size_t len)
+{
+    unsigned int h;
+    size_t j;
+
+    for (h = 2166136261u, j = 0; j < len; j++)          /* FNV-1a */
+        h = (h ^ (unsigned char) name[j]) * 16777619u;
+    return h;
+}
+
+/* Return 'len' bytes from the arena, or NULL on error */
+
+static char *
+arenaAlloc(struct envBuilder *eb, size_t len)
+{
+    struct envbChunk *c;
+    size_t size;
+    char *p;
+
+    c = eb->arena;
+    if (c == NULL || c->size - c->used < len) {
+        size = (len > CHUNK_SIZE) ? len : CHUNK_SIZE;
+        c = malloc(sizeof(struct envbChunk) + size);
+        if (c == NULL)
+            return NULL;
+        c->next = eb->arena;
+        c->used = 0;
+        c->size = size;
+        eb->arena = c;
+    }
+
+    p = c->data + c->used;
+    c->used += len;
+    return p;
+}
+
+/* Search the index for 'name'. If it is found, set '*found' to TRUE and
+   return its slot. Otherwise, set '*found' to FALSE and return the slot
+   where it should be added. */
+
+static size_t
+findSlot(struct envBuilder *eb, const char *name, size_t nameLen,
+         unsigned int hash, Boolean *found)
+{
+    struct envbEntry *e;
+    size_t mask, j, freeSlot;
+    Boolean haveFree;
+    long k;
+
+    mask = eb->indexSize - 1;
+    haveFree = FALSE;
+    freeSlot = 0;
+
+    /* There is always at least one EB_EMPTY slot, so this terminates */
+
+    for (j = hash & mask; ; j = (j + 1) & mask) {
+        k = eb->index[j];
+        if (k == EB_EMPTY) {
+            *found = FALSE;
+            return haveFree ? freeSlot : j;
+        }
+        if (k == EB_DELETED) {
+            if (!haveFree) {            /* Reuse first deleted slot */
+                haveFree = TRUE;
+                freeSlot = j;
+            }
+            continue;
+        }
+        e = &eb->ent[k];
+        if (e->hash == hash && e->nameLen == nameLen &&
+                memcmp(e->str, name, nameLen) == 0) {
+            *found = TRUE;
+            return j;
+        }
+    }
+}
+
+/* Rebuild the index so that it is at most one quarter full with 'want'
+   entries, discarding removed entries. Returns 0 on success, or -1 on
+   error. */
+
+static int
+rebuildIndex(struct envBuilder *eb, size_t want)
+{
+    size_t size, mask, j, k;
+    long *index;
+
+    for (size = 64; size < want * 4; size *= 2)
+        continue;
+    index = malloc(size * sizeof(long));
+    if (index == NULL)
+        return -1;
+    for (j = 0; j < size; j++)
+        index[j] = EB_EMPTY;
+
+    for (j = 0, k = 0; j < eb->numEnts; j++)
+        if (eb->ent[j].str != NULL)
+            eb->ent[k++] = eb->ent[j];
+    eb->numEnts = k;
+
+    mask = size - 1;
+    for (j = 0; j < eb->numEnts; j++) {
+        for (k = eb->ent[j].hash & mask; index[k] != EB_EMPTY;
+                k = (k + 1) & mask)
+            continue;
+        index[k] = j;
+    }
+
+    free(eb->index);
+    eb->index = index;
+    eb->indexSize = size;
+    eb->indexUsed = eb->numEnts;
+    return 0;
+}
+
+/* Add a new entry for 'str' (whose name is known not to be present) in
+   index slot 'slot'. Returns 0 on success, or -1 on error. */
+
+static int
+addEntry(struct envBuilder *eb, const char *str, size_t nameLen,
+         unsigned int hash, size_t slot)
+{
+    struct envbEntry *ent;
+    size_t max;
+
+    if (eb->numEnts == eb->maxEnts) {
+        max = (eb->maxEnts == 0) ? 64 : eb->maxEnts * 2;
+        ent = realloc(eb->ent, max * sizeof(struct envbEntry));
+        if (ent == NULL)
+            return -1;
+        eb->ent = ent;
+        eb->maxEnts = max;
+    }
+
+    eb->ent[eb->numEnts].str = str;
+    eb->ent[eb->numEnts].nameLen = nameLen;
+    eb->ent[eb->numEnts].hash = hash;
+
+    if (eb->index[slot] == EB_EMPTY)
+        eb->indexUsed++;
+    eb->index[slot] = eb->numEnts++;
+    eb->numLive++;
+    eb->envpValid = FALSE;
+    return 0;
+}
+
+/* Make sure that adding an entry leaves the index at most half full
+   (counting deleted slots, which lengthen searches just as entries do) */
+
+static int
+ensureCapacity(struct envBuilder *eb)
+{
+    if ((eb->indexUsed + 1) * 2 <= eb->indexSize)
+        return 0;
+    return rebuildIndex(eb, eb->numLive + 1);
+}
+
+static Boolean
+validName(const char *name)
+{
+    return name != NULL && name[0] != '\0' && strchr(name, '=') == NULL;
+}
+
+struct envBuilder *
+envbCreate(char **base)
+{
+    struct envBuilder *eb;
+    size_t n, nameLen, slot;
+    unsigned int hash;
+    Boolean found;
+    char **ep, *eq;
+
+    eb = calloc(1, sizeof(struct envBuilder));
+    if (eb == NULL)
+        return NULL;
+
+    n = 0;
+    if (base != NULL)
+        for (ep = base; *ep != NULL; ep++)
+            n++;
+    if (rebuildIndex(eb, n) == -1) {
+        free(eb);
+        return NULL;
+    }
+
+    for (ep = base; n > 0 && *ep != NULL; ep++) {
+        eq = strchr(*ep, '=');
+        if (eq == NULL || eq == *ep)    /* Not of the form "name=value" */
+            continue;
+        nameLen = eq - *ep;
+        hash = hashName(*ep, nameLen);
+        slot = findSlot(eb, *ep, nameLen, hash, &found);
+        if (found)                      /* Duplicate: first one wins */
+            continue;
+        if (addEntry(eb, *ep, nameLen, hash, slot) == -1) {
+            envbFree(eb);
+            return NULL;
+        }
+    }
+
+    return eb;
+}
+
+int
+envbSet(struct envBuilder *eb, const char *name, const char *value,
+        int overwrite)
+{
+    size_t nameLen, valueLen, slot;
+    unsigned int hash;
+    Boolean found;
+    char *str;
+
+    if (!validName(name) || value == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    nameLen = strlen(name);
+    hash = hashName(name, nameLen);
+    if (ensureCapacity(eb) == -1)
+        return -1;
+    slot = findSlot(eb, name, nameLen, hash, &found);
+    if (found && !overwrite)
+        return 0;
+
+    valueLen = strlen(value);
+    str = arenaAlloc(eb, nameLen + valueLen + 2);
+    if (str == NULL)                    /* +2 for '=' and null terminator */
+        return -1;
+    memcpy(str, name, nameLen);
+    str[nameLen] = '=';
+    memcpy(str + nameLen + 1, value, valueLen + 1);
+
+    if (!found)
+        return addEntry(eb, str, nameLen, hash, slot);
+
+    eb->ent[eb->index[slot]].str = str; /* Keeps its position */
+    eb->envpValid = FALSE;
+    return 0;
+}
+
+int
+envbUnset(struct envBuilder *eb, const char *name)
+{
+    size_t nameLen, slot;
+    Boolean found;
+
+    if (!validName(name)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    nameLen = strlen(name);
+    slot = findSlot(eb, name, nameLen, hashName(name, nameLen), &found);
+    if (found) {
+        eb->ent[eb->index[slot]].str = NULL;
+        eb->index[slot] = EB_DELETED;
+        eb->numLive--;
+        eb->envpValid = FALSE;
+    }
+    return 0;
+}
+
+const char *
+envbGet(struct envBuilder *eb, const char *name)
+{
+    size_t nameLen, slot;
+    Boolean found;
+
+    if (!validName(name))
+        return NULL;
+
+    nameLen = strlen(name);
+    slot = findSlot(eb, name, nameLen, hashName(name, nameLen), &found);
+    return found ? eb->ent[eb->index[slot]].str + nameLen + 1 : NULL;
+}
+
+char **
+envbMaterialize(struct envBuilder *eb)
+{
+    char **envp;
+    size_t j, k;
+
+    if (eb->envpValid)
+        return eb->envp;
+
+    envp = realloc(eb->envp, (eb->numLive + 1) * sizeof(char *));
+    if (envp == NULL)
+        return NULL;
+    eb->envp = envp;
+
+    for (j = 0, k = 0; j < eb->numEnts; j++)
+        if (eb->ent[j].str != NULL)
+            envp[k++] = (char *) eb->ent[j].str;
+    envp[k] = NULL;
+
+    eb->envpValid = TRUE;
+    return envp;
+}
+
+void
+envbFree(struct envBuilder *eb)
+{
+    struct envbChunk *c, *next;
+
+    for (c = eb->arena; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(eb->ent);
+    free(eb->index);
+    free(eb->envp);
+    free(eb);
+}
@@ -0,0 +1,74 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 6 */
+
+/* env_builder.h
+
+   Header file for env_builder.c.
+*/
+#ifndef ENV_BUILDER_H
+#define ENV_BUILDER_H
+
+#include <stddef.h>
+#include "tlpi_hdr.h"           /* For 'Boolean' */
+
+struct envbEntry {
+    const char *str;            /* "name=value", or NULL if removed */
+    size_t nameLen;
+    unsigned int hash;
+};
+
+struct envbChunk;               /* Arena storage; see env_builder.c */
+
+struct envBuilder {
+    struct envbEntry *ent;      /* Entries, in order of creation */
+    size_t numEnts, maxEnts;
+    size_t numLive;             /* Entries not removed */
+    long *index;                /* Open-addressing hash table of indexes
+                                   into 'ent' (or EB_EMPTY, EB_DELETED) */
+    size_t indexSize;           /* Always a power of 2 */
+    size_t indexUsed;           /* Slots not EB_EMPTY */
+    struct envbChunk *arena;
+    char **envp;                /* Built by envbMaterialize() */
+    Boolean envpValid;          /* 'envp' reflects current entries */
+};
+
+/* Create a builder whose initial contents are those of 'base' (e.g.,
+   'environ'; may be NULL). The strings of 'base' are not copied; they
+   must remain valid and unchanged until envbFree() is called. Only
+   variables that are set or changed are stored in the builder's own
+   memory. If a name appears more than once in 'base', the first
+   occurrence is used (as getenv() would).
+
+   Returns: pointer to new builder, or NULL on error. */
+
+struct envBuilder *envbCreate(char **base);
+
+/* Like setenv() and unsetenv(), but operating on the builder rather
+   than on 'environ'. Returns: 0 on success, or -1 on error. */
+
+int envbSet(struct envBuilder *eb, const char *name, const char *value,
+            int overwrite);
+int envbUnset(struct envBuilder *eb, const char *name);
+
+/* Like getenv(). Returns: pointer to value, or NULL if not set. */
+
+const char *envbGet(struct envBuilder *eb, const char *name);
+
+/* Return a NULL-terminated array of "name=value" strings, suitable as
+   the 'envp' argument of execve(). The array remains valid until the
+   next change to the builder or envbFree(). Returns NULL on error. */
+
+char **envbMaterialize(struct envBuilder *eb);
+
+void envbFree(struct envBuilder *eb);
+
+#endif
@@ -0,0 +1,160 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* close_fds.c
+
+   closeFdsFrom(): close (or, with CFD_CLOEXEC, mark close-on-exec) all
+   of the caller's file descriptors numbered 'lowFd' or higher. Returns 0
+   on success, or -1 on error.
+
+   The traditional approach is to call close() on every descriptor from
+   'lowFd' up to the RLIMIT_NOFILE limit. That costs one system call per
+   possible descriptor, which is expensive if the limit is high (limits
+   of 1048576 are common), however few descriptors are actually open. It
+   also misses descriptors that were opened before the limit was lowered.
+   So we use, in order of preference:
+
+   1. close_range() (Linux 5.9; CLOSE_RANGE_CLOEXEC needs Linux 5.11),
+      which handles all descriptors in a single system call.
+
+   2. The entries in /proc/self/fd, which lists just the open descriptors.
+      Listing an entry costs some microseconds (rather more than a
+      close() of an unused descriptor), so this method wins only when few
+      of the possible descriptors are open, which is the usual case.
+      Note that this uses opendir(), which allocates memory, and so is not
+      async-signal-safe; in the child of fork() in a multithreaded
+      program, this method is safe only if close_range() is known to be
+      available.
+
+   3. The traditional loop, up to the larger of the RLIMIT_NOFILE soft
+      limit and sysconf(_SC_OPEN_MAX), or CFD_MAX_GUESS if neither is
+      determinate.
+
+   CFD_NO_CLOSE_RANGE and CFD_NO_PROC disable the first two methods (to
+   allow the methods to be compared).
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "close_fds.h"
+#include "tlpi_hdr.h"
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/* Close or mark 'fd'. Errors are ignored, since 'fd' may well not be
+   open. */
+
+static void
+cleanupFd(int fd, Boolean cloexec)
+{
+    int flags;
+
+    if (!cloexec) {
+        close(fd);
+        return;
+    }
+
+    flags = fcntl(fd, F_GETFD);
+    if (flags != -1 && !(flags & FD_CLOEXEC))
+        fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+/* Clean up the descriptors listed in /proc/self/fd. Returns 0 on
+   success, or -1 if the directory can't be read. */
+
+static int
+cleanupProcFds(int lowFd, Boolean cloexec)
+{
+    struct dirent *dp;
+    DIR *dirp;
+    char *end;
+    long fd;
+    int dfd;
+
+    dirp = opendir("/proc/self/fd");
+    if (dirp == NULL)
+        return -1;
+    dfd = dirfd(dirp);
+
+    /* Descriptors are listed in numerical order, and the listing isn't
+       disturbed by closing descriptors that have already been listed */
+
+    for (;;) {
+        errno = 0;
+        dp = readdir(dirp);
+        if (dp == NULL)
+            break;
+
+        fd = strtol(dp->d_name, &end, 10);
+        if (end == dp->d_name || *end != '\0')  /* "." and ".." */
+            continue;
+        if (fd >= lowFd && fd != dfd)
+            cleanupFd(fd, cloexec);
+    }
+
+    if (errno != 0) {
+        closedir(dirp);
+        return -1;
+    }
+    return closedir(dirp);
+}
+
+int
+closeFdsFrom(int lowFd, int flags)
+{
+    struct rlimit rl;
+    Boolean cloexec;
+    long maxFd, openMax;
+    int fd;
+
+    if (lowFd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    cloexec = (flags & CFD_CLOEXEC) != 0;
+
+#ifdef SYS_close_range
+    if (!(flags & CFD_NO_CLOSE_RANGE)) {
+        if (syscall(SYS_close_range, (unsigned int) lowFd, ~0U,
+                    cloexec ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+            return 0;
+
+        /* ENOSYS: kernel predates close_range(); EINVAL: kernel predates
+           CLOSE_RANGE_CLOEXEC. Otherwise, something is seriously wrong. */
+
+        if (errno != ENOSYS && errno != EINVAL)
+            return -1;
+    }
+#endif
+
+    if (!(flags & CFD_NO_PROC) && cleanupProcFds(lowFd, cloexec) == 0)
+        return 0;
+
+    maxFd = -1;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        maxFd = (rl.rlim_cur > INT_MAX) ? INT_MAX : (long) rl.rlim_cur;
+    openMax = sysconf(_SC_OPEN_MAX);
+    if (openMax > maxFd)
+        maxFd = openMax;
+    if (maxFd == -1)                    /* Limit is indeterminate... */
+        maxFd = CFD_MAX_GUESS;          /* so take a guess */
+
+    for (fd = lowFd; fd < maxFd; fd++)
+        cleanupFd(fd, cloexec);
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* close_fds.h
+
+   Header file for close_fds.c.
+*/
+#ifndef CLOSE_FDS_H
+#define CLOSE_FDS_H
+
+/* Bit-mask values for 'flags' argument of closeFdsFrom() */
+
+#define CFD_CLOEXEC         01  /* Set close-on-exec flag instead of
+                                   closing */
+#define CFD_NO_CLOSE_RANGE  02  /* Don't use close_range() */
+#define CFD_NO_PROC         04  /* Don't enumerate /proc/self/fd */
+
+#define CFD_MAX_GUESS     8192  /* Highest file descriptor to try if the
+                                   limit is indeterminate */
+
+int closeFdsFrom(int lowFd, int flags);
+
+#endif
@@ -0,0 +1,236 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* fd_cleanup_bench.c
+
+   Measure the cost of closing (or marking close-on-exec) a process's file
+   descriptors before becoming a daemon or execing a program, as a
+   function of the number of open descriptors and of RLIMIT_NOFILE.
+
+   Usage: fd_cleanup_bench [-n reps] [-l nofile] [-p prog] num-fds...
+
+   For each 'num-fds', the program opens that many descriptors (numbered
+   from 3 upward) and then, for each method below, 'reps' (default: 10)
+   times: creates a child, which cleans up its descriptors from 3 upward
+   using that method and then execs 'prog' (default: /bin/true). It
+   reports the time taken by the cleanup step alone (which is what
+   becomeDaemon() pays), and the time from fork() until the child has
+   been waited for (the startup cost of a spawned program).
+
+        none        no cleanup (descriptors are inherited by 'prog')
+        loop        close() every descriptor below sysconf(_SC_OPEN_MAX),
+                    as becomeDaemon() formerly did
+        proc        close the descriptors listed in /proc/self/fd
+        range       close_range()
+        cloexec     close_range() with CLOSE_RANGE_CLOEXEC, leaving the
+                    closing to execve()
+
+   The RLIMIT_NOFILE soft limit is set to 'nofile' if -l is specified.
+   (Raising it above the hard limit requires privilege.)
+
+   If the kernel doesn't support close_range() (or CLOSE_RANGE_CLOEXEC),
+   closeFdsFrom() would quietly fall back to the loop, so the "range" (or
+   "cloexec") method is reported as unsupported rather than timed.
+
+   See also closeonexec.c. This program is Linux-specific.
+*/
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include "close_fds.h"
+#include "tlpi_hdr.h"
+
+enum method { M_NONE, M_LOOP, M_PROC, M_RANGE, M_CLOEXEC, NUM_METHODS };
+
+static const char *methodName[NUM_METHODS] = {
+    "none", "loop", "proc", "range", "cloexec"
+};
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/* Return TRUE if the kernel supports method 'm' */
+
+static Boolean
+supported(enum method m)
+{
+    if (m != M_RANGE && m != M_CLOEXEC)
+        return TRUE;
+#ifdef SYS_close_range
+
+    /* Closing a range containing only the highest possible descriptor
+       number does nothing, but fails if close_range() (or the flag) is
+       unknown */
+
+    return syscall(SYS_close_range, ~0U, ~0U,
+                   (m == M_CLOEXEC) ? CLOSE_RANGE_CLOEXEC : 0) == 0;
+#else
+    return FALSE;
+#endif
+}
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cleanup(enum method m)
+{
+    long maxFd, fd;
+
+    switch (m) {
+    case M_NONE:
+        return 0;
+    case M_LOOP:
+        maxFd = sysconf(_SC_OPEN_MAX);
+        for (fd = STDERR_FILENO + 1; fd < maxFd; fd++)
+            close(fd);
+        return 0;
+    case M_PROC:
+        return closeFdsFrom(STDERR_FILENO + 1, CFD_NO_CLOSE_RANGE);
+    case M_RANGE:
+        return closeFdsFrom(STDERR_FILENO + 1, CFD_NO_PROC);
+    case M_CLOEXEC:
+        return closeFdsFrom(STDERR_FILENO + 1, CFD_CLOEXEC | CFD_NO_PROC);
+    default:
+        return -1;
+    }
+}
+
+/* Create a child that cleans up with method 'm' and execs 'prog'. The
+   child records the time taken by the cleanup in '*cleanupSecs' (which
+   is in shared memory). Returns the time until the child was reaped. */
+
+static double
+spawn(enum method m, const char *prog, volatile double *cleanupSecs)
+{
+    double start, t;
+    int status;
+
+    start = nowSecs();
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        t = nowSecs();
+        if (cleanup(m) == -1)
+            _exit(EXIT_FAILURE);
+        *cleanupSecs = nowSecs() - t;
+        execl(prog, prog, (char *) NULL);
+        _exit(127);
+
+    default:
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("child failed (method %s): status %#x", methodName[m],
+                    (unsigned int) status);
+        return nowSecs() - start;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    volatile double *cleanupSecs;
+    double cleanupSum, spawnSum;
+    struct rlimit rl;
+    char *prog;
+    int opt, reps, numFds, fd, j, k;
+    enum method m;
+
+    reps = 10;
+    prog = "/bin/true";
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+
+    while ((opt = getopt(argc, argv, "n:l:p:")) != -1) {
+        switch (opt) {
+        case 'n':
+            reps = getInt(optarg, GN_GT_0, "reps");
+            break;
+        case 'l':
+            rl.rlim_cur = getLong(optarg, GN_GT_0, "nofile");
+            if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+                rl.rlim_max = rl.rlim_cur;
+            if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+                errExit("setrlimit");
+            break;
+        case 'p':
+            prog = optarg;
+            break;
+        default:
+            usageErr("%s [-n reps] [-l nofile] [-p prog] num-fds...\n",
+                    argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-n reps] [-l nofile] [-p prog] num-fds...\n", argv[0]);
+
+    cleanupSecs = mmap(NULL, sizeof(double), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cleanupSecs == MAP_FAILED)
+        errExit("mmap");
+
+    printf("RLIMIT_NOFILE soft limit: %lld; times in microseconds\n",
+            (long long) rl.rlim_cur);
+    printf("%8s %-8s %10s %10s\n", "open fds", "method", "cleanup",
+            "spawn");
+
+    for (j = optind; j < argc; j++) {
+        numFds = getInt(argv[j], GN_NONNEG, "num-fds");
+
+        /* Replace the previous set of descriptors with 'numFds' copies
+           of a descriptor for /dev/null */
+
+        if (closeFdsFrom(STDERR_FILENO + 1, 0) == -1)
+            errExit("closeFdsFrom");
+        if (numFds > 0) {
+            fd = open("/dev/null", O_RDONLY);
+            if (fd != STDERR_FILENO + 1)
+                fatal("expected /dev/null to be opened as fd %d",
+                        STDERR_FILENO + 1);
+            for (k = 1; k < numFds; k++)
+                if (dup2(fd, fd + k) == -1)
+                    errExit("dup2 (is num-fds below RLIMIT_NOFILE?)");
+        }
+
+        for (m = 0; m < NUM_METHODS; m++) {
+            if (!supported(m)) {
+                printf("%8d %-8s %10s %10s\n", numFds, methodName[m],
+                        "unsupported", "-");
+                continue;
+            }
+
+            cleanupSum = spawnSum = 0;
+            for (k = 0; k < reps; k++) {
+                spawnSum += spawn(m, prog, cleanupSecs);
+                cleanupSum += *cleanupSecs;
+            }
+            printf("%8d %-8s %10.1f %10.1f\n", numFds, methodName[m],
+                    cleanupSum * 1e6 / reps, spawnSum * 1e6 / reps);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
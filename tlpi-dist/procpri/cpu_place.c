@@ -0,0 +1,164 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* cpu_place.c
+
+   Display the CPU topology, compute a placement for a number of workers,
+   or run a number of copies of a command placed according to a layout.
+
+   Usage: cpu_place
+          cpu_place -l layout -n workers [-m] [command [arg...]]
+
+   With no arguments, the program displays each online CPU with its core,
+   package, and NUMA node.
+
+   With "-l" and "-n", the program shows the CPU on which each of
+   'workers' workers would run under 'layout', which is one of:
+
+        none      no binding
+        spread    one worker per physical core, avoiding SMT siblings,
+                  with workers distributed round-robin across NUMA nodes
+        pack      fill all cores of one NUMA node (one worker per core,
+                  then SMT siblings) before moving on to the next node
+        smt       consecutive workers share the hardware threads of a core
+
+   If a command is also given, 'workers' child processes are created, each
+   bound to its CPU with sched_setaffinity(), and each executes 'command'.
+   The environment variables CPU_PLACE_WORKER and CPU_PLACE_CPU tell each
+   child its worker index and CPU. With "-m", each child also sets its
+   preferred memory node (set_mempolicy()) to the node of its CPU. The
+   parent waits for all children, and displays their status.
+
+   See also t_sched_setaffinity.c and cpu_place_bench.c.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include "cpu_topology.h"
+#include "print_wait_status.h"
+#include "tlpi_hdr.h"
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s\n", progName);
+    fprintf(stderr, "       %s -l layout -n workers [-m] "
+            "[command [arg...]]\n", progName);
+    fprintf(stderr, "    layout is one of: none, spread, pack, smt\n");
+    fprintf(stderr, "    -m    bind memory to each worker's NUMA node\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct cpuTopology topo;
+    int *cpuList, layout, numWorkers, opt, j, status;
+    Boolean bindMem;
+    char str[32];
+    pid_t pid;
+
+    layout = -1;
+    numWorkers = 0;
+    bindMem = FALSE;
+
+    /* '+' stops option processing at the command */
+
+    while ((opt = getopt(argc, argv, "+l:n:m")) != -1) {
+        switch (opt) {
+        case 'l':
+            layout = topoLayoutFromStr(optarg);
+            if (layout == -1)
+                usageError(argv[0]);
+            break;
+        case 'n': numWorkers = getInt(optarg, GN_GT_0, "workers"); break;
+        case 'm': bindMem = TRUE;                                   break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if (topoRead(&topo) == -1)
+        errExit("topoRead");
+
+    if (layout == -1) {
+        if (numWorkers != 0 || optind < argc)
+            usageError(argv[0]);
+
+        printf("%d CPUs, %d cores, %d NUMA node(s)\n\n",
+                topo.numCpus, topo.numCores, topo.numNodes);
+        printf("%5s %6s %7s %6s %6s\n", "cpu", "core", "package", "node",
+                "thread");
+        for (j = 0; j < topo.numCpus; j++)
+            printf("%5d %6d %7d %6d %6d\n", topo.cpus[j].cpu,
+                    topo.cpus[j].core, topo.cpus[j].package,
+                    topo.cpus[j].node, topo.cpus[j].thread);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (numWorkers == 0)
+        usageError(argv[0]);
+
+    cpuList = malloc(numWorkers * sizeof(int));
+    if (cpuList == NULL)
+        errExit("malloc");
+    if (topoLayout(&topo, layout, numWorkers, cpuList) == -1)
+        errExit("topoLayout");
+
+    if (optind >= argc) {               /* Just display the placement */
+        printf("%6s %5s %5s\n", "worker", "cpu", "node");
+        for (j = 0; j < numWorkers; j++) {
+            if (cpuList[j] == -1)
+                printf("%6d %5s %5s\n", j, "-", "-");
+            else
+                printf("%6d %5d %5d\n", j, cpuList[j],
+                        topoNodeOf(&topo, cpuList[j]));
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    for (j = 0; j < numWorkers; j++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+
+        case 0:
+            if (topoBindCpu(0, cpuList[j]) == -1)
+                errExit("topoBindCpu");
+            if (bindMem && cpuList[j] != -1 &&
+                    topoBindMemNode(topoNodeOf(&topo, cpuList[j])) == -1)
+                errMsg("topoBindMemNode");      /* Not fatal */
+
+            snprintf(str, sizeof(str), "%d", j);
+            setenv("CPU_PLACE_WORKER", str, 1);
+            snprintf(str, sizeof(str), "%d", cpuList[j]);
+            setenv("CPU_PLACE_CPU", str, 1);
+
+            execvp(argv[optind], &argv[optind]);
+            errExit("execvp");
+
+        default:
+            break;
+        }
+    }
+
+    /* Wait for all children */
+
+    while ((pid = wait(&status)) != -1) {
+        printf("child %ld: ", (long) pid);
+        printWaitStatus(NULL, status);
+    }
+    if (errno != ECHILD)
+        errExit("wait");
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,298 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* cpu_place_bench.c
+
+   Show the effect of the worker layouts computed by cpu_topology.c.
+
+   Usage: cpu_place_bench [-l layout] [-n workers] [-s MiB] [-r passes]
+                          [-p round-trips] [-m]
+
+   For each layout (or just 'layout', if "-l" is given), two tests are
+   run:
+
+   * Memory bandwidth: 'workers' (default: number of physical cores)
+     threads are placed according to the layout, each allocates (and thus,
+     under the default first-touch policy, places) its own 'MiB'
+     (default: 64) MiB buffer, and then reads and writes the buffer
+     'passes' (default: 5) times. The aggregate bandwidth is reported.
+     With "-m", each thread also sets its preferred memory node to the
+     node of its CPU before allocating.
+
+   * Ping-pong: the first two workers of the layout alternately update a
+     shared cache line 'round-trips' (default: 100000) times. This shows
+     the cost of moving a cache line between SMT siblings, between cores,
+     and between NUMA nodes.
+
+   On a system with fewer than two CPUs, the ping-pong test is dominated
+   by context switches, since the two threads can't run simultaneously.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "cpu_topology.h"
+#include "tlpi_hdr.h"
+
+#define SPINS_BEFORE_YIELD 1000
+
+struct worker {
+    pthread_t tid;
+    int cpu;
+    int node;
+    int parity;                 /* Ping-pong: 0 or 1 */
+    double secs;                /* Time taken by this worker's passes */
+};
+
+static struct cpuTopology topo;
+static size_t bufSize;
+static int numPasses;
+static Boolean bindMem;
+static pthread_barrier_t barrier;
+
+static volatile uint64_t sink;  /* Prevents optimizing away the reads */
+
+/* The ping-pong counter, on its own cache line */
+
+static struct {
+    char pad1[64];
+    volatile long val;
+    char pad2[64];
+} pp;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bindSelf(struct worker *w)
+{
+    if (topoBindCpu(0, w->cpu) == -1)
+        errExit("topoBindCpu");
+    if (bindMem && w->cpu != -1 && topoBindMemNode(w->node) == -1)
+        errMsg("topoBindMemNode");
+}
+
+static void *
+bandwidthFunc(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t *buf, sum;
+    size_t n, j;
+    double start;
+    int p, s;
+
+    bindSelf(w);
+
+    /* Allocate and touch the buffer after binding, so that its pages are
+       allocated on (or near) this worker's node */
+
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+    n = bufSize / sizeof(uint64_t);
+    for (j = 0; j < n; j++)
+        buf[j] = j;
+
+    s = pthread_barrier_wait(&barrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    start = nowSecs();
+    sum = 0;
+    for (p = 0; p < numPasses; p++)
+        for (j = 0; j < n; j++) {
+            sum += buf[j];
+            buf[j] = sum;
+        }
+    w->secs = nowSecs() - start;
+
+    sink = sum;
+    free(buf);
+    return NULL;
+}
+
+static long numRoundTrips;
+
+/* Wait until the ping-pong counter is 'val'. If we seem to be sharing a
+   CPU with the other thread, let it run. */
+
+static void
+waitFor(long val)
+{
+    int spins;
+
+    for (spins = 0; __atomic_load_n(&pp.val, __ATOMIC_ACQUIRE) != val; )
+        if (++spins >= SPINS_BEFORE_YIELD) {
+            sched_yield();
+            spins = 0;
+        }
+}
+
+static void *
+pingPongFunc(void *arg)
+{
+    struct worker *w = arg;
+    long j;
+
+    bindSelf(w);
+
+    for (j = 0; j < numRoundTrips; j++) {
+        waitFor(2 * j + w->parity);
+        __atomic_store_n(&pp.val, 2 * j + w->parity + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void
+runLayout(int layout, int numWorkers)
+{
+    struct worker *w;
+    int *cpuList, j, s;
+    double maxSecs, start, elapsed;
+    char cpus[64];
+
+    /* The ping-pong test always uses two workers */
+
+    w = calloc(numWorkers < 2 ? 2 : numWorkers, sizeof(struct worker));
+    cpuList = malloc((numWorkers < 2 ? 2 : numWorkers) * sizeof(int));
+    if (w == NULL || cpuList == NULL)
+        errExit("malloc");
+
+    /* Bandwidth test */
+
+    if (topoLayout(&topo, layout, numWorkers, cpuList) == -1)
+        errExit("topoLayout");
+
+    s = pthread_barrier_init(&barrier, NULL, numWorkers);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    for (j = 0; j < numWorkers; j++) {
+        w[j].cpu = cpuList[j];
+        w[j].node = (cpuList[j] == -1) ? -1 : topoNodeOf(&topo, cpuList[j]);
+        s = pthread_create(&w[j].tid, NULL, bandwidthFunc, &w[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    maxSecs = 0;
+    for (j = 0; j < numWorkers; j++) {
+        s = pthread_join(w[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        if (w[j].secs > maxSecs)
+            maxSecs = w[j].secs;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    /* Ping-pong test between the first two workers of the layout */
+
+    if (topoLayout(&topo, layout, 2, cpuList) == -1)
+        errExit("topoLayout");
+
+    pp.val = 0;
+    for (j = 0; j < 2; j++) {
+        w[j].cpu = cpuList[j];
+        w[j].node = (cpuList[j] == -1) ? -1 : topoNodeOf(&topo, cpuList[j]);
+        w[j].parity = j;
+    }
+
+    start = nowSecs();
+    for (j = 0; j < 2; j++) {
+        s = pthread_create(&w[j].tid, NULL, pingPongFunc, &w[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < 2; j++) {
+        s = pthread_join(w[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    elapsed = nowSecs() - start;
+
+    if (cpuList[0] == -1)
+        snprintf(cpus, sizeof(cpus), "unbound");
+    else
+        snprintf(cpus, sizeof(cpus), "%d(n%d)<->%d(n%d)",
+                cpuList[0], topoNodeOf(&topo, cpuList[0]),
+                cpuList[1], topoNodeOf(&topo, cpuList[1]));
+
+    printf("%-7s %12.2f %20s %12.1f\n", topoLayoutName(layout),
+            2.0 * bufSize * numPasses * numWorkers / maxSecs / 1e9,
+            cpus, elapsed * 1e9 / numRoundTrips);
+
+    free(w);
+    free(cpuList);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int layout, numWorkers, opt;
+
+    layout = -1;
+    numWorkers = 0;
+    bufSize = 64 * 1024 * 1024;
+    numPasses = 5;
+    numRoundTrips = 100000;
+    bindMem = FALSE;
+
+    while ((opt = getopt(argc, argv, "l:n:s:r:p:m")) != -1) {
+        switch (opt) {
+        case 'l':
+            layout = topoLayoutFromStr(optarg);
+            if (layout == -1)
+                usageErr("%s: layout must be none, spread, pack or smt\n",
+                        argv[0]);
+            break;
+        case 'n': numWorkers = getInt(optarg, GN_GT_0, "workers");    break;
+        case 's': bufSize = getLong(optarg, GN_GT_0, "MiB") << 20;     break;
+        case 'r': numPasses = getInt(optarg, GN_GT_0, "passes");      break;
+        case 'p': numRoundTrips = getLong(optarg, GN_GT_0, "round-trips");
+                  break;
+        case 'm': bindMem = TRUE;                                     break;
+        default:
+            usageErr("%s [-l layout] [-n workers] [-s MiB] [-r passes] "
+                    "[-p round-trips] [-m]\n", argv[0]);
+        }
+    }
+
+    if (topoRead(&topo) == -1)
+        errExit("topoRead");
+    if (numWorkers == 0)
+        numWorkers = topo.numCores;
+
+    printf("%d CPUs, %d cores, %d node(s); %d workers, %ld MiB each%s\n\n",
+            topo.numCpus, topo.numCores, topo.numNodes, numWorkers,
+            (long) (bufSize >> 20), bindMem ? ", memory bound" : "");
+    printf("%-7s %12s %20s %12s\n", "layout", "mem GB/s", "ping-pong cpus",
+            "ns/round");
+
+    if (layout != -1) {
+        runLayout(layout, numWorkers);
+    } else {
+        for (layout = LAYOUT_NONE; layout <= LAYOUT_SMT; layout++)
+            runLayout(layout, numWorkers);
+    }
+
+    exit(EXIT_SUCCESS);
+}
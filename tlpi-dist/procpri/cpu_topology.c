@@ -0,0 +1,458 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* cpu_topology.c
+
+   Functions for discovering the CPU and NUMA topology of the system, for
+   computing where a set of workers should run, and for binding threads
+   and processes (and their memory) accordingly.
+
+   The topology is read from /sys/devices/system/cpu (online CPUs and the
+   hardware threads that share each core) and /sys/devices/system/node
+   (the CPUs belonging to each NUMA node). If the latter directory does
+   not exist (i.e., the kernel was built without NUMA support), all CPUs
+   are treated as belonging to node 0.
+
+   Memory placement uses the set_mempolicy() and mbind() system calls
+   directly, rather than via libnuma, so that the library doesn't gain a
+   dependency; where those system calls aren't available, topoBindMemNode()
+   and topoBindRegion() fail with ENOSYS.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>    /* MPOL_* constants */
+#include "cpu_topology.h"       /* Declares functions defined here */
+#include "tlpi_hdr.h"
+
+#define SYS_CPU_DIR "/sys/devices/system/cpu"
+#define SYS_NODE_DIR "/sys/devices/system/node"
+#define LIST_BUF_SIZE 4096
+
+/* Read the contents of a (small) sysfs file into 'buf', removing any
+   trailing newline. Return 0 on success, or -1 on error. */
+
+static int
+readSysFile(const char *path, char *buf, size_t size)
+{
+    ssize_t numRead;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    numRead = read(fd, buf, size - 1);
+    close(fd);
+    if (numRead == -1)
+        return -1;
+
+    while (numRead > 0 && buf[numRead - 1] == '\n')
+        numRead--;
+    buf[numRead] = '\0';
+    return 0;
+}
+
+/* Parse a CPU list of the form used in sysfs (e.g., "0-3,8,10-11"),
+   placing up to 'max' CPU numbers in 'out'. Return the number of CPUs
+   in the list, or -1 if the list is malformed. */
+
+static int
+parseList(const char *str, int *out, int max)
+{
+    char *end;
+    long lo, hi, c;
+    int n;
+
+    n = 0;
+    while (*str != '\0') {
+        lo = strtol(str, &end, 10);
+        if (end == str || lo < 0)
+            return -1;
+        hi = lo;
+        if (*end == '-') {
+            str = end + 1;
+            hi = strtol(str, &end, 10);
+            if (end == str || hi < lo)
+                return -1;
+        }
+        for (c = lo; c <= hi; c++) {
+            if (n < max)
+                out[n] = c;
+            n++;
+        }
+        str = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return -1;
+    }
+    return n;
+}
+
+static struct cpuInfo *
+findCpu(const struct cpuTopology *topo, int cpu)
+{
+    int j;
+
+    for (j = 0; j < topo->numCpus; j++)
+        if (topo->cpus[j].cpu == cpu)
+            return &topo->cpus[j];
+    return NULL;
+}
+
+/* Read the topology of the online CPUs into 'topo'. Return 0 on success,
+   or -1 on error. */
+
+int
+topoRead(struct cpuTopology *topo)
+{
+    char path[PATH_MAX], buf[LIST_BUF_SIZE];
+    int *list, *coreFirst, n, ns, j, k, node, numNodeCpus, maxCpus;
+    int sib[CPU_SETSIZE];
+    struct cpuInfo *ci;
+    struct dirent *dent;
+    DIR *dirp;
+
+    maxCpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (maxCpus < 1)
+        maxCpus = CPU_SETSIZE;
+
+    if (readSysFile(SYS_CPU_DIR "/online", buf, sizeof(buf)) == -1)
+        return -1;
+
+    list = malloc(maxCpus * sizeof(int));
+    coreFirst = malloc(maxCpus * sizeof(int));
+    topo->cpus = malloc(maxCpus * sizeof(struct cpuInfo));
+    if (list == NULL || coreFirst == NULL || topo->cpus == NULL)
+        goto fail;
+
+    n = parseList(buf, list, maxCpus);
+    if (n <= 0 || n > maxCpus) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    /* Identify each CPU's core by the first CPU in its list of thread
+       siblings; cores are numbered in order of discovery */
+
+    topo->numCpus = n;
+    topo->numCores = 0;
+    for (j = 0; j < n; j++) {
+        ci = &topo->cpus[j];
+        ci->cpu = list[j];
+        ci->node = 0;
+        ci->package = 0;
+        ci->thread = 0;
+
+        snprintf(path, sizeof(path),
+                SYS_CPU_DIR "/cpu%d/topology/physical_package_id", ci->cpu);
+        if (readSysFile(path, buf, sizeof(buf)) == 0)
+            ci->package = atoi(buf);
+
+        coreFirst[topo->numCores] = ci->cpu;    /* Default: own core */
+        snprintf(path, sizeof(path),
+                SYS_CPU_DIR "/cpu%d/topology/thread_siblings_list", ci->cpu);
+        if (readSysFile(path, buf, sizeof(buf)) == 0) {
+            ns = parseList(buf, sib, CPU_SETSIZE);
+            for (k = 0; k < ns && k < CPU_SETSIZE; k++)
+                if (sib[k] == ci->cpu)
+                    ci->thread = k;
+            if (ns > 0)
+                coreFirst[topo->numCores] = sib[0];
+        }
+
+        for (k = 0; k < topo->numCores; k++)
+            if (coreFirst[k] == coreFirst[topo->numCores])
+                break;
+        ci->core = k;
+        if (k == topo->numCores)
+            topo->numCores++;
+    }
+
+    /* Assign CPUs to NUMA nodes */
+
+    topo->numNodes = 1;
+    dirp = opendir(SYS_NODE_DIR);
+    if (dirp != NULL) {
+        topo->numNodes = 0;
+        while ((dent = readdir(dirp)) != NULL) {
+            if (strncmp(dent->d_name, "node", 4) != 0 ||
+                    dent->d_name[4] < '0' || dent->d_name[4] > '9')
+                continue;
+            node = atoi(dent->d_name + 4);
+
+            snprintf(path, sizeof(path), SYS_NODE_DIR "/%s/cpulist",
+                    dent->d_name);
+            if (readSysFile(path, buf, sizeof(buf)) == -1)
+                continue;
+            numNodeCpus = parseList(buf, list, maxCpus);
+            for (k = 0; k < numNodeCpus && k < maxCpus; k++) {
+                ci = findCpu(topo, list[k]);
+                if (ci != NULL)
+                    ci->node = node;
+            }
+            if (numNodeCpus > 0)
+                topo->numNodes++;       /* Count only nodes with CPUs */
+        }
+        closedir(dirp);
+        if (topo->numNodes == 0)
+            topo->numNodes = 1;
+    }
+
+    free(list);
+    free(coreFirst);
+    return 0;
+
+fail:
+    free(list);
+    free(coreFirst);
+    free(topo->cpus);
+    topo->cpus = NULL;
+    return -1;
+}
+
+void
+topoFree(struct cpuTopology *topo)
+{
+    free(topo->cpus);
+    topo->cpus = NULL;
+    topo->numCpus = 0;
+}
+
+static const char *layoutNames[] = { "none", "spread", "pack", "smt" };
+
+/* Convert a layout name to a LAYOUT_* constant; return -1 if the name
+   is not recognized */
+
+int
+topoLayoutFromStr(const char *name)
+{
+    int j;
+
+    for (j = 0; j < (int) (sizeof(layoutNames) / sizeof(layoutNames[0])); j++)
+        if (strcmp(name, layoutNames[j]) == 0)
+            return j;
+    return -1;
+}
+
+const char *
+topoLayoutName(int layout)
+{
+    return (layout >= LAYOUT_NONE && layout <= LAYOUT_SMT) ?
+            layoutNames[layout] : "?";
+}
+
+/* Return the NUMA node of 'cpu', or -1 if 'cpu' is not online */
+
+int
+topoNodeOf(const struct cpuTopology *topo, int cpu)
+{
+    struct cpuInfo *ci;
+
+    ci = findCpu(topo, cpu);
+    return (ci == NULL) ? -1 : ci->node;
+}
+
+/* Return the lowest node ID greater than 'prev' that has CPUs, or -1 */
+
+static int
+nextNode(const struct cpuTopology *topo, int prev)
+{
+    int j, best;
+
+    best = -1;
+    for (j = 0; j < topo->numCpus; j++)
+        if (topo->cpus[j].node > prev &&
+                (best == -1 || topo->cpus[j].node < best))
+            best = topo->cpus[j].node;
+    return best;
+}
+
+/* Compute the CPU on which each of 'numWorkers' workers should run under
+   'layout', and return them in 'cpuList' (which must have 'numWorkers'
+   elements). If there are more workers than CPUs, the placement wraps
+   around. For LAYOUT_NONE, each element is set to -1. Return 0 on
+   success, or -1 on error. */
+
+int
+topoLayout(const struct cpuTopology *topo, int layout, int numWorkers,
+           int *cpuList)
+{
+    int *order, *used, n, j, node, thread, core, maxThread, progress;
+
+    if (layout == LAYOUT_NONE) {
+        for (j = 0; j < numWorkers; j++)
+            cpuList[j] = -1;
+        return 0;
+    }
+    if (layout < LAYOUT_NONE || layout > LAYOUT_SMT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    order = malloc(topo->numCpus * sizeof(int));
+    used = calloc(topo->numCpus, sizeof(int));
+    if (order == NULL || used == NULL) {
+        free(order);
+        free(used);
+        return -1;
+    }
+
+    maxThread = 0;
+    for (j = 0; j < topo->numCpus; j++)
+        if (topo->cpus[j].thread > maxThread)
+            maxThread = topo->cpus[j].thread;
+
+    /* Build 'order', a permutation of the online CPUs (as indexes into
+       topo->cpus) giving the order in which workers are placed */
+
+    n = 0;
+    switch (layout) {
+    case LAYOUT_SPREAD:
+
+        /* Use the first hardware thread of each core before any second
+           threads; at each level, take one CPU from each node in turn */
+
+        for (thread = 0; thread <= maxThread; thread++) {
+            do {
+                progress = 0;
+                for (node = nextNode(topo, -1); node != -1;
+                        node = nextNode(topo, node)) {
+                    for (j = 0; j < topo->numCpus; j++) {
+                        if (!used[j] && topo->cpus[j].node == node &&
+                                topo->cpus[j].thread == thread) {
+                            used[j] = 1;
+                            order[n++] = j;
+                            progress = 1;
+                            break;
+                        }
+                    }
+                }
+            } while (progress);
+        }
+        break;
+
+    case LAYOUT_PACK:
+
+        /* Fill each node in turn, using one thread per core first */
+
+        for (node = nextNode(topo, -1); node != -1; node = nextNode(topo, node))
+            for (thread = 0; thread <= maxThread; thread++)
+                for (j = 0; j < topo->numCpus; j++)
+                    if (topo->cpus[j].node == node &&
+                            topo->cpus[j].thread == thread)
+                        order[n++] = j;
+        break;
+
+    case LAYOUT_SMT:
+
+        /* Place all hardware threads of a core consecutively */
+
+        for (node = nextNode(topo, -1); node != -1; node = nextNode(topo, node))
+            for (core = 0; core < topo->numCores; core++)
+                for (thread = 0; thread <= maxThread; thread++)
+                    for (j = 0; j < topo->numCpus; j++)
+                        if (topo->cpus[j].node == node &&
+                                topo->cpus[j].core == core &&
+                                topo->cpus[j].thread == thread)
+                            order[n++] = j;
+        break;
+    }
+
+    for (j = 0; j < numWorkers; j++)
+        cpuList[j] = topo->cpus[order[j % n]].cpu;
+
+    free(order);
+    free(used);
+    return 0;
+}
+
+/* Confine the thread (or process) 'tid' to 'cpu'. A 'tid' of 0 means
+   the calling thread. If 'cpu' is -1, do nothing. Return 0 on success,
+   or -1 on error (EINVAL if 'cpu' can't be represented in a cpu_set_t). */
+
+int
+topoBindCpu(pid_t tid, int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu == -1)
+        return 0;
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(tid, sizeof(cpu_set_t), &set);
+}
+
+/* Make 'node' the preferred NUMA node for future memory allocations by
+   the calling thread; if 'node' is -1, revert to the default policy
+   (allocate on the node where the thread is running). We use
+   MPOL_PREFERRED rather than MPOL_BIND, so that allocation falls back to
+   other nodes rather than failing when 'node' is out of memory. Return 0
+   on success, or -1 on error. */
+
+int
+topoBindMemNode(int node)
+{
+#if defined(SYS_set_mempolicy)
+    unsigned long mask;
+
+    if (node == -1)
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+
+    if (node < 0 || node >= (int) (sizeof(mask) * CHAR_BIT)) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask = 1UL << node;
+
+    /* The kernel considers only the first 'maxnode' - 1 bits */
+
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                   sizeof(mask) * CHAR_BIT + 1);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Ask that the pages in the region starting at 'addr' (which must be
+   page-aligned) and extending for 'len' bytes be placed on 'node', moving
+   any pages that have already been allocated. Return 0 on success, or -1
+   on error. */
+
+int
+topoBindRegion(void *addr, size_t len, int node)
+{
+#if defined(SYS_mbind)
+    unsigned long mask;
+
+    if (node < 0 || node >= (int) (sizeof(mask) * CHAR_BIT)) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask = 1UL << node;
+
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask,
+                   sizeof(mask) * CHAR_BIT + 1, MPOL_MF_MOVE);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
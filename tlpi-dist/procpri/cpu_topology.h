@@ -0,0 +1,67 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* cpu_topology.h
+
+   Header file for cpu_topology.c.
+*/
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H          /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+struct cpuInfo {                /* Describes one online CPU */
+    int cpu;                    /* CPU number, as used by sched_setaffinity() */
+    int core;                   /* Index of physical core (0, 1, ...) */
+    int package;                /* Physical package (socket) ID */
+    int node;                   /* NUMA node */
+    int thread;                 /* Position among the core's hardware
+                                   threads; 0 for the first */
+};
+
+struct cpuTopology {
+    int numCpus;                /* Number of online CPUs */
+    int numCores;               /* Number of physical cores */
+    int numNodes;               /* Number of NUMA nodes with CPUs */
+    struct cpuInfo *cpus;       /* Array of 'numCpus' entries */
+};
+
+/* Worker placement layouts, for topoLayout() */
+
+#define LAYOUT_NONE     0       /* Don't bind workers */
+#define LAYOUT_SPREAD   1       /* One worker per physical core, avoiding
+                                   SMT siblings, round-robin over nodes */
+#define LAYOUT_PACK     2       /* Fill one NUMA node (one worker per core,
+                                   then siblings) before using the next */
+#define LAYOUT_SMT      3       /* Place consecutive workers on sibling
+                                   hardware threads of the same core */
+
+int topoRead(struct cpuTopology *topo);
+
+void topoFree(struct cpuTopology *topo);
+
+int topoLayoutFromStr(const char *name);
+
+const char *topoLayoutName(int layout);
+
+int topoLayout(const struct cpuTopology *topo, int layout, int numWorkers,
+               int *cpuList);
+
+int topoNodeOf(const struct cpuTopology *topo, int cpu);
+
+int topoBindCpu(pid_t tid, int cpu);
+
+int topoBindMemNode(int node);
+
+int topoBindRegion(void *addr, size_t len, int node);
+
+#endif
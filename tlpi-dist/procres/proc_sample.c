@@ -0,0 +1,424 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 36 */
+
+/* proc_sample.c
+
+   Sample the resource usage of a process at regular intervals, and print
+   a time series and a summary of rates and peaks.
+
+   Usage: proc_sample [-r hz] [-o secs] [-d secs] [-q] -p pid
+          proc_sample [-r hz] [-o secs] [-d secs] [-q] command [arg...]
+
+   The program either attaches to the existing process 'pid', or runs
+   'command' as a child. It then takes a sample 'hz' (default: 100) times
+   per second until the process terminates, 'secs' seconds have passed
+   ("-d"), or the program is interrupted. Every 'secs' seconds ("-o";
+   default: 1; 0 means every sample) it prints a line showing, for the
+   preceding interval, the CPU usage, resident set size, page-fault rates,
+   the rate at which the main thread is scheduled, and I/O rates. "-q"
+   suppresses the time series, so that only the summary is printed.
+
+   If sampling stops ("-d" or an interrupt) while a command that we
+   launched is still running, the command is sent SIGTERM and reaped.
+
+   Whereas rusage.c reports a command's total resource usage only after it
+   has terminated, this program shows how usage changes over time, and
+   works for processes other than its own children. The information comes
+   from the following files:
+
+        /proc/PID/stat       CPU time, page faults, number of threads
+        /proc/PID/statm      resident set size
+        /proc/PID/io         I/O bytes (requires the same permissions as
+                             ptrace(); may not be available)
+        /proc/PID/schedstat  time spent running and waiting on a run
+                             queue, and number of times scheduled
+                             (requires CONFIG_SCHED_INFO; for a
+                             multithreaded process, covers only the main
+                             thread)
+
+   To keep the cost of each sample low, each file is opened just once and
+   then reread with pread() at offset 0, which makes the kernel regenerate
+   its contents; no open()/close() or lseek() is needed per sample. At the
+   end, the program reports the mean time taken to read a sample (at
+   100 Hz, 1% of one CPU corresponds to 100 microseconds per sample) and
+   its own total CPU usage, which also includes the cost of waking up 'hz'
+   times per second. Reading /proc/PID/stat dominates the cost, since the
+   kernel sums the CPU times of all of the process's threads.
+
+   Note that CPU times in /proc/PID/stat are measured in clock ticks
+   (usually 10 ms), so CPU usage is reported per output interval rather
+   than per sample.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE 1024
+
+/* Indexes into the array of held-open /proc files */
+
+enum { F_STAT, F_STATM, F_IO, F_SCHEDSTAT, NUM_FILES };
+
+static const char *fileName[NUM_FILES] = { "stat", "statm", "io", "schedstat" };
+
+struct sample {
+    double t;                   /* Seconds since sampling started */
+    char state;                 /* Process state from /proc/PID/stat */
+    int threads;
+    unsigned long long utime, stime;    /* Clock ticks */
+    unsigned long long minflt, majflt;
+    long rss;                   /* Pages */
+    unsigned long long rchar, wchar;    /* All bytes read and written */
+    unsigned long long readBytes, writeBytes;   /* Storage I/O */
+    unsigned long long runNs, waitNs, slices;
+};
+
+static volatile sig_atomic_t gotSig = 0;
+
+static void
+handler(int sig)
+{
+    gotSig = 1;
+}
+
+static double
+tsDiff(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+/* Reread the held-open /proc file 'fd' into 'buf'. Return the number of
+   bytes read, or -1 on error (ESRCH once the process has been reaped). */
+
+static ssize_t
+rereadFile(int fd, char *buf)
+{
+    ssize_t numRead;
+
+    numRead = pread(fd, buf, BUF_SIZE - 1, 0);
+    if (numRead == -1)
+        return -1;
+    buf[numRead] = '\0';
+    return numRead;
+}
+
+/* Return the value of the field 'name' in the "name: value" lines of
+   /proc/PID/io */
+
+static unsigned long long
+ioField(const char *buf, const char *name)
+{
+    const char *p;
+    size_t len;
+
+    len = strlen(name);
+    for (p = buf; p != NULL && *p != '\0'; p = strchr(p, '\n')) {
+        if (*p == '\n')
+            p++;
+        if (strncmp(p, name, len) == 0 && p[len] == ':')
+            return strtoull(p + len + 1, NULL, 10);
+    }
+    return 0;
+}
+
+/* Fill in 's' from the open /proc files in 'fd'. A file whose descriptor
+   is -1 is skipped (its fields are left as zero). Return 0 on success, or
+   -1 if the process no longer exists. */
+
+static int
+takeSample(int fd[], struct sample *s)
+{
+    char buf[BUF_SIZE], *p;
+
+    memset(s, 0, sizeof(*s));
+
+    /* The command name (field 2) may contain spaces and parentheses, so
+       start parsing after the last ')' */
+
+    if (rereadFile(fd[F_STAT], buf) <= 0)
+        return -1;
+    p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %llu %*u %llu "
+                "%*u %llu %llu %*d %*d %*d %*d %d", &s->state, &s->minflt,
+                &s->majflt, &s->utime, &s->stime, &s->threads) != 6)
+        return -1;
+
+    if (rereadFile(fd[F_STATM], buf) > 0)
+        sscanf(buf, "%*d %ld", &s->rss);
+
+    if (fd[F_IO] != -1 && rereadFile(fd[F_IO], buf) > 0) {
+        s->rchar = ioField(buf, "rchar");
+        s->wchar = ioField(buf, "wchar");
+        s->readBytes = ioField(buf, "read_bytes");
+        s->writeBytes = ioField(buf, "write_bytes");
+    }
+
+    if (fd[F_SCHEDSTAT] != -1 && rereadFile(fd[F_SCHEDSTAT], buf) > 0)
+        sscanf(buf, "%llu %llu %llu", &s->runNs, &s->waitNs, &s->slices);
+
+    return 0;
+}
+
+/* Print the rates over the interval between samples 'a' and 'b' */
+
+static void
+printInterval(const struct sample *a, const struct sample *b,
+              long clkTck, long pageKiB, Boolean haveIo, Boolean haveSched)
+{
+    double secs;
+
+    secs = b->t - a->t;
+    if (secs <= 0)
+        return;
+
+    printf("%8.2f %6.1f %9ld %9.0f %7.0f", b->t,
+            (b->utime + b->stime - a->utime - a->stime) * 100.0 /
+                    clkTck / secs,
+            b->rss * pageKiB,
+            (b->minflt - a->minflt) / secs, (b->majflt - a->majflt) / secs);
+    if (haveSched)
+        printf(" %9.0f", (b->slices - a->slices) / secs);
+    else
+        printf(" %9s", "-");
+    if (haveIo)
+        printf(" %10.0f %10.0f\n", (b->rchar - a->rchar) / 1024.0 / secs,
+                (b->wchar - a->wchar) / 1024.0 / secs);
+    else
+        printf(" %10s %10s\n", "-", "-");
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-r hz] [-o secs] [-d secs] [-q] "
+            "{-p pid | command [arg...]}\n", progName);
+    fprintf(stderr, "    -r hz     samples per second (default: 100)\n");
+    fprintf(stderr, "    -o secs   output interval (default: 1; "
+            "0 = every sample)\n");
+    fprintf(stderr, "    -d secs   stop after this many seconds\n");
+    fprintf(stderr, "    -q        print only the summary\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int fd[NUM_FILES], opt, j, hz, status;
+    pid_t pid;
+    Boolean child, quiet, haveIo, haveSched, exited;
+    double outSecs, maxSecs, cpuPct, peakCpu, nextOut, secs, selfSecs;
+    double readSecs;
+    long clkTck, pageKiB, peakRss, numSamples;
+    struct sample first, prev, cur, lastOut;
+    struct timespec start, next, end, t0, t1;
+    struct rusage ru;
+    struct sigaction sa;
+    siginfo_t si;
+    char path[64];
+
+    hz = 100;
+    outSecs = 1;
+    maxSecs = 0;
+    quiet = FALSE;
+    pid = 0;
+
+    /* '+' stops option processing at the command */
+
+    while ((opt = getopt(argc, argv, "+r:o:d:qp:")) != -1) {
+        switch (opt) {
+        case 'r': hz = getInt(optarg, GN_GT_0, "hz");                    break;
+        case 'o': outSecs = getLong(optarg, GN_NONNEG, "output-secs");  break;
+        case 'd': maxSecs = getLong(optarg, GN_GT_0, "duration");       break;
+        case 'q': quiet = TRUE;                                         break;
+        case 'p': pid = getLong(optarg, GN_GT_0, "pid");                break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if ((pid == 0) == (optind >= argc))         /* Need exactly one */
+        usageError(argv[0]);
+
+    child = (pid == 0);
+    if (child) {
+        pid = fork();
+        if (pid == -1)
+            errExit("fork");
+        if (pid == 0) {
+            execvp(argv[optind], &argv[optind]);
+            errExit("execvp");
+        }
+    }
+
+    /* Open the /proc files once. Failing to open 'io' (permissions) or
+       'schedstat' (kernel configuration) is not fatal. */
+
+    for (j = 0; j < NUM_FILES; j++) {
+        snprintf(path, sizeof(path), "/proc/%ld/%s", (long) pid, fileName[j]);
+        fd[j] = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd[j] == -1 && (j == F_STAT || j == F_STATM))
+            errExit("open %s", path);
+    }
+    haveIo = fd[F_IO] != -1;
+    haveSched = fd[F_SCHEDSTAT] != -1;
+
+    /* SIGINT and SIGTERM end sampling; no SA_RESTART, so that
+       clock_nanosleep() is interrupted. When we launched the command, it
+       receives terminal-generated signals too. */
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = handler;
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    clkTck = sysconf(_SC_CLK_TCK);
+    pageKiB = sysconf(_SC_PAGESIZE) / 1024;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    if (takeSample(fd, &first) == -1)
+        fatal("process %ld has terminated", (long) pid);
+
+    if (!quiet)
+        printf("%8s %6s %9s %9s %7s %9s %10s %10s\n", "time", "cpu%",
+                "rss(KiB)", "minflt/s", "majflt/s", "mtsched/s", "rd(KiB/s)",
+                "wr(KiB/s)");
+
+    prev = lastOut = first;
+    peakRss = first.rss;
+    peakCpu = 0;
+    nextOut = outSecs;
+    numSamples = 1;
+    readSecs = 0;
+    exited = FALSE;
+    next = start;
+
+    while (!gotSig && !exited) {
+        next.tv_nsec += 1000000000L / hz;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+            continue;           /* EINTR: 'gotSig' is set */
+
+        /* If our child has terminated, take a last sample from the zombie
+           before reaping it below */
+
+        if (child) {
+            si.si_pid = 0;
+            if (waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) == -1)
+                errExit("waitid");
+            exited = si.si_pid != 0;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (takeSample(fd, &cur) == -1)
+            break;              /* Process has gone */
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        readSecs += tsDiff(&t1, &t0);
+        if (cur.state == 'Z') {
+            cur.rss = prev.rss;         /* statm shows 0 for a zombie */
+            exited = TRUE;
+        }
+        cur.t = tsDiff(&next, &start);
+        numSamples++;
+
+        if (cur.rss > peakRss)
+            peakRss = cur.rss;
+
+        if (cur.t >= nextOut || exited) {
+            cpuPct = (cur.utime + cur.stime - lastOut.utime - lastOut.stime)
+                        * 100.0 / clkTck / (cur.t - lastOut.t);
+            if (cpuPct > peakCpu)
+                peakCpu = cpuPct;
+            if (!quiet)
+                printInterval(&lastOut, &cur, clkTck, pageKiB,
+                              haveIo, haveSched);
+            lastOut = cur;
+            nextOut = cur.t + outSecs;
+        }
+
+        prev = cur;
+        if (maxSecs > 0 && cur.t >= maxSecs)
+            break;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+    secs = prev.t - first.t;
+
+    /* Summary */
+
+    printf("\nPID %ld: %ld samples over %.2f s (%d Hz)\n", (long) pid,
+            numSamples, secs, hz);
+    if (secs > 0) {
+        printf("    CPU:          user %.2f s, system %.2f s; "
+                "mean %.1f%%, peak %.1f%%\n",
+                (double) (prev.utime - first.utime) / clkTck,
+                (double) (prev.stime - first.stime) / clkTck,
+                (prev.utime + prev.stime - first.utime - first.stime) *
+                        100.0 / clkTck / secs, peakCpu);
+        printf("    RSS:          final %ld KiB, peak %ld KiB\n",
+                prev.rss * pageKiB, peakRss * pageKiB);
+        printf("    Page faults:  minor %llu (%.0f/s), major %llu (%.0f/s)\n",
+                prev.minflt - first.minflt,
+                (prev.minflt - first.minflt) / secs,
+                prev.majflt - first.majflt,
+                (prev.majflt - first.majflt) / secs);
+        printf("    Threads:      %d\n", prev.threads);
+        if (haveSched)
+            printf("    Scheduling:   main thread %llu times (%.0f/s), "
+                    "run-queue wait %.3f s\n", prev.slices - first.slices,
+                    (prev.slices - first.slices) / secs,
+                    (prev.waitNs - first.waitNs) / 1e9);
+        if (haveIo)
+            printf("    I/O:          read %llu KiB (storage %llu KiB), "
+                    "written %llu KiB (storage %llu KiB)\n",
+                    (prev.rchar - first.rchar) / 1024,
+                    (prev.readBytes - first.readBytes) / 1024,
+                    (prev.wchar - first.wchar) / 1024,
+                    (prev.writeBytes - first.writeBytes) / 1024);
+    }
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        errExit("getrusage");
+    selfSecs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    printf("    Sampler:      %.1f us per sample (%.3f%% of one CPU); "
+            "total %.3f s CPU (%.2f%%)\n",
+            (numSamples > 1) ? readSecs * 1e6 / (numSamples - 1) : 0.0,
+            (numSamples > 1) ? readSecs * 100 / secs : 0.0,
+            selfSecs, selfSecs * 100 / tsDiff(&end, &start));
+
+    /* Reap our child (first terminating it, if sampling stopped while
+       it was still running), and show its context switches, which
+       (unlike /proc/PID/schedstat) cover all of its threads */
+
+    if (child) {
+        if (!exited && kill(pid, SIGTERM) == -1 && errno != ESRCH)
+            errExit("kill");
+        if (wait4(pid, &status, 0, &ru) == -1)
+            errExit("wait4");
+        printf("    Context switches: voluntary %ld, involuntary %ld\n",
+                ru.ru_nvcsw, ru.ru_nivcsw);
+    }
+
+    exit(EXIT_SUCCESS);
+}
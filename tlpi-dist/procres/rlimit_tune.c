@@ -0,0 +1,208 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 36 */
+
+/* rlimit_tune.c
+
+   rlimTuneInit(): find out how much of various resources the caller may
+   use, and recommend sizes for a server's listen() backlog, connection
+   and child process pools, worker pool, and per-connection buffers,
+   returning the results in 'rt'. Returns 0. (Values that can't be
+   determined are treated as unlimited, or given conservative defaults.)
+
+   Unless RT_NO_RAISE is specified in 'flags', the soft limits for
+   RLIMIT_NOFILE, RLIMIT_NPROC, RLIMIT_MEMLOCK, and RLIMIT_SIGPENDING are
+   first raised to the corresponding hard limits. (An unprivileged
+   process may always do this.) Note that a program that uses select()
+   can't use descriptors numbered FD_SETSIZE or higher, and so should not
+   act on a 'maxClients' larger than that.
+
+   The recommendations are:
+
+        backlog         the kernel's cap on the backlog (somaxconn); a
+                        larger value is silently reduced to this
+        maxClients      RLIMIT_NOFILE, less RT_RESERVE_FDS
+        maxChildren     RLIMIT_NPROC, less the processes (strictly,
+                        threads) that our real user ID already has, less
+                        RT_RESERVE_PROCS; or, if RLIMIT_NPROC is
+                        unlimited, half of the system-wide thread limit
+        workers         the number of CPUs in our CPU affinity mask
+        bufSize         RT_BUF_BUDGET (or a quarter of RLIMIT_DATA or
+                        RLIMIT_AS, if smaller) divided among 'maxClients'
+                        connections, within RT_MIN_BUF..RT_MAX_BUF
+
+   The Linux-specific values (somaxconn, the thread counts) are read from
+   /proc.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include "rlimit_tune.h"
+#include "tlpi_hdr.h"
+
+/* Return the value of 'resource''s soft limit (after raising it to the
+   hard limit, if 'raise' is TRUE), or -1 if it is unlimited */
+
+static long
+getLimit(int resource, Boolean raise)
+{
+    struct rlimit rl;
+
+    if (getrlimit(resource, &rl) == -1)
+        return -1;
+
+    if (raise && rl.rlim_cur != rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(resource, &rl) == -1 && getrlimit(resource, &rl) == -1)
+            return -1;
+    }
+
+    if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > LONG_MAX)
+        return -1;
+    return rl.rlim_cur;
+}
+
+/* Return the number in the file 'path', or 'deflt' if it can't be read */
+
+static long
+readProcLong(const char *path, long deflt)
+{
+    FILE *fp;
+    long val;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return deflt;
+    if (fscanf(fp, "%ld", &val) != 1)
+        val = deflt;
+    fclose(fp);
+    return val;
+}
+
+/* Return the number of threads whose real user ID is 'uid' (which is
+   what RLIMIT_NPROC limits), or -1 if /proc can't be read */
+
+static long
+countThreads(uid_t uid)
+{
+    char path[sizeof("/proc//status") + NAME_MAX], line[128];
+    struct dirent *dp;
+    DIR *dirp;
+    FILE *fp;
+    long total, threads, ruid;
+    Boolean match;
+
+    dirp = opendir("/proc");
+    if (dirp == NULL)
+        return -1;
+
+    total = 0;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (dp->d_name[0] < '1' || dp->d_name[0] > '9')
+            continue;                   /* Not a PID directory */
+
+        snprintf(path, sizeof(path), "/proc/%s/status", dp->d_name);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;                   /* Process has gone away */
+
+        match = FALSE;
+        threads = 1;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "Uid: %ld", &ruid) == 1)
+                match = ruid == (long) uid;
+            else if (sscanf(line, "Threads: %ld", &threads) == 1)
+                break;                  /* "Threads" follows "Uid" */
+        }
+        fclose(fp);
+
+        if (match)
+            total += threads;
+    }
+
+    closedir(dirp);
+    return total;
+}
+
+static long
+countCpus(void)
+{
+    cpu_set_t set;
+    long n;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return CPU_COUNT(&set);
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+}
+
+int
+rlimTuneInit(struct rlimTune *rt, int flags)
+{
+    Boolean raise;
+    long budget, lim, n;
+
+    raise = !(flags & RT_NO_RAISE);
+
+    rt->nofile = getLimit(RLIMIT_NOFILE, raise);
+    rt->nproc = getLimit(RLIMIT_NPROC, raise);
+    rt->memlock = getLimit(RLIMIT_MEMLOCK, raise);
+    rt->sigpending = getLimit(RLIMIT_SIGPENDING, raise);
+    rt->procsInUse = countThreads(getuid());
+    rt->somaxconn = readProcLong("/proc/sys/net/core/somaxconn", SOMAXCONN);
+    rt->cpus = countCpus();
+
+    rt->backlog = (rt->somaxconn > INT_MAX) ? INT_MAX : rt->somaxconn;
+
+    n = (rt->nofile == -1) ? INT_MAX : rt->nofile - RT_RESERVE_FDS;
+    rt->maxClients = (n < 1) ? 1 : (n > INT_MAX) ? INT_MAX : n;
+
+    if (rt->nproc == -1)
+        n = readProcLong("/proc/sys/kernel/threads-max", 8192) / 2;
+    else
+        n = rt->nproc - ((rt->procsInUse > 0) ? rt->procsInUse : 0) -
+            RT_RESERVE_PROCS;
+    rt->maxChildren = (n < 1) ? 1 : (n > INT_MAX) ? INT_MAX : n;
+
+    rt->workers = rt->cpus;
+
+    budget = RT_BUF_BUDGET;
+    lim = getLimit(RLIMIT_DATA, FALSE);
+    if (lim != -1 && lim / 4 < budget)
+        budget = lim / 4;
+    lim = getLimit(RLIMIT_AS, FALSE);
+    if (lim != -1 && lim / 4 < budget)
+        budget = lim / 4;
+
+    n = budget / rt->maxClients / RT_MIN_BUF * RT_MIN_BUF;
+    rt->bufSize = (n < RT_MIN_BUF) ? RT_MIN_BUF :
+                  (n > RT_MAX_BUF) ? RT_MAX_BUF : n;
+
+    return 0;
+}
+
+/* Display 'rt' on 'fp' */
+
+void
+rlimTunePrint(FILE *fp, const struct rlimTune *rt)
+{
+    fprintf(fp, "Limits: nofile=%ld nproc=%ld (in use %ld) memlock=%ld "
+            "sigpending=%ld somaxconn=%ld cpus=%ld\n", rt->nofile,
+            rt->nproc, rt->procsInUse, rt->memlock, rt->sigpending,
+            rt->somaxconn, rt->cpus);
+    fprintf(fp, "Recommended: backlog=%d maxClients=%d maxChildren=%d "
+            "workers=%d bufSize=%zu\n", rt->backlog, rt->maxClients,
+            rt->maxChildren, rt->workers, rt->bufSize);
+}
@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 36 */
+
+/* rlimit_tune.h
+
+   Header file for rlimit_tune.c.
+*/
+#ifndef RLIMIT_TUNE_H
+#define RLIMIT_TUNE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Bit-mask values for 'flags' argument of rlimTuneInit() */
+
+#define RT_NO_RAISE     01      /* Don't raise soft limits to hard limits */
+
+#define RT_RESERVE_FDS  16      /* Descriptors not counted in 'maxClients',
+                                   for listening sockets, log files, etc. */
+#define RT_RESERVE_PROCS 4      /* Processes not counted in 'maxChildren' */
+#define RT_BUF_BUDGET   (64 * 1024 * 1024)
+                                /* Default total for connection buffers */
+#define RT_MIN_BUF      4096    /* Range for 'bufSize' */
+#define RT_MAX_BUF      65536
+
+struct rlimTune {
+
+    /* What the system allows, after any raising of soft limits. -1 means
+       unlimited. */
+
+    long nofile;                /* RLIMIT_NOFILE soft limit */
+    long nproc;                 /* RLIMIT_NPROC soft limit */
+    long procsInUse;            /* Processes (threads) of our real UID */
+    long memlock;               /* RLIMIT_MEMLOCK soft limit (bytes) */
+    long sigpending;            /* RLIMIT_SIGPENDING soft limit */
+    long somaxconn;             /* Kernel's cap on listen() backlog */
+    long cpus;                  /* CPUs we may run on */
+
+    /* Recommendations derived from the above */
+
+    int backlog;                /* For listen() */
+    int maxClients;             /* Concurrently open connections */
+    int maxChildren;            /* Concurrent child processes */
+    int workers;                /* Threads or processes for CPU-bound
+                                   work */
+    size_t bufSize;             /* Per-connection buffer */
+};
+
+int rlimTuneInit(struct rlimTune *rt, int flags);
+
+void rlimTunePrint(FILE *fp, const struct rlimTune *rt);
+
+#endif
@@ -0,0 +1,799 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_arena.c
+
+   A memory allocator that manages a POSIX shared memory object, so that
+   processes can build linked data structures in shared memory.
+
+   Each process may map the object at a different address, so the object
+   contains no pointers: blocks are identified by their offset from the
+   start of the object, and shmArenaPtr() converts an offset to an
+   address in the calling process.
+
+   The object starts small and is enlarged (with ftruncate()) as needed.
+   So that enlarging the object never moves blocks that a process is
+   already using, each process reserves (with a PROT_NONE mapping) enough
+   address space for the largest size that the object may reach, and maps
+   the object over the start of that range. When a process encounters an
+   offset beyond the part of the object that it has mapped (because
+   another process has enlarged the object), it maps the remainder of the
+   object (with MAP_FIXED) over the next part of the reserved range.
+
+   Each block is preceded by a 16-byte header that records its size, and
+   requests of up to 32 kB (including the header) are rounded up to one of
+   39 size classes (four per power of two). Each size class has its own
+   list of free blocks, a lock-free stack whose head is updated with an
+   atomic compare-and-swap; the head includes a counter that changes on
+   every update, so that a process that read the head before a block was
+   removed and put back (the "ABA problem") can't corrupt the list. When
+   a class has no free blocks, a new run of blocks is carved from the
+   uncarved end of the object, which is also done without locking.
+
+   Larger requests are rounded up to a multiple of the page size, and are
+   kept on a single list, in address order, so that adjacent free blocks
+   can be merged. This list is protected by a process-shared mutex, as is
+   enlarging the object.
+
+   Blocks of the size classes are never merged or returned to other
+   classes, so a workload whose sizes shift over time leaves memory
+   stranded in free lists; shmArenaGetStats() reports how much (external
+   fragmentation), and how much is lost to rounding up requests (internal
+   fragmentation).
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "shm_arena.h"
+#include "tlpi_hdr.h"
+
+#define SA_MAGIC 0x53414e41     /* Set once the object is initialized */
+
+#define CACHE_LINE 64
+#define UNIT 16                 /* Alignment and granularity of blocks */
+
+#define NUM_CLASSES 39
+#define SMALL_MAX 32768         /* Size of largest size class */
+#define RUN_BYTES 65536         /* Preferred size of run of new blocks */
+
+#define BLOCK_USED 0xa110       /* Values for 'state' in block header */
+#define BLOCK_FREE 0xf4ee
+
+struct blockHdr {               /* Precedes each block */
+    uint64_t size;              /* Size of block, including header */
+    uint32_t len;               /* Bytes requested */
+    uint16_t cls;               /* Size class, or NUM_CLASSES if large */
+    uint16_t state;             /* BLOCK_USED or BLOCK_FREE */
+};
+
+/* Free-list link, which follows the header of a free block. Small blocks
+   are linked by offset / UNIT, so that the link and a counter fit in
+   the 64-bit head of a size class list. */
+
+union freeLink {
+    uint32_t nextUnit;          /* For a size class; 0 ends list */
+    uint64_t next;              /* For the large block list; 0 ends list */
+};
+
+struct sizeClass {              /* One per cache line */
+    uint64_t head;              /* Counter << 32 | first block / UNIT */
+    uint64_t carvedBlocks;
+    uint64_t inUseBlocks;
+    uint64_t requested;         /* Bytes requested for blocks in use */
+    char pad[CACHE_LINE - 4 * sizeof(uint64_t)];
+};
+
+struct shmArenaSeg {            /* Start of the shared memory object */
+    uint32_t magic;             /* SA_MAGIC once initialized */
+    uint32_t flags;
+    uint64_t maxSize;
+    uint64_t size;              /* Current size of object */
+    uint64_t top;               /* Offset of uncarved part of object */
+    uint64_t root;
+    uint64_t grows;
+    uint64_t bigList;           /* First free large block */
+    uint64_t bigInUse;          /* Bytes in allocated large blocks */
+    uint64_t bigRequested;
+    pthread_mutex_t lock;       /* Used with SHM_ARENA_LOCKED */
+    pthread_mutex_t bigLock;    /* Protects large block list */
+    pthread_mutex_t growLock;   /* Serializes enlarging of object */
+    struct sizeClass cls[NUM_CLASSES];
+};
+
+/* Offset of first block (the header occupies whole cache lines, so the
+   size classes do too) */
+
+#define FIRST_BLOCK ((sizeof(struct shmArenaSeg) + CACHE_LINE - 1) / \
+                     CACHE_LINE * CACHE_LINE)
+
+/* Return the size class for a block of 'size' bytes (a multiple of UNIT,
+   and no more than SMALL_MAX), and the size of blocks of that class */
+
+static int
+classOf(uint64_t size)
+{
+    int e;
+
+    if (size <= 64)
+        return (size <= 32) ? 0 : size / UNIT - 2;
+
+    e = 63 - __builtin_clzll(size - 1);         /* 2^e < size <= 2^(e+1) */
+    return 3 + (e - 6) * 4 + (((size - 1) >> (e - 2)) & 3);
+}
+
+static uint64_t
+classSize(int c)
+{
+    int e;
+
+    if (c < 3)
+        return (c + 2) * UNIT;
+    e = 6 + (c - 3) / 4;
+    return (1ULL << e) + ((c - 3) % 4 + 1) * (1ULL << (e - 2));
+}
+
+/* Make sure that the first 'end' bytes of the object are mapped in this
+   process. Returns: 0 on success, or -1 on error (EINVAL if the object
+   isn't that large). */
+
+static int
+ensureMapped(struct shmArena *sa, uint64_t end)
+{
+    size_t mapped;
+    uint64_t size;
+
+    mapped = __atomic_load_n(&sa->mapped, __ATOMIC_ACQUIRE);
+    if (end <= mapped)
+        return 0;
+
+    size = __atomic_load_n(&sa->seg->size, __ATOMIC_ACQUIRE);
+    if (end > size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Other threads may do the same concurrently, which is harmless */
+
+    if (mmap((char *) sa->seg + mapped, size - mapped,
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             sa->fd, mapped) == MAP_FAILED)
+        return -1;
+    __atomic_store_n(&sa->mapped, size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Return the address of the block header at offset 'off', which must be
+   within the object */
+
+static struct blockHdr *
+hdrAt(struct shmArena *sa, uint64_t off)
+{
+    if (ensureMapped(sa, off + sizeof(struct blockHdr) +
+                     sizeof(union freeLink)) == -1)
+        return NULL;
+    return (struct blockHdr *) ((char *) sa->seg + off);
+}
+
+static union freeLink *
+linkOf(struct blockHdr *b)
+{
+    return (union freeLink *) (b + 1);
+}
+
+/* Enlarge the object so that it has at least 'need' bytes */
+
+static int
+grow(struct shmArena *sa, uint64_t need)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    uint64_t size, newSize;
+    long pageSize;
+    int s, ret;
+
+    if (need > seg->maxSize) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    s = pthread_mutex_lock(&seg->growLock);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+
+    ret = 0;
+    size = seg->size;
+    if (size < need) {          /* Not already done by another process */
+        pageSize = sysconf(_SC_PAGESIZE);
+        for (newSize = size * 2; newSize < need; newSize *= 2)
+            continue;
+        newSize = (newSize + pageSize - 1) / pageSize * pageSize;
+        if (newSize > seg->maxSize)
+            newSize = seg->maxSize;
+
+        if (ftruncate(sa->fd, newSize) == -1) {
+            ret = -1;
+        } else {
+            __atomic_store_n(&seg->size, newSize, __ATOMIC_RELEASE);
+            seg->grows++;
+        }
+    }
+
+    s = errno;
+    pthread_mutex_unlock(&seg->growLock);
+    errno = s;
+    return ret;
+}
+
+/* Carve 'len' bytes from the uncarved part of the object, enlarging it
+   if necessary. Returns: offset of carved space, or 0 on error. */
+
+static uint64_t
+carve(struct shmArena *sa, uint64_t len)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    uint64_t top;
+
+    top = __atomic_load_n(&seg->top, __ATOMIC_RELAXED);
+    for (;;) {
+        if (top + len > __atomic_load_n(&seg->size, __ATOMIC_ACQUIRE)) {
+            if (grow(sa, top + len) == -1)
+                return 0;
+            top = __atomic_load_n(&seg->top, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /* On failure, 'top' is updated to the current value */
+
+        if (__atomic_compare_exchange_n(&seg->top, &top, top + len, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (ensureMapped(sa, top + len) == -1)
+        return 0;
+    return top;
+}
+
+/* Push the chain of blocks from 'first' to 'last' (offsets), which are
+   already linked together, onto the free list of 'sc' */
+
+static void
+pushChain(struct shmArena *sa, struct sizeClass *sc, uint64_t first,
+          uint64_t last)
+{
+    union freeLink *lastLink;
+    uint64_t head, newHead;
+
+    lastLink = linkOf((struct blockHdr *) ((char *) sa->seg + last));
+    head = __atomic_load_n(&sc->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&lastLink->nextUnit, (uint32_t) head,
+                         __ATOMIC_RELAXED);
+        newHead = ((head >> 32) + 1) << 32 | first / UNIT;
+    } while (!__atomic_compare_exchange_n(&sc->head, &head, newHead, 0,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+/* Take a block from the free list of class 'c', carving a new run of
+   blocks if the list is empty. Returns: offset of block, or 0 on
+   error. */
+
+static uint64_t
+popBlock(struct shmArena *sa, int c)
+{
+    struct sizeClass *sc = &sa->seg->cls[c];
+    struct blockHdr *b;
+    uint64_t head, newHead, off, size, run, j;
+    uint32_t next;
+
+    head = __atomic_load_n(&sc->head, __ATOMIC_ACQUIRE);
+    while ((uint32_t) head != 0) {
+        off = (uint64_t) (uint32_t) head * UNIT;
+        b = hdrAt(sa, off);
+        if (b == NULL)
+            return 0;
+
+        /* If another process takes this block first, it may overwrite
+           the link, but then the counter in the head will have changed,
+           and the compare-and-swap will fail */
+
+        next = __atomic_load_n(&linkOf(b)->nextUnit, __ATOMIC_RELAXED);
+        newHead = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&sc->head, &head, newHead, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            return off;
+    }
+
+    /* List is empty: carve a run of blocks, keep the first, and put the
+       rest on the list */
+
+    size = classSize(c);
+    run = (size >= RUN_BYTES / 2) ? 2 : RUN_BYTES / size;
+    off = carve(sa, run * size);
+    if (off == 0)
+        return 0;
+    __atomic_fetch_add(&sc->carvedBlocks, run, __ATOMIC_RELAXED);
+
+    for (j = 1; j < run; j++) {
+        b = (struct blockHdr *) ((char *) sa->seg + off + j * size);
+        b->size = size;
+        b->cls = c;
+        b->state = BLOCK_FREE;
+        linkOf(b)->nextUnit = (off + (j + 1) * size) / UNIT;
+    }
+    if (run > 1)
+        pushChain(sa, sc, off + size, off + (run - 1) * size);
+    return off;
+}
+
+/* Allocate a large block of 'size' bytes (a multiple of the page size),
+   taking the first free block that is big enough, or else carving a new
+   one. Called with 'bigLock' held. */
+
+static uint64_t
+bigAlloc(struct shmArena *sa, uint64_t size)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    struct blockHdr *b, *prev;
+    uint64_t off;
+
+    /* All blocks on the list lie below 'top' */
+
+    if (ensureMapped(sa, __atomic_load_n(&seg->top, __ATOMIC_ACQUIRE)) == -1)
+        return 0;
+
+    prev = NULL;
+    for (off = seg->bigList; off != 0; off = linkOf(b)->next) {
+        b = (struct blockHdr *) ((char *) seg + off);
+        if (b->size >= size) {
+            if (b->size - size >= SMALL_MAX) {
+
+                /* Split: take the end of the block, leaving the rest in
+                   place on the list */
+
+                b->size -= size;
+                off += b->size;
+                b = (struct blockHdr *) ((char *) seg + off);
+                b->size = size;
+            } else {
+                if (prev == NULL)
+                    seg->bigList = linkOf(b)->next;
+                else
+                    linkOf(prev)->next = linkOf(b)->next;
+            }
+            return off;
+        }
+        prev = b;
+    }
+
+    off = carve(sa, size);
+    if (off != 0)
+        ((struct blockHdr *) ((char *) seg + off))->size = size;
+    return off;
+}
+
+/* Return large block 'b' at 'off' to the list, merging it with adjacent
+   free blocks. Called with 'bigLock' held. */
+
+static void
+bigFree(struct shmArena *sa, struct blockHdr *b, uint64_t off)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    struct blockHdr *prev, *next;
+    uint64_t prevOff, nextOff;
+
+    if (ensureMapped(sa, __atomic_load_n(&seg->top, __ATOMIC_ACQUIRE)) == -1)
+        return;                         /* Can't happen: 'b' is mapped */
+
+    prevOff = 0;
+    prev = NULL;
+    for (nextOff = seg->bigList; nextOff != 0 && nextOff < off;
+            nextOff = linkOf(next)->next) {
+        next = (struct blockHdr *) ((char *) seg + nextOff);
+        prevOff = nextOff;
+        prev = next;
+    }
+
+    if (nextOff != 0 && off + b->size == nextOff) {
+        next = (struct blockHdr *) ((char *) seg + nextOff);
+        b->size += next->size;
+        nextOff = linkOf(next)->next;
+    }
+    linkOf(b)->next = nextOff;
+
+    if (prev != NULL && prevOff + prev->size == off) {
+        prev->size += b->size;
+        linkOf(prev)->next = nextOff;
+    } else if (prev != NULL) {
+        linkOf(prev)->next = off;
+    } else {
+        seg->bigList = off;
+    }
+}
+
+static int
+lockArena(pthread_mutex_t *mtx)
+{
+    int s;
+
+    s = pthread_mutex_lock(mtx);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+unlockArena(pthread_mutex_t *mtx)
+{
+    int savedErrno;
+
+    savedErrno = errno;
+    pthread_mutex_unlock(mtx);
+    errno = savedErrno;
+}
+
+uint64_t
+shmArenaAlloc(struct shmArena *sa, size_t len)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    struct blockHdr *b;
+    Boolean locked;
+    uint64_t size, off;
+    long pageSize;
+    int c;
+
+    if (len > UINT32_MAX) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    locked = (seg->flags & SHM_ARENA_LOCKED) != 0;
+    if (locked && lockArena(&seg->lock) == -1)
+        return 0;
+
+    size = (len + sizeof(struct blockHdr) + UNIT - 1) / UNIT * UNIT;
+    if (size <= SMALL_MAX) {
+        c = classOf(size);
+        off = popBlock(sa, c);
+        if (off != 0) {
+            b = (struct blockHdr *) ((char *) seg + off);
+            b->size = classSize(c);
+            __atomic_fetch_add(&seg->cls[c].inUseBlocks, 1,
+                               __ATOMIC_RELAXED);
+            __atomic_fetch_add(&seg->cls[c].requested, len,
+                               __ATOMIC_RELAXED);
+        }
+    } else {
+        c = NUM_CLASSES;
+        pageSize = sysconf(_SC_PAGESIZE);
+        size = (size + pageSize - 1) / pageSize * pageSize;
+        if (lockArena(&seg->bigLock) == -1) {
+            off = 0;
+        } else {
+            off = bigAlloc(sa, size);
+            if (off != 0) {
+                b = (struct blockHdr *) ((char *) seg + off);
+                seg->bigInUse += b->size;
+                seg->bigRequested += len;
+            }
+            unlockArena(&seg->bigLock);
+        }
+    }
+
+    if (off != 0) {
+        b = (struct blockHdr *) ((char *) seg + off);
+        b->len = len;
+        b->cls = c;
+        b->state = BLOCK_USED;
+        off += sizeof(struct blockHdr);
+    }
+
+    if (locked)
+        unlockArena(&seg->lock);
+    return off;
+}
+
+int
+shmArenaFree(struct shmArena *sa, uint64_t off)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    struct blockHdr *b;
+    struct sizeClass *sc;
+    uint16_t state;
+    Boolean locked;
+    int ret;
+
+    if (off < FIRST_BLOCK + sizeof(struct blockHdr) || off % UNIT != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    off -= sizeof(struct blockHdr);
+    b = hdrAt(sa, off);
+    if (b == NULL)
+        return -1;
+
+    /* Catch (most) attempts to free a block twice */
+
+    state = BLOCK_USED;
+    if (b->cls > NUM_CLASSES ||
+            !__atomic_compare_exchange_n(&b->state, &state, BLOCK_FREE, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    locked = (seg->flags & SHM_ARENA_LOCKED) != 0;
+    if (locked && lockArena(&seg->lock) == -1)
+        return -1;
+
+    ret = 0;
+    if (b->cls < NUM_CLASSES) {
+        sc = &seg->cls[b->cls];
+        __atomic_fetch_sub(&sc->inUseBlocks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&sc->requested, b->len, __ATOMIC_RELAXED);
+        pushChain(sa, sc, off, off);
+    } else if (lockArena(&seg->bigLock) == -1) {
+        ret = -1;
+    } else {
+        seg->bigInUse -= b->size;
+        seg->bigRequested -= b->len;
+        bigFree(sa, b, off);
+        unlockArena(&seg->bigLock);
+    }
+
+    if (locked)
+        unlockArena(&seg->lock);
+    return ret;
+}
+
+void *
+shmArenaPtr(struct shmArena *sa, uint64_t off)
+{
+    uint64_t size;
+
+    /* The block may extend beyond the part of the object that we have
+       mapped, even if 'off' does not, so map all of the object as it is
+       now; it was at least this large when the block was carved */
+
+    size = __atomic_load_n(&sa->seg->size, __ATOMIC_ACQUIRE);
+    if (off < FIRST_BLOCK || off >= size || ensureMapped(sa, size) == -1)
+        return NULL;
+    return (char *) sa->seg + off;
+}
+
+uint64_t
+shmArenaOffset(struct shmArena *sa, const void *p)
+{
+    return (p == NULL) ? 0 : (uint64_t) ((const char *) p -
+                                         (const char *) sa->seg);
+}
+
+void
+shmArenaSetRoot(struct shmArena *sa, uint64_t off)
+{
+    __atomic_store_n(&sa->seg->root, off, __ATOMIC_RELEASE);
+}
+
+uint64_t
+shmArenaRoot(struct shmArena *sa)
+{
+    return __atomic_load_n(&sa->seg->root, __ATOMIC_ACQUIRE);
+}
+
+void
+shmArenaGetStats(struct shmArena *sa, struct shmArenaStats *st)
+{
+    struct shmArenaSeg *seg = sa->seg;
+    struct sizeClass *sc;
+    struct blockHdr *b;
+    uint64_t off, carved, inUse;
+    int c;
+
+    memset(st, 0, sizeof(struct shmArenaStats));
+    st->size = __atomic_load_n(&seg->size, __ATOMIC_ACQUIRE);
+    st->maxSize = seg->maxSize;
+    st->carved = __atomic_load_n(&seg->top, __ATOMIC_RELAXED) - FIRST_BLOCK;
+    st->grows = seg->grows;
+
+    for (c = 0; c < NUM_CLASSES; c++) {
+        sc = &seg->cls[c];
+        carved = __atomic_load_n(&sc->carvedBlocks, __ATOMIC_RELAXED);
+        inUse = __atomic_load_n(&sc->inUseBlocks, __ATOMIC_RELAXED);
+        st->inUse += inUse * classSize(c);
+        st->requested += __atomic_load_n(&sc->requested, __ATOMIC_RELAXED);
+        st->freeSmall += (carved - inUse) * classSize(c);
+    }
+
+    if (lockArena(&seg->bigLock) == 0) {
+        st->inUse += seg->bigInUse;
+        st->requested += seg->bigRequested;
+        ensureMapped(sa, __atomic_load_n(&seg->top, __ATOMIC_ACQUIRE));
+        for (off = seg->bigList; off != 0; off = linkOf(b)->next) {
+            b = (struct blockHdr *) ((char *) seg + off);
+            st->freeLarge += b->size;
+            if (b->size > st->largestFree)
+                st->largestFree = b->size;
+        }
+        unlockArena(&seg->bigLock);
+    }
+}
+
+/* Reserve 'maxSize' bytes of address space, and map the first 'size'
+   bytes of the object 'fd' there. Returns: pointer to handle, or NULL
+   on error. */
+
+static struct shmArena *
+attach(int fd, size_t size, size_t maxSize)
+{
+    struct shmArena *sa;
+    char *base;
+    int savedErrno;
+
+    sa = malloc(sizeof(struct shmArena));
+    if (sa == NULL)
+        return NULL;
+
+    base = mmap(NULL, maxSize, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        goto fail;
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED) {
+        savedErrno = errno;
+        munmap(base, maxSize);
+        errno = savedErrno;
+        goto fail;
+    }
+
+    sa->seg = (struct shmArenaSeg *) base;
+    sa->maxSize = maxSize;
+    sa->mapped = size;
+    sa->fd = fd;
+    return sa;
+
+fail:
+    savedErrno = errno;
+    free(sa);
+    errno = savedErrno;
+    return NULL;
+}
+
+struct shmArena *
+shmArenaCreate(const char *name, size_t initSize, size_t maxSize, int flags,
+               mode_t perms)
+{
+    pthread_mutexattr_t mattr;
+    struct shmArenaSeg *seg;
+    struct shmArena *sa;
+    long pageSize;
+    int fd, s;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (initSize < FIRST_BLOCK)
+        initSize = FIRST_BLOCK;
+    initSize = (initSize + pageSize - 1) / pageSize * pageSize;
+    maxSize = (maxSize + pageSize - 1) / pageSize * pageSize;
+    if (maxSize < initSize || maxSize > SHM_ARENA_MAX_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, perms);
+    if (fd == -1)
+        return NULL;
+    if (ftruncate(fd, initSize) == -1)
+        goto fail;
+    sa = attach(fd, initSize, maxSize);
+    if (sa == NULL)
+        goto fail;
+
+    /* The new object is zero-filled, so all lists are empty */
+
+    seg = sa->seg;
+    seg->flags = flags;
+    seg->maxSize = maxSize;
+    seg->size = initSize;
+    seg->top = FIRST_BLOCK;
+
+    s = pthread_mutexattr_init(&mattr);
+    if (s == 0)
+        s = pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    if (s == 0)
+        s = pthread_mutex_init(&seg->lock, &mattr);
+    if (s == 0)
+        s = pthread_mutex_init(&seg->bigLock, &mattr);
+    if (s == 0)
+        s = pthread_mutex_init(&seg->growLock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    if (s != 0) {
+        shmArenaClose(sa);
+        shm_unlink(name);
+        errno = s;
+        return NULL;
+    }
+
+    /* Only now may other processes use the arena */
+
+    __atomic_store_n(&seg->magic, SA_MAGIC, __ATOMIC_RELEASE);
+    return sa;
+
+fail:
+    s = errno;
+    shm_unlink(name);
+    close(fd);
+    errno = s;
+    return NULL;
+}
+
+struct shmArena *
+shmArenaOpen(const char *name)
+{
+    struct shmArenaSeg *seg;
+    struct shmArena *sa;
+    struct stat sb;
+    uint64_t maxSize;
+    int fd, tries, savedErrno;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+
+    /* The creator may not yet have sized and initialized the object;
+       allow it a little time to do so */
+
+    for (tries = 0; ; tries++) {
+        if (fstat(fd, &sb) == -1)
+            goto fail;
+        if (sb.st_size >= (off_t) FIRST_BLOCK) {
+            seg = mmap(NULL, FIRST_BLOCK, PROT_READ, MAP_SHARED, fd, 0);
+            if (seg == MAP_FAILED)
+                goto fail;
+            if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) == SA_MAGIC)
+                break;
+            munmap(seg, FIRST_BLOCK);
+        }
+        if (tries == 100) {
+            errno = EINVAL;             /* Not an arena */
+            goto fail;
+        }
+        usleep(10000);
+    }
+    maxSize = seg->maxSize;
+    munmap(seg, FIRST_BLOCK);
+
+    /* The object may grow between fstat() and mmap(); the extra part is
+       mapped when it is first needed */
+
+    sa = attach(fd, sb.st_size, maxSize);
+    if (sa == NULL)
+        goto fail;
+    return sa;
+
+fail:
+    savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    return NULL;
+}
+
+void
+shmArenaClose(struct shmArena *sa)
+{
+    munmap(sa->seg, sa->maxSize);
+    close(sa->fd);
+    free(sa);
+}
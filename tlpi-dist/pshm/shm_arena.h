@@ -0,0 +1,97 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_arena.h
+
+   Header file for shm_arena.c.
+*/
+#ifndef SHM_ARENA_H
+#define SHM_ARENA_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bit-mask value for 'flags' argument of shmArenaCreate() */
+
+#define SHM_ARENA_LOCKED 01     /* Serialize all allocations and frees
+                                   with a single mutex (for comparison) */
+
+#define SHM_ARENA_MAX_SIZE (64ULL << 30)        /* Largest possible arena */
+
+struct shmArenaSeg;             /* Layout of the shared memory object;
+                                   see shm_arena.c */
+
+struct shmArena {               /* Per-process handle for an arena */
+    struct shmArenaSeg *seg;    /* Start of reserved address range */
+    size_t maxSize;             /* Size of reserved address range */
+    size_t mapped;              /* Bytes of object currently mapped */
+    int fd;                     /* Used to grow and map the object */
+};
+
+struct shmArenaStats {
+    uint64_t size;              /* Current size of object */
+    uint64_t maxSize;           /* Size to which object may grow */
+    uint64_t carved;            /* Bytes divided into blocks so far */
+    uint64_t inUse;             /* Bytes in allocated blocks */
+    uint64_t requested;         /* Bytes requested for allocated blocks */
+    uint64_t freeSmall;         /* Bytes in free blocks of size classes */
+    uint64_t freeLarge;         /* Bytes in free large blocks */
+    uint64_t largestFree;       /* Largest free large block */
+    uint64_t grows;             /* Times the object has been enlarged */
+};
+
+/* Create an arena in the new POSIX shared memory object 'name'. The
+   object initially has 'initSize' bytes, and is enlarged as needed up
+   to 'maxSize' bytes. Returns: pointer to handle, or NULL on error. */
+
+struct shmArena *shmArenaCreate(const char *name, size_t initSize,
+                                size_t maxSize, int flags, mode_t perms);
+
+/* Open an arena created (possibly by another process) with
+   shmArenaCreate(). Returns: pointer to handle, or NULL on error. */
+
+struct shmArena *shmArenaOpen(const char *name);
+
+/* Allocate a block of at least 'len' bytes. Returns: offset of block
+   within the arena, or 0 on error (ENOMEM if the arena is full). */
+
+uint64_t shmArenaAlloc(struct shmArena *sa, size_t len);
+
+/* Free the block at offset 'off'. Returns: 0 on success, or -1 on error
+   (EINVAL if 'off' is not an allocated block). */
+
+int shmArenaFree(struct shmArena *sa, uint64_t off);
+
+/* Convert between offsets and addresses in this process. The address of
+   a block remains valid until shmArenaClose(). shmArenaPtr() returns NULL
+   for offset 0 or an invalid offset. */
+
+void *shmArenaPtr(struct shmArena *sa, uint64_t off);
+uint64_t shmArenaOffset(struct shmArena *sa, const void *p);
+
+/* Set or get an offset (initially 0) stored in the arena's header, by
+   which processes can find the data structure that the arena holds */
+
+void shmArenaSetRoot(struct shmArena *sa, uint64_t off);
+uint64_t shmArenaRoot(struct shmArena *sa);
+
+/* Fill in '*st'. Since other processes may be allocating and freeing
+   meanwhile, the figures are only approximately consistent. */
+
+void shmArenaGetStats(struct shmArena *sa, struct shmArenaStats *st);
+
+/* Unmap the arena and free 'sa' (the object itself is not removed) */
+
+void shmArenaClose(struct shmArena *sa);
+
+#endif
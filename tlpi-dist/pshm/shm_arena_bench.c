@@ -0,0 +1,325 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_arena_bench.c
+
+   Measure the rate at which several processes can allocate and free
+   blocks concurrently in a shared memory arena (see shm_arena.c), using
+   the lock-free size class lists, and with all operations serialized by
+   a single mutex (SHM_ARENA_LOCKED). For reference, the rate achieved
+   using malloc() (where each process has its own private heap) is also
+   shown.
+
+   Usage: shm_arena_bench [-n allocs] [-l live] [-m max-size] [-b big-pct]
+                          nprocs...
+
+   For each 'nprocs' (e.g., "1 2 4 8"), the program creates a new arena,
+   and 'nprocs' processes that each open it by name (and so map it at a
+   different address) and between them perform 'allocs' (default:
+   1000000) allocations. Each process keeps up to 'live' (default: 1000)
+   blocks allocated, freeing a randomly chosen one before allocating
+   another. Block sizes are chosen at random from 1 to 'max-size'
+   (default: 1024) bytes, except that 'big-pct' percent (default: 0) of
+   blocks are instead 32 kB to 256 kB, and so are allocated from the list
+   of large blocks. The arena starts at 64 kB, and so must be enlarged
+   as the test proceeds.
+
+   Each process writes a tag at both ends of each block that it
+   allocates, and checks the tags when freeing the block, so that blocks
+   wrongly allocated to two processes at once are detected.
+
+   For the lock-free arena, the program also displays the size that the
+   arena reached, the number of times it was enlarged, and the internal
+   and external fragmentation at the end of the test (when each process
+   still has 'live' blocks allocated).
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "shm_arena.h"
+#include "tlpi_hdr.h"
+
+#define SHM_NAME "/tlpi_shm_arena_bench"
+
+#define INIT_SIZE (64 * 1024)
+#define MAX_SIZE (1024 * 1024 * 1024)
+
+enum { M_LOCKFREE, M_LOCKED, M_MALLOC, NUM_METHODS };
+
+static const char *methodName[NUM_METHODS] = {
+    "lock-free/s", "one mutex/s", "malloc/s"
+};
+
+struct live {                   /* A block allocated by a child */
+    uint64_t off;               /* 0 if slot is empty */
+    void *p;
+    size_t len;
+};
+
+struct result {                 /* Results of one child */
+    long allocs;
+    long errors;                /* Corrupted blocks found */
+};
+
+static int numLive = 1000, maxLen = 1024, bigPct = 0;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+xorshift(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Write a tag identifying block 'n' of this process at both ends of the
+   block at 'p', or check that the tags are still there */
+
+static void
+setTag(struct live *b, uint64_t tag)
+{
+    memcpy(b->p, &tag, sizeof(tag));
+    memcpy((char *) b->p + b->len - sizeof(tag), &tag, sizeof(tag));
+}
+
+static Boolean
+tagOk(struct live *b, uint64_t tag)
+{
+    uint64_t head, tail;
+
+    memcpy(&head, b->p, sizeof(head));
+    memcpy(&tail, (char *) b->p + b->len - sizeof(tail), sizeof(tail));
+    return head == tag && tail == tag;
+}
+
+static uint64_t
+tagFor(int slot)
+{
+    return (uint64_t) getpid() << 32 | slot;
+}
+
+/* The operations of one child; 'sa' is NULL if malloc() is to be used */
+
+static void
+runChild(struct shmArena *sa, long allocs, struct result *r)
+{
+    struct live *blk, *b;
+    uint64_t rnd;
+    long j;
+    int slot;
+
+    blk = calloc(numLive, sizeof(struct live));
+    if (blk == NULL)
+        errExit("calloc");
+
+    rnd = getpid() * 2654435761u + 1;
+    for (j = 0; j < allocs; j++) {
+        slot = xorshift(&rnd) % numLive;
+        b = &blk[slot];
+
+        if (b->p != NULL) {
+            if (!tagOk(b, tagFor(slot)))
+                r->errors++;
+            if (sa == NULL)
+                free(b->p);
+            else if (shmArenaFree(sa, b->off) == -1)
+                errExit("shmArenaFree");
+        }
+
+        if ((int) (xorshift(&rnd) % 100) < bigPct)
+            b->len = 32768 + xorshift(&rnd) % (229376 + 1);
+        else
+            b->len = 1 + xorshift(&rnd) % maxLen;
+        if (b->len < 2 * sizeof(uint64_t))     /* Room for both tags */
+            b->len = 2 * sizeof(uint64_t);
+
+        if (sa == NULL) {
+            b->p = malloc(b->len);
+            if (b->p == NULL)
+                errExit("malloc");
+        } else {
+            b->off = shmArenaAlloc(sa, b->len);
+            if (b->off == 0)
+                errExit("shmArenaAlloc");
+            b->p = shmArenaPtr(sa, b->off);
+        }
+        setTag(b, tagFor(slot));
+    }
+
+    /* Check the remaining blocks; those in the arena are left allocated,
+       so that the arena's statistics reflect the final working set */
+
+    for (slot = 0; slot < numLive; slot++) {
+        b = &blk[slot];
+        if (b->p == NULL)
+            continue;
+        if (!tagOk(b, tagFor(slot)))
+            r->errors++;
+        if (sa == NULL)
+            free(b->p);
+    }
+
+    r->allocs = allocs;
+    free(blk);
+}
+
+/* Run 'nprocs' children that perform 'allocs' allocations between them
+   using 'method'. Returns the elapsed time; the children's results are
+   summed into '*total'. For the arena methods, '*st' receives the arena
+   statistics at the end of the test. */
+
+static double
+runTest(int method, int nprocs, long allocs, struct result *total,
+        struct shmArenaStats *st)
+{
+    struct shmArena *sa;
+    struct result *res;
+    int startPipe[2];
+    double start;
+    char ch;
+    int j;
+
+    res = mmap(NULL, nprocs * sizeof(struct result), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED)
+        errExit("mmap");
+
+    sa = NULL;
+    if (method != M_MALLOC) {
+        shm_unlink(SHM_NAME);
+        sa = shmArenaCreate(SHM_NAME, INIT_SIZE, MAX_SIZE,
+                            (method == M_LOCKED) ? SHM_ARENA_LOCKED : 0,
+                            S_IRUSR | S_IWUSR);
+        if (sa == NULL)
+            errExit("shmArenaCreate");
+    }
+
+    if (pipe(startPipe) == -1)
+        errExit("pipe");
+
+    for (j = 0; j < nprocs; j++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+
+        case 0:
+            close(startPipe[1]);
+            if (sa != NULL) {
+                shmArenaClose(sa);
+                sa = shmArenaOpen(SHM_NAME);
+                if (sa == NULL)
+                    errExit("shmArenaOpen");
+            }
+            if (read(startPipe[0], &ch, 1) == -1)
+                errExit("read");
+            runChild(sa, allocs / nprocs + (j < allocs % nprocs), &res[j]);
+            _exit(EXIT_SUCCESS);
+
+        default:
+            break;
+        }
+    }
+
+    usleep(100000);                     /* Let the children get ready */
+    start = nowSecs();
+    close(startPipe[1]);
+    close(startPipe[0]);
+
+    for (j = 0; j < nprocs; j++)
+        if (wait(NULL) == -1)
+            errExit("wait");
+    start = nowSecs() - start;
+
+    memset(total, 0, sizeof(struct result));
+    for (j = 0; j < nprocs; j++) {
+        total->allocs += res[j].allocs;
+        total->errors += res[j].errors;
+    }
+
+    if (sa != NULL) {
+        shmArenaGetStats(sa, st);
+        shmArenaClose(sa);
+        shm_unlink(SHM_NAME);
+    }
+    munmap(res, nprocs * sizeof(struct result));
+    return start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct shmArenaStats st, lockFreeSt;
+    struct result total;
+    double t;
+    long allocs;
+    int opt, nprocs, m, j;
+
+    allocs = 1000000;
+    while ((opt = getopt(argc, argv, "n:l:m:b:")) != -1) {
+        switch (opt) {
+        case 'n': allocs = getLong(optarg, GN_GT_0, "allocs");  break;
+        case 'l': numLive = getInt(optarg, GN_GT_0, "live");    break;
+        case 'm': maxLen = getInt(optarg, GN_GT_0, "max-size"); break;
+        case 'b': bigPct = getInt(optarg, 0, "big-pct");        break;
+        default:
+            usageErr("%s [-n allocs] [-l live] [-m max-size] [-b big-pct] "
+                    "nprocs...\n", argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-n allocs] [-l live] [-m max-size] [-b big-pct] "
+                "nprocs...\n", argv[0]);
+
+    printf("%6s", "procs");
+    for (m = 0; m < NUM_METHODS; m++)
+        printf("%13s", methodName[m]);
+    printf("%11s %6s %6s %6s\n", "size (kB)", "grows", "int %", "ext %");
+
+    for (j = optind; j < argc; j++) {
+        nprocs = getInt(argv[j], GN_GT_0, "nprocs");
+
+        printf("%6d", nprocs);
+        for (m = 0; m < NUM_METHODS; m++) {
+            t = runTest(m, nprocs, allocs, &total, &st);
+            if (m == M_LOCKFREE)
+                lockFreeSt = st;
+            printf("%13.0f", total.allocs / t);
+            fflush(stdout);
+            if (total.errors != 0)
+                printf(" (%ld corrupt blocks)", total.errors);
+        }
+
+        /* Internal fragmentation: bytes allocated but not requested;
+           external: free bytes in blocks already carved */
+
+        st = lockFreeSt;
+        printf("%11llu %6llu %6.1f %6.1f\n",
+                (unsigned long long) st.size / 1024,
+                (unsigned long long) st.grows,
+                100.0 * (st.inUse - st.requested) /
+                        (st.inUse ? st.inUse : 1),
+                100.0 * (st.freeSmall + st.freeLarge) /
+                        (st.carved ? st.carved : 1));
+    }
+
+    exit(EXIT_SUCCESS);
+}
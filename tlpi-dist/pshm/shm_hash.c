@@ -0,0 +1,497 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_hash.c
+
+   A fixed-size hash table, held in a POSIX shared memory object, that
+   unrelated processes can use as a shared cache without a server process.
+
+   The table is an array of fixed-size slots (open addressing): a key is
+   stored in one of the SH_PROBE_MAX slots that follow the slot selected
+   by its hash value. The object may be mapped at a different address in
+   each process, so it contains no pointers: the location of the slot
+   array is recorded as an offset from the start of the object.
+
+   Each slot has a sequence number that is odd while a writer is changing
+   the slot. Lookups take no locks: a reader copies what it needs from a
+   slot and then checks that the sequence number is unchanged and even,
+   retrying if not (as with the sequence counter in fs_monitor.h). Readers
+   never write to the shared memory, except to set a slot's reference bit
+   (see below) if it is not already set.
+
+   A writer first locks one of SH_STRIPES process-shared mutexes, chosen
+   by the key's hash value; this serializes updates to any one key. It
+   then takes ownership of the slot that it will change by using an
+   atomic compare-and-swap to make the slot's sequence number odd; this
+   fails if another writer (working on a different key that probes to the
+   same slot) has changed the slot since it was examined, in which case
+   the search is repeated.
+
+   When all of the slots available to a new key are in use, one is
+   evicted using the CLOCK algorithm: the slots are examined in turn,
+   starting at a rotating position; a slot whose reference bit is set
+   (because it was used since it was last examined) has the bit cleared
+   and is passed over; the first slot whose bit is clear is evicted.
+
+   Removed keys leave their slot marked as deleted rather than empty, so
+   that searches for other keys can still stop at the first empty slot.
+
+   If a process dies while updating the table, the update is left
+   incomplete, and other processes may then wait forever; the table must
+   then be removed and created afresh.
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include "shm_hash.h"
+#include "tlpi_hdr.h"
+
+#define SH_MAGIC 0x53484854     /* Set once the object is initialized */
+
+#define CACHE_LINE 64
+
+enum { SLOT_EMPTY, SLOT_USED, SLOT_DELETED };
+
+struct shmHashSeg {             /* Start of the shared memory object */
+    uint32_t magic;             /* SH_MAGIC once initialized */
+    uint32_t numSlots;
+    uint32_t valMax;
+    uint32_t slotSize;
+    uint64_t slotsOff;          /* Offset of slot array within object */
+    uint64_t size;              /* Size of object */
+    uint32_t clockHand;         /* Where the next eviction search starts */
+    uint64_t evictions;
+    pthread_mutex_t lock[SH_STRIPES];
+};
+
+struct shmHashSlot {
+    uint32_t seq;               /* Odd while a writer owns the slot */
+    uint8_t state;              /* SLOT_EMPTY, SLOT_USED, SLOT_DELETED */
+    uint8_t ref;                /* CLOCK reference bit */
+    uint16_t keyLen;            /* Excluding terminating null byte */
+    uint32_t hash;
+    uint32_t valLen;
+    char key[SH_KEY_MAX];
+    char val[];                 /* 'valMax' bytes */
+};
+
+static uint32_t
+hashKey(const char *key, size_t *lenp)
+{
+    uint32_t h;
+    size_t j;
+
+    for (h = 2166136261u, j = 0; key[j] != '\0'; j++)   /* FNV-1a */
+        h = (h ^ (unsigned char) key[j]) * 16777619u;
+    *lenp = j;
+    return h;
+}
+
+static struct shmHashSlot *
+slotAt(struct shmHash *sh, uint32_t n)
+{
+    return (struct shmHashSlot *) (sh->slots + (size_t) n * sh->slotSize);
+}
+
+/* Take ownership of 's', provided that its sequence number is still
+   'seq' (which must be even). Returns TRUE on success. */
+
+static Boolean
+slotLock(struct shmHashSlot *s, uint32_t seq)
+{
+    if (!__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return FALSE;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static void
+slotUnlock(struct shmHashSlot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Return the sequence number of 's', waiting while a writer owns it */
+
+static uint32_t
+slotSeq(struct shmHashSlot *s)
+{
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+    return seq;
+}
+
+static Boolean
+slotMatches(struct shmHashSlot *s, const char *key, size_t keyLen,
+            uint32_t h)
+{
+    return s->state == SLOT_USED && s->hash == h && s->keyLen == keyLen &&
+           memcmp(s->key, key, keyLen) == 0;
+}
+
+/* Fill in 'sh' for the object of 'size' bytes mapped at 'seg' */
+
+static void
+attach(struct shmHash *sh, struct shmHashSeg *seg, size_t size)
+{
+    sh->seg = seg;
+    sh->segSize = size;
+    sh->slots = (char *) seg + seg->slotsOff;
+    sh->slotSize = seg->slotSize;
+    sh->numSlots = seg->numSlots;
+    sh->valMax = seg->valMax;
+}
+
+struct shmHash *
+shmHashCreate(const char *name, long numSlots, size_t valMax, mode_t perms)
+{
+    pthread_mutexattr_t mattr;
+    struct shmHashSeg *seg;
+    struct shmHash *sh;
+    size_t slotSize, slotsOff, size;
+    int fd, j, s;
+
+    if (numSlots < SH_PROBE_MAX || numSlots > UINT32_MAX ||
+            valMax > UINT32_MAX / 2) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    slotsOff = (sizeof(struct shmHashSeg) + CACHE_LINE - 1) /
+               CACHE_LINE * CACHE_LINE;
+    slotSize = (sizeof(struct shmHashSlot) + valMax + CACHE_LINE - 1) /
+               CACHE_LINE * CACHE_LINE;
+    size = slotsOff + numSlots * slotSize;
+
+    sh = malloc(sizeof(struct shmHash));
+    if (sh == NULL)
+        return NULL;
+
+    if (name == NULL) {
+        seg = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    } else {
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, perms);
+        if (fd == -1)
+            goto fail;
+        if (ftruncate(fd, size) == -1) {
+            shm_unlink(name);
+            close(fd);
+            goto fail;
+        }
+        seg = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (seg == MAP_FAILED)
+            shm_unlink(name);
+    }
+    if (seg == MAP_FAILED)
+        goto fail;
+
+    /* The new object is zero-filled, so all slots are SLOT_EMPTY */
+
+    seg->numSlots = numSlots;
+    seg->valMax = valMax;
+    seg->slotSize = slotSize;
+    seg->slotsOff = slotsOff;
+    seg->size = size;
+
+    s = pthread_mutexattr_init(&mattr);
+    if (s == 0)
+        s = pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    for (j = 0; s == 0 && j < SH_STRIPES; j++)
+        s = pthread_mutex_init(&seg->lock[j], &mattr);
+    if (s != 0) {
+        munmap(seg, size);
+        if (name != NULL)
+            shm_unlink(name);
+        errno = s;
+        goto fail;
+    }
+    pthread_mutexattr_destroy(&mattr);
+
+    /* Only now may other processes use the table */
+
+    __atomic_store_n(&seg->magic, SH_MAGIC, __ATOMIC_RELEASE);
+
+    attach(sh, seg, size);
+    return sh;
+
+fail:
+    s = errno;
+    free(sh);
+    errno = s;
+    return NULL;
+}
+
+struct shmHash *
+shmHashOpen(const char *name)
+{
+    struct shmHashSeg *seg;
+    struct shmHash *sh;
+    struct stat sb;
+    int fd, tries, savedErrno;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+
+    /* The creator may not yet have sized and initialized the object;
+       allow it a little time to do so */
+
+    for (tries = 0; ; tries++) {
+        if (fstat(fd, &sb) == -1)
+            goto fail;
+        if (sb.st_size >= (off_t) sizeof(struct shmHashSeg)) {
+            seg = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+            if (seg == MAP_FAILED)
+                goto fail;
+            if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) == SH_MAGIC)
+                break;
+            munmap(seg, sb.st_size);
+        }
+        if (tries == 100) {
+            errno = EINVAL;             /* Not a table */
+            goto fail;
+        }
+        usleep(10000);
+    }
+    close(fd);
+
+    if (seg->size != (uint64_t) sb.st_size) {
+        munmap(seg, sb.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    sh = malloc(sizeof(struct shmHash));
+    if (sh == NULL) {
+        munmap(seg, sb.st_size);
+        return NULL;
+    }
+    attach(sh, seg, sb.st_size);
+    return sh;
+
+fail:
+    savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    return NULL;
+}
+
+ssize_t
+shmHashGet(struct shmHash *sh, const char *key, void *val, size_t max)
+{
+    struct shmHashSlot *s;
+    uint32_t h, seq, first;
+    size_t keyLen, len;
+    Boolean match, empty;
+    int j;
+
+    h = hashKey(key, &keyLen);
+    first = h % sh->numSlots;
+
+    for (j = 0; j < SH_PROBE_MAX; j++) {
+        s = slotAt(sh, (first + j) % sh->numSlots);
+
+        /* Copy what we need, and retry if a writer changed the slot
+           meanwhile. ('len' is checked before use, because if the copy
+           is inconsistent it may be garbage.) */
+
+        do {
+            seq = slotSeq(s);
+            empty = s->state == SLOT_EMPTY;
+            match = slotMatches(s, key, keyLen, h);
+            len = match ? s->valLen : 0;
+            if (match && len <= max)
+                memcpy(val, s->val, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
+
+        if (empty)
+            break;
+        if (match) {
+            if (!__atomic_load_n(&s->ref, __ATOMIC_RELAXED))
+                __atomic_store_n(&s->ref, 1, __ATOMIC_RELAXED);
+            if (len > max) {
+                errno = ERANGE;
+                return -1;
+            }
+            return len;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+/* Choose a slot to evict from the 'SH_PROBE_MAX' slots starting at
+   'first', returning it and its sequence number in '*seqp' */
+
+static struct shmHashSlot *
+chooseVictim(struct shmHash *sh, uint32_t first, uint32_t *seqp)
+{
+    struct shmHashSlot *s;
+    uint32_t hand;
+    int j;
+
+    hand = __atomic_fetch_add(&sh->seg->clockHand, 1, __ATOMIC_RELAXED);
+
+    /* Two passes suffice: the first clears any reference bits */
+
+    for (j = 0; ; j++) {
+        s = slotAt(sh, (first + (hand + j) % SH_PROBE_MAX) % sh->numSlots);
+        if (!__atomic_load_n(&s->ref, __ATOMIC_RELAXED) ||
+                j >= 2 * SH_PROBE_MAX) {
+            *seqp = slotSeq(s);
+            return s;
+        }
+        __atomic_store_n(&s->ref, 0, __ATOMIC_RELAXED);
+    }
+}
+
+/* Find the slot for 'key' (or, if 'val' is not NULL, a slot to which it
+   can be added), lock it, and store 'val' there or, if 'val' is NULL,
+   mark the slot deleted. Called with the key's stripe lock held. */
+
+static int
+update(struct shmHash *sh, const char *key, size_t keyLen, uint32_t h,
+       const void *val, size_t len)
+{
+    struct shmHashSlot *s, *target;
+    uint32_t seq, targetSeq, first;
+    Boolean found, evict;
+    int j;
+
+    first = h % sh->numSlots;
+
+    for (;;) {
+        target = NULL;
+        found = FALSE;
+        targetSeq = 0;
+
+        for (j = 0; j < SH_PROBE_MAX; j++) {
+            s = slotAt(sh, (first + j) % sh->numSlots);
+            seq = slotSeq(s);
+            if (slotMatches(s, key, keyLen, h)) {
+                target = s;
+                targetSeq = seq;
+                found = TRUE;
+                break;
+            }
+            if (s->state != SLOT_USED && target == NULL) {
+                target = s;             /* First free slot */
+                targetSeq = seq;
+            }
+            if (s->state == SLOT_EMPTY)
+                break;                  /* Key can't be further on */
+        }
+
+        if (!found && val == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        evict = FALSE;
+        if (target == NULL) {
+            target = chooseVictim(sh, first, &targetSeq);
+            evict = TRUE;
+        }
+
+        /* If another writer changed the slot since we examined it, what
+           we found may no longer be true; search again */
+
+        if (slotLock(target, targetSeq))
+            break;
+    }
+
+    if (val == NULL) {
+        target->state = SLOT_DELETED;
+    } else {
+        target->state = SLOT_USED;
+        target->hash = h;
+        target->keyLen = keyLen;
+        memcpy(target->key, key, keyLen + 1);
+        target->valLen = len;
+        memcpy(target->val, val, len);
+        __atomic_store_n(&target->ref, 1, __ATOMIC_RELAXED);
+    }
+    slotUnlock(target);
+
+    if (evict)
+        __atomic_fetch_add(&sh->seg->evictions, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Lock the stripe for key hash 'h', perform the update, and unlock */
+
+static int
+lockedUpdate(struct shmHash *sh, const char *key, const void *val,
+             size_t len)
+{
+    pthread_mutex_t *mtx;
+    size_t keyLen;
+    uint32_t h;
+    int s, ret, savedErrno;
+
+    h = hashKey(key, &keyLen);
+    if (keyLen >= SH_KEY_MAX || len > sh->valMax) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mtx = &sh->seg->lock[(h >> 16) % SH_STRIPES];
+    s = pthread_mutex_lock(mtx);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    ret = update(sh, key, keyLen, h, val, len);
+    savedErrno = errno;
+    pthread_mutex_unlock(mtx);
+    errno = savedErrno;
+    return ret;
+}
+
+int
+shmHashPut(struct shmHash *sh, const char *key, const void *val, size_t len)
+{
+    if (val == NULL && len != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return lockedUpdate(sh, key, (val == NULL) ? "" : val, len);
+}
+
+int
+shmHashDelete(struct shmHash *sh, const char *key)
+{
+    return lockedUpdate(sh, key, NULL, 0);
+}
+
+uint64_t
+shmHashEvictions(struct shmHash *sh)
+{
+    return __atomic_load_n(&sh->seg->evictions, __ATOMIC_RELAXED);
+}
+
+void
+shmHashClose(struct shmHash *sh)
+{
+    munmap(sh->seg, sh->segSize);
+    free(sh);
+}
@@ -0,0 +1,79 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_hash.h
+
+   Header file for shm_hash.c.
+*/
+#ifndef SHM_HASH_H
+#define SHM_HASH_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SH_KEY_MAX 64           /* Maximum length of a key, including
+                                   terminating null byte */
+#define SH_PROBE_MAX 16         /* Slots examined when looking for a key */
+#define SH_STRIPES 64           /* Number of writer locks */
+
+struct shmHashSeg;              /* Layout of the shared memory object;
+                                   see shm_hash.c */
+
+struct shmHash {                /* Per-process handle for a table */
+    struct shmHashSeg *seg;     /* Where the object is mapped */
+    size_t segSize;
+    char *slots;                /* Address of slot array in this process */
+    size_t slotSize;
+    uint32_t numSlots;
+    uint32_t valMax;
+};
+
+/* Create a table in the new POSIX shared memory object 'name', with
+   'numSlots' slots, each able to hold a value of up to 'valMax' bytes.
+   If 'name' is NULL, the table is instead created in an anonymous shared
+   mapping, and can be shared only with children created by fork().
+
+   Returns: pointer to handle, or NULL on error. */
+
+struct shmHash *shmHashCreate(const char *name, long numSlots, size_t valMax,
+                              mode_t perms);
+
+/* Open a table created (possibly by another process) with
+   shmHashCreate(). Returns: pointer to handle, or NULL on error. */
+
+struct shmHash *shmHashOpen(const char *name);
+
+/* Copy the value for 'key' into 'val', whose size is 'max'.
+   Returns: length of value, or -1 on error (ENOENT if there is no such
+   key; ERANGE if 'max' is too small). */
+
+ssize_t shmHashGet(struct shmHash *sh, const char *key, void *val,
+                   size_t max);
+
+/* Set or remove the value for 'key'. Setting a value may evict another
+   key. 'val' may be NULL only if 'len' is 0. Returns: 0 on success, or
+   -1 on error. */
+
+int shmHashPut(struct shmHash *sh, const char *key, const void *val,
+               size_t len);
+int shmHashDelete(struct shmHash *sh, const char *key);
+
+/* Return the number of keys evicted since the table was created */
+
+uint64_t shmHashEvictions(struct shmHash *sh);
+
+/* Unmap the table and free 'sh' (the object itself is not removed) */
+
+void shmHashClose(struct shmHash *sh);
+
+#endif
@@ -0,0 +1,421 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_hash_bench.c
+
+   Compare the throughput of a cache shared by several processes via the
+   shared memory hash table of shm_hash.c with that of a cache held by a
+   server process, which the other processes query over UNIX domain
+   sockets.
+
+   Usage: shm_hash_bench [-k keys] [-s slots] [-n ops] [-w write-pct]
+                         nprocs...
+
+   For each 'nprocs' (e.g., "1 2 4 8 16 32 64"), the program creates
+   'nprocs' processes that between them perform 'ops' (default: 1000000)
+   operations on the cache, first using a table in a POSIX shared memory
+   object, and then using the server. Each operation looks up a key
+   chosen at random from 'keys' (default: 10000) keys, and, if it is not
+   found, adds it (as a process using the cache to avoid recomputing
+   values would); 'write-pct' percent (default: 0) of operations instead
+   unconditionally set the key's value. The table has 'slots' slots
+   (default: twice 'keys'); if this is fewer than 'keys', the cache
+   evicts keys, and some lookups miss.
+
+   The program displays operations per second, and the percentage of
+   lookups that found their key, for each method. Every value found is
+   checked.
+*/
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <time.h>
+#include "shm_hash.h"
+#include "tlpi_hdr.h"
+
+#define SHM_NAME "/tlpi_shm_hash_bench"
+
+#define VAL_MAX 64
+
+#define REQ_GET 'G'             /* Server request types */
+#define REQ_PUT 'P'
+
+struct reqMsg {                 /* Request to server */
+    char type;
+    char key[SH_KEY_MAX];
+    char val[VAL_MAX];          /* For REQ_PUT */
+};
+
+struct respMsg {                /* Response from server */
+    char found;
+    char val[VAL_MAX];
+};
+
+struct counts {                 /* Results of one child */
+    long ops;
+    long lookups;
+    long hits;
+    long errors;                /* Wrong values found */
+};
+
+static int numKeys = 10000, writePct = 0;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+xorshift(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void
+makeKey(char *key, char *val, int n)
+{
+    snprintf(key, SH_KEY_MAX, "key-%d", n);
+    snprintf(val, VAL_MAX, "value-%d", n);
+}
+
+/* The operations of one child; 'sh' is NULL if the server (via 'sfd')
+   is to be used */
+
+static void
+runChild(struct shmHash *sh, int sfd, long ops, struct counts *c)
+{
+    char key[SH_KEY_MAX], val[VAL_MAX], got[VAL_MAX];
+    struct reqMsg req;
+    struct respMsg resp;
+    uint64_t rnd;
+    ssize_t len;
+    Boolean found;
+    long j;
+    int n;
+
+    rnd = getpid() * 2654435761u + 1;
+    for (j = 0; j < ops; j++) {
+        n = xorshift(&rnd) % numKeys;
+        makeKey(key, val, n);
+
+        if ((int) (xorshift(&rnd) % 100) < writePct) {
+            if (sh != NULL) {
+                if (shmHashPut(sh, key, val, strlen(val) + 1) == -1)
+                    errExit("shmHashPut");
+            } else {
+                req.type = REQ_PUT;
+                memcpy(req.key, key, SH_KEY_MAX);
+                memcpy(req.val, val, VAL_MAX);
+                if (write(sfd, &req, sizeof(req)) != sizeof(req) ||
+                        read(sfd, &resp, sizeof(resp)) <= 0)
+                    fatal("server request failed");
+            }
+            continue;
+        }
+
+        if (sh != NULL) {
+            len = shmHashGet(sh, key, got, sizeof(got));
+            if (len == -1 && errno != ENOENT)
+                errExit("shmHashGet");
+            found = len != -1;
+        } else {
+            req.type = REQ_GET;
+            memcpy(req.key, key, SH_KEY_MAX);
+            if (write(sfd, &req, sizeof(req)) != sizeof(req) ||
+                    read(sfd, &resp, sizeof(resp)) != sizeof(resp))
+                fatal("server request failed");
+            found = resp.found;
+            memcpy(got, resp.val, VAL_MAX);
+        }
+
+        c->lookups++;
+        if (found) {
+            c->hits++;
+            if (strcmp(got, val) != 0)
+                c->errors++;
+        } else {                        /* Miss: "compute" and add value */
+            if (sh != NULL) {
+                if (shmHashPut(sh, key, val, strlen(val) + 1) == -1)
+                    errExit("shmHashPut");
+            } else {
+                req.type = REQ_PUT;
+                memcpy(req.val, val, VAL_MAX);
+                if (write(sfd, &req, sizeof(req)) != sizeof(req) ||
+                        read(sfd, &resp, sizeof(resp)) <= 0)
+                    fatal("server request failed");
+            }
+        }
+    }
+    c->ops = ops;
+}
+
+/* Fill 'sh' with all keys */
+
+static void
+populate(struct shmHash *sh)
+{
+    char key[SH_KEY_MAX], val[VAL_MAX];
+    int n;
+
+    for (n = 0; n < numKeys; n++) {
+        makeKey(key, val, n);
+        if (shmHashPut(sh, key, val, strlen(val) + 1) == -1)
+            errExit("shmHashPut");
+    }
+}
+
+/* The cache server: serve requests on the 'nfds' sockets in 'fds' until
+   all have been closed, using a private table */
+
+static void
+runServer(int *fds, int nfds, long numSlots)
+{
+    struct pollfd *pfd;
+    struct shmHash *sh;
+    struct reqMsg req;
+    struct respMsg resp;
+    int open, j;
+    ssize_t len;
+
+    sh = shmHashCreate(NULL, numSlots, VAL_MAX, 0);
+    if (sh == NULL)
+        errExit("shmHashCreate");
+    populate(sh);
+
+    pfd = calloc(nfds, sizeof(struct pollfd));
+    if (pfd == NULL)
+        errExit("calloc");
+    for (j = 0; j < nfds; j++) {
+        pfd[j].fd = fds[j];
+        pfd[j].events = POLLIN;
+    }
+
+    for (open = nfds; open > 0; ) {
+        if (poll(pfd, nfds, -1) == -1)
+            errExit("poll");
+
+        for (j = 0; j < nfds; j++) {
+            if (pfd[j].revents == 0)
+                continue;
+
+            len = read(pfd[j].fd, &req, sizeof(req));
+            if (len <= 0) {
+                close(pfd[j].fd);
+                pfd[j].fd = -1;                 /* poll() ignores it */
+                open--;
+                continue;
+            }
+
+            memset(&resp, 0, sizeof(resp));
+            req.key[SH_KEY_MAX - 1] = '\0';
+            if (req.type == REQ_PUT) {
+                req.val[VAL_MAX - 1] = '\0';
+                if (shmHashPut(sh, req.key, req.val,
+                               strlen(req.val) + 1) == -1)
+                    errExit("shmHashPut");
+            } else {
+                resp.found = shmHashGet(sh, req.key, resp.val,
+                                        sizeof(resp.val)) != -1;
+            }
+            if (write(pfd[j].fd, &resp, sizeof(resp)) != sizeof(resp))
+                errMsg("write");
+        }
+    }
+
+    shmHashClose(sh);
+}
+
+/* Run 'nprocs' children that perform 'ops' operations between them,
+   using 'sh', or, if 'sh' is NULL, a server. Returns the elapsed time;
+   the children's results are summed into '*total'. */
+
+static double
+runTest(struct shmHash *sh, int nprocs, long ops, long numSlots,
+        struct counts *total)
+{
+    struct counts *cnt;
+    int (*sv)[2];
+    int startPipe[2];
+    pid_t serverPid, pid;
+    double start;
+    char ch;
+    int *fds;
+    int j, k;
+
+    cnt = mmap(NULL, nprocs * sizeof(struct counts), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cnt == MAP_FAILED)
+        errExit("mmap");
+    sv = malloc(nprocs * sizeof(*sv));
+    fds = malloc(nprocs * sizeof(int));
+    if (sv == NULL || fds == NULL)
+        errExit("malloc");
+
+    serverPid = 0;
+    if (sh == NULL) {
+        for (j = 0; j < nprocs; j++) {
+            if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv[j]) == -1)
+                errExit("socketpair");
+            fds[j] = sv[j][0];
+        }
+
+        serverPid = fork();
+        if (serverPid == -1)
+            errExit("fork");
+        if (serverPid == 0) {
+            for (j = 0; j < nprocs; j++)
+                close(sv[j][1]);
+            runServer(fds, nprocs, numSlots);
+            _exit(EXIT_SUCCESS);
+        }
+
+        for (j = 0; j < nprocs; j++)
+            close(sv[j][0]);
+    }
+
+    /* Create the children, which wait until the pipe is closed before
+       starting. (The pipe is created after the server, so that the server
+       doesn't hold it open.) */
+
+    if (pipe(startPipe) == -1)
+        errExit("pipe");
+
+    for (j = 0; j < nprocs; j++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+
+        case 0:
+            close(startPipe[1]);
+            if (read(startPipe[0], &ch, 1) == -1)
+                errExit("read");
+            if (sh == NULL)
+                for (k = 0; k < nprocs; k++)
+                    if (k != j)
+                        close(sv[k][1]);
+            runChild(sh, (sh == NULL) ? sv[j][1] : -1,
+                     ops / nprocs + (j < ops % nprocs), &cnt[j]);
+            _exit(EXIT_SUCCESS);
+
+        default:
+            break;
+        }
+    }
+
+    if (sh == NULL)
+        for (j = 0; j < nprocs; j++)
+            close(sv[j][1]);
+
+    usleep(100000);                     /* Let the children get ready */
+    start = nowSecs();
+    close(startPipe[1]);
+    close(startPipe[0]);
+
+    /* The time taken is that for all of the children to finish. (The
+       server finishes after them, but may be reaped first.) */
+
+    for (j = 0; j < nprocs; ) {
+        pid = waitpid(-1, NULL, 0);
+        if (pid == -1)
+            errExit("waitpid");
+        if (pid == serverPid)
+            serverPid = 0;
+        else
+            j++;
+    }
+    start = nowSecs() - start;
+
+    if (serverPid != 0 && waitpid(serverPid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    memset(total, 0, sizeof(struct counts));
+    for (j = 0; j < nprocs; j++) {
+        total->ops += cnt[j].ops;
+        total->lookups += cnt[j].lookups;
+        total->hits += cnt[j].hits;
+        total->errors += cnt[j].errors;
+    }
+
+    munmap(cnt, nprocs * sizeof(struct counts));
+    free(sv);
+    free(fds);
+    return start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct shmHash *sh;
+    struct counts cShm, cSrv;
+    double tShm, tSrv;
+    long numSlots, ops;
+    int opt, nprocs, j;
+
+    numSlots = 0;
+    ops = 1000000;
+    while ((opt = getopt(argc, argv, "k:s:n:w:")) != -1) {
+        switch (opt) {
+        case 'k': numKeys = getInt(optarg, GN_GT_0, "keys");    break;
+        case 's': numSlots = getLong(optarg, GN_GT_0, "slots"); break;
+        case 'n': ops = getLong(optarg, GN_GT_0, "ops");        break;
+        case 'w': writePct = getInt(optarg, 0, "write-pct");    break;
+        default:
+            usageErr("%s [-k keys] [-s slots] [-n ops] [-w write-pct] "
+                    "nprocs...\n", argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-k keys] [-s slots] [-n ops] [-w write-pct] "
+                "nprocs...\n", argv[0]);
+    if (numSlots == 0)
+        numSlots = 2L * numKeys;
+
+    printf("%6s %14s %7s %14s %7s\n", "procs", "shm ops/s", "hit %",
+            "server ops/s", "hit %");
+
+    for (j = optind; j < argc; j++) {
+        nprocs = getInt(argv[j], GN_GT_0, "nprocs");
+
+        /* Use a fresh table for each test */
+
+        shm_unlink(SHM_NAME);
+        sh = shmHashCreate(SHM_NAME, numSlots, VAL_MAX, S_IRUSR | S_IWUSR);
+        if (sh == NULL)
+            errExit("shmHashCreate");
+        populate(sh);
+
+        tShm = runTest(sh, nprocs, ops, numSlots, &cShm);
+        shmHashClose(sh);
+        shm_unlink(SHM_NAME);
+
+        tSrv = runTest(NULL, nprocs, ops, numSlots, &cSrv);
+
+        printf("%6d %14.0f %7.1f %14.0f %7.1f\n", nprocs, cShm.ops / tShm,
+                100.0 * cShm.hits / (cShm.lookups ? cShm.lookups : 1),
+                cSrv.ops / tSrv,
+                100.0 * cSrv.hits / (cSrv.lookups ? cSrv.lookups : 1));
+        if (cShm.errors != 0 || cSrv.errors != 0)
+            printf("       wrong values found: shm %ld, server %ld\n",
+                    cShm.errors, cSrv.errors);
+    }
+
+    exit(EXIT_SUCCESS);
+}
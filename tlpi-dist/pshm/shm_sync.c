@@ -0,0 +1,186 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_sync.c
+
+   Functions for using Pthreads mutexes and condition variables, placed in
+   shared memory, to synchronize processes.
+
+   The mutexes are created with the PTHREAD_PROCESS_SHARED and
+   PTHREAD_MUTEX_ROBUST attributes. With a robust mutex, if the owner
+   terminates while holding the mutex, the next process to lock it is told
+   so (by the error EOWNERDEAD), and then owns the mutex. (Without this,
+   the mutex would remain locked forever. System V semaphores provide
+   SEM_UNDO for the same purpose; POSIX semaphores have no equivalent.)
+   The new owner must make the protected data consistent, and then mark
+   the mutex consistent with pthread_mutex_consistent(); the functions
+   here do this with the help of a caller-supplied function.
+
+   The condition variables are created with the PTHREAD_PROCESS_SHARED
+   attribute, and use CLOCK_MONOTONIC for timeouts.
+
+   Unlike the Pthreads functions, these functions return -1 and set
+   'errno' on error.
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <time.h>
+#include "shm_sync.h"
+
+/* Deal with the status 's' returned on acquiring 'mtx' */
+
+static int
+acquired(pthread_mutex_t *mtx, int s, ShmConsistFunc consist, void *arg)
+{
+    if (s == EOWNERDEAD) {
+        if (consist == NULL || consist(mtx, arg) == 0) {
+            s = pthread_mutex_consistent(mtx);
+        } else {
+
+            /* Unlocking the mutex without marking it consistent makes
+               it permanently unusable */
+
+            pthread_mutex_unlock(mtx);
+            s = ENOTRECOVERABLE;
+        }
+    }
+
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+int
+shmMutexInit(pthread_mutex_t *mtx)
+{
+    pthread_mutexattr_t attr;
+    int s;
+
+    s = pthread_mutexattr_init(&attr);
+    if (s == 0)
+        s = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (s == 0)
+        s = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (s == 0)
+        s = pthread_mutex_init(mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+int
+shmCondInit(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    int s;
+
+    s = pthread_condattr_init(&attr);
+    if (s == 0)
+        s = pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (s == 0)
+        s = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (s == 0)
+        s = pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+int
+shmMutexLock(pthread_mutex_t *mtx, ShmConsistFunc consist, void *arg)
+{
+    return acquired(mtx, pthread_mutex_lock(mtx), consist, arg);
+}
+
+int
+shmMutexTrylock(pthread_mutex_t *mtx, ShmConsistFunc consist, void *arg)
+{
+    return acquired(mtx, pthread_mutex_trylock(mtx), consist, arg);
+}
+
+int
+shmMutexUnlock(pthread_mutex_t *mtx)
+{
+    int s;
+
+    s = pthread_mutex_unlock(mtx);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+int
+shmCondWait(pthread_cond_t *cond, pthread_mutex_t *mtx, int timeoutMs,
+            ShmConsistFunc consist, void *arg)
+{
+    struct timespec ts;
+    int s;
+
+    if (timeoutMs < 0) {
+        s = pthread_cond_wait(cond, mtx);
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += timeoutMs / 1000;
+        ts.tv_nsec += (timeoutMs % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        s = pthread_cond_timedwait(cond, mtx, &ts);
+    }
+
+    /* On ETIMEDOUT, the mutex has nevertheless been reacquired */
+
+    if (s == ETIMEDOUT) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return acquired(mtx, s, consist, arg);
+}
+
+int
+shmCondSignal(pthread_cond_t *cond)
+{
+    int s;
+
+    s = pthread_cond_signal(cond);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+int
+shmCondBroadcast(pthread_cond_t *cond)
+{
+    int s;
+
+    s = pthread_cond_broadcast(cond);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_sync.h
+
+   Header file for shm_sync.c.
+*/
+#ifndef SHM_SYNC_H
+#define SHM_SYNC_H
+
+#include <pthread.h>
+
+/* Called when a mutex is acquired whose previous owner terminated while
+   holding it. The function should restore the consistency of the data
+   that the mutex protects, and return 0, or return -1 if that isn't
+   possible. */
+
+typedef int (*ShmConsistFunc)(pthread_mutex_t *mtx, void *arg);
+
+/* Initialize a mutex or condition variable that is located in shared
+   memory. Returns: 0 on success, or -1 on error. */
+
+int shmMutexInit(pthread_mutex_t *mtx);
+
+int shmCondInit(pthread_cond_t *cond);
+
+/* Lock 'mtx'. If the previous owner died while holding the mutex,
+   'consist' (if not NULL) is called with 'arg'; if 'consist' returns 0
+   (or is NULL), the mutex is marked consistent, and the call succeeds.
+   Otherwise, the mutex is made permanently unusable, and the call fails
+   with ENOTRECOVERABLE (as do all later attempts to lock it).
+
+   Returns: 0 on success, or -1 on error. shmMutexTrylock() fails with
+   EBUSY if the mutex is locked. */
+
+int shmMutexLock(pthread_mutex_t *mtx, ShmConsistFunc consist, void *arg);
+
+int shmMutexTrylock(pthread_mutex_t *mtx, ShmConsistFunc consist,
+                    void *arg);
+
+int shmMutexUnlock(pthread_mutex_t *mtx);
+
+/* Wait on 'cond' for at most 'timeoutMs' milliseconds (-1: no limit).
+   On return, 'mtx' is locked, with owner death handled as for
+   shmMutexLock(). Returns: 0 on success, or -1 on error (ETIMEDOUT on
+   timeout; 'mtx' is then also locked). */
+
+int shmCondWait(pthread_cond_t *cond, pthread_mutex_t *mtx, int timeoutMs,
+                ShmConsistFunc consist, void *arg);
+
+int shmCondSignal(pthread_cond_t *cond);
+
+int shmCondBroadcast(pthread_cond_t *cond);
+
+#endif
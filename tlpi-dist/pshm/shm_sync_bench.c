@@ -0,0 +1,378 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_sync_bench.c
+
+   Compare the costs of synchronizing processes using a robust,
+   process-shared mutex and condition variable (see shm_sync.c) in a
+   POSIX shared memory object, System V semaphores (via binary_sems.c),
+   and POSIX named semaphores.
+
+   Usage: shm_sync_bench [-n loops] [-p nprocs] [-u]
+
+   Two tests are run with each method:
+
+   * 'nprocs' (default: 4) processes repeatedly lock, increment a shared
+     counter, and unlock, 'loops' (default: 1000000) times in total. This
+     is done first with one process, and then with 'nprocs' processes.
+
+   * Two processes take turns, each waiting to be woken by the other,
+     'loops' / 10 times. With the mutex, this uses a condition variable;
+     with the semaphores, a pair of semaphores.
+
+   The "-u" option causes the System V semaphore operations to specify
+   SEM_UNDO, which (like a robust mutex) provides for a process that
+   terminates while holding a semaphore.
+
+   Finally, the program checks that a process that locks the mutex after
+   its owner has been killed recovers it.
+*/
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <time.h>
+#include "shm_sync.h"
+#include "binary_sems.h"
+#include "semun.h"
+#include "tlpi_hdr.h"
+
+#define SHM_NAME "/tlpi_shm_sync_bench"
+#define SEM_NAME "/tlpi_shm_sync_bench"
+
+enum { M_MUTEX, M_SYSV, M_POSIX, NUM_METHODS };
+
+static const char *methodName[NUM_METHODS] = {
+    "mutex", "semop()", "POSIX sem"
+};
+
+struct syncShm {                /* Layout of shared memory object */
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int turn;                   /* Whose turn it is in ping-pong test */
+    long counter;
+    long shadow;                /* Equal to 'counter' when consistent */
+    int recoveries;             /* Calls to fixState() */
+};
+
+static struct syncShm *shm;
+static int semid;               /* Set of 3 System V semaphores */
+static sem_t *psem[3];          /* POSIX named semaphores */
+
+/* Semaphore numbers: one to act as a lock, and two for taking turns */
+
+#define SEM_LOCK 0
+#define SEM_TURN0 1
+#define SEM_TURN1 2
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Called by shmMutexLock() if the owner of the mutex died while holding
+   it; restore the invariant 'shadow == counter' */
+
+static int
+fixState(pthread_mutex_t *mtx, void *arg)
+{
+    struct syncShm *s = arg;
+
+    s->shadow = s->counter;
+    s->recoveries++;
+    return 0;
+}
+
+static void
+lock(int method)
+{
+    switch (method) {
+    case M_MUTEX:
+        if (shmMutexLock(&shm->mtx, fixState, shm) == -1)
+            errExit("shmMutexLock");
+        break;
+    case M_SYSV:
+        if (reserveSem(semid, SEM_LOCK) == -1)
+            errExit("reserveSem");
+        break;
+    case M_POSIX:
+        if (sem_wait(psem[SEM_LOCK]) == -1)
+            errExit("sem_wait");
+        break;
+    }
+}
+
+static void
+unlock(int method)
+{
+    switch (method) {
+    case M_MUTEX:
+        if (shmMutexUnlock(&shm->mtx) == -1)
+            errExit("shmMutexUnlock");
+        break;
+    case M_SYSV:
+        if (releaseSem(semid, SEM_LOCK) == -1)
+            errExit("releaseSem");
+        break;
+    case M_POSIX:
+        if (sem_post(psem[SEM_LOCK]) == -1)
+            errExit("sem_post");
+        break;
+    }
+}
+
+/* Wait for our turn ('me' is 0 or 1), and then give the other process
+   its turn */
+
+static void
+takeTurn(int method, int me)
+{
+    switch (method) {
+    case M_MUTEX:
+        if (shmMutexLock(&shm->mtx, fixState, shm) == -1)
+            errExit("shmMutexLock");
+        while (shm->turn != me)
+            if (shmCondWait(&shm->cond, &shm->mtx, -1, fixState, shm) == -1)
+                errExit("shmCondWait");
+        shm->turn = !me;
+        if (shmCondSignal(&shm->cond) == -1)
+            errExit("shmCondSignal");
+        if (shmMutexUnlock(&shm->mtx) == -1)
+            errExit("shmMutexUnlock");
+        break;
+    case M_SYSV:
+        if (reserveSem(semid, SEM_TURN0 + me) == -1)
+            errExit("reserveSem");
+        if (releaseSem(semid, SEM_TURN0 + !me) == -1)
+            errExit("releaseSem");
+        break;
+    case M_POSIX:
+        if (sem_wait(psem[SEM_TURN0 + me]) == -1)
+            errExit("sem_wait");
+        if (sem_post(psem[SEM_TURN0 + !me]) == -1)
+            errExit("sem_post");
+        break;
+    }
+}
+
+/* Return nanoseconds per lock/unlock pair when 'nprocs' processes share
+   'loops' iterations */
+
+static double
+timeLocks(int method, int nprocs, long loops)
+{
+    double start;
+    long j;
+    int k;
+
+    shm->counter = shm->shadow = 0;
+    start = nowSecs();
+
+    for (k = 0; k < nprocs; k++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            for (j = loops / nprocs + (k < loops % nprocs); j > 0; j--) {
+                lock(method);
+                shm->counter++;
+                shm->shadow++;
+                unlock(method);
+            }
+            _exit(EXIT_SUCCESS);
+        default:
+            break;
+        }
+    }
+    while (wait(NULL) > 0)
+        continue;
+
+    start = nowSecs() - start;
+    if (shm->counter != loops || shm->shadow != loops)
+        fatal("%s: counter is %ld; expected %ld", methodName[method],
+                shm->counter, loops);
+    return start / loops * 1e9;
+}
+
+/* Return microseconds per round trip when two processes take turns
+   'rounds' times */
+
+static double
+timeTurns(int method, long rounds)
+{
+    double start;
+    long j;
+    pid_t pid;
+
+    shm->turn = 0;
+    start = nowSecs();
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        for (j = 0; j < rounds; j++)
+            takeTurn(method, 1);
+        _exit(EXIT_SUCCESS);
+    }
+
+    for (j = 0; j < rounds; j++)
+        takeTurn(method, 0);
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    return (nowSecs() - start) / rounds * 1e6;
+}
+
+/* Kill a child that holds the mutex while the shared data is
+   inconsistent, and check that we recover */
+
+static void
+checkRecovery(void)
+{
+    Boolean ok;
+    int pfd[2];
+    char ch;
+    pid_t pid;
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    shm->counter = shm->shadow = 0;
+    shm->recoveries = 0;
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        if (shmMutexLock(&shm->mtx, fixState, shm) == -1)
+            errExit("shmMutexLock");
+        shm->counter++;                 /* 'shadow' not yet updated */
+        if (write(pfd[1], "x", 1) != 1)
+            errExit("write");
+        pause();                        /* Wait to be killed */
+        _exit(EXIT_FAILURE);
+    }
+
+    close(pfd[1]);
+    if (read(pfd[0], &ch, 1) != 1)      /* Child now holds mutex */
+        fatal("child failed");
+    close(pfd[0]);
+    kill(pid, SIGKILL);
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    if (shmMutexLock(&shm->mtx, fixState, shm) == -1)
+        errExit("shmMutexLock");
+    ok = shm->recoveries == 1 && shm->counter == shm->shadow;
+    if (shmMutexUnlock(&shm->mtx) == -1)
+        errExit("shmMutexUnlock");
+
+    /* The mutex must also remain usable by other processes */
+
+    timeLocks(M_MUTEX, 2, 1000);
+
+    printf("Owner-death recovery: %s\n", ok ? "OK" : "FAILED");
+}
+
+int
+main(int argc, char *argv[])
+{
+    double tOne[NUM_METHODS], tMany[NUM_METHODS], tTurn[NUM_METHODS];
+    char name[64];
+    union semun arg;
+    long loops;
+    int opt, nprocs, fd, m, j;
+
+    loops = 1000000;
+    nprocs = 4;
+    while ((opt = getopt(argc, argv, "n:p:u")) != -1) {
+        switch (opt) {
+        case 'n': loops = getLong(optarg, GN_GT_0, "loops");    break;
+        case 'p': nprocs = getInt(optarg, GN_GT_0, "nprocs");   break;
+        case 'u': bsUseSemUndo = TRUE;                          break;
+        default:  usageErr("%s [-n loops] [-p nprocs] [-u]\n", argv[0]);
+        }
+    }
+
+    /* Create the shared memory object; unlink it at once, since only
+       our children need it */
+
+    fd = shm_open(SHM_NAME, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("shm_open");
+    shm_unlink(SHM_NAME);
+    if (ftruncate(fd, sizeof(struct syncShm)) == -1)
+        errExit("ftruncate");
+    shm = mmap(NULL, sizeof(struct syncShm), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        errExit("mmap");
+    close(fd);
+
+    if (shmMutexInit(&shm->mtx) == -1)
+        errExit("shmMutexInit");
+    if (shmCondInit(&shm->cond) == -1)
+        errExit("shmCondInit");
+
+    semid = semget(IPC_PRIVATE, 3, S_IRUSR | S_IWUSR);
+    if (semid == -1)
+        errExit("semget");
+    if (initSemAvailable(semid, SEM_LOCK) == -1 ||
+            initSemAvailable(semid, SEM_TURN0) == -1 ||
+            initSemInUse(semid, SEM_TURN1) == -1)
+        errExit("initSem");
+
+    for (j = 0; j < 3; j++) {
+        snprintf(name, sizeof(name), "%s.%d", SEM_NAME, j);
+        psem[j] = sem_open(name, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR,
+                           (j == SEM_TURN1) ? 0 : 1);
+        if (psem[j] == SEM_FAILED)
+            errExit("sem_open");
+        sem_unlink(name);
+    }
+
+    for (m = 0; m < NUM_METHODS; m++) {
+        tOne[m] = timeLocks(m, 1, loops);
+        tMany[m] = timeLocks(m, nprocs, loops);
+        tTurn[m] = timeTurns(m, loops / 10);
+    }
+
+    printf("%-32s", "");
+    for (m = 0; m < NUM_METHODS; m++)
+        printf("%12s", methodName[m]);
+    printf("\n%-32s", "lock+unlock, 1 process (ns)");
+    for (m = 0; m < NUM_METHODS; m++)
+        printf("%12.1f", tOne[m]);
+    snprintf(name, sizeof(name), "lock+unlock, %d processes (ns)", nprocs);
+    printf("\n%-32s", name);
+    for (m = 0; m < NUM_METHODS; m++)
+        printf("%12.1f", tMany[m]);
+    printf("\n%-32s", "wake/wait round trip (us)");
+    for (m = 0; m < NUM_METHODS; m++)
+        printf("%12.2f", tTurn[m]);
+    printf("\n");
+    if (bsUseSemUndo)
+        printf("(semop() used SEM_UNDO)\n");
+
+    checkRecovery();
+
+    if (semctl(semid, 0, IPC_RMID, arg) == -1)
+        errExit("semctl");
+    exit(EXIT_SUCCESS);
+}
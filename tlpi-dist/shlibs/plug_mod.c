@@ -0,0 +1,39 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plug_mod.c
+
+   A plugin for plugin_host.c. It is built both as a shared library
+   (libplug.so) and as an object file linked directly into plugin_host,
+   so that calls via the plugin manager can be compared with direct
+   calls. Define PLUG_VERSION when building to distinguish versions:
+
+        cc -shared -fPIC -DPLUG_VERSION=2 -o libplug.so plug_mod.c
+*/
+#ifndef PLUG_VERSION
+#define PLUG_VERSION 1
+#endif
+
+int plug_step(int x);
+int plug_version(void);
+
+int
+plug_step(int x)
+{
+    return x + 1;
+}
+
+int
+plug_version(void)
+{
+    return PLUG_VERSION;
+}
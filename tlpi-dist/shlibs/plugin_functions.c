@@ -0,0 +1,380 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plugin_functions.c
+
+   Functions for loading shared libraries on first use, and for replacing
+   them while they are in use ("hot reloading"). See plugin_functions.h
+   for an overview.
+
+   Each version of a library is loaded from a private copy, in a memfd.
+   This is necessary because dlopen() of a pathname that is already
+   loaded simply returns the existing handle, and the old version remains
+   loaded until its last user has finished with it. Copying also means
+   that a build that is in progress can't change the code under a
+   running version.
+*/
+#define _GNU_SOURCE
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "plugin_functions.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Return the last component of 'path' */
+
+static const char *
+baseName(const char *path)
+{
+    const char *p;
+
+    p = strrchr(path, '/');
+    return (p == NULL) ? path : p + 1;
+}
+
+/* Initialize 'p' to describe the library 'path' and the 'numFuncs'
+   functions named in 'funcNames'. The library is not loaded until it is
+   first used. Returns 0 on success, or -1 on error. */
+
+int
+plugInit(struct plugin *p, const char *path,
+         const char *const funcNames[], int numFuncs)
+{
+    int s;
+
+    if (numFuncs > PLUG_MAX_FUNCS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(p, 0, sizeof(struct plugin));
+    p->path = strdup(path);
+    if (p->path == NULL)
+        return -1;
+    p->funcNames = funcNames;
+    p->numFuncs = numFuncs;
+    p->wd = -1;
+
+    s = pthread_mutex_init(&p->mtx, NULL);
+    if (s != 0) {
+        free(p->path);
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+unloadVersion(struct plugVersion *v)
+{
+    if (v->handle != NULL)
+        dlclose(v->handle);
+    if (v->memFd != -1)
+        close(v->memFd);
+    free(v);
+}
+
+/* Copy the library of plugin 'p' into a memfd, load it, and look up its
+   functions. RTLD_NOW is used so that all binding is done now, rather
+   than on the first calls after the version becomes current. Returns a
+   new version (with no references), or NULL on error. */
+
+static struct plugVersion *
+loadVersion(struct plugin *p)
+{
+    struct plugVersion *v;
+    struct stat sb;
+    char fdPath[64];
+    ssize_t numCopied;
+    off_t remaining;
+    int fd, j;
+
+    v = calloc(1, sizeof(struct plugVersion));
+    if (v == NULL)
+        return NULL;
+    v->memFd = -1;
+
+    fd = open(p->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &sb) == -1) {
+        if (fd != -1)
+            close(fd);
+        free(v);
+        return NULL;
+    }
+
+    v->memFd = memfd_create(baseName(p->path), MFD_CLOEXEC);
+    if (v->memFd == -1) {
+        close(fd);
+        free(v);
+        return NULL;
+    }
+
+    for (remaining = sb.st_size; remaining > 0; remaining -= numCopied) {
+        numCopied = sendfile(v->memFd, fd, NULL, remaining);
+        if (numCopied <= 0)
+            break;
+    }
+    close(fd);
+    if (remaining > 0) {        /* Error, or file truncated meanwhile */
+        if (numCopied == 0)
+            errno = ENOEXEC;
+        unloadVersion(v);
+        return NULL;
+    }
+
+    snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", v->memFd);
+    v->handle = dlopen(fdPath, RTLD_NOW | RTLD_LOCAL);
+    if (v->handle == NULL) {
+        fprintf(stderr, "%s: %s\n", p->path, dlerror());
+        errno = ENOEXEC;
+        unloadVersion(v);
+        return NULL;
+    }
+
+    for (j = 0; j < p->numFuncs; j++) {
+        v->fn[j] = dlsym(v->handle, p->funcNames[j]);
+        if (v->fn[j] == NULL) {
+            fprintf(stderr, "%s: %s\n", p->path, dlerror());
+            errno = ENOEXEC;
+            unloadVersion(v);
+            return NULL;
+        }
+    }
+
+    return v;
+}
+
+/* Make 'v' the current version of 'p', returning the version that it
+   supersedes if that version should now be unloaded. The caller must
+   hold p->mtx. */
+
+static struct plugVersion *
+installVersion(struct plugin *p, struct plugVersion *v)
+{
+    struct plugVersion *old;
+
+    old = p->cur;
+    v->refs = 1;                /* The plugin's own reference */
+    v->gen = p->gen + 1;
+    p->cur = v;
+    p->loads++;
+    __atomic_store_n(&p->gen, v->gen, __ATOMIC_RELEASE);
+
+    if (old == NULL)
+        return NULL;
+    old->retireTime = nowSecs();
+    old->refs--;
+    if (old->refs > 0)
+        return NULL;            /* Still in use; unloaded by plugPut() */
+    p->unloads++;
+    return old;
+}
+
+/* Return the current version of 'p', with a reference held for the
+   caller, loading the library if this is its first use. Returns NULL
+   on error. */
+
+struct plugVersion *
+plugGet(struct plugin *p)
+{
+    struct plugVersion *v;
+    double start;
+
+    pthread_mutex_lock(&p->mtx);
+
+    if (p->cur == NULL) {
+        start = nowSecs();
+        v = loadVersion(p);
+        if (v == NULL) {
+            p->loadFailures++;
+            pthread_mutex_unlock(&p->mtx);
+            return NULL;
+        }
+        p->lastLoadSecs = nowSecs() - start;
+        installVersion(p, v);
+    }
+
+    v = p->cur;
+    v->refs++;
+
+    pthread_mutex_unlock(&p->mtx);
+    return v;
+}
+
+/* Release a reference to the version 'v' of 'p' (obtained by plugGet()).
+   If 'v' has been superseded and this was the last reference, the
+   version is unloaded. */
+
+void
+plugPut(struct plugin *p, struct plugVersion *v)
+{
+    double drain;
+    Boolean unload;
+
+    pthread_mutex_lock(&p->mtx);
+    v->refs--;
+    unload = (v->refs == 0);
+    if (unload) {
+        p->unloads++;
+        drain = nowSecs() - v->retireTime;
+        if (drain > p->maxDrainSecs)
+            p->maxDrainSecs = drain;
+    }
+    pthread_mutex_unlock(&p->mtx);
+
+    if (unload)
+        unloadVersion(v);
+}
+
+/* Load a new version of the library of 'p', and make it current. The
+   library is loaded without holding the plugin's mutex, so that callers
+   are delayed only while the new version is installed. Returns 0 on
+   success, or -1 on error (in which case the current version remains
+   in use). */
+
+int
+plugReload(struct plugin *p)
+{
+    struct plugVersion *v, *old;
+    double start, swapStart, swap;
+
+    start = nowSecs();
+    v = loadVersion(p);
+    if (v == NULL) {
+        pthread_mutex_lock(&p->mtx);
+        p->loadFailures++;
+        pthread_mutex_unlock(&p->mtx);
+        return -1;
+    }
+
+    swapStart = nowSecs();
+    pthread_mutex_lock(&p->mtx);
+    p->lastLoadSecs = swapStart - start;
+    old = installVersion(p, v);
+    swap = nowSecs() - swapStart;
+    if (swap > p->maxSwapSecs)
+        p->maxSwapSecs = swap;
+    pthread_mutex_unlock(&p->mtx);
+
+    if (old != NULL)
+        unloadVersion(old);
+    return 0;
+}
+
+/* Exchange the reference held by 'r' (if any) for one to the current
+   version of its plugin */
+
+void
+plugRefRefresh(struct plugRef *r)
+{
+    struct plugVersion *old;
+
+    old = r->ver;
+    r->ver = plugGet(r->plugin);
+    if (old != NULL)
+        plugPut(r->plugin, old);
+}
+
+void
+plugRefRelease(struct plugRef *r)
+{
+    if (r->ver != NULL) {
+        plugPut(r->plugin, r->ver);
+        r->ver = NULL;
+    }
+}
+
+/* Add a watch for the library of 'p' to the inotify instance
+   'inotifyFd'. The directory containing the library is watched, rather
+   than the library itself, since build tools commonly replace a file by
+   renaming a new file over it. Returns 0 on success, or -1 on error. */
+
+int
+plugWatchAdd(int inotifyFd, struct plugin *p)
+{
+    char dir[PATH_MAX];
+    const char *base;
+
+    base = baseName(p->path);
+    if (base == p->path) {
+        strcpy(dir, ".");
+    } else if (base - p->path - 1 >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    } else {
+        memcpy(dir, p->path, base - p->path - 1);
+        dir[base - p->path - 1] = '\0';
+        if (dir[0] == '\0')
+            strcpy(dir, "/");
+    }
+
+    p->wd = inotify_add_watch(inotifyFd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    return (p->wd == -1) ? -1 : 0;
+}
+
+#define BUF_LEN (10 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+/* Read the available events from 'inotifyFd', and reload each of the
+   'numPlugins' plugins in 'plugins' whose library has been written or
+   renamed into place. Each plugin is reloaded at most once, however many
+   events refer to it. Returns the number of plugins reloaded, or -1 if
+   the read failed. */
+
+int
+plugWatchHandle(int inotifyFd, struct plugin *plugins[], int numPlugins)
+{
+    char buf[BUF_LEN] __attribute__ ((aligned(8)));
+    struct inotify_event *event;
+    Boolean *changed;
+    ssize_t numRead;
+    char *p;
+    int j, numReloaded;
+
+    numRead = read(inotifyFd, buf, BUF_LEN);
+    if (numRead == -1)
+        return -1;
+
+    changed = calloc(numPlugins, sizeof(Boolean));
+    if (changed == NULL)
+        return -1;
+
+    for (p = buf; p < buf + numRead; ) {
+        event = (struct inotify_event *) p;
+        if (event->len > 0)
+            for (j = 0; j < numPlugins; j++)
+                if (plugins[j]->wd == event->wd &&
+                        strcmp(event->name, baseName(plugins[j]->path)) == 0)
+                    changed[j] = TRUE;
+        p += sizeof(struct inotify_event) + event->len;
+    }
+
+    numReloaded = 0;
+    for (j = 0; j < numPlugins; j++)
+        if (changed[j] && plugReload(plugins[j]) == 0)
+            numReloaded++;
+
+    free(changed);
+    return numReloaded;
+}
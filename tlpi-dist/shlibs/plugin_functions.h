@@ -0,0 +1,107 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plugin_functions.h
+
+   Header file for plugin_functions.c.
+
+   A 'struct plugin' describes a module (a shared library) and the names
+   of the functions that its users call. The module is loaded when it is
+   first used. Each load of the module produces a 'struct plugVersion',
+   which caches the addresses of the functions, and carries a reference
+   count and a generation number.
+
+   A caller obtains the current version with plugGet(), calls functions
+   via the version's fn[] table, and releases the version with plugPut().
+   When the module is reloaded (plugReload()), the new version becomes
+   current immediately; the old version is unloaded by whichever
+   plugPut() drops its reference count to zero, so that calls already in
+   progress complete using the old code.
+
+   To avoid taking the plugin's mutex on every call, a caller may instead
+   keep a 'struct plugRef', which holds a reference to a version across
+   calls, and use plugRefFn(). This checks (with a single atomic load)
+   whether a newer generation has been loaded, and only then exchanges
+   its reference for one to the current version. A thread that stops
+   calling should release its reference with plugRefRelease(), or the
+   old version remains loaded.
+*/
+#ifndef PLUGIN_FUNCTIONS_H
+#define PLUGIN_FUNCTIONS_H
+
+#include <pthread.h>
+#include "tlpi_hdr.h"
+
+#define PLUG_MAX_FUNCS 16
+
+struct plugVersion {
+    void *handle;               /* From dlopen() */
+    int memFd;                  /* Copy of the library that was loaded */
+    unsigned long gen;          /* Generation number (1, 2, ...) */
+    int refs;                   /* Protected by the plugin's mutex */
+    double retireTime;          /* When superseded (for statistics) */
+    void *fn[PLUG_MAX_FUNCS];   /* Addresses of the plugin's functions */
+};
+
+struct plugin {
+    char *path;                 /* Pathname of the library */
+    const char *const *funcNames;
+    int numFuncs;
+    pthread_mutex_t mtx;
+    struct plugVersion *cur;    /* NULL until first loaded */
+    unsigned long gen;          /* Generation of 'cur'; read atomically */
+    int wd;                     /* inotify watch descriptor, or -1 */
+
+    /* Statistics, protected by 'mtx' */
+
+    unsigned long loads, loadFailures, unloads;
+    double lastLoadSecs;        /* Time to copy, dlopen(), and dlsym() */
+    double maxSwapSecs;         /* Longest time 'mtx' was held for a swap */
+    double maxDrainSecs;        /* Longest time from supersession of a
+                                   version until it was unloaded */
+};
+
+struct plugRef {
+    struct plugin *plugin;
+    struct plugVersion *ver;    /* NULL if no reference is held */
+};
+
+int plugInit(struct plugin *p, const char *path,
+             const char *const funcNames[], int numFuncs);
+
+struct plugVersion *plugGet(struct plugin *p);
+
+void plugPut(struct plugin *p, struct plugVersion *v);
+
+int plugReload(struct plugin *p);
+
+void plugRefRefresh(struct plugRef *r);
+
+void plugRefRelease(struct plugRef *r);
+
+/* Return the address of function 'idx' from the current version of the
+   plugin referred to by 'r', or NULL if the plugin can't be loaded */
+
+static inline void *
+plugRefFn(struct plugRef *r, int idx)
+{
+    if (r->ver == NULL ||
+            r->ver->gen != __atomic_load_n(&r->plugin->gen, __ATOMIC_ACQUIRE))
+        plugRefRefresh(r);
+    return (r->ver == NULL) ? NULL : r->ver->fn[idx];
+}
+
+int plugWatchAdd(int inotifyFd, struct plugin *p);
+
+int plugWatchHandle(int inotifyFd, struct plugin *plugins[], int numPlugins);
+
+#endif
@@ -0,0 +1,275 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plugin_host.c
+
+   Demonstrate the plugin functions in plugin_functions.c: measure the
+   cost of calling a plugin function, and reload the plugin while worker
+   threads are calling it.
+
+   Usage: plugin_host [-n calls] [-t threads] [-d secs] lib-path
+
+   'lib-path' should be built from plug_mod.c (the Makefile builds
+   libplug.so). The program first measures the cost of 'calls' (default:
+   10000000) calls of plug_step() made:
+
+        direct      to the copy of plug_mod.c linked into this program
+        dlsym       via a pointer looked up with dlsym() before each call
+        get/put     via plugGet() and plugPut() around each call
+        plugRef     via plugRefFn(), which holds a reference across calls
+
+   If 'secs' (-d) is nonzero, the program then creates 'threads' (default:
+   2) threads that call plug_step() via plugRefFn() for 'secs' seconds,
+   while the main thread watches the library with inotify and reloads it
+   whenever it is rebuilt. Try rebuilding it from another terminal:
+
+        cc -shared -fPIC -DPLUG_VERSION=2 -o libplug.so plug_mod.c
+
+   For each reload, the program shows the time taken to load the new
+   version and the time for which callers were blocked while it was
+   installed. At the end, it shows, for each thread, the number of calls
+   and of versions seen, and the mean and longest times taken by a batch
+   of BATCH_CALLS calls. (On a loaded system, the longest time mostly
+   reflects preemption rather than reloading.)
+*/
+#include <sys/inotify.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <time.h>
+#include "plugin_functions.h"
+
+#define BATCH_CALLS 1000
+
+int plug_step(int x);           /* From plug_mod.c */
+
+static const char *funcNames[] = { "plug_step", "plug_version" };
+enum { FN_STEP, FN_VERSION };
+
+static struct plugin plug;
+static volatile int stop = 0;
+static volatile int sink;
+
+struct worker {
+    pthread_t tid;
+    int index;
+    unsigned long calls, versions, numBatches;
+    double totalSecs, maxSecs;  /* Time taken by batches of calls */
+};
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Measure and display the cost per call of plug_step() when called in
+   each of the ways described above */
+
+static void
+measureCalls(const char *libPath, long calls)
+{
+    int (*step)(int), (*fn)(int);
+    struct plugVersion *v;
+    struct plugRef ref;
+    void *handle;
+    double start;
+    long j;
+    int x;
+
+    printf("%-10s %10s\n", "method", "ns/call");
+
+    start = nowSecs();
+    for (x = 0, j = 0; j < calls; j++)
+        x = plug_step(x);
+    sink = x;
+    printf("%-10s %10.2f\n", "direct", (nowSecs() - start) * 1e9 / calls);
+
+    handle = dlopen(libPath, RTLD_NOW);
+    if (handle == NULL)
+        fatal("dlopen: %s", dlerror());
+    start = nowSecs();
+    for (x = 0, j = 0; j < calls; j++) {
+        *(void **) (&step) = dlsym(handle, "plug_step");
+        x = step(x);
+    }
+    sink = x;
+    printf("%-10s %10.2f\n", "dlsym", (nowSecs() - start) * 1e9 / calls);
+    dlclose(handle);
+
+    start = nowSecs();
+    for (x = 0, j = 0; j < calls; j++) {
+        v = plugGet(&plug);
+        if (v == NULL)
+            errExit("plugGet");
+        *(void **) (&fn) = v->fn[FN_STEP];
+        x = fn(x);
+        plugPut(&plug, v);
+    }
+    sink = x;
+    printf("%-10s %10.2f\n", "get/put", (nowSecs() - start) * 1e9 / calls);
+
+    ref.plugin = &plug;
+    ref.ver = NULL;
+    start = nowSecs();
+    for (x = 0, j = 0; j < calls; j++) {
+        *(void **) (&fn) = plugRefFn(&ref, FN_STEP);
+        x = fn(x);
+    }
+    sink = x;
+    printf("%-10s %10.2f\n", "plugRef", (nowSecs() - start) * 1e9 / calls);
+    plugRefRelease(&ref);
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct worker *w = arg;
+    struct plugRef ref;
+    int (*fn)(int), (*version)(void);
+    unsigned long lastGen;
+    double start, t;
+    int j, x;
+
+    ref.plugin = &plug;
+    ref.ver = NULL;
+    lastGen = 0;
+    x = 0;
+
+    while (!stop) {
+        start = nowSecs();
+        for (j = 0; j < BATCH_CALLS; j++) {
+            *(void **) (&fn) = plugRefFn(&ref, FN_STEP);
+            if (fn == NULL)
+                fatal("plugin could not be loaded");
+            x = fn(x);
+        }
+        t = nowSecs() - start;
+        w->totalSecs += t;
+        if (t > w->maxSecs)
+            w->maxSecs = t;
+        w->numBatches++;
+        w->calls += BATCH_CALLS;
+
+        if (ref.ver->gen != lastGen) {
+            lastGen = ref.ver->gen;
+            *(void **) (&version) = ref.ver->fn[FN_VERSION];
+            if (w->versions > 0)
+                printf("    thread %d now calling version %d\n",
+                        w->index, version());
+            w->versions++;
+        }
+    }
+    sink = x;
+
+    plugRefRelease(&ref);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct plugin *plugs[1];
+    struct worker *workers;
+    struct pollfd pfd;
+    double end;
+    long calls;
+    int opt, numThreads, secs, inotifyFd, j, s, ready;
+
+    calls = 10000000;
+    numThreads = 2;
+    secs = 0;
+
+    while ((opt = getopt(argc, argv, "n:t:d:")) != -1) {
+        switch (opt) {
+        case 'n': calls = getLong(optarg, GN_GT_0, "calls");         break;
+        case 't': numThreads = getInt(optarg, GN_GT_0, "threads");   break;
+        case 'd': secs = getInt(optarg, GN_NONNEG, "secs");          break;
+        default:
+            usageErr("%s [-n calls] [-t threads] [-d secs] lib-path\n",
+                    argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-n calls] [-t threads] [-d secs] lib-path\n", argv[0]);
+
+    if (plugInit(&plug, argv[optind], funcNames, 2) == -1)
+        errExit("plugInit");
+
+    measureCalls(argv[optind], calls);
+    printf("First load of %s took %.1f us\n", argv[optind],
+            plug.lastLoadSecs * 1e6);
+
+    if (secs == 0)
+        exit(EXIT_SUCCESS);
+
+    /* Hot-reload demonstration */
+
+    inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd == -1)
+        errExit("inotify_init1");
+    if (plugWatchAdd(inotifyFd, &plug) == -1)
+        errExit("plugWatchAdd");
+    plugs[0] = &plug;
+
+    workers = calloc(numThreads, sizeof(struct worker));
+    if (workers == NULL)
+        errExit("calloc");
+    for (j = 0; j < numThreads; j++) {
+        workers[j].index = j;
+        s = pthread_create(&workers[j].tid, NULL, threadFunc, &workers[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    printf("Watching %s for %d seconds\n", argv[optind], secs);
+    pfd.fd = inotifyFd;
+    pfd.events = POLLIN;
+    end = nowSecs() + secs;
+
+    while (nowSecs() < end) {
+        ready = poll(&pfd, 1, (int) ((end - nowSecs()) * 1000) + 1);
+        if (ready == -1 && errno != EINTR)
+            errExit("poll");
+        if (ready <= 0)
+            continue;
+
+        if (plugWatchHandle(inotifyFd, plugs, 1) > 0) {
+            pthread_mutex_lock(&plug.mtx);
+            printf("Reloaded (generation %lu): load %.1f us; "
+                    "callers blocked for at most %.1f us\n", plug.gen,
+                    plug.lastLoadSecs * 1e6, plug.maxSwapSecs * 1e6);
+            pthread_mutex_unlock(&plug.mtx);
+        }
+    }
+
+    stop = 1;
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_join(workers[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    printf("loads %lu, failures %lu, unloads %lu; longest drain of an old "
+            "version %.1f us\n", plug.loads, plug.loadFailures,
+            plug.unloads, plug.maxDrainSecs * 1e6);
+    for (j = 0; j < numThreads; j++)
+        printf("thread %d: %lu calls, %lu versions; batch of %d calls: "
+                "mean %.1f us, max %.1f us\n", j, workers[j].calls,
+                workers[j].versions, BATCH_CALLS, (workers[j].numBatches > 0) ?
+                workers[j].totalSecs / workers[j].numBatches * 1e6 : 0.0,
+                workers[j].maxSecs * 1e6);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,167 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* sym_bench.c
+
+   Measure the cost of loading a shared library and of resolving its
+   symbols, for libraries built by sym_build.sh.
+
+   Usage: sym_bench [-n reps] lib-path...
+
+   For each library, and for each of RTLD_LAZY and RTLD_NOW, the program
+   'reps' times (default: 20) loads the library with dlopen(), looks up
+   each of its symlib_fNNNNN symbols with dlsym(), calls symlib_run()
+   twice, and unloads the library with dlclose(). It then displays the
+   median time taken by each step:
+
+        dlopen      loading and relocating the library; with RTLD_NOW
+                    (or LD_BIND_NOW), this includes binding every PLT
+                    entry
+        dlsym-all   looking up all of the library's symlib_fNNNNN
+                    symbols ("-" if they are not exported)
+        1st-call    the first call of symlib_run(), which calls each
+                    symlib_fNNNNN function once; with lazy binding, each
+                    call goes through the dynamic linker's resolver
+        2nd-call    the second call, for which all bindings are in place
+
+   Setting LD_BIND_NOW in the environment makes RTLD_LAZY behave like
+   RTLD_NOW. Note that the library's pages are in the page cache after
+   the first iteration, so the figures exclude disk I/O.
+*/
+#include <dlfcn.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+median(double *t, int n)
+{
+    qsort(t, n, sizeof(double), cmpDouble);
+    return t[n / 2];
+}
+
+/* Perform 'reps' load/lookup/call/unload cycles for the library 'path',
+   using the dlopen() flag 'mode', and display the median times */
+
+static void
+benchLib(const char *path, int mode, int reps)
+{
+    double *tOpen, *tSym, *tCall1, *tCall2, start;
+    int (*run)(int);
+    int *countp, j, k, numSyms, result;
+    Boolean exported;
+    void *handle;
+    char name[32];
+
+    tOpen = calloc(reps, sizeof(double));
+    tSym = calloc(reps, sizeof(double));
+    tCall1 = calloc(reps, sizeof(double));
+    tCall2 = calloc(reps, sizeof(double));
+    if (tOpen == NULL || tSym == NULL || tCall1 == NULL || tCall2 == NULL)
+        errExit("calloc");
+
+    exported = TRUE;
+
+    for (j = 0; j < reps; j++) {
+        start = nowSecs();
+        handle = dlopen(path, mode);
+        if (handle == NULL)
+            fatal("dlopen: %s", dlerror());
+        tOpen[j] = nowSecs() - start;
+
+        countp = dlsym(handle, "symlib_count");
+        *(void **) (&run) = dlsym(handle, "symlib_run");
+        if (countp == NULL || run == NULL)
+            fatal("%s was not built by sym_build.sh", path);
+        numSyms = *countp;
+
+        start = nowSecs();
+        for (k = 0; k < numSyms && exported; k++) {
+            snprintf(name, sizeof(name), "symlib_f%05d", k);
+            if (dlsym(handle, name) == NULL)
+                exported = FALSE;
+        }
+        tSym[j] = nowSecs() - start;
+
+        start = nowSecs();
+        result = run(0);
+        tCall1[j] = nowSecs() - start;
+
+        start = nowSecs();
+        run(0);
+        tCall2[j] = nowSecs() - start;
+
+        if (result != numSyms)
+            fatal("symlib_run() returned %d; expected %d", result, numSyms);
+
+        if (dlclose(handle) != 0)
+            fatal("dlclose: %s", dlerror());
+    }
+
+    printf("%-22s %-5s %6d %10.1f ", path,
+            (mode == RTLD_NOW) ? "now" : "lazy", numSyms,
+            median(tOpen, reps) * 1e6);
+    if (exported)
+        printf("%10.1f ", median(tSym, reps) * 1e6);
+    else
+        printf("%10s ", "-");
+    printf("%10.1f %10.1f\n", median(tCall1, reps) * 1e6,
+            median(tCall2, reps) * 1e6);
+
+    free(tOpen);
+    free(tSym);
+    free(tCall1);
+    free(tCall2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, reps, j;
+
+    reps = 20;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': reps = getInt(optarg, GN_GT_0, "reps");      break;
+        default:  usageErr("%s [-n reps] lib-path...\n", argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-n reps] lib-path...\n", argv[0]);
+
+    printf("%-22s %-5s %6s %10s %10s %10s %10s\n", "library", "bind",
+            "syms", "dlopen", "dlsym-all", "1st-call", "2nd-call");
+
+    for (j = optind; j < argc; j++) {
+        benchLib(argv[j], RTLD_LAZY, reps);
+        benchLib(argv[j], RTLD_NOW, reps);
+    }
+    printf("(median microseconds over %d runs)\n", reps);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# sym_build.sh [num-syms]
+#
+# Generate a synthetic shared library that defines 'num-syms' (default:
+# 5000) exported functions, plus symlib_run(), which calls each of them
+# once, and build it in several variants for comparison with sym_bench:
+#
+#   libsym_default.so    Default build: every call from symlib_run() to
+#                        an exported function goes via the PLT
+#   libsym_sysvhash.so   Only a DT_HASH (not DT_GNU_HASH) symbol table
+#   libsym_bsymbolic.so  -Bsymbolic: calls inside the library are bound
+#                        to its own definitions at link time
+#   libsym_hidden.so     -fvisibility=hidden: only symlib_run() and
+#                        symlib_count are exported
+#   libsym_vscript.so    A version script exports only symlib_run() and
+#                        symlib_count (see sym_run.map)
+#   libsym_znow.so       -z now: all PLT entries are bound at load time,
+#                        as if LD_BIND_NOW were set
+#   libsym_noplt.so      -fno-plt: calls go via the GOT, which is filled
+#                        in at load time
+#
+# Then run, for example:
+#
+#       ./sym_bench ./libsym_*.so
+#
+NSYMS=${1:-5000}
+CFLAGS="-O2 -fPIC -Wall"
+
+# Generate the library source. The functions are 'noinline' so that, in
+# the variants where calls are bound locally, the compiler doesn't simply
+# fold them into symlib_run().
+
+awk -v n="$NSYMS" 'BEGIN {
+    print "#ifndef SYMLIB_API"
+    print "#define SYMLIB_API"
+    print "#endif"
+    print "#define EXPORT __attribute__((visibility(\"default\")))"
+    printf "EXPORT int symlib_count = %d;\n", n
+    for (j = 0; j < n; j++)
+        printf "SYMLIB_API __attribute__((noinline)) int " \
+               "symlib_f%05d(int x) { return x + 1; }\n", j
+    print "EXPORT int symlib_run(int x) {"
+    for (j = 0; j < n; j++)
+        printf "    x = symlib_f%05d(x);\n", j
+    print "    return x;"
+    print "}"
+}' > symlib_gen.c
+
+set -v
+
+gcc $CFLAGS -shared -o libsym_default.so symlib_gen.c
+gcc $CFLAGS -shared -Wl,--hash-style=sysv -o libsym_sysvhash.so symlib_gen.c
+gcc $CFLAGS -shared -Wl,-Bsymbolic -o libsym_bsymbolic.so symlib_gen.c
+gcc $CFLAGS -shared -fvisibility=hidden -o libsym_hidden.so symlib_gen.c
+gcc $CFLAGS -shared -Wl,--version-script,sym_run.map \
+        -o libsym_vscript.so symlib_gen.c
+gcc $CFLAGS -shared -Wl,-z,now -o libsym_znow.so symlib_gen.c
+gcc $CFLAGS -shared -fno-plt -o libsym_noplt.so symlib_gen.c
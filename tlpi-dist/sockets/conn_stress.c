@@ -0,0 +1,291 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* conn_stress.c
+
+   Open many simultaneous TCP connections to a server, and check that
+   each is served.
+
+   Usage: conn_stress [-n conns] [-t secs] [-r] [-R] host port
+
+   The program first opens 'conns' (default: 1000) connections, and then,
+   keeping all of them open, sends one request on each and waits for the
+   reply. By default, the request is a line of text that an echo server
+   (is_echo_sv.c) should return; with -r, it is an RPC_OP_NULL request
+   for us_rpc_sv.c (started with "-t port"). Each connect() is allowed
+   'secs' (default: 5) seconds, and the replies to all of the requests
+   must arrive within a further 'secs' seconds.
+
+   The program reports how many connections were established and served,
+   and how the others failed. Run against a server with a low RLIMIT_NOFILE
+   soft limit, a server that doesn't adjust to its limits fails once it
+   runs out of descriptors, while one that uses rlimTuneInit() (see
+   rlimit_tune.c) serves every connection.
+
+   The program itself uses rlimTuneInit() to raise its own limits (unless
+   -R is specified), and refuses to run if it can't open 'conns'
+   descriptors.
+*/
+#include "us_rpc.h"             /* Defines _GNU_SOURCE, so include first */
+#include <sys/time.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "rdwrn.h"
+#include "rlimit_tune.h"
+
+#define REQ_MAX 32              /* Maximum size of a request or reply */
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Connect to 'ai', waiting at most 'secs' seconds. Returns the (blocking)
+   socket with send and receive timeouts of 'secs' seconds, or -1 on
+   error. */
+
+static int
+connectTimed(const struct addrinfo *ai, int secs)
+{
+    struct timeval tv;
+    struct pollfd pfd;
+    socklen_t len;
+    int sfd, flags, err, savedErrno;
+
+    sfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sfd == -1)
+        return -1;
+
+    flags = fcntl(sfd, F_GETFL);
+    fcntl(sfd, F_SETFL, flags | O_NONBLOCK);
+
+    if (connect(sfd, ai->ai_addr, ai->ai_addrlen) == -1) {
+        if (errno != EINPROGRESS)
+            goto fail;
+
+        pfd.fd = sfd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, secs * 1000) != 1) {
+            errno = ETIMEDOUT;
+            goto fail;
+        }
+        len = sizeof(err);
+        if (getsockopt(sfd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+            goto fail;
+        if (err != 0) {
+            errno = err;
+            goto fail;
+        }
+    }
+
+    fcntl(sfd, F_SETFL, flags);
+    tv.tv_sec = secs;
+    tv.tv_usec = 0;
+    if (setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+            setsockopt(sfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1)
+        goto fail;
+    return sfd;
+
+fail:
+    savedErrno = errno;
+    close(sfd);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Send one request on 'sfd'. Returns the length of the expected reply,
+   which is placed in 'expect', or -1 on error. */
+
+static ssize_t
+sendRequest(int sfd, int n, Boolean rpc, char *expect, size_t max)
+{
+    struct rpcHdr req;
+    size_t len;
+
+    if (rpc) {
+        memset(&req, 0, sizeof(req));
+        req.op = RPC_OP_NULL;
+        req.id = n;
+        if (writen(sfd, &req, sizeof(req)) != sizeof(req))
+            return -1;
+
+        req.op = RPC_OK;                /* The response we expect */
+        memcpy(expect, &req, sizeof(req));
+        return sizeof(req);
+    }
+
+    snprintf(expect, max, "connection %d\n", n);
+    len = strlen(expect);
+    if (writen(sfd, expect, len) != (ssize_t) len)
+        return -1;
+    return len;
+}
+
+/* Wait until 'deadline' for a reply of 'len' bytes on 'sfd', and check
+   that it matches 'expect'. Returns 0 on success, or -1 on error. */
+
+static int
+recvReply(int sfd, const char *expect, size_t len, double deadline)
+{
+    struct pollfd pfd;
+    char buf[REQ_MAX];
+    double remaining;
+
+    remaining = deadline - nowSecs();
+    pfd.fd = sfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (remaining > 0) ? remaining * 1000 : 0) != 1) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    errno = 0;
+    if (readn(sfd, buf, len) != (ssize_t) len) {
+        if (errno == 0)
+            errno = ECONNRESET;         /* EOF */
+        return -1;
+    }
+    if (memcmp(buf, expect, len) != 0) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Count an error, by kind */
+
+static void
+countError(long *timedOut, long *refused, long *other)
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT)
+        (*timedOut)++;
+    else if (errno == ECONNREFUSED || errno == ECONNRESET || errno == EPIPE)
+        (*refused)++;
+    else
+        (*other)++;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct addrinfo hints, *result;
+    struct rlimTune rt;
+    long cTimedOut, cRefused, cOther, rTimedOut, rRefused, rOther;
+    long connected, served;
+    double start, deadline, tConnect, tServe;
+    int opt, numConns, secs, tuneFlags, j, s;
+    Boolean rpc;
+    char (*expect)[REQ_MAX];
+    ssize_t *expLen;
+    int *fds;
+
+    numConns = 1000;
+    secs = 5;
+    rpc = FALSE;
+    tuneFlags = 0;
+
+    while ((opt = getopt(argc, argv, "n:t:rR")) != -1) {
+        switch (opt) {
+        case 'n': numConns = getInt(optarg, GN_GT_0, "conns");  break;
+        case 't': secs = getInt(optarg, GN_GT_0, "secs");       break;
+        case 'r': rpc = TRUE;                                   break;
+        case 'R': tuneFlags |= RT_NO_RAISE;                     break;
+        default:
+            usageErr("%s [-n conns] [-t secs] [-r] [-R] host port\n",
+                    argv[0]);
+        }
+    }
+    if (optind + 2 != argc)
+        usageErr("%s [-n conns] [-t secs] [-r] [-R] host port\n", argv[0]);
+
+    rlimTuneInit(&rt, tuneFlags);
+    if (numConns > rt.maxClients)
+        fatal("Can open at most %d connections (RLIMIT_NOFILE is %ld)",
+                rt.maxClients, rt.nofile);
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    s = getaddrinfo(argv[optind], argv[optind + 1], &hints, &result);
+    if (s != 0)
+        fatal("getaddrinfo: %s", gai_strerror(s));
+
+    fds = malloc(numConns * sizeof(int));
+    expLen = malloc(numConns * sizeof(ssize_t));
+    expect = malloc(numConns * sizeof(*expect));
+    if (fds == NULL || expLen == NULL || expect == NULL)
+        errExit("malloc");
+
+    /* Open all of the connections */
+
+    cTimedOut = cRefused = cOther = 0;
+    connected = 0;
+    start = nowSecs();
+    for (j = 0; j < numConns; j++) {
+        fds[j] = connectTimed(result, secs);
+        if (fds[j] == -1)
+            countError(&cTimedOut, &cRefused, &cOther);
+        else
+            connected++;
+    }
+    tConnect = nowSecs() - start;
+
+    /* Send a request on every connection, and then collect the replies,
+       allowing 'secs' seconds in total (so that a server that isn't
+       servicing some connections doesn't cost 'secs' for each of them) */
+
+    rTimedOut = rRefused = rOther = 0;
+    served = 0;
+    start = nowSecs();
+    for (j = 0; j < numConns; j++) {
+        if (fds[j] == -1)
+            continue;
+        expLen[j] = sendRequest(fds[j], j, rpc, expect[j], REQ_MAX);
+        if (expLen[j] == -1)
+            countError(&rTimedOut, &rRefused, &rOther);
+    }
+
+    deadline = nowSecs() + secs;
+    for (j = 0; j < numConns; j++) {
+        if (fds[j] == -1 || expLen[j] == -1)
+            continue;
+        if (recvReply(fds[j], expect[j], expLen[j], deadline) == -1)
+            countError(&rTimedOut, &rRefused, &rOther);
+        else
+            served++;
+    }
+    tServe = nowSecs() - start;
+
+    for (j = 0; j < numConns; j++)
+        if (fds[j] != -1)
+            close(fds[j]);
+
+    printf("connect: %ld of %d succeeded in %.3f s "
+            "(%ld timed out, %ld refused, %ld other errors)\n",
+            connected, numConns, tConnect, cTimedOut, cRefused, cOther);
+    printf("request: %ld of %ld served in %.3f s "
+            "(%ld timed out, %ld reset, %ld other errors)\n",
+            served, connected, tServe, rTimedOut, rRefused, rOther);
+
+    freeaddrinfo(result);
+    exit((served == numConns) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -165,12 +165,100 @@ inetBind(const char *service, int type, socklen_t *addrlen)
     return inetPassiveSocket(service, type, addrlen, FALSE, 0);
 }
 
+/* Create a listening stream socket bound to the wildcard address +
+   'service' for *each* address family supported by the host, so that
+   a server on a dual-stack host accepts both IPv4 and IPv6 clients.
+   (inetListen() instead binds only the first address returned by
+   getaddrinfo(), and so may end up serving just one family.)
+
+   If 'dualStack' is FALSE, then separate IPv4 and IPv6 sockets are
+   created, with the IPV6_V6ONLY option set on the latter so that the
+   two sockets don't conflict. If 'dualStack' is TRUE, a single IPv6
+   socket with IPV6_V6ONLY disabled is created; IPv4 clients then appear
+   as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d). If the host has no
+   IPv6 support, an IPv4 socket is created instead.
+
+   The descriptors are returned in 'lfds', which has room for 'maxfds'
+   entries. Return the number of sockets created, or -1 on error. */
+
+int
+inetListenAll(const char *service, int backlog, Boolean dualStack,
+              int *lfds, int maxfds)
+{
+    struct addrinfo hints;
+    struct addrinfo *result, *rp;
+    int sfd, optval, v6only, nfds, pass, savedErrno;
+    Boolean haveV4, haveV6;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_canonname = NULL;
+    hints.ai_addr = NULL;
+    hints.ai_next = NULL;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = AF_UNSPEC;        /* Allows IPv4 or IPv6 */
+    hints.ai_flags = AI_PASSIVE;        /* Use wildcard IP address */
+
+    if (getaddrinfo(NULL, service, &hints, &result) != 0)
+        return -1;
+
+    /* The first pass considers only IPv6 addresses, and the second pass
+       only IPv4 addresses. In dual-stack mode, we stop as soon as we have
+       one socket, so that an IPv4 socket is created only if IPv6 is
+       unavailable. */
+
+    nfds = 0;
+    haveV4 = haveV6 = FALSE;
+    for (pass = 0; pass < 2; pass++) {
+        for (rp = result; rp != NULL; rp = rp->ai_next) {
+            if (nfds >= maxfds || (dualStack && nfds > 0))
+                break;
+            if ((pass == 0) != (rp->ai_family == AF_INET6))
+                continue;
+            if ((rp->ai_family == AF_INET6 && haveV6) ||
+                    (rp->ai_family == AF_INET && haveV4))
+                continue;               /* One socket per family */
+
+            sfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+            if (sfd == -1)
+                continue;               /* E.g., no kernel IPv6 support */
+
+            optval = 1;
+            v6only = dualStack ? 0 : 1;
+            if (setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &optval,
+                        sizeof(optval)) == -1 ||
+                    (rp->ai_family == AF_INET6 &&
+                     setsockopt(sfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only,
+                        sizeof(v6only)) == -1) ||
+                    bind(sfd, rp->ai_addr, rp->ai_addrlen) == -1 ||
+                    listen(sfd, backlog) == -1) {
+                savedErrno = errno;
+                close(sfd);             /* Try next address */
+                errno = savedErrno;
+                continue;
+            }
+
+            if (rp->ai_family == AF_INET6)
+                haveV6 = TRUE;
+            else
+                haveV4 = TRUE;
+            lfds[nfds++] = sfd;
+        }
+    }
+
+    freeaddrinfo(result);
+
+    return (nfds == 0) ? -1 : nfds;
+}
+
 /* Given a socket address in 'addr', whose length is specified in
-   'addrlen', return a null-terminated string containing the host and
-   service names in the form "(hostname, port#)". The string is
+   'addrlen', return a null-terminated string containing the host
+   address and port number in the form "(address, port#)". The string is
    returned in the buffer pointed to by 'addrStr', and this value is
    also returned as the function result. The caller must specify the
-   size of the 'addrStr' buffer in 'addrStrLen'. */
+   size of the 'addrStr' buffer in 'addrStrLen'.
+
+   The address is formatted numerically: a reverse DNS lookup could
+   block a server for seconds each time a client connects. */
 
 char *
 inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
@@ -179,7 +267,7 @@ inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
     char host[NI_MAXHOST], service[NI_MAXSERV];
 
     if (getnameinfo(addr, addrlen, host, NI_MAXHOST,
-                    service, NI_MAXSERV, NI_NUMERICSERV) == 0)
+                    service, NI_MAXSERV, NI_NUMERICHOST | NI_NUMERICSERV) == 0)
         snprintf(addrStr, addrStrLen, "(%s, %s)", host, service);
     else
         snprintf(addrStr, addrStrLen, "(?UNKNOWN?)");
@@ -19,6 +19,7 @@
 
 #include <sys/socket.h>
 #include <netdb.h>
+#include "tlpi_hdr.h"           /* For 'Boolean' */
 
 int inetConnect(const char *host, const char *service, int type);
 
@@ -26,6 +27,9 @@ int inetListen(const char *service, int backlog, socklen_t *addrlen);
 
 int inetBind(const char *service, int type, socklen_t *addrlen);
 
+int inetListenAll(const char *service, int backlog, Boolean dualStack,
+                int *lfds, int maxfds);
+
 char *inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
                 char *addrStr, int addrStrLen);
 
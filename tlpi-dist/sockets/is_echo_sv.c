@@ -19,6 +19,13 @@
    replace the SERVICE name below with a suitable unreserved port number
    (e.g., "51000"), and make a corresponding change in the client.
 
+   The listen() backlog, the maximum number of children (one per client),
+   and the size of each child's buffer are taken from rlimTuneInit() (see
+   rlimit_tune.c). When that many children exist, the server accepts no
+   further connections until one terminates, so that pending clients wait
+   in the listen queue rather than being dropped because fork() fails
+   with EAGAIN.
+
    See also is_echo_cl.c.
 */
 #include <signal.h>
@@ -26,10 +33,12 @@
 #include <sys/wait.h>
 #include "become_daemon.h"
 #include "inet_sockets.h"       /* Declarations of inet*() socket functions */
+#include "rlimit_tune.h"
 #include "tlpi_hdr.h"
 
 #define SERVICE "echo"          /* Name of TCP service */
-#define BUF_SIZE 4096
+
+static volatile sig_atomic_t numChildren = 0;   /* Live children */
 
 static void             /* SIGCHLD handler to reap dead child processes */
 grimReaper(int sig)
@@ -38,19 +47,25 @@ grimReaper(int sig)
 
     savedErrno = errno;
     while (waitpid(-1, NULL, WNOHANG) > 0)
-        continue;
+        numChildren--;
     errno = savedErrno;
 }
 
 /* Handle a client request: copy socket input back to socket */
 
 static void
-handleRequest(int cfd)
+handleRequest(int cfd, size_t bufSize)
 {
-    char buf[BUF_SIZE];
+    char *buf;
     ssize_t numRead;
 
-    while ((numRead = read(cfd, buf, BUF_SIZE)) > 0) {
+    buf = malloc(bufSize);
+    if (buf == NULL) {
+        syslog(LOG_ERR, "malloc() failed: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    while ((numRead = read(cfd, buf, bufSize)) > 0) {
         if (write(cfd, buf, numRead) != numRead) {
             syslog(LOG_ERR, "write() failed: %s", strerror(errno));
             exit(EXIT_FAILURE);
@@ -68,10 +83,14 @@ main(int argc, char *argv[])
 {
     int lfd, cfd;               /* Listening and connected sockets */
     struct sigaction sa;
+    struct rlimTune rt;
+    sigset_t blockMask, origMask;
 
     if (becomeDaemon(0) == -1)
         errExit("becomeDaemon");
 
+    rlimTuneInit(&rt, 0);
+
     /* Establish SIGCHLD handler to reap terminated child processes */
 
     sigemptyset(&sa.sa_mask);
@@ -83,13 +102,23 @@ main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    lfd = inetListen(SERVICE, 10, NULL);
+    lfd = inetListen(SERVICE, rt.backlog, NULL);
     if (lfd == -1) {
         syslog(LOG_ERR, "Could not create server socket (%s)", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
+    /* SIGCHLD is blocked while we inspect or change 'numChildren' */
+
+    sigemptyset(&blockMask);
+    sigaddset(&blockMask, SIGCHLD);
+
     for (;;) {
+        sigprocmask(SIG_BLOCK, &blockMask, &origMask);
+        while (numChildren >= rt.maxChildren)   /* Wait for a child to end */
+            sigsuspend(&origMask);
+        sigprocmask(SIG_SETMASK, &origMask, NULL);
+
         cfd = accept(lfd, NULL, NULL);  /* Wait for connection */
         if (cfd == -1) {
             syslog(LOG_ERR, "Failure in accept(): %s", strerror(errno));
@@ -98,6 +127,7 @@ main(int argc, char *argv[])
 
         /* Handle each client request in a new child process */
 
+        sigprocmask(SIG_BLOCK, &blockMask, &origMask);
         switch (fork()) {
         case -1:
             syslog(LOG_ERR, "Can't create child (%s)", strerror(errno));
@@ -105,13 +135,16 @@ main(int argc, char *argv[])
             break;                      /* May be temporary; try next client */
 
         case 0:                         /* Child */
+            sigprocmask(SIG_SETMASK, &origMask, NULL);
             close(lfd);                 /* Unneeded copy of listening socket */
-            handleRequest(cfd);
+            handleRequest(cfd, rt.bufSize);
             _exit(EXIT_SUCCESS);
 
         default:                        /* Parent */
+            numChildren++;
             close(cfd);                 /* Unneeded copy of connected socket */
             break;                      /* Loop to accept next connection */
         }
+        sigprocmask(SIG_SETMASK, &origMask, NULL);
     }
 }
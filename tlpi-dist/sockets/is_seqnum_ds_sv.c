@@ -0,0 +1,326 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* is_seqnum_ds_sv.c
+
+   A version of is_seqnum_v2_sv.c that serves both IPv4 and IPv6 clients
+   on a dual-stack host, handles all clients from a single poll() loop,
+   and keeps connection and byte counts for each address family.
+
+   Usage:  is_seqnum_ds_sv [-d] [-q] [-m max-clients] [init-seq-num]
+
+   The initial sequence number defaults to 0.
+
+   By default, the server creates separate IPv4 and IPv6 listening
+   sockets (the latter with IPV6_V6ONLY set). With "-d", it instead
+   creates a single IPv6 socket that also accepts IPv4 connections; such
+   connections are nevertheless counted as IPv4, since their addresses
+   are IPv4-mapped IPv6 addresses. (The is_seqnum_sv.c and
+   is_seqnum_v2_sv.c servers bind only to the first address returned by
+   getaddrinfo(), and so may end up serving just one family.)
+
+   Client addresses are logged in numeric form, so that a slow reverse
+   DNS lookup never holds up the other clients; "-q" suppresses the
+   logging altogether.
+
+   Sending SIGUSR1 to the server causes it to display the statistics;
+   SIGINT and SIGTERM display the statistics and terminate the server.
+
+   The listen() backlog is taken from rlimTuneInit() (see rlimit_tune.c).
+   At most 'max-clients' (default: DEF_MAX_CLIENTS) clients are served
+   at once; this is reduced if RLIMIT_NOFILE (as reported by
+   rlimTuneInit()) doesn't allow that many. (Sizing the client table from
+   the NOFILE limit alone could allocate tens of megabytes up front,
+   since hard limits of a million or more are common.) While that many
+   clients are connected, the server stops polling the listening sockets,
+   so that further connections wait in the backlog rather than being
+   accepted and immediately closed. Likewise, if accept() fails for lack
+   of descriptors or memory, the listening sockets (which remain
+   readable) are left out of the poll set for ACCEPT_BACKOFF_MS
+   milliseconds, rather than the server spinning on the error.
+
+   Clients are the same as for is_seqnum_v2_sv.c; see is_seqnum_v2_cl.c.
+*/
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include "is_seqnum_v2.h"
+#include "rlimit_tune.h"
+
+#define MAX_LISTEN 2            /* One IPv4 and one IPv6 socket */
+#define ACCEPT_BACKOFF_MS 100   /* Pause in accepting after EMFILE etc. */
+#define DEF_MAX_CLIENTS 1024    /* Default for "-m" */
+
+enum { FAM_IPV4, FAM_IPV6, NUM_FAM };
+
+static const char *famName[NUM_FAM] = { "IPv4", "IPv6" };
+
+struct famStats {
+    long accepted;              /* Connections accepted */
+    long active;                /* Connections currently open */
+    long long bytesIn;          /* Bytes read from clients */
+    long long bytesOut;         /* Bytes written to clients */
+};
+
+static struct famStats stats[NUM_FAM];
+
+struct client {                 /* State for a client connection */
+    int family;                 /* FAM_IPV4 or FAM_IPV6 */
+    size_t len;                 /* Bytes of request received so far */
+    char buf[INT_LEN];
+};
+
+static volatile sig_atomic_t gotStatsSig = 0;
+static volatile sig_atomic_t gotTermSig = 0;
+
+static void
+handler(int sig)
+{
+    if (sig == SIGUSR1)
+        gotStatsSig = 1;
+    else
+        gotTermSig = 1;
+}
+
+static void
+printStats(void)
+{
+    int f;
+
+    printf("%-6s %10s %8s %14s %14s\n", "family", "accepted", "active",
+            "bytes-in", "bytes-out");
+    for (f = 0; f < NUM_FAM; f++)
+        printf("%-6s %10ld %8ld %14lld %14lld\n", famName[f],
+                stats[f].accepted, stats[f].active,
+                stats[f].bytesIn, stats[f].bytesOut);
+}
+
+static long long
+nowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Classify a client address; IPv4 clients of a dual-stack IPv6 socket
+   have IPv4-mapped addresses */
+
+static int
+addrFamily(const struct sockaddr_storage *addr)
+{
+    if (addr->ss_family == AF_INET6 &&
+            !IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *) addr)->sin6_addr))
+        return FAM_IPV6;
+    return FAM_IPV4;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct pollfd *pfd;
+    struct client *client;
+    struct rlimTune rt;
+    struct sockaddr_storage claddr;
+    struct sigaction sa;
+    char addrStr[IS_ADDR_STR_LEN];
+    char seqNumStr[INT_LEN];
+    Boolean dualStack, quiet, done;
+    uint32_t seqNum;
+    int lfd[MAX_LISTEN], nlfd, nfds, cfd, ready, reqLen, opt, j, timeout;
+    int maxClients;
+    long long acceptResume, now;
+    Boolean accepting;
+    socklen_t addrlen;
+    ssize_t numRead, numWritten;
+    struct client *c;
+
+    dualStack = FALSE;
+    quiet = FALSE;
+    maxClients = DEF_MAX_CLIENTS;
+    while ((opt = getopt(argc, argv, "dqm:")) != -1) {
+        switch (opt) {
+        case 'd': dualStack = TRUE;     break;
+        case 'q': quiet = TRUE;         break;
+        case 'm': maxClients = getInt(optarg, GN_GT_0, "max-clients"); break;
+        default:
+            usageErr("%s [-d] [-q] [-m max-clients] [init-seq-num]\n"
+                    "        -d    use a single dual-stack IPv6 socket\n"
+                    "        -q    don't log client addresses\n"
+                    "        -m    maximum simultaneous clients\n", argv[0]);
+        }
+    }
+
+    seqNum = (optind < argc) ? getInt(argv[optind], 0, "init-seq-num") : 0;
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken connection
+       errors via a failure from write(). */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    /* No SA_RESTART: we want poll() to be interrupted by these signals */
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = handler;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1 ||
+            sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    rlimTuneInit(&rt, 0);
+    if (maxClients > rt.maxClients)
+        maxClients = rt.maxClients;
+    pfd = calloc(MAX_LISTEN + maxClients, sizeof(struct pollfd));
+    client = calloc(MAX_LISTEN + maxClients, sizeof(struct client));
+    if (pfd == NULL || client == NULL)
+        errExit("calloc");
+
+    nlfd = inetListenAll(PORT_NUM_STR, rt.backlog, dualStack, lfd, MAX_LISTEN);
+    if (nlfd == -1)
+        errExit("inetListenAll");
+
+    for (j = 0; j < nlfd; j++) {
+        addrlen = sizeof(struct sockaddr_storage);
+        if (getsockname(lfd[j], (struct sockaddr *) &claddr, &addrlen) == -1)
+            errExit("getsockname");
+        printf("Listening on %s%s\n",
+                inetAddressStr((struct sockaddr *) &claddr, addrlen,
+                               addrStr, IS_ADDR_STR_LEN),
+                (dualStack && claddr.ss_family == AF_INET6) ?
+                        " (dual-stack)" : "");
+
+        pfd[j].fd = lfd[j];
+        pfd[j].events = POLLIN;
+    }
+    nfds = nlfd;
+    acceptResume = 0;
+
+    while (!gotTermSig) {
+        if (gotStatsSig) {
+            gotStatsSig = 0;
+            printStats();
+        }
+
+        /* Poll the listening sockets only if we can take another client
+           and are not backing off after an accept() failure */
+
+        now = nowMs();
+        accepting = nfds < nlfd + maxClients && now >= acceptResume;
+        for (j = 0; j < nlfd; j++)
+            pfd[j].events = accepting ? POLLIN : 0;
+        timeout = (nfds < nlfd + maxClients && now < acceptResume) ?
+                        (int) (acceptResume - now) : -1;
+
+        ready = poll(pfd, nfds, timeout);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+
+        /* Accept new clients on whichever listening sockets are ready */
+
+        for (j = 0; j < nlfd && nfds < nlfd + maxClients; j++) {
+            if (!(pfd[j].revents & POLLIN))
+                continue;
+
+            addrlen = sizeof(struct sockaddr_storage);
+            cfd = accept(lfd[j], (struct sockaddr *) &claddr, &addrlen);
+            if (cfd == -1) {
+                errMsg("accept");
+                if (errno == EMFILE || errno == ENFILE ||
+                        errno == ENOBUFS || errno == ENOMEM)
+                    acceptResume = nowMs() + ACCEPT_BACKOFF_MS;
+                continue;
+            }
+
+            if (fcntl(cfd, F_SETFL, O_NONBLOCK) == -1) {
+                errMsg("fcntl");
+                close(cfd);
+                continue;
+            }
+
+            c = &client[nfds];
+            c->family = addrFamily(&claddr);
+            c->len = 0;
+            stats[c->family].accepted++;
+            stats[c->family].active++;
+
+            if (!quiet)
+                printf("Connection from %s\n",
+                        inetAddressStr((struct sockaddr *) &claddr, addrlen,
+                                       addrStr, IS_ADDR_STR_LEN));
+
+            pfd[nfds].fd = cfd;
+            pfd[nfds].events = POLLIN;
+            pfd[nfds].revents = 0;      /* Don't process in loop below */
+            nfds++;
+        }
+
+        /* Read requests from clients; as soon as a complete line has been
+           received, send the response and close the connection. We walk
+           backward, so that closing a connection (by moving the last entry
+           into its slot) doesn't cause an entry to be skipped. */
+
+        for (j = nfds - 1; j >= nlfd; j--) {
+            if (pfd[j].revents == 0)
+                continue;
+
+            c = &client[j];
+            done = FALSE;
+
+            numRead = read(pfd[j].fd, c->buf + c->len, INT_LEN - 1 - c->len);
+            if (numRead == -1 && errno == EAGAIN)
+                continue;
+            if (numRead <= 0) {
+                done = TRUE;            /* EOF or error */
+            } else {
+                stats[c->family].bytesIn += numRead;
+                c->len += numRead;
+                c->buf[c->len] = '\0';
+
+                if (strchr(c->buf, '\n') != NULL) {
+                    done = TRUE;
+                    reqLen = atoi(c->buf);
+                    if (reqLen > 0) {   /* Watch for misbehaving clients */
+                        snprintf(seqNumStr, INT_LEN, "%d\n", seqNum);
+                        numWritten = write(pfd[j].fd, seqNumStr,
+                                           strlen(seqNumStr));
+                        if (numWritten > 0)
+                            stats[c->family].bytesOut += numWritten;
+                        if (numWritten != strlen(seqNumStr))
+                            fprintf(stderr, "Error on write\n");
+                        seqNum += reqLen;
+                    }
+                } else if (c->len == INT_LEN - 1) {
+                    done = TRUE;        /* Overlong request */
+                }
+            }
+
+            if (done) {
+                if (close(pfd[j].fd) == -1)
+                    errMsg("close");
+                stats[c->family].active--;
+
+                nfds--;
+                pfd[j] = pfd[nfds];
+                client[j] = client[nfds];
+            }
+        }
+    }
+
+    printStats();
+    exit(EXIT_SUCCESS);
+}
@@ -18,14 +18,16 @@
    Usage:  is_seqnum_sv [init-seq-num]
                         (default = 0)
 
+   The listen() backlog is the largest that the kernel allows (see
+   rlimit_tune.c).
+
    See also is_seqnum_cl.c.
 */
 #define _BSD_SOURCE             /* To get definitions of NI_MAXHOST and
                                    NI_MAXSERV from <netdb.h> */
 #include <netdb.h>
 #include "is_seqnum.h"
-
-#define BACKLOG 50
+#include "rlimit_tune.h"
 
 int
 main(int argc, char *argv[])
@@ -38,6 +40,7 @@ main(int argc, char *argv[])
     socklen_t addrlen;
     struct addrinfo hints;
     struct addrinfo *result, *rp;
+    struct rlimTune rt;
 #define ADDRSTRLEN (NI_MAXHOST + NI_MAXSERV + 10)
     char addrStr[ADDRSTRLEN];
     char host[NI_MAXHOST];
@@ -98,7 +101,8 @@ main(int argc, char *argv[])
     if (rp == NULL)
         fatal("Could not bind socket to any address");
 
-    if (listen(lfd, BACKLOG) == -1)
+    rlimTuneInit(&rt, RT_NO_RAISE);     /* Iterative: needs few resources */
+    if (listen(lfd, rt.backlog) == -1)
         errExit("listen");
 
     for (;;) {                  /* Handle clients iteratively */
@@ -0,0 +1,416 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* memfd_xfr.c
+
+   Functions for passing large payloads between processes without
+   copying them through a socket. The sender places each payload in a
+   memory-backed file created with memfd_create(), and passes the file
+   descriptor over a UNIX domain SOCK_SEQPACKET socket (as in
+   scm_rights_send.c); the receiver maps the file read-only. Only a small
+   descriptor (struct mfxDesc) travels on the socket. When the receiver
+   has finished with a payload, it sends the buffer number back, so that
+   the sender can reuse the buffer.
+
+   A receiver can't safely access a mapping of a file that another
+   process might truncate (doing so would deliver SIGBUS), so the sender
+   seals each file against shrinking and growing (F_SEAL_SHRINK,
+   F_SEAL_GROW), and against further sealing (F_SEAL_SEAL), before passing
+   it, and the receiver checks these seals before mapping the file.
+
+   If MFX_SEAL_WRITE is specified, the sender also seals each file
+   against writing (F_SEAL_WRITE), so that the receiver knows that the
+   payload can't change while it is being used. This seal can't be
+   removed, and can be applied only when no writable mapping of the file
+   exists, so in this case each buffer is used only once: the sender
+   unmaps it before sealing it, and creates a new file for the next
+   payload. Otherwise, the sender keeps its mapping of each buffer, and
+   reuses the buffer (and the receiver its mapping of the buffer) once
+   the receiver has released it, so that the descriptor is passed, and
+   the buffer mapped and faulted in, only once; the receiver must then
+   trust the sender not to modify a buffer before it is released. A
+   receiver that won't extend that trust specifies MFX_SEAL_WRITE to
+   mfxReceiverInit(), so that it checks for F_SEAL_WRITE itself rather
+   than relying on the flag that the sender places in the descriptor.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "memfd_xfr.h"
+
+#define SIZE_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* Send 'desc' on 'sfd', along with 'fd' if it is not -1 */
+
+static int
+sendDesc(int sfd, const struct mfxDesc *desc, int fd)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    memset(&msgh, 0, sizeof(msgh));
+    iov.iov_base = (void *) desc;
+    iov.iov_len = sizeof(struct mfxDesc);
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+
+    if (fd != -1) {
+        msgh.msg_control = controlMsg.buf;
+        msgh.msg_controllen = sizeof(controlMsg.buf);
+        cmsgp = CMSG_FIRSTHDR(&msgh);
+        cmsgp->cmsg_level = SOL_SOCKET;
+        cmsgp->cmsg_type = SCM_RIGHTS;
+        cmsgp->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsgp), &fd, sizeof(int));
+    }
+
+    return (sendmsg(sfd, &msgh, 0) == -1) ? -1 : 0;
+}
+
+/* Receive a descriptor message on 'sfd', placing any file descriptor
+   that accompanies it in '*fdp' (or -1 if there is none). Returns the
+   number of bytes received (0 on end of file), or -1 on error. */
+
+static ssize_t
+recvDesc(int sfd, struct mfxDesc *desc, int *fdp)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    ssize_t nr;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    memset(&msgh, 0, sizeof(msgh));
+    iov.iov_base = desc;
+    iov.iov_len = sizeof(struct mfxDesc);
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = sizeof(controlMsg.buf);
+
+    *fdp = -1;
+    nr = recvmsg(sfd, &msgh, MSG_CMSG_CLOEXEC);
+    if (nr <= 0)
+        return nr;
+
+    cmsgp = CMSG_FIRSTHDR(&msgh);
+    if (cmsgp != NULL && cmsgp->cmsg_level == SOL_SOCKET &&
+            cmsgp->cmsg_type == SCM_RIGHTS &&
+            cmsgp->cmsg_len == CMSG_LEN(sizeof(int)))
+        memcpy(fdp, CMSG_DATA(cmsgp), sizeof(int));
+
+    if (nr != sizeof(struct mfxDesc) || (msgh.msg_flags & MSG_CTRUNC)) {
+        if (*fdp != -1)
+            close(*fdp);
+        errno = EPROTO;
+        return -1;
+    }
+    return nr;
+}
+
+int
+mfxSenderInit(struct mfxSender *s, int sfd, int flags)
+{
+    int j;
+
+    memset(s, 0, sizeof(struct mfxSender));
+    s->sfd = sfd;
+    s->flags = flags;
+    for (j = 0; j < MFX_MAX_BUFS; j++)
+        s->buf[j].fd = -1;
+    return 0;
+}
+
+/* Discard the memfd (if any) of sender buffer 'id' */
+
+static void
+discardBuf(struct mfxSender *s, int id)
+{
+    if (s->buf[id].addr != NULL)
+        munmap(s->buf[id].addr, s->buf[id].size);
+    if (s->buf[id].fd != -1)
+        close(s->buf[id].fd);
+    s->buf[id].addr = NULL;
+    s->buf[id].fd = -1;
+}
+
+/* Wait for the receiver to release a buffer */
+
+static int
+reclaim(struct mfxSender *s)
+{
+    uint32_t id;
+    ssize_t nr;
+
+    nr = recv(s->sfd, &id, sizeof(id), 0);
+    if (nr == -1)
+        return -1;
+    if (nr == 0) {
+        errno = EPIPE;                  /* Receiver has gone away */
+        return -1;
+    }
+    if (nr != sizeof(id) || id >= MFX_MAX_BUFS || !s->buf[id].inUse) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    s->buf[id].inUse = FALSE;
+    return 0;
+}
+
+void *
+mfxAlloc(struct mfxSender *s, size_t len, int *idp)
+{
+    long pageSize;
+    size_t size;
+    char *addr;
+    int j, id, fd;
+
+    /* Prefer a free buffer that is big enough to reuse */
+
+    for (;;) {
+        id = -1;
+        for (j = 0; j < MFX_MAX_BUFS; j++) {
+            if (s->buf[j].inUse)
+                continue;
+            if (s->buf[j].addr != NULL && s->buf[j].size >= len) {
+                id = j;
+                break;
+            }
+            if (id == -1)
+                id = j;
+        }
+        if (id != -1)
+            break;
+        if (reclaim(s) == -1)
+            return NULL;
+    }
+
+    if (s->buf[id].addr == NULL || s->buf[id].size < len) {
+        discardBuf(s, id);
+
+        pageSize = sysconf(_SC_PAGESIZE);
+        size = (len + pageSize - 1) / pageSize * pageSize;
+        if (size == 0)
+            size = pageSize;
+
+        fd = memfd_create("mfx", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd == -1)
+            return NULL;
+        if (ftruncate(fd, size) == -1) {
+            close(fd);
+            return NULL;
+        }
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+
+        s->buf[id].fd = fd;
+        s->buf[id].addr = addr;
+        s->buf[id].size = size;
+        s->buf[id].sent = FALSE;
+    }
+
+    s->buf[id].inUse = TRUE;
+    *idp = id;
+    return s->buf[id].addr;
+}
+
+int
+mfxDrain(struct mfxSender *s)
+{
+    int j;
+
+    for (j = 0; j < MFX_MAX_BUFS; j++)
+        while (s->buf[j].inUse)
+            if (reclaim(s) == -1)
+                return -1;
+    return 0;
+}
+
+int
+mfxSend(struct mfxSender *s, int id, size_t len)
+{
+    struct mfxDesc desc;
+    Boolean sealWrite;
+    int seals;
+
+    if (id < 0 || id >= MFX_MAX_BUFS || !s->buf[id].inUse ||
+            len > s->buf[id].size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    desc.id = id;
+    desc.len = len;
+    desc.flags = 0;
+
+    if (s->buf[id].sent)                /* Receiver already has it mapped */
+        return sendDesc(s->sfd, &desc, -1);
+
+    sealWrite = (s->flags & MFX_SEAL_WRITE) != 0;
+    seals = SIZE_SEALS;
+    if (sealWrite) {
+
+        /* F_SEAL_WRITE fails (EBUSY) while writable mappings exist */
+
+        munmap(s->buf[id].addr, s->buf[id].size);
+        s->buf[id].addr = NULL;
+        seals |= F_SEAL_WRITE;
+        desc.flags |= MFX_DESC_SEALED;
+    }
+    if (fcntl(s->buf[id].fd, F_ADD_SEALS, seals) == -1)
+        return -1;
+
+    desc.flags |= MFX_DESC_NEW_FD;
+    if (sendDesc(s->sfd, &desc, s->buf[id].fd) == -1)
+        return -1;
+    s->buf[id].sent = TRUE;
+
+    if (sealWrite)                      /* We can't use it again */
+        discardBuf(s, id);
+    return 0;
+}
+
+void
+mfxSenderFree(struct mfxSender *s)
+{
+    int j;
+
+    for (j = 0; j < MFX_MAX_BUFS; j++)
+        discardBuf(s, j);
+}
+
+int
+mfxReceiverInit(struct mfxReceiver *r, int sfd, int flags)
+{
+    memset(r, 0, sizeof(struct mfxReceiver));
+    r->sfd = sfd;
+    r->flags = flags;
+    return 0;
+}
+
+/* Check the seals on 'fd', and map it for receiver buffer 'id' */
+
+static int
+mapBuf(struct mfxReceiver *r, int id, int fd, Boolean sealed)
+{
+    struct stat sb;
+    const char *addr;
+    int seals, need;
+
+    if (r->flags & MFX_SEAL_WRITE)
+        sealed = TRUE;                  /* Whatever the sender says */
+    need = SIZE_SEALS | (sealed ? F_SEAL_WRITE : 0);
+    seals = fcntl(fd, F_GET_SEALS);     /* Fails unless 'fd' is a memfd */
+    if (seals == -1 || (seals & need) != need) {
+        errno = EPERM;
+        return -1;
+    }
+    if (fstat(fd, &sb) == -1)
+        return -1;
+
+    addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                fd, 0);
+    if (addr == MAP_FAILED)
+        return -1;
+
+    if (r->buf[id].addr != NULL)
+        munmap((void *) r->buf[id].addr, r->buf[id].size);
+    r->buf[id].addr = addr;
+    r->buf[id].size = sb.st_size;
+    r->buf[id].sealed = sealed;
+    return 0;
+}
+
+const void *
+mfxRecv(struct mfxReceiver *r, size_t *lenp, int *idp)
+{
+    struct mfxDesc desc;
+    ssize_t nr;
+    int fd, s;
+
+    nr = recvDesc(r->sfd, &desc, &fd);
+    if (nr <= 0) {
+        if (nr == 0)
+            errno = 0;
+        return NULL;
+    }
+
+    if (desc.id >= MFX_MAX_BUFS ||
+            ((desc.flags & MFX_DESC_NEW_FD) != 0) != (fd != -1)) {
+        if (fd != -1)
+            close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    if (fd != -1) {
+        s = mapBuf(r, desc.id, fd, (desc.flags & MFX_DESC_SEALED) != 0);
+        close(fd);                      /* The mapping remains */
+        if (s == -1)
+            return NULL;
+    }
+
+    if (r->buf[desc.id].addr == NULL || desc.len > r->buf[desc.id].size) {
+        errno = EPROTO;
+        return NULL;
+    }
+
+    *lenp = desc.len;
+    *idp = desc.id;
+    return r->buf[desc.id].addr;
+}
+
+int
+mfxRelease(struct mfxReceiver *r, int id)
+{
+    uint32_t v;
+
+    if (id < 0 || id >= MFX_MAX_BUFS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (r->buf[id].sealed && r->buf[id].addr != NULL) {
+        munmap((void *) r->buf[id].addr, r->buf[id].size);
+        r->buf[id].addr = NULL;
+    }
+
+    v = id;
+    return (send(r->sfd, &v, sizeof(v), 0) == -1) ? -1 : 0;
+}
+
+void
+mfxReceiverFree(struct mfxReceiver *r)
+{
+    int j;
+
+    for (j = 0; j < MFX_MAX_BUFS; j++)
+        if (r->buf[j].addr != NULL)
+            munmap((void *) r->buf[j].addr, r->buf[j].size);
+}
@@ -0,0 +1,106 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* memfd_xfr.h
+
+   Header file for memfd_xfr.c.
+*/
+#ifndef MEMFD_XFR_H
+#define MEMFD_XFR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tlpi_hdr.h"           /* For 'Boolean' */
+
+#define MFX_MAX_BUFS 8          /* Maximum buffers in flight */
+
+/* Bit-mask value for 'flags' argument of mfxSenderInit() and
+   mfxReceiverInit() */
+
+#define MFX_SEAL_WRITE  01      /* Sender: seal each buffer against writing;
+                                   receiver: reject buffers not so sealed */
+
+struct mfxDesc {                /* Sent on the socket for each payload */
+    uint32_t id;                /* Buffer number (< MFX_MAX_BUFS) */
+    uint32_t flags;             /* MFX_DESC_* */
+    uint64_t len;               /* Bytes of payload */
+};
+
+#define MFX_DESC_NEW_FD 01      /* Descriptor for buffer accompanies this
+                                   message (replacing any earlier one) */
+#define MFX_DESC_SEALED 02      /* Buffer is sealed against writing */
+
+struct mfxSender {
+    int sfd;                    /* Connected SOCK_SEQPACKET socket */
+    int flags;
+    struct {
+        int fd;                 /* -1 if no memfd yet */
+        char *addr;             /* Writable mapping, or NULL */
+        size_t size;
+        Boolean inUse;          /* Between mfxAlloc() and release */
+        Boolean sent;           /* Receiver has the descriptor */
+    } buf[MFX_MAX_BUFS];
+};
+
+struct mfxReceiver {
+    int sfd;
+    int flags;
+    struct {
+        const char *addr;       /* Read-only mapping, or NULL */
+        size_t size;
+        Boolean sealed;         /* Unmap after release */
+    } buf[MFX_MAX_BUFS];
+};
+
+/* Sender: set up 's' to send on 'sfd'. Returns 0. */
+
+int mfxSenderInit(struct mfxSender *s, int sfd, int flags);
+
+/* Sender: return a buffer of at least 'len' bytes, and its number in
+   '*idp'. If all buffers are in use, waits for the receiver to release
+   one. Returns: address of buffer, or NULL on error. */
+
+void *mfxAlloc(struct mfxSender *s, size_t len, int *idp);
+
+/* Sender: send the first 'len' bytes of buffer 'id' (which may no longer
+   be used by the sender). Returns: 0 on success, or -1 on error. */
+
+int mfxSend(struct mfxSender *s, int id, size_t len);
+
+/* Sender: wait until the receiver has released all buffers (e.g., before
+   closing the socket). Returns: 0 on success, or -1 on error. */
+
+int mfxDrain(struct mfxSender *s);
+
+void mfxSenderFree(struct mfxSender *s);
+
+/* Receiver: set up 'r' to receive on 'sfd'. With MFX_SEAL_WRITE in
+   'flags', mfxRecv() fails (EPERM) for any buffer that is not sealed
+   against writing, whatever the sender claims. Returns 0. */
+
+int mfxReceiverInit(struct mfxReceiver *r, int sfd, int flags);
+
+/* Receiver: wait for a payload, and return its length in '*lenp' and
+   its buffer number in '*idp'. The payload remains valid (and unchanged)
+   until mfxRelease() is called for 'id'. Returns: (read-only) address of
+   payload, or NULL on error or end of file (errno == 0). */
+
+const void *mfxRecv(struct mfxReceiver *r, size_t *lenp, int *idp);
+
+/* Receiver: tell the sender that we have finished with buffer 'id'.
+   Returns: 0 on success, or -1 on error. */
+
+int mfxRelease(struct mfxReceiver *r, int id);
+
+void mfxReceiverFree(struct mfxReceiver *r);
+
+#endif
@@ -0,0 +1,234 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* memfd_xfr_bench.c
+
+   Compare the throughput of passing payloads of various sizes from one
+   process to another by copying them through a UNIX domain stream socket
+   with that of passing them in memfd buffers (see memfd_xfr.c), both
+   with buffers reused and with each buffer sealed against writing and
+   used once.
+
+   Usage: memfd_xfr_bench [-m MiB] [size...]
+
+   For each 'size' (default: 4096 to 4194304, in powers of 4), about
+   'MiB' mebibytes (default: 256) are transferred with each method. In
+   every case, the sender fills each payload, and the receiver reads all
+   of it and checks it.
+
+   The program displays the throughput of each method and, for each memfd
+   method, the smallest size at which it was faster than copying.
+
+   This program is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "memfd_xfr.h"
+#include "rdwrn.h"
+
+enum { M_COPY, M_REUSE, M_SEALED, NUM_METHODS };
+
+static const char *methodName[NUM_METHODS] = {
+    "copy", "memfd reuse", "memfd sealed"
+};
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Read the whole of payload 'n', returning FALSE if it isn't filled with
+   the expected value */
+
+static Boolean
+consume(const char *p, size_t size, long n)
+{
+    const uint64_t *w = (const uint64_t *) p;
+    uint64_t sum, expect;
+    size_t j;
+
+    memset(&expect, n & 0xff, sizeof(expect));
+    for (sum = 0, j = 0; j < size / sizeof(uint64_t); j++)
+        sum |= w[j] ^ expect;
+    return sum == 0 && (unsigned char) p[size - 1] == (n & 0xff);
+}
+
+static void
+runReceiver(int method, int sfd, size_t size, long count)
+{
+    struct mfxReceiver r;
+    const char *p;
+    char *buf;
+    size_t len;
+    long n;
+    int id;
+
+    if (method == M_COPY) {
+        buf = malloc(size);
+        if (buf == NULL)
+            errExit("malloc");
+        for (n = 0; n < count; n++) {
+            if (readn(sfd, buf, size) != (ssize_t) size)
+                fatal("short read");
+            if (!consume(buf, size, n))
+                fatal("payload %ld is corrupt", n);
+        }
+        return;
+    }
+
+    mfxReceiverInit(&r, sfd, (method == M_SEALED) ? MFX_SEAL_WRITE : 0);
+    for (n = 0; n < count; n++) {
+        p = mfxRecv(&r, &len, &id);
+        if (p == NULL)
+            errExit("mfxRecv");
+        if (len != size || !consume(p, size, n))
+            fatal("payload %ld is corrupt", n);
+        if (mfxRelease(&r, id) == -1)
+            errExit("mfxRelease");
+    }
+    mfxReceiverFree(&r);
+}
+
+static void
+runSender(int method, int sfd, size_t size, long count)
+{
+    struct mfxSender s;
+    char *p;
+    long n;
+    int id;
+
+    if (method == M_COPY) {
+        p = malloc(size);
+        if (p == NULL)
+            errExit("malloc");
+        for (n = 0; n < count; n++) {
+            memset(p, n & 0xff, size);
+            if (writen(sfd, p, size) != (ssize_t) size)
+                errExit("write");
+        }
+        free(p);
+        return;
+    }
+
+    mfxSenderInit(&s, sfd, (method == M_SEALED) ? MFX_SEAL_WRITE : 0);
+    for (n = 0; n < count; n++) {
+        p = mfxAlloc(&s, size, &id);
+        if (p == NULL)
+            errExit("mfxAlloc");
+        memset(p, n & 0xff, size);
+        if (mfxSend(&s, id, size) == -1)
+            errExit("mfxSend");
+    }
+    if (mfxDrain(&s) == -1)
+        errExit("mfxDrain");
+    mfxSenderFree(&s);
+}
+
+/* Return the throughput (MiB/s) of transferring 'count' payloads */
+
+static double
+timeMethod(int method, size_t size, long count)
+{
+    double start;
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, (method == M_COPY) ? SOCK_STREAM :
+                   SOCK_SEQPACKET, 0, sv) == -1)
+        errExit("socketpair");
+
+    start = nowSecs();
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        close(sv[0]);
+        runReceiver(method, sv[1], size, count);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sv[1]);
+    runSender(method, sv[0], size, count);
+    close(sv[0]);
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    return (double) size * count / (nowSecs() - start) / (1024 * 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const size_t defSizes[] = {
+        4096, 16384, 65536, 262144, 1048576, 4194304
+    };
+    double mbps[NUM_METHODS];
+    size_t crossover[NUM_METHODS];
+    size_t size;
+    long count, mib;
+    int opt, numSizes, m, j;
+
+    mib = 256;
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+        case 'm': mib = getLong(optarg, GN_GT_0, "MiB");        break;
+        default:  usageErr("%s [-m MiB] [size...]\n", argv[0]);
+        }
+    }
+    numSizes = (optind < argc) ? argc - optind :
+               (int) (sizeof(defSizes) / sizeof(defSizes[0]));
+
+    printf("%10s", "size");
+    for (m = 0; m < NUM_METHODS; m++)
+        printf("%16s", methodName[m]);
+    printf("   (MiB/s)\n");
+
+    for (m = 0; m < NUM_METHODS; m++)
+        crossover[m] = 0;
+
+    for (j = 0; j < numSizes; j++) {
+        size = (optind < argc) ?
+               (size_t) getLong(argv[optind + j], GN_GT_0, "size") :
+               defSizes[j];
+        if (size < sizeof(uint64_t))
+            size = sizeof(uint64_t);
+        count = mib * 1024 * 1024 / size;
+        if (count < 16)
+            count = 16;
+
+        printf("%10zu", size);
+        for (m = 0; m < NUM_METHODS; m++) {
+            mbps[m] = timeMethod(m, size, count);
+            printf("%16.0f", mbps[m]);
+            fflush(stdout);
+            if (m != M_COPY && crossover[m] == 0 && mbps[m] > mbps[M_COPY])
+                crossover[m] = size;
+        }
+        printf("\n");
+    }
+
+    for (m = M_REUSE; m < NUM_METHODS; m++) {
+        if (crossover[m] != 0)
+            printf("%s is faster than copying from %zu bytes\n",
+                    methodName[m], crossover[m]);
+        else
+            printf("%s was not faster than copying at any size tested\n",
+                    methodName[m]);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,478 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* ring_relay_bench.c
+
+   Measure a relay that reads a stream of variable-length messages from
+   one stream socket, checks each message, and forwards it to another
+   stream socket, buffering the data in a ring buffer, where the ring is
+   either an ordinary buffer, so that messages that wrap past its end
+   must be copied together before they can be checked, and reads and
+   writes that wrap must be split in two, or the double-mapped ring of
+   magic_ring.c, where data is always contiguous.
+
+   Usage: ring_relay_bench [-r ring-kB] [-m max-msg] [-M MiB]
+
+   A source process sends about 'MiB' mebibytes (default: 256) of
+   messages, each a 4-byte length followed by 1 to 'max-msg' (default:
+   4096) bytes of contents, to the relay, which forwards them to a sink
+   process. The ring has 'ring-kB' kilobytes (default: 64). The relay is
+   run with each kind of ring, and then with the double-mapped ring
+   shared between two processes: one that fills the ring from the input
+   socket, and another that checks and forwards the messages.
+
+   This program is Linux-specific.
+*/
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <time.h>
+#include "magic_ring.h"
+#include "rdwrn.h"
+#include "tlpi_hdr.h"
+
+#define PATTERN_SIZE (1024 * 1024)
+
+enum { M_SPLIT, M_MAGIC, M_MAGIC_2PROC, NUM_METHODS };
+
+static const char *methodName[NUM_METHODS] = {
+    "split-copy ring", "double-mapped ring", "double-mapped, 2 procs"
+};
+
+struct relayStats {
+    long msgs;
+    long bad;                   /* Messages that failed the check */
+    long straddled;             /* Messages copied together */
+};
+
+static size_t ringSize = 64 * 1024;
+static uint32_t maxMsg = 4096;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Check the contents of a message, which must be contiguous: each byte
+   holds the low byte of the message length */
+
+static Boolean
+checkMsg(const char *p, uint32_t len)
+{
+    uint64_t w, expect, diff;
+    uint32_t j;
+
+    memset(&expect, len & 0xff, sizeof(expect));
+    for (diff = 0, j = 0; j + sizeof(w) <= len; j += sizeof(w)) {
+        memcpy(&w, p + j, sizeof(w));
+        diff |= w ^ expect;
+    }
+    for (; j < len; j++)
+        diff |= (unsigned char) p[j] ^ (len & 0xff);
+    return diff == 0;
+}
+
+/* Build a buffer of whole messages of random lengths, of which the
+   source sends repeated copies. Returns the size used. */
+
+static size_t
+buildPattern(char *buf, long *msgsp)
+{
+    uint64_t rnd;
+    uint32_t len;
+    size_t used;
+
+    rnd = 88172645463325252ULL;
+    *msgsp = 0;
+    for (used = 0; ; used += sizeof(len) + len) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        len = 1 + rnd % maxMsg;
+        if (used + sizeof(len) + len > PATTERN_SIZE)
+            break;
+        memcpy(buf + used, &len, sizeof(len));
+        memset(buf + used + sizeof(len), len & 0xff, len);
+        (*msgsp)++;
+    }
+    return used;
+}
+
+/* Forward complete messages from the 'avail' bytes at 'p' (contiguous)
+   to 'out'. Returns the number of bytes forwarded. */
+
+static size_t
+forwardContiguous(const char *p, size_t avail, int out,
+                  struct relayStats *st)
+{
+    size_t off;
+    uint32_t len;
+
+    for (off = 0; avail - off >= sizeof(len); off += sizeof(len) + len) {
+        memcpy(&len, p + off, sizeof(len));
+        if (avail - off - sizeof(len) < len)
+            break;
+        if (!checkMsg(p + off + sizeof(len), len))
+            st->bad++;
+        st->msgs++;
+    }
+
+    if (off > 0 && writen(out, p, off) != (ssize_t) off)
+        errExit("write");
+    return off;
+}
+
+/* Relay using the double-mapped ring */
+
+static void
+relayMagic(int in, int out, struct relayStats *st)
+{
+    struct magicRing mr;
+    Boolean eof;
+    const char *p;
+    size_t avail, done;
+    ssize_t n;
+
+    if (magicRingCreate(&mr, ringSize) == -1)
+        errExit("magicRingCreate");
+
+    for (eof = FALSE; ; ) {
+        if (!eof) {
+            n = magicRingFill(&mr, in);
+            if (n == 0)
+                eof = TRUE;
+            else if (n == -1 && errno != EAGAIN)
+                errExit("read");
+        }
+
+        p = magicRingReadPtr(&mr, &avail);
+        if (p == NULL)
+            errExit("magicRingReadPtr");
+        done = forwardContiguous(p, avail, out, st);
+        magicRingConsume(&mr, done);
+        if (eof && done == 0)
+            break;
+    }
+
+    if (avail != 0)
+        fatal("stream ended with a partial message");
+    magicRingDetach(&mr);
+}
+
+/* Copy 'n' bytes starting at position 'pos' of the ordinary ring 'buf'
+   to 'dst' */
+
+static void
+copyOut(const char *buf, uint64_t pos, char *dst, size_t n)
+{
+    size_t off, first;
+
+    off = pos % ringSize;
+    first = (n < ringSize - off) ? n : ringSize - off;
+    memcpy(dst, buf + off, first);
+    memcpy(dst + first, buf, n - first);
+}
+
+/* Relay using an ordinary ring, where data that wraps must be handled
+   in two pieces */
+
+static void
+relaySplit(int in, int out, struct relayStats *st)
+{
+    struct iovec iov[2];
+    uint64_t head, tail, pos;
+    size_t off, space;
+    uint32_t len;
+    Boolean eof;
+    char *buf, *bounce;
+    const char *msg;
+    ssize_t n;
+
+    buf = malloc(ringSize);
+    bounce = malloc(maxMsg);
+    if (buf == NULL || bounce == NULL)
+        errExit("malloc");
+
+    head = tail = 0;
+    for (eof = FALSE; ; ) {
+
+        /* Fill the free space, which may be in two pieces */
+
+        space = ringSize - (tail - head);
+        if (!eof && space > 0) {
+            off = tail % ringSize;
+            iov[0].iov_base = buf + off;
+            iov[0].iov_len = (space < ringSize - off) ? space : ringSize - off;
+            iov[1].iov_base = buf;
+            iov[1].iov_len = space - iov[0].iov_len;
+            n = readv(in, iov, (iov[1].iov_len > 0) ? 2 : 1);
+            if (n == -1)
+                errExit("readv");
+            if (n == 0)
+                eof = TRUE;
+            tail += n;
+        }
+
+        /* Check complete messages, copying together any that wrap */
+
+        for (pos = head; tail - pos >= sizeof(len);
+                pos += sizeof(len) + len) {
+            copyOut(buf, pos, (char *) &len, sizeof(len));
+            if (tail - pos - sizeof(len) < len)
+                break;
+
+            off = (pos + sizeof(len)) % ringSize;
+            if (off + len <= ringSize) {
+                msg = buf + off;
+            } else {
+                copyOut(buf, pos + sizeof(len), bounce, len);
+                msg = bounce;
+                st->straddled++;
+            }
+            if (!checkMsg(msg, len))
+                st->bad++;
+            st->msgs++;
+        }
+
+        /* Forward them, in two pieces if they wrap */
+
+        if (pos > head) {
+            off = head % ringSize;
+            iov[0].iov_len = (pos - head < ringSize - off) ? pos - head :
+                                                             ringSize - off;
+            if (writen(out, buf + off, iov[0].iov_len) !=
+                        (ssize_t) iov[0].iov_len ||
+                    writen(out, buf, pos - head - iov[0].iov_len) !=
+                        (ssize_t) (pos - head - iov[0].iov_len))
+                errExit("write");
+        } else if (eof) {
+            break;
+        }
+        head = pos;
+    }
+
+    if (tail != head)
+        fatal("stream ended with a partial message");
+    free(buf);
+    free(bounce);
+}
+
+/* Relay with the double-mapped ring shared between this process, which
+   fills it, and a child, which forwards the messages. Each waits for
+   the other with sched_yield(). */
+
+static void
+relayMagic2(int in, int out, struct relayStats *st)
+{
+    struct relayStats *shared;
+    struct magicRing mr, cmr;
+    const char *p;
+    size_t avail, done;
+    int *eof, cfd;
+    ssize_t n;
+    pid_t pid;
+
+    if (magicRingCreate(&mr, ringSize) == -1)
+        errExit("magicRingCreate");
+    shared = mmap(NULL, sizeof(struct relayStats) + sizeof(int),
+                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        errExit("mmap");
+    memset(shared, 0, sizeof(struct relayStats));
+    eof = (int *) (shared + 1);
+    *eof = 0;
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+
+        /* Attach the ring afresh, as an unrelated process given the
+           file descriptor via SCM_RIGHTS would */
+
+        close(in);
+        cfd = dup(mr.fd);
+        if (cfd == -1)
+            errExit("dup");
+        magicRingDetach(&mr);
+        if (magicRingAttach(&cmr, cfd) == -1)
+            errExit("magicRingAttach");
+
+        for (;;) {
+            p = magicRingReadPtr(&cmr, &avail);
+            if (p == NULL)
+                errExit("magicRingReadPtr");
+            done = forwardContiguous(p, avail, out, shared);
+            magicRingConsume(&cmr, done);
+            if (done == 0) {
+
+                /* Check for end of input before checking (again) that
+                   the ring is empty */
+
+                if (__atomic_load_n(eof, __ATOMIC_ACQUIRE)) {
+                    if (magicRingReadPtr(&cmr, &avail) == NULL)
+                        errExit("magicRingReadPtr");
+                    if (avail == 0)
+                        break;
+                }
+                sched_yield();
+            }
+        }
+        magicRingDetach(&cmr);
+        _exit(EXIT_SUCCESS);
+    }
+
+    for (;;) {
+        n = magicRingFill(&mr, in);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            if (errno != EAGAIN)
+                errExit("read");
+            sched_yield();              /* Ring full */
+        }
+    }
+    __atomic_store_n(eof, 1, __ATOMIC_RELEASE);
+
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+    *st = *shared;
+    munmap(shared, sizeof(struct relayStats) + sizeof(int));
+    magicRingDetach(&mr);
+}
+
+/* Run the source, relay, and sink; return the elapsed time */
+
+static double
+runTest(int method, const char *pattern, size_t patLen, long reps,
+        struct relayStats *st)
+{
+    int inSv[2], outSv[2];
+    pid_t srcPid, sinkPid;
+    char *buf;
+    long total, j;
+    double start;
+    ssize_t n;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, inSv) == -1 ||
+            socketpair(AF_UNIX, SOCK_STREAM, 0, outSv) == -1)
+        errExit("socketpair");
+
+    start = nowSecs();
+
+    srcPid = fork();
+    if (srcPid == -1)
+        errExit("fork");
+    if (srcPid == 0) {
+        close(inSv[1]);
+        close(outSv[0]);
+        close(outSv[1]);
+        for (j = 0; j < reps; j++)
+            if (writen(inSv[0], pattern, patLen) != (ssize_t) patLen)
+                errExit("write");
+        _exit(EXIT_SUCCESS);
+    }
+
+    sinkPid = fork();
+    if (sinkPid == -1)
+        errExit("fork");
+    if (sinkPid == 0) {
+        close(inSv[0]);
+        close(inSv[1]);
+        close(outSv[1]);
+        buf = malloc(PATTERN_SIZE);
+        if (buf == NULL)
+            errExit("malloc");
+        for (total = 0; (n = read(outSv[0], buf, PATTERN_SIZE)) > 0; )
+            total += n;
+        if (n == -1)
+            errExit("read");
+        if (total != (long) patLen * reps)
+            fatal("sink received %ld bytes; expected %ld", total,
+                    (long) patLen * reps);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(inSv[0]);
+    close(outSv[0]);
+    memset(st, 0, sizeof(struct relayStats));
+
+    switch (method) {
+    case M_SPLIT:       relaySplit(inSv[1], outSv[1], st);      break;
+    case M_MAGIC:       relayMagic(inSv[1], outSv[1], st);      break;
+    case M_MAGIC_2PROC: relayMagic2(inSv[1], outSv[1], st);     break;
+    }
+    close(inSv[1]);
+    close(outSv[1]);
+
+    if (waitpid(srcPid, NULL, 0) == -1 || waitpid(sinkPid, NULL, 0) == -1)
+        errExit("waitpid");
+    return nowSecs() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct relayStats st;
+    size_t patLen;
+    long mib, reps, patMsgs;
+    char *pattern;
+    double t;
+    int opt, m;
+
+    mib = 256;
+    while ((opt = getopt(argc, argv, "r:m:M:")) != -1) {
+        switch (opt) {
+        case 'r': ringSize = getLong(optarg, GN_GT_0, "ring-kB") * 1024;
+                  break;
+        case 'm': maxMsg = getInt(optarg, GN_GT_0, "max-msg");          break;
+        case 'M': mib = getLong(optarg, GN_GT_0, "MiB");                break;
+        default:  usageErr("%s [-r ring-kB] [-m max-msg] [-M MiB]\n",
+                           argv[0]);
+        }
+    }
+
+    /* The ordinary ring must be a whole number of pages, like the other,
+       and must be able to hold the largest message */
+
+    ringSize = (ringSize + sysconf(_SC_PAGESIZE) - 1) /
+               sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE);
+    if (maxMsg + sizeof(uint32_t) > ringSize || maxMsg > PATTERN_SIZE / 2)
+        usageErr("max-msg too large for ring\n");
+
+    pattern = malloc(PATTERN_SIZE);
+    if (pattern == NULL)
+        errExit("malloc");
+    patLen = buildPattern(pattern, &patMsgs);
+    reps = mib * 1024 * 1024 / patLen;
+    if (reps == 0)
+        reps = 1;
+
+    printf("%-24s %10s %12s %12s\n", "", "MiB/s", "msgs/s", "copied");
+    for (m = 0; m < NUM_METHODS; m++) {
+        t = runTest(m, pattern, patLen, reps, &st);
+        printf("%-24s %10.0f %12.0f %12ld\n", methodName[m],
+                patLen * reps / t / (1024 * 1024), st.msgs / t,
+                st.straddled);
+        if (st.msgs != patMsgs * reps || st.bad != 0)
+            printf("    ERROR: %ld messages (expected %ld), %ld bad\n",
+                    st.msgs, patMsgs * reps, st.bad);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -92,3 +92,91 @@ unixBind(const char *path, int type)
 
     return sd;
 }
+
+/* Build a UNIX domain socket address structure for the Linux-specific
+   abstract socket 'name' (i.e., sun_path[0] is a null byte, followed by
+   the bytes of 'name', without a terminating null byte). The address is
+   returned in 'addr' and its length (which must be supplied to bind()
+   and connect()) in 'addrlen'. Returns 0 on success, or -1 on error. */
+
+int
+unixBuildAbstractAddress(const char *name, struct sockaddr_un *addr,
+                         socklen_t *addrlen)
+{
+    size_t len;
+
+    if (addr == NULL || name == NULL || addrlen == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    len = strlen(name);
+    if (len + 1 > sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    memcpy(&addr->sun_path[1], name, len);
+    *addrlen = sizeof(sa_family_t) + 1 + len;
+    return 0;
+}
+
+/* Create a UNIX domain socket of type 'type' and connect it to the
+   abstract socket address 'name'.
+   Return the socket descriptor on success, or -1 on error. */
+
+int
+unixConnectAbstract(const char *name, int type)
+{
+    int sd, savedErrno;
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+
+    if (unixBuildAbstractAddress(name, &addr, &addrlen) == -1)
+        return -1;
+
+    sd = socket(AF_UNIX, type, 0);
+    if (sd == -1)
+        return -1;
+
+    if (connect(sd, (struct sockaddr *) &addr, addrlen) == -1) {
+        savedErrno = errno;
+        close(sd);                      /* Might change 'errno' */
+        errno = savedErrno;
+        return -1;
+    }
+
+    return sd;
+}
+
+/* Create a UNIX domain socket and bind it to the abstract socket
+   address 'name'. Return the socket descriptor on success, or -1 on
+   error. Since abstract sockets have no file system permissions, any
+   process may bind any free name; callers that care about who owns a
+   name must check the peer's credentials (e.g., via SO_PEERCRED). */
+
+int
+unixBindAbstract(const char *name, int type)
+{
+    int sd, savedErrno;
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+
+    if (unixBuildAbstractAddress(name, &addr, &addrlen) == -1)
+        return -1;
+
+    sd = socket(AF_UNIX, type, 0);
+    if (sd == -1)
+        return -1;
+
+    if (bind(sd, (struct sockaddr *) &addr, addrlen) == -1) {
+        savedErrno = errno;
+        close(sd);                      /* Might change 'errno' */
+        errno = savedErrno;
+        return -1;
+    }
+
+    return sd;
+}
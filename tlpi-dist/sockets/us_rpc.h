@@ -0,0 +1,138 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_rpc.h
+
+   Header file used by us_rpc_registry.c, us_rpc_sv.c, us_rpc_bench.c,
+   and us_rpc_functions.c.
+
+   These programs implement a small local RPC transport over UNIX domain
+   stream sockets bound in the Linux-specific abstract namespace:
+
+   * A registry (us_rpc_registry) listens on the well-known abstract name
+     RPC_REGISTRY_NAME. A service registers its name over a connection
+     that it keeps open; when that connection closes (e.g., because the
+     service died), the registration is discarded.
+
+   * Because any process can bind any unused abstract name, the registry
+     records the credentials (obtained via SO_PEERCRED) of each service
+     that registers. A client that looks up a service obtains those
+     credentials, and checks them against the SO_PEERCRED credentials of
+     the socket that it actually connects to. Since any user can also be
+     first to register a name, the client additionally says which user
+     the service must run as, and both sets of credentials must match.
+
+   * Servers likewise fetch the client's credentials once, when the
+     connection is accepted, rather than having credentials accompany
+     each message (as is done with SCM_CREDENTIALS in scm_cred_send.c).
+
+   * Every message consists of a fixed-size binary header (struct rpcHdr)
+     followed by 'len' bytes of payload. Clients may send multiple
+     requests without waiting for responses (pipelining); each response
+     carries the 'id' of the request to which it corresponds.
+
+   All integers are in host byte order: the transport is intended only
+   for communication on the local host.
+*/
+#ifndef US_RPC_H
+#define US_RPC_H
+
+#define _GNU_SOURCE             /* To get 'struct ucred' and SO_PEERCRED
+                                   definitions from <sys/socket.h> */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
+#include "unix_sockets.h"       /* Declares our socket functions */
+#include "tlpi_hdr.h"
+
+#define RPC_REGISTRY_NAME "tlpi_rpc_registry"
+                                /* Abstract name of the registry */
+#define RPC_SERVICE_PREFIX "tlpi_rpc."
+                                /* Services bind "\0" RPC_SERVICE_PREFIX name */
+#define RPC_MAX_NAME 64         /* Maximum length of a service name,
+                                   including terminating null byte */
+#define RPC_MAX_PAYLOAD 4096    /* Maximum payload in a single message */
+
+struct rpcHdr {                 /* Header that precedes every message */
+    uint32_t len;               /* Length of payload that follows */
+    uint32_t op;                /* Request: operation; response: status */
+    uint64_t id;                /* Chosen by client; echoed in response */
+};
+
+/* Operations */
+
+#define RPC_OP_REGISTER 1       /* Payload: service name */
+#define RPC_OP_LOOKUP   2       /* Payload: service name; response
+                                   payload is a 'struct rpcServiceInfo' */
+#define RPC_OP_NULL     3       /* Empty request and response */
+#define RPC_OP_ECHO     4       /* Response payload == request payload */
+
+/* Status values returned in the 'op' field of a response */
+
+#define RPC_OK          0
+#define RPC_ERR_INVAL   1       /* Malformed or unknown request */
+#define RPC_ERR_NOENT   2       /* No such service */
+#define RPC_ERR_EXIST   3       /* Service name already registered */
+
+struct rpcServiceInfo {         /* Returned by RPC_OP_LOOKUP */
+    int32_t pid;                /* Credentials of the registering process */
+    int32_t uid;
+    int32_t gid;
+    char addr[RPC_MAX_NAME + sizeof(RPC_SERVICE_PREFIX)];
+                                /* Abstract name on which service listens */
+};
+
+/* The buffers used for each connection must be able to hold at least
+   one maximum-size message */
+
+#define RPC_BUF_SIZE (4 * (sizeof(struct rpcHdr) + RPC_MAX_PAYLOAD))
+
+struct rpcConn {                /* State for one (nonblocking) connection */
+    int fd;
+    Boolean haveCred;           /* FALSE for non-UNIX domain peers */
+    struct ucred cred;          /* Peer credentials, fetched at accept() */
+    size_t inLen;               /* Bytes of unprocessed input in 'inBuf' */
+    size_t outLen;              /* Bytes of pending output in 'outBuf' */
+    Boolean peerDone;           /* Peer has stopped sending */
+    char inBuf[RPC_BUF_SIZE];
+    char outBuf[RPC_BUF_SIZE];
+    void *data;                 /* For use by the caller */
+};
+
+/* Called by rpcServe() for each complete request. The handler appends
+   its response with rpcReply(). It returns 0 on success, or -1 if the
+   connection should be closed. */
+
+typedef int (*RpcRequestFunc)(struct rpcConn *conn, const struct rpcHdr *req,
+                              const char *payload);
+
+/* Called by rpcServe() when a new connection has been accepted (returning
+   -1 causes the connection to be rejected), and when a connection is
+   about to be closed. Either may be NULL. */
+
+typedef int (*RpcConnFunc)(struct rpcConn *conn);
+
+int rpcServe(const int *lfds, int nlfds, int maxConns,
+             RpcRequestFunc reqFunc, RpcConnFunc acceptFunc,
+             RpcConnFunc closeFunc);
+
+int rpcReply(struct rpcConn *conn, uint64_t id, uint32_t status,
+             const void *payload, size_t len);
+
+int rpcCall(int sfd, uint32_t op, const void *payload, size_t len,
+            struct rpcHdr *resp, void *respPayload, size_t respMax);
+
+int rpcLookup(const char *name, struct rpcServiceInfo *info);
+
+int rpcConnectService(const struct rpcServiceInfo *info, uid_t expectedUid);
+
+#endif
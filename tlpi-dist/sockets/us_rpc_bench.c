@@ -0,0 +1,323 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_rpc_bench.c
+
+   Measure the round-trip latency of our local RPC transport (see
+   us_rpc.h), optionally comparing it with the same protocol carried over
+   TCP on the loopback interface.
+
+   Usage: us_rpc_bench [-c max-callers] [-n reqs] [-p depth] [-s size]
+                       [-t port] [-u uid] service-name
+
+   The program looks up 'service-name' via the registry, and then runs
+   a series of tests with 1, 2, 4, ..., 'max-callers' (default: 256)
+   concurrent callers. Each caller is a thread with its own connection,
+   which makes 'reqs' (default: 2000) RPC_OP_ECHO calls with a payload of
+   'size' (default: 16) bytes, keeping up to 'depth' (default: 1) requests
+   in flight. If "-t" is specified, each test is repeated using a TCP
+   connection to 'port' on the loopback address; the service must have
+   been started with the same "-t" option. The service must be run by
+   user 'uid' (default: our effective user ID); otherwise we refuse to
+   connect to it.
+
+   For example:
+
+        $ ./us_rpc_registry &
+        $ ./us_rpc_sv -t 50100 echo &
+        $ ./us_rpc_bench -t 50100 echo
+
+   For each test, the mean, median, 99th percentile and maximum latency
+   (in microseconds), and the overall request rate are displayed.
+
+   This program is Linux-specific.
+*/
+#include "us_rpc.h"             /* Defines _GNU_SOURCE, so include first */
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <time.h>
+#include "inet_sockets.h"
+#include "rdwrn.h"
+
+struct caller {                 /* Per-thread state */
+    pthread_t tid;
+    int sfd;
+    double *lat;                /* Latency of each request, in usecs */
+};
+
+static long numReqs = 2000;
+static int depth = 1;
+static size_t payloadSize = 16;
+static pthread_barrier_t startBarrier;
+
+static double
+nowUsecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Append an RPC_OP_ECHO request with ID 'id' to 'buf' */
+
+static size_t
+addRequest(char *buf, uint64_t id)
+{
+    struct rpcHdr hdr;
+
+    hdr.len = payloadSize;
+    hdr.op = RPC_OP_ECHO;
+    hdr.id = id;
+    memcpy(buf, &hdr, sizeof(struct rpcHdr));
+    memset(buf + sizeof(struct rpcHdr), 'x', payloadSize);
+    return sizeof(struct rpcHdr) + payloadSize;
+}
+
+static void *
+callerFunc(void *arg)
+{
+    struct caller *c = arg;
+    char *outBuf, inBuf[RPC_BUF_SIZE];
+    double *sendTime;
+    uint64_t nextId, done;
+    size_t outLen, inLen, off, msgLen;
+    struct rpcHdr hdr;
+    ssize_t nr;
+    int s;
+
+    outBuf = malloc(depth * (sizeof(struct rpcHdr) + payloadSize));
+    sendTime = malloc(depth * sizeof(double));
+    if (outBuf == NULL || sendTime == NULL)
+        errExit("malloc");
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    /* Prime the pipeline with up to 'depth' requests, sent with a
+       single write() */
+
+    outLen = 0;
+    for (nextId = 0; nextId < depth && nextId < numReqs; nextId++) {
+        sendTime[nextId % depth] = nowUsecs();
+        outLen += addRequest(outBuf + outLen, nextId);
+    }
+    if (writen(c->sfd, outBuf, outLen) != outLen)
+        errExit("writen");
+
+    /* Each time a batch of responses arrives, record their latencies and
+       replace them with the same number of new requests */
+
+    inLen = 0;
+    for (done = 0; done < numReqs; ) {
+        nr = read(c->sfd, inBuf + inLen, RPC_BUF_SIZE - inLen);
+        if (nr <= 0)
+            fatal("read from server failed or returned EOF");
+        inLen += nr;
+
+        outLen = 0;
+        for (off = 0; inLen - off >= sizeof(struct rpcHdr); off += msgLen) {
+            memcpy(&hdr, inBuf + off, sizeof(struct rpcHdr));
+            if (hdr.op != RPC_OK || hdr.len != payloadSize)
+                fatal("bad response (status %ld)", (long) hdr.op);
+
+            /* The response must be for one of the (at most 'depth')
+               requests that are outstanding */
+
+            if (hdr.id >= nextId || nextId - hdr.id > (uint64_t) depth)
+                fatal("response has unexpected id %llu",
+                        (unsigned long long) hdr.id);
+
+            msgLen = sizeof(struct rpcHdr) + hdr.len;
+            if (inLen - off < msgLen)
+                break;
+
+            c->lat[hdr.id] = nowUsecs() - sendTime[hdr.id % depth];
+            done++;
+
+            if (nextId < numReqs) {
+                sendTime[nextId % depth] = nowUsecs();
+                outLen += addRequest(outBuf + outLen, nextId);
+                nextId++;
+            }
+        }
+        memmove(inBuf, inBuf + off, inLen - off);
+        inLen -= off;
+
+        if (outLen > 0 && writen(c->sfd, outBuf, outLen) != outLen)
+            errExit("writen");
+    }
+
+    free(outBuf);
+    free(sendTime);
+    return NULL;
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Run one test with 'numCallers' threads, each using a connection
+   created by 'connectFunc' */
+
+static void
+runTest(const char *label, int numCallers, int (*connectFunc)(void))
+{
+    struct caller *callers;
+    double *all, sum, start, elapsed;
+    long total, j, k;
+    int s;
+
+    callers = calloc(numCallers, sizeof(struct caller));
+    all = malloc(numCallers * numReqs * sizeof(double));
+    if (callers == NULL || all == NULL)
+        errExit("malloc");
+
+    /* Establish all connections before timing starts */
+
+    for (j = 0; j < numCallers; j++) {
+        callers[j].sfd = connectFunc();
+        callers[j].lat = all + j * numReqs;
+    }
+
+    s = pthread_barrier_init(&startBarrier, NULL, numCallers + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    for (j = 0; j < numCallers; j++) {
+        s = pthread_create(&callers[j].tid, NULL, callerFunc, &callers[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+    start = nowUsecs();
+
+    for (j = 0; j < numCallers; j++) {
+        s = pthread_join(callers[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        close(callers[j].sfd);
+    }
+    elapsed = nowUsecs() - start;
+
+    pthread_barrier_destroy(&startBarrier);
+
+    total = numCallers * numReqs;
+    sum = 0;
+    for (k = 0; k < total; k++)
+        sum += all[k];
+    qsort(all, total, sizeof(double), cmpDouble);
+
+    printf("%-5s %7d %10.1f %10.1f %10.1f %10.1f %12.0f\n", label,
+            numCallers, sum / total, all[total / 2],
+            all[(long) (total * 0.99)], all[total - 1],
+            total / (elapsed / 1e6));
+
+    free(all);
+    free(callers);
+}
+
+static struct rpcServiceInfo svcInfo;
+static const char *tcpPort;
+static uid_t serviceUid;
+
+static int
+connectUnix(void)
+{
+    int sfd;
+
+    sfd = rpcConnectService(&svcInfo, serviceUid);
+    if (sfd == -1)
+        errExit("rpcConnectService");
+    return sfd;
+}
+
+static int
+connectTcp(void)
+{
+    int sfd, optval;
+
+    sfd = inetConnect(NULL, tcpPort, SOCK_STREAM);
+    if (sfd == -1)
+        errExit("inetConnect");
+
+    optval = 1;
+    if (setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &optval,
+                sizeof(optval)) == -1)
+        errExit("setsockopt-TCP_NODELAY");
+    return sfd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int maxCallers, n, opt;
+
+    maxCallers = 256;
+    tcpPort = NULL;
+    serviceUid = geteuid();
+
+    while ((opt = getopt(argc, argv, "c:n:p:s:t:u:")) != -1) {
+        switch (opt) {
+        case 'c': maxCallers = getInt(optarg, GN_GT_0, "max-callers"); break;
+        case 'n': numReqs = getLong(optarg, GN_GT_0, "reqs");          break;
+        case 'p': depth = getInt(optarg, GN_GT_0, "depth");            break;
+        case 's': payloadSize = getInt(optarg, GN_NONNEG, "size");     break;
+        case 't': tcpPort = optarg;                                     break;
+        case 'u': serviceUid = getLong(optarg, GN_NONNEG, "uid");      break;
+        default:
+            usageErr("%s [-c max-callers] [-n reqs] [-p depth] [-s size] "
+                    "[-t port] [-u uid] service-name\n", argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageErr("%s [options] service-name\n", argv[0]);
+    if (payloadSize > RPC_MAX_PAYLOAD)
+        fatal("Payload size must be no more than %d", RPC_MAX_PAYLOAD);
+
+    /* A depth of 'depth' means that up to 'depth' requests and responses
+       may be buffered at once; don't exceed what the server will buffer */
+
+    if (depth * (sizeof(struct rpcHdr) + payloadSize) > RPC_BUF_SIZE)
+        fatal("depth * (header + payload) must not exceed %ld bytes",
+                (long) RPC_BUF_SIZE);
+
+    if (rpcLookup(argv[optind], &svcInfo) == -1)
+        errExit("rpcLookup-%s", argv[optind]);
+    printf("Service \"%s\": address \"@%s\", pid=%ld, uid=%ld\n",
+            argv[optind], svcInfo.addr, (long) svcInfo.pid,
+            (long) svcInfo.uid);
+    printf("%ld requests per caller, depth %d, payload %ld bytes\n\n",
+            numReqs, depth, (long) payloadSize);
+
+    printf("%-5s %7s %10s %10s %10s %10s %12s\n", "", "callers",
+            "mean(us)", "p50(us)", "p99(us)", "max(us)", "reqs/sec");
+
+    for (n = 1; n <= maxCallers; n *= 2) {
+        runTest("unix", n, connectUnix);
+        if (tcpPort != NULL)
+            runTest("tcp", n, connectTcp);
+    }
+
+    exit(EXIT_SUCCESS);
+}
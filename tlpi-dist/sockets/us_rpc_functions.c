@@ -0,0 +1,508 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_rpc_functions.c
+
+   Functions shared by the programs that implement our local RPC transport
+   (see us_rpc.h for an overview).
+
+   rpcServe() is a single-threaded, epoll-based event loop that accepts
+   connections on one or more listening sockets, fetches the credentials
+   of each UNIX domain peer once (at accept() time), and passes each
+   complete request to a caller-supplied handler. Because a client may
+   pipeline many requests, all complete requests in the input buffer are
+   processed before the accumulated responses are written back with a
+   single write().
+
+   rpcServe() stops accepting connections while 'maxConns' connections
+   are open, and for SHORTAGE_RETRY_MS after accept() fails for lack of
+   file descriptors (or until a connection closes, if sooner; the retry
+   deadline is checked on every pass through the loop, so that traffic on
+   existing connections can't postpone it indefinitely). Pending
+   connections then wait in the listen queue; otherwise, because epoll
+   would report the listening socket as ready again at once, the server
+   would spin, repeatedly failing to accept them.
+
+   This code is Linux-specific.
+*/
+#include "us_rpc.h"             /* Defines _GNU_SOURCE, so include first */
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <time.h>
+#include "rdwrn.h"
+
+#define MAX_EVENTS 64
+#define SHORTAGE_RETRY_MS 100
+
+static struct rpcConn **connTab;        /* Connections, indexed by fd */
+static int connTabSize;
+static int numConns;
+static long long shortageEnd;           /* When to retry after accept()
+                                           ran out of fds (ms); 0 if not */
+
+/* Return the time (in milliseconds) on the monotonic clock */
+
+static long long
+nowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Write as much pending output on 'conn' as the socket will accept.
+   Return 0 on success (even if some output remains), or -1 on error. */
+
+static int
+flushOutput(struct rpcConn *conn)
+{
+    ssize_t nw;
+    size_t off;
+
+    for (off = 0; off < conn->outLen; off += nw) {
+        nw = write(conn->fd, conn->outBuf + off, conn->outLen - off);
+        if (nw == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR) {
+                nw = 0;
+                continue;
+            }
+            return -1;
+        }
+    }
+
+    memmove(conn->outBuf, conn->outBuf + off, conn->outLen - off);
+    conn->outLen -= off;
+    return 0;
+}
+
+/* Append a response to the output buffer of 'conn'. Return 0 on success,
+   or -1 if there is insufficient space (rpcServe() guarantees that there
+   is space for one maximum-size response each time that it calls the
+   request handler). */
+
+int
+rpcReply(struct rpcConn *conn, uint64_t id, uint32_t status,
+         const void *payload, size_t len)
+{
+    struct rpcHdr hdr;
+
+    if (len > RPC_MAX_PAYLOAD ||
+            RPC_BUF_SIZE - conn->outLen < sizeof(struct rpcHdr) + len) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    hdr.len = len;
+    hdr.op = status;
+    hdr.id = id;
+    memcpy(conn->outBuf + conn->outLen, &hdr, sizeof(struct rpcHdr));
+    conn->outLen += sizeof(struct rpcHdr);
+    if (len > 0)
+        memcpy(conn->outBuf + conn->outLen, payload, len);
+    conn->outLen += len;
+    return 0;
+}
+
+/* Process all complete requests in the input buffer of 'conn', stopping
+   early if the output buffer does not have room for another maximum-size
+   response. Return 0 on success, or -1 if the connection should be
+   closed. */
+
+static int
+processInput(struct rpcConn *conn, RpcRequestFunc reqFunc)
+{
+    struct rpcHdr hdr;
+    size_t off;
+
+    off = 0;
+    while (conn->inLen - off >= sizeof(struct rpcHdr)) {
+        if (RPC_BUF_SIZE - conn->outLen <
+                sizeof(struct rpcHdr) + RPC_MAX_PAYLOAD) {
+            if (flushOutput(conn) == -1)
+                return -1;
+            if (RPC_BUF_SIZE - conn->outLen <
+                    sizeof(struct rpcHdr) + RPC_MAX_PAYLOAD)
+                break;                  /* Wait until peer reads output */
+        }
+
+        memcpy(&hdr, conn->inBuf + off, sizeof(struct rpcHdr));
+        if (hdr.len > RPC_MAX_PAYLOAD)
+            return -1;                  /* Misbehaving client */
+        if (conn->inLen - off < sizeof(struct rpcHdr) + hdr.len)
+            break;                      /* Incomplete request */
+
+        if (reqFunc(conn, &hdr, conn->inBuf + off + sizeof(struct rpcHdr))
+                == -1)
+            return -1;
+        off += sizeof(struct rpcHdr) + hdr.len;
+    }
+
+    memmove(conn->inBuf, conn->inBuf + off, conn->inLen - off);
+    conn->inLen -= off;
+    return 0;
+}
+
+/* Change the events that epoll monitors for 'conn': while there is
+   unsent output, we wait only for the socket to become writable, so that
+   a client that does not read its responses cannot make us buffer an
+   unbounded amount of data */
+
+static int
+updateInterest(int epfd, struct rpcConn *conn)
+{
+    struct epoll_event ev;
+
+    ev.events = (conn->outLen > 0) ? EPOLLOUT : EPOLLIN;
+    ev.data.fd = conn->fd;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void
+closeConn(int epfd, struct rpcConn *conn, RpcConnFunc closeFunc)
+{
+    if (closeFunc != NULL)
+        closeFunc(conn);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    connTab[conn->fd] = NULL;
+    free(conn);
+    numConns--;
+    shortageEnd = 0;                    /* We've just freed one */
+}
+
+static void
+acceptConn(int epfd, int lfd, RpcConnFunc acceptFunc)
+{
+    struct sockaddr_storage addr;
+    struct epoll_event ev;
+    struct rpcConn *conn;
+    socklen_t len;
+    int cfd, newSize;
+
+    len = sizeof(struct sockaddr_storage);
+    cfd = accept4(lfd, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK);
+    if (cfd == -1) {
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+                errno == ENOMEM)
+            shortageEnd = nowMs() + SHORTAGE_RETRY_MS;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                 errno != ECONNABORTED)
+            errMsg("accept4");
+        return;
+    }
+
+    if (cfd >= connTabSize) {
+        newSize = (cfd + 1) * 2;
+        connTab = realloc(connTab, newSize * sizeof(struct rpcConn *));
+        if (connTab == NULL)
+            errExit("realloc");
+        memset(connTab + connTabSize, 0,
+                (newSize - connTabSize) * sizeof(struct rpcConn *));
+        connTabSize = newSize;
+    }
+
+    conn = malloc(sizeof(struct rpcConn));
+    if (conn == NULL)
+        errExit("malloc");
+    conn->fd = cfd;
+    conn->inLen = 0;
+    conn->outLen = 0;
+    conn->peerDone = FALSE;
+    conn->data = NULL;
+
+    /* Authenticate UNIX domain peers once, for the life of the
+       connection */
+
+    conn->haveCred = FALSE;
+    if (addr.ss_family == AF_UNIX) {
+        len = sizeof(struct ucred);
+        if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &conn->cred, &len) == -1) {
+            errMsg("getsockopt-SO_PEERCRED");
+            close(cfd);
+            free(conn);
+            return;
+        }
+        conn->haveCred = TRUE;
+    }
+
+    if (acceptFunc != NULL && acceptFunc(conn) == -1) {
+        close(cfd);
+        free(conn);
+        return;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = cfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) == -1)
+        errExit("epoll_ctl");
+    connTab[cfd] = conn;
+    numConns++;
+}
+
+/* Close 'epfd' and return -1, preserving 'errno' */
+
+static int
+serveFail(int epfd)
+{
+    int savedErrno;
+
+    savedErrno = errno;
+    close(epfd);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Start or stop monitoring the listening sockets */
+
+static int
+setAccepting(int epfd, const int *lfds, int nlfds, Boolean on)
+{
+    struct epoll_event ev;
+    int j;
+
+    for (j = 0; j < nlfds; j++) {
+        ev.events = on ? EPOLLIN : 0;
+        ev.data.fd = lfds[j];
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, lfds[j], &ev) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* Handle connections on the 'nlfds' listening sockets in 'lfds' until
+   an unrecoverable error occurs, allowing at most 'maxConns' (if greater
+   than 0) connections at a time. Return -1 on error. */
+
+int
+rpcServe(const int *lfds, int nlfds, int maxConns, RpcRequestFunc reqFunc,
+         RpcConnFunc acceptFunc, RpcConnFunc closeFunc)
+{
+    struct epoll_event ev, evlist[MAX_EVENTS];
+    struct rpcConn *conn;
+    int epfd, ready, j, k, fd, flags;
+    Boolean isListener, accepting, wantAccept;
+    long long now;
+    ssize_t nr;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        return -1;
+
+    for (j = 0; j < nlfds; j++) {
+        flags = fcntl(lfds[j], F_GETFL);
+        if (flags == -1 || fcntl(lfds[j], F_SETFL, flags | O_NONBLOCK) == -1)
+            return serveFail(epfd);
+
+        ev.events = EPOLLIN;
+        ev.data.fd = lfds[j];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfds[j], &ev) == -1)
+            return serveFail(epfd);
+    }
+
+    accepting = TRUE;
+    for (;;) {
+        now = nowMs();
+        if (shortageEnd != 0 && now >= shortageEnd)
+            shortageEnd = 0;            /* Shortage timed out; try again */
+
+        wantAccept = shortageEnd == 0 && (maxConns <= 0 || numConns < maxConns);
+        if (wantAccept != accepting) {
+            if (setAccepting(epfd, lfds, nlfds, wantAccept) == -1)
+                return serveFail(epfd);
+            accepting = wantAccept;
+        }
+
+        ready = epoll_wait(epfd, evlist, MAX_EVENTS,
+                           (shortageEnd != 0) ? (int) (shortageEnd - now) : -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            return serveFail(epfd);
+        }
+
+        for (j = 0; j < ready; j++) {
+            fd = evlist[j].data.fd;
+
+            isListener = FALSE;
+            for (k = 0; k < nlfds; k++)
+                if (fd == lfds[k])
+                    isListener = TRUE;
+            if (isListener) {
+                acceptConn(epfd, fd, acceptFunc);
+                continue;
+            }
+
+            conn = connTab[fd];
+
+            if (evlist[j].events & EPOLLOUT) {
+                if (flushOutput(conn) == -1) {
+                    closeConn(epfd, conn, closeFunc);
+                    continue;
+                }
+                if (conn->outLen > 0)
+                    continue;           /* Still can't write everything */
+            }
+
+            /* Read as much input as is available and will fit in the
+               buffer. If the peer has closed its end (perhaps only for
+               writing), we still process the requests that it sent
+               before doing so, and send all of the responses, closing
+               the connection only once the output has drained. */
+
+            if (!conn->peerDone &&
+                    (evlist[j].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                while (conn->inLen < RPC_BUF_SIZE) {
+                    nr = read(fd, conn->inBuf + conn->inLen,
+                              RPC_BUF_SIZE - conn->inLen);
+                    if (nr > 0) {
+                        conn->inLen += nr;
+                    } else {
+                        if (nr == 0 || (errno != EAGAIN &&
+                                    errno != EWOULDBLOCK && errno != EINTR))
+                            conn->peerDone = TRUE;
+                        break;
+                    }
+                }
+            }
+
+            if (processInput(conn, reqFunc) == -1 ||
+                    flushOutput(conn) == -1 ||
+                    (conn->peerDone && conn->outLen == 0)) {
+                closeConn(epfd, conn, closeFunc);
+                continue;
+            }
+
+            if (updateInterest(epfd, conn) == -1)
+                return serveFail(epfd);
+        }
+    }
+}
+
+/* Client side: send a request on the blocking socket 'sfd' and wait for
+   the response. The response header is returned in 'resp', and up to
+   'respMax' bytes of response payload in 'respPayload'. Return 0 on
+   success, or -1 on error. This function does not pipeline; see
+   us_rpc_bench.c for a client that does. */
+
+int
+rpcCall(int sfd, uint32_t op, const void *payload, size_t len,
+        struct rpcHdr *resp, void *respPayload, size_t respMax)
+{
+    char buf[sizeof(struct rpcHdr) + RPC_MAX_PAYLOAD];
+    struct rpcHdr hdr;
+    ssize_t n;
+
+    if (len > RPC_MAX_PAYLOAD) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    hdr.len = len;
+    hdr.op = op;
+    hdr.id = 0;
+    memcpy(buf, &hdr, sizeof(struct rpcHdr));
+    memcpy(buf + sizeof(struct rpcHdr), payload, len);
+    if (writen(sfd, buf, sizeof(struct rpcHdr) + len) !=
+            sizeof(struct rpcHdr) + len)
+        return -1;
+
+    n = readn(sfd, resp, sizeof(struct rpcHdr));
+    if (n != sizeof(struct rpcHdr)) {
+        if (n >= 0)
+            errno = ECONNRESET;
+        return -1;
+    }
+    if (resp->len > respMax || resp->len > RPC_MAX_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (resp->len > 0 && readn(sfd, respPayload, resp->len) != resp->len)
+        return -1;
+
+    return 0;
+}
+
+/* Ask the registry for the details of the service 'name'. Return 0 on
+   success, or -1 on error (with 'errno' set to ENOENT if the service is
+   not registered). */
+
+int
+rpcLookup(const char *name, struct rpcServiceInfo *info)
+{
+    struct rpcHdr resp;
+    int sfd, savedErrno;
+
+    sfd = unixConnectAbstract(RPC_REGISTRY_NAME, SOCK_STREAM);
+    if (sfd == -1)
+        return -1;
+
+    if (rpcCall(sfd, RPC_OP_LOOKUP, name, strlen(name) + 1, &resp,
+                info, sizeof(struct rpcServiceInfo)) == -1) {
+        savedErrno = errno;
+        close(sfd);
+        errno = savedErrno;
+        return -1;
+    }
+    close(sfd);
+
+    if (resp.op != RPC_OK || resp.len != sizeof(struct rpcServiceInfo)) {
+        errno = (resp.op == RPC_ERR_NOENT) ? ENOENT : EPROTO;
+        return -1;
+    }
+    info->addr[sizeof(info->addr) - 1] = '\0';
+    return 0;
+}
+
+/* Connect to the service 'name', using the details previously obtained
+   by rpcLookup() in 'info'. Because any process can bind an unused
+   abstract name, we check that the process at the other end of the
+   connection is the one that registered the service. Likewise, any user
+   can register a name first, so the caller names the user that the
+   service must run as in 'expectedUid'; both the credentials recorded by
+   the registry and those of the connected peer must match it. Return a
+   socket descriptor on success, or -1 on error (with 'errno' set to
+   EPERM if the peer is not the registered process or does not run as
+   'expectedUid'). */
+
+int
+rpcConnectService(const struct rpcServiceInfo *info, uid_t expectedUid)
+{
+    struct ucred cred;
+    socklen_t len;
+    int sfd;
+
+    if ((uid_t) info->uid != expectedUid) {
+        errno = EPERM;
+        return -1;
+    }
+
+    sfd = unixConnectAbstract(info->addr, SOCK_STREAM);
+    if (sfd == -1)
+        return -1;
+
+    len = sizeof(struct ucred);
+    if (getsockopt(sfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        close(sfd);
+        return -1;
+    }
+
+    if (cred.pid != info->pid || cred.uid != expectedUid) {
+        close(sfd);
+        errno = EPERM;
+        return -1;
+    }
+
+    return sfd;
+}
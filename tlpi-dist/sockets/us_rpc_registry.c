@@ -0,0 +1,169 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_rpc_registry.c
+
+   The registry for our local RPC transport (see us_rpc.h).
+
+   Usage: us_rpc_registry
+
+   The registry listens on the abstract socket name RPC_REGISTRY_NAME.
+   A service sends an RPC_OP_REGISTER request containing its name, and
+   keeps the connection open for as long as it provides the service. The
+   registry records the service's credentials, as obtained (once) via
+   SO_PEERCRED when the connection was accepted. A client sends an
+   RPC_OP_LOOKUP request, and receives the abstract address of the service
+   plus the credentials of the process that registered it.
+
+   A name that is already registered can't be registered again until the
+   connection of the process that registered it is closed.
+
+   The listen() backlog and the maximum number of simultaneous
+   connections are taken from rlimTuneInit() (see rlimit_tune.c).
+
+   This program is Linux-specific.
+
+   See also us_rpc_sv.c and us_rpc_bench.c.
+*/
+#include "us_rpc.h"             /* Defines _GNU_SOURCE, so include first */
+#include <signal.h>
+#include "rlimit_tune.h"
+
+struct service {                /* A registered service */
+    char name[RPC_MAX_NAME];
+    struct rpcConn *owner;      /* Connection over which it registered */
+    struct service *next;
+};
+
+static struct service *svcList = NULL;
+
+static struct service *
+findService(const char *name)
+{
+    struct service *svc;
+
+    for (svc = svcList; svc != NULL; svc = svc->next)
+        if (strcmp(svc->name, name) == 0)
+            return svc;
+    return NULL;
+}
+
+/* Check that 'payload' is a null-terminated service name of
+   acceptable length */
+
+static Boolean
+validName(const char *payload, uint32_t len)
+{
+    return len >= 2 && len <= RPC_MAX_NAME && payload[len - 1] == '\0' &&
+           strlen(payload) == len - 1 && strchr(payload, '/') == NULL;
+}
+
+static int
+handleRequest(struct rpcConn *conn, const struct rpcHdr *req,
+              const char *payload)
+{
+    struct service *svc;
+    struct rpcServiceInfo info;
+
+    switch (req->op) {
+    case RPC_OP_REGISTER:
+        if (!validName(payload, req->len))
+            return rpcReply(conn, req->id, RPC_ERR_INVAL, NULL, 0);
+        if (findService(payload) != NULL)
+            return rpcReply(conn, req->id, RPC_ERR_EXIST, NULL, 0);
+
+        svc = malloc(sizeof(struct service));
+        if (svc == NULL)
+            errExit("malloc");
+        strcpy(svc->name, payload);
+        svc->owner = conn;
+        svc->next = svcList;
+        svcList = svc;
+
+        printf("Registered \"%s\" (pid=%ld, uid=%ld)\n", svc->name,
+                (long) conn->cred.pid, (long) conn->cred.uid);
+        return rpcReply(conn, req->id, RPC_OK, NULL, 0);
+
+    case RPC_OP_LOOKUP:
+        if (!validName(payload, req->len))
+            return rpcReply(conn, req->id, RPC_ERR_INVAL, NULL, 0);
+        svc = findService(payload);
+        if (svc == NULL)
+            return rpcReply(conn, req->id, RPC_ERR_NOENT, NULL, 0);
+
+        memset(&info, 0, sizeof(struct rpcServiceInfo));
+        info.pid = svc->owner->cred.pid;
+        info.uid = svc->owner->cred.uid;
+        info.gid = svc->owner->cred.gid;
+        snprintf(info.addr, sizeof(info.addr), "%s%s",
+                RPC_SERVICE_PREFIX, svc->name);
+        return rpcReply(conn, req->id, RPC_OK, &info, sizeof(info));
+
+    default:
+        return rpcReply(conn, req->id, RPC_ERR_INVAL, NULL, 0);
+    }
+}
+
+/* Only UNIX domain peers may talk to the registry, since we rely on
+   knowing their credentials */
+
+static int
+acceptPeer(struct rpcConn *conn)
+{
+    return conn->haveCred ? 0 : -1;
+}
+
+/* When a connection closes, discard any services registered over it */
+
+static int
+closePeer(struct rpcConn *conn)
+{
+    struct service **pp, *svc;
+
+    for (pp = &svcList; *pp != NULL; ) {
+        svc = *pp;
+        if (svc->owner == conn) {
+            printf("Unregistered \"%s\"\n", svc->name);
+            *pp = svc->next;
+            free(svc);
+        } else {
+            pp = &svc->next;
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct rlimTune rt;
+    int lfd;
+
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageErr("%s\n", argv[0]);
+
+    setbuf(stdout, NULL);
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    rlimTuneInit(&rt, 0);
+
+    lfd = unixBindAbstract(RPC_REGISTRY_NAME, SOCK_STREAM);
+    if (lfd == -1)
+        errExit("unixBindAbstract");
+    if (listen(lfd, rt.backlog) == -1)
+        errExit("listen");
+
+    rpcServe(&lfd, 1, rt.maxClients, handleRequest, acceptPeer, closePeer);
+    errExit("rpcServe");
+}
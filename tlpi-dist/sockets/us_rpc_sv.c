@@ -0,0 +1,182 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_rpc_sv.c
+
+   A service for our local RPC transport (see us_rpc.h). The service
+   implements the RPC_OP_NULL and RPC_OP_ECHO operations.
+
+   Usage: us_rpc_sv [-R] [-v] [-t port] [-u uid]... service-name
+
+   The server listens on the abstract socket name
+   RPC_SERVICE_PREFIX + 'service-name', and registers 'service-name' with
+   the registry (us_rpc_registry), which must already be running.
+
+   The credentials of each client are checked once, when its connection
+   is accepted. By default, only clients with the same effective user ID
+   as the server, or with user ID 0, are permitted; each "-u" option
+   permits one further user ID.
+
+   If the "-t" option is specified, the server also listens on the
+   specified TCP port. Connections to this port receive exactly the same
+   service, but can't be authenticated; they exist so that us_rpc_bench.c
+   can compare the costs of the two transports.
+
+   The listen() backlog and the maximum number of simultaneous
+   connections are taken from rlimTuneInit() (see rlimit_tune.c), which
+   first raises the soft resource limits to the hard limits, unless "-R"
+   is specified. "-v" displays the limits and the values chosen.
+
+   This program is Linux-specific.
+*/
+#include "us_rpc.h"             /* Defines _GNU_SOURCE, so include first */
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include "inet_sockets.h"
+#include "rlimit_tune.h"
+
+#define MAX_UIDS 16
+
+static uid_t allowedUid[MAX_UIDS];
+static int numAllowed = 0;
+
+static int
+handleRequest(struct rpcConn *conn, const struct rpcHdr *req,
+              const char *payload)
+{
+    switch (req->op) {
+    case RPC_OP_NULL:
+        return rpcReply(conn, req->id, RPC_OK, NULL, 0);
+    case RPC_OP_ECHO:
+        return rpcReply(conn, req->id, RPC_OK, payload, req->len);
+    default:
+        return rpcReply(conn, req->id, RPC_ERR_INVAL, NULL, 0);
+    }
+}
+
+static int
+acceptPeer(struct rpcConn *conn)
+{
+    int j, optval;
+
+    if (!conn->haveCred) {              /* TCP peer */
+
+        /* Don't let Nagle's algorithm delay small responses */
+
+        optval = 1;
+        if (setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &optval,
+                    sizeof(optval)) == -1)
+            errMsg("setsockopt-TCP_NODELAY");
+        return 0;
+    }
+
+    for (j = 0; j < numAllowed; j++)
+        if (conn->cred.uid == allowedUid[j])
+            return 0;
+
+    fprintf(stderr, "Rejected connection from pid=%ld, uid=%ld\n",
+            (long) conn->cred.pid, (long) conn->cred.uid);
+    return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int lfd[2], nlfd, regfd, opt, tuneFlags;
+    char addr[sizeof(RPC_SERVICE_PREFIX) + RPC_MAX_NAME];
+    char *tcpPort;
+    struct rpcHdr resp;
+    struct rlimTune rt;
+    Boolean verbose;
+
+    tcpPort = NULL;
+    tuneFlags = 0;
+    verbose = FALSE;
+    allowedUid[numAllowed++] = geteuid();
+    allowedUid[numAllowed++] = 0;
+
+    while ((opt = getopt(argc, argv, "Rvt:u:")) != -1) {
+        switch (opt) {
+        case 'R':
+            tuneFlags |= RT_NO_RAISE;
+            break;
+
+        case 'v':
+            verbose = TRUE;
+            break;
+
+        case 't':
+            tcpPort = optarg;
+            break;
+
+        case 'u':
+            if (numAllowed >= MAX_UIDS)
+                fatal("Too many -u options");
+            allowedUid[numAllowed++] = getInt(optarg, GN_NONNEG, "uid");
+            break;
+
+        default:
+            usageErr("%s [-R] [-v] [-t port] [-u uid]... service-name\n"
+                    "        -R        don't raise soft resource limits\n"
+                    "        -v        display limits and pool sizes\n"
+                    "        -t port   also listen on TCP 'port'\n"
+                    "        -u uid    also accept clients with this UID\n",
+                    argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageErr("%s [-R] [-v] [-t port] [-u uid]... service-name\n",
+                argv[0]);
+    if (strlen(argv[optind]) >= RPC_MAX_NAME)
+        fatal("Service name too long");
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    rlimTuneInit(&rt, tuneFlags);
+    if (verbose)
+        rlimTunePrint(stderr, &rt);
+
+    snprintf(addr, sizeof(addr), "%s%s", RPC_SERVICE_PREFIX, argv[optind]);
+    lfd[0] = unixBindAbstract(addr, SOCK_STREAM);
+    if (lfd[0] == -1)
+        errExit("unixBindAbstract");
+    if (listen(lfd[0], rt.backlog) == -1)
+        errExit("listen");
+    nlfd = 1;
+
+    if (tcpPort != NULL) {
+        lfd[1] = inetListen(tcpPort, rt.backlog, NULL);
+        if (lfd[1] == -1)
+            errExit("inetListen");
+        nlfd = 2;
+    }
+
+    /* Register with the registry only once we are ready to accept
+       connections. We never close 'regfd': the registration lasts as long
+       as this process does. */
+
+    regfd = unixConnectAbstract(RPC_REGISTRY_NAME, SOCK_STREAM);
+    if (regfd == -1)
+        errExit("unixConnectAbstract-%s", RPC_REGISTRY_NAME);
+    if (rpcCall(regfd, RPC_OP_REGISTER, argv[optind],
+                strlen(argv[optind]) + 1, &resp, NULL, 0) == -1)
+        errExit("rpcCall");
+    if (resp.op != RPC_OK)
+        fatal("Registration of \"%s\" failed (status %ld)",
+                argv[optind], (long) resp.op);
+
+    rpcServe(lfd, nlfd, rt.maxClients, handleRequest, acceptPeer, NULL);
+    errExit("rpcServe");
+}
@@ -22,12 +22,13 @@
    kill %1表示杀死jobs显示的后台任务的第一个任务，在item2中执行有所不同。
 */
 #include "us_xfr.h"
-#define BACKLOG 5
+#include "rlimit_tune.h"
 
 int
 main(int argc, char *argv[])
 {
     struct sockaddr_un addr;
+    struct rlimTune rt;
     int sfd, cfd;
     ssize_t numRead;
     char buf[BUF_SIZE];
@@ -56,7 +57,11 @@ main(int argc, char *argv[])
     if (bind(sfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)
         errExit("bind");
 
-    if (listen(sfd, BACKLOG) == -1)
+    /* Size the listen queue from the resource limits (see rlimit_tune.c),
+       since clients wait there while we handle them one at a time */
+
+    rlimTuneInit(&rt, 0);
+    if (listen(sfd, rt.backlog) == -1)
         errExit("listen");
 
     for (;;) {          /* Handle client connections iteratively */
@@ -0,0 +1,233 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_pub.c
+
+   Functions with which one writer process publishes data (e.g., a
+   configuration) in a System V shared memory segment to any number of
+   reader processes.
+
+   Unlike svshm_xfr_writer.c and svshm_xfr_reader.c, where a pair of
+   semaphores makes the writer and a single reader take turns, here the
+   writer never waits for readers, and readers neither block one another
+   nor write to the data buffers. Each reader just obtains a consistent
+   copy of the most recently published data. (The one word that readers
+   do write is 'waiters', described below, so readers must attach the
+   segment read-write.)
+
+   There are two data buffers. The writer fills the buffer that is not
+   current, and then makes it current by incrementing 'version'. Each
+   buffer has a sequence number, which is odd while the writer is
+   changing the buffer. A reader copies the current buffer, and then
+   checks that the buffer's sequence number is even and unchanged; if
+   not, the writer has published twice during the copy, and the reader
+   tries again. So, even when the data is large and takes a while to
+   copy, readers rarely have to retry.
+
+   A reader that wants to know when new data is published can wait on
+   the 'version' word using futex(2) (an eventfd would have to be passed
+   to each reader, but the futex needs nothing beyond the segment). To
+   avoid making a system call on every publication, a reader sets
+   'waiters' in pubWait() before sleeping, and the writer calls
+   FUTEX_WAKE only if 'waiters' shows that a reader may be waiting.
+
+   This code is Linux-specific.
+*/
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <time.h>
+#include "svshm_pub.h"
+#include "tlpi_hdr.h"
+
+static int
+futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+struct pubShm *
+pubAttach(key_t key, size_t maxLen, int perms)
+{
+    struct pubShm *p;
+    size_t size;
+    int savedErrno;
+
+    p = malloc(sizeof(struct pubShm));
+    if (p == NULL)
+        return NULL;
+
+    if (maxLen > 0) {
+        if (maxLen > UINT32_MAX / 2) {
+            errno = EINVAL;
+            goto fail;
+        }
+        maxLen = (maxLen + PUB_LINE - 1) / PUB_LINE * PUB_LINE;
+        size = sizeof(struct pubSeg) + 2 * maxLen;
+        p->shmid = shmget(key, size, IPC_CREAT | IPC_EXCL | perms);
+    } else {
+        p->shmid = shmget(key, 0, 0);
+    }
+    if (p->shmid == -1)
+        goto fail;
+
+    p->seg = shmat(p->shmid, NULL, 0);
+    if (p->seg == (void *) -1) {
+        if (maxLen > 0)
+            shmctl(p->shmid, IPC_RMID, NULL);
+        goto fail;
+    }
+
+    /* A new segment is zero-filled, so version 0 (empty data) is
+       already published */
+
+    if (maxLen > 0)
+        p->seg->maxLen = maxLen;
+    return p;
+
+fail:
+    savedErrno = errno;
+    free(p);
+    errno = savedErrno;
+    return NULL;
+}
+
+int
+pubPublish(struct pubShm *p, const void *data, size_t len)
+{
+    struct pubSeg *seg = p->seg;
+    uint32_t version, seq;
+    int n;
+
+    if (len > seg->maxLen) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Fill the buffer that isn't current */
+
+    version = seg->version;
+    n = (version + 1) % 2;
+    seq = seg->buf[n].seq;
+    __atomic_store_n(&seg->buf[n].seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(seg->data + (size_t) n * seg->maxLen, data, len);
+    seg->buf[n].len = len;
+
+    __atomic_store_n(&seg->buf[n].seq, seq + 2, __ATOMIC_RELEASE);
+
+    /* Make it current. The sequentially consistent operations here and
+       in pubWait() ensure that either we see that a reader is waiting,
+       or the reader's FUTEX_WAIT sees the new version. */
+
+    __atomic_store_n(&seg->version, version + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&seg->waiters, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&seg->waiters, 0, __ATOMIC_SEQ_CST))
+        if (futex(&seg->version, FUTEX_WAKE, INT_MAX, NULL) == -1)
+            return -1;
+
+    return 0;
+}
+
+ssize_t
+pubRead(struct pubShm *p, void *buf, size_t max, uint32_t *versionp)
+{
+    struct pubSeg *seg = p->seg;
+    uint32_t version, seq;
+    size_t len;
+    int n;
+
+    for (;;) {
+        version = __atomic_load_n(&seg->version, __ATOMIC_ACQUIRE);
+        n = version % 2;
+        seq = __atomic_load_n(&seg->buf[n].seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;           /* Writer has already come round again */
+
+        /* 'len' may be garbage if the writer is changing the buffer, so
+           check it before use */
+
+        len = seg->buf[n].len;
+        if (len <= max && len <= seg->maxLen)
+            memcpy(buf, seg->data + (size_t) n * seg->maxLen, len);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seg->buf[n].seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+
+    if (versionp != NULL)
+        *versionp = version;
+    if (len > max) {
+        errno = ERANGE;
+        return -1;
+    }
+    return len;
+}
+
+int
+pubWait(struct pubShm *p, uint32_t version, int timeoutMs)
+{
+    struct pubSeg *seg = p->seg;
+    struct timespec deadline, now, ts;
+
+    if (timeoutMs >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while (__atomic_load_n(&seg->version, __ATOMIC_ACQUIRE) == version) {
+        __atomic_store_n(&seg->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if (timeoutMs >= 0) {           /* FUTEX_WAIT takes a relative time */
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ts.tv_sec = deadline.tv_sec - now.tv_sec;
+            ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (ts.tv_nsec < 0) {
+                ts.tv_sec--;
+                ts.tv_nsec += 1000000000L;
+            }
+            if (ts.tv_sec < 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+
+        if (futex(&seg->version, FUTEX_WAIT, version,
+                  (timeoutMs >= 0) ? &ts : NULL) == -1 &&
+                errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+pubDetach(struct pubShm *p, int remove)
+{
+    int ret;
+
+    ret = shmdt(p->seg);
+    if (ret == 0 && remove)
+        ret = shmctl(p->shmid, IPC_RMID, NULL);
+    free(p);
+    return ret;
+}
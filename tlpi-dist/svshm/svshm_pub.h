@@ -0,0 +1,74 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_pub.h
+
+   Header file for svshm_pub.c.
+*/
+#ifndef SVSHM_PUB_H
+#define SVSHM_PUB_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#define PUB_LINE 64             /* Assumed cache line size */
+
+struct pubSeg {                 /* Layout of the shared memory segment */
+    uint32_t version;           /* Number of publications so far; the
+                                   current data is in buf[version % 2] */
+    uint32_t maxLen;            /* Size of each data buffer */
+    char pad1[PUB_LINE - 8];
+    uint32_t waiters;           /* Nonzero if readers may be waiting for
+                                   'version' to change */
+    char pad2[PUB_LINE - 4];
+    struct {
+        uint32_t seq;           /* Odd while the writer is changing buffer */
+        uint32_t len;           /* Bytes of data in buffer */
+        char pad[PUB_LINE - 8];
+    } buf[2];
+    char data[];                /* Two buffers of 'maxLen' bytes */
+};
+
+struct pubShm {                 /* Per-process handle */
+    int shmid;
+    struct pubSeg *seg;
+};
+
+/* Create (if 'maxLen' is greater than 0) or attach to the segment with
+   the key 'key'. Returns: pointer to handle, or NULL on error. */
+
+struct pubShm *pubAttach(key_t key, size_t maxLen, int perms);
+
+/* Writer: make 'len' bytes from 'data' the current data, and wake any
+   readers waiting in pubWait(). Returns: 0 on success, or -1 on error. */
+
+int pubPublish(struct pubShm *p, const void *data, size_t len);
+
+/* Reader: copy the current data into 'buf', whose size is 'max', and
+   return its version number in '*versionp'. Returns: length of data, or
+   -1 on error (ERANGE if 'max' is too small). */
+
+ssize_t pubRead(struct pubShm *p, void *buf, size_t max, uint32_t *versionp);
+
+/* Reader: wait until the version number differs from 'version', or
+   until 'timeoutMs' milliseconds (-1: no limit) have passed.
+   Returns: 0 on success, or -1 on error (ETIMEDOUT on timeout). */
+
+int pubWait(struct pubShm *p, uint32_t version, int timeoutMs);
+
+/* Detach from the segment and free 'p'; if 'remove' is nonzero, also
+   mark the segment for deletion. Returns: 0 on success, or -1 on
+   error. */
+
+int pubDetach(struct pubShm *p, int remove);
+
+#endif
@@ -0,0 +1,253 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_pub_bench.c
+
+   Measure the performance of the publication functions in svshm_pub.c.
+
+   Usage: svshm_pub_bench [-r readers] [-w waiters] [-s size] [-i usecs]
+                          [-d secs]
+
+   The program creates 'readers' (default: 64) processes that repeatedly
+   copy the published data as fast as they can, and 'waiters' (default:
+   4) processes that use pubWait() to wait for each new version. The
+   parent then publishes 'size' bytes (default: 4096) every 'usecs'
+   microseconds (default: 1000) for 'secs' seconds (default: 2).
+
+   The program reports the total rate at which the readers obtained
+   copies, the time taken by each publication, and the time between a
+   publication and a waiting reader's return from pubWait(). Every copy
+   is checked for consistency.
+
+   This program is Linux-specific.
+*/
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "svshm_pub.h"
+#include "tlpi_hdr.h"
+
+struct payHdr {                 /* Start of each publication; the rest of
+                                   the data consists of bytes with the
+                                   value ('num' & 0xff) */
+    uint64_t num;
+    double stamp;               /* CLOCK_MONOTONIC time of publication */
+};
+
+struct stats {                  /* Results of one child */
+    long reads;
+    long errors;                /* Inconsistent copies */
+    double latSum;              /* For waiters: wake-up latency */
+    double latMax;
+};
+
+static volatile int *stop;      /* Set by parent to tell children to stop */
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Return TRUE if the 'len' bytes of publication 'buf' are consistent */
+
+static Boolean
+consistent(const char *buf, ssize_t len)
+{
+    struct payHdr hdr;
+    unsigned char c;
+
+    if (len == 0)                       /* Nothing published yet */
+        return TRUE;
+    if (len < (ssize_t) sizeof(hdr))
+        return FALSE;
+    memcpy(&hdr, buf, sizeof(hdr));
+    c = hdr.num & 0xff;
+    return (unsigned char) buf[sizeof(hdr)] == c &&
+           (unsigned char) buf[sizeof(hdr) + (len - sizeof(hdr)) / 2] == c &&
+           (unsigned char) buf[len - 1] == c;
+}
+
+static void
+runReader(struct pubShm *p, char *buf, size_t size, struct stats *st)
+{
+    ssize_t len;
+
+    if (pubWait(p, 0, -1) == -1)        /* Wait for first publication */
+        errExit("pubWait");
+
+    while (!*stop) {
+        len = pubRead(p, buf, size, NULL);
+        if (len == -1)
+            errExit("pubRead");
+        if (!consistent(buf, len))
+            st->errors++;
+        st->reads++;
+    }
+}
+
+static void
+runWaiter(struct pubShm *p, char *buf, size_t size, struct stats *st)
+{
+    struct payHdr hdr;
+    uint32_t version;
+    ssize_t len;
+    double lat;
+
+    len = pubRead(p, buf, size, &version);
+    while (!*stop) {
+        if (pubWait(p, version, 100) == -1) {
+            if (errno == ETIMEDOUT)
+                continue;
+            errExit("pubWait");
+        }
+        len = pubRead(p, buf, size, &version);
+        if (len == -1)
+            errExit("pubRead");
+        lat = nowSecs();
+        if (!consistent(buf, len)) {
+            st->errors++;
+            continue;
+        }
+        memcpy(&hdr, buf, sizeof(hdr));
+        lat -= hdr.stamp;
+        st->latSum += lat;
+        if (lat > st->latMax)
+            st->latMax = lat;
+        st->reads++;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int numReaders, numWaiters, usecs, secs, opt, j;
+    double start, end, t, pubSum, pubMax;
+    struct stats *st, *sp, rd, wt;
+    struct timespec interval;
+    struct pubShm *p;
+    struct payHdr hdr;
+    size_t size;
+    long pubs;
+    char *buf;
+
+    numReaders = 64;
+    numWaiters = 4;
+    size = 4096;
+    usecs = 1000;
+    secs = 2;
+    while ((opt = getopt(argc, argv, "r:w:s:i:d:")) != -1) {
+        switch (opt) {
+        case 'r': numReaders = getInt(optarg, 0, "readers");    break;
+        case 'w': numWaiters = getInt(optarg, 0, "waiters");    break;
+        case 's': size = getLong(optarg, GN_GT_0, "size");      break;
+        case 'i': usecs = getInt(optarg, 0, "usecs");           break;
+        case 'd': secs = getInt(optarg, GN_GT_0, "secs");       break;
+        default:
+            usageErr("%s [-r readers] [-w waiters] [-s size] [-i usecs] "
+                    "[-d secs]\n", argv[0]);
+        }
+    }
+    if (size < sizeof(struct payHdr) + 1)
+        size = sizeof(struct payHdr) + 1;
+
+    p = pubAttach(IPC_PRIVATE, size, S_IRUSR | S_IWUSR);
+    if (p == NULL)
+        errExit("pubAttach");
+
+    buf = malloc(size);
+    st = mmap(NULL, (numReaders + numWaiters) * sizeof(struct stats) +
+              sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+              -1, 0);
+    if (buf == NULL || st == MAP_FAILED)
+        errExit("malloc/mmap");
+    stop = (int *) &st[numReaders + numWaiters];
+
+    /* Children inherit the attachment of the segment */
+
+    for (j = 0; j < numReaders + numWaiters; j++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            if (j < numReaders)
+                runReader(p, buf, size, &st[j]);
+            else
+                runWaiter(p, buf, size, &st[j]);
+            _exit(EXIT_SUCCESS);
+        default:
+            break;
+        }
+    }
+
+    /* Publish until time is up */
+
+    interval.tv_sec = usecs / 1000000;
+    interval.tv_nsec = (usecs % 1000000) * 1000L;
+    pubSum = pubMax = 0;
+    start = nowSecs();
+    end = start + secs;
+    for (pubs = 0; nowSecs() < end; pubs++) {
+        hdr.num = pubs + 1;
+        memset(buf, hdr.num & 0xff, size);
+        hdr.stamp = nowSecs();
+        memcpy(buf, &hdr, sizeof(hdr));
+
+        if (pubPublish(p, buf, size) == -1)
+            errExit("pubPublish");
+
+        t = nowSecs() - hdr.stamp;
+        pubSum += t;
+        if (t > pubMax)
+            pubMax = t;
+
+        if (usecs > 0)
+            nanosleep(&interval, NULL);
+    }
+    start = nowSecs() - start;
+
+    *stop = 1;
+    while (wait(NULL) > 0)
+        continue;
+
+    memset(&rd, 0, sizeof(rd));
+    memset(&wt, 0, sizeof(wt));
+    for (j = 0; j < numReaders + numWaiters; j++) {
+        sp = (j < numReaders) ? &rd : &wt;
+        sp->reads += st[j].reads;
+        sp->errors += st[j].errors;
+        sp->latSum += st[j].latSum;
+        if (st[j].latMax > sp->latMax)
+            sp->latMax = st[j].latMax;
+    }
+
+    printf("Payload %zu bytes, %d readers, %d waiters, %.2f s\n", size,
+            numReaders, numWaiters, start);
+    printf("Readers: %.0f copies/s in total (%.0f per reader); "
+            "%ld inconsistent\n", rd.reads / start,
+            numReaders ? rd.reads / start / numReaders : 0.0, rd.errors);
+    printf("Writer:  %ld publications; latency mean %.2f us, max %.2f us\n",
+            pubs, pubs ? pubSum / pubs * 1e6 : 0.0, pubMax * 1e6);
+    printf("Waiters: %ld wake-ups; latency mean %.2f us, max %.2f us; "
+            "%ld inconsistent\n", wt.reads,
+            wt.reads ? wt.latSum / wt.reads * 1e6 : 0.0, wt.latMax * 1e6,
+            wt.errors);
+
+    if (pubDetach(p, 1) == -1)
+        errExit("pubDetach");
+    exit((rd.errors + wt.errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,366 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* periodic_jitter.c
+
+   Run a periodic task and measure how late each period's wake-up is,
+   comparing several ways of waiting for the start of the next period.
+
+   Usage: periodic_jitter [-m mode] [-p period-usecs] [-n periods]
+                          [-w work-usecs] [-s spin-usecs] [-f prio] [-l]
+
+   'mode' is one of:
+
+        nanosleep   nanosleep() for one period after each task run. This is
+                    the naive approach: the time spent running the task,
+                    plus each wake-up delay, accumulates as drift.
+        abstime     clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME) until
+                    the next deadline, where deadlines are fixed points
+                    start + k * period, so that drift can't accumulate.
+        timerfd     read() from a periodic CLOCK_MONOTONIC timerfd whose
+                    first expiration is set with TFD_TIMER_ABSTIME.
+        busy        clock_nanosleep(TIMER_ABSTIME) until 'spin-usecs'
+                    (default: 50) before the deadline, and then busy-wait
+                    (polling clock_gettime()) for the rest of the period.
+                    This trades CPU time for lower jitter.
+        all         run each of the above in turn (the default)
+
+   Each period, the task consumes 'work-usecs' (default: 0) of CPU time.
+   The default period is 1000 microseconds, and the default number of
+   periods is 5000.
+
+   If a deadline has already passed when the task completes, the missed
+   periods are skipped (and counted), rather than run back to back.
+
+   The "-f" option runs the task under SCHED_FIFO with the specified
+   priority, and "-l" locks the process's memory with mlockall(), so that
+   page faults can't add to wake-up latency. (See demo_sched_fifo.c and
+   memlock.c.) Both usually require privilege.
+
+   For each mode, the program shows the minimum, mean, 99th percentile
+   and maximum wake-up latency, a histogram of latencies in power-of-two
+   microsecond buckets, the number of missed periods, and the drift: how
+   far the final wake-up was from the final deadline on the ideal
+   schedule start + k * period.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include "tlpi_hdr.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+enum { MODE_NANOSLEEP, MODE_ABSTIME, MODE_TIMERFD, MODE_BUSY, NUM_MODES };
+
+static const char *modeName[NUM_MODES] =
+        { "nanosleep", "abstime", "timerfd", "busy" };
+
+#define NUM_BUCKETS 24          /* Bucket 0: < 1 us; bucket b (b > 0):
+                                   [2^(b-1), 2^b) us; last bucket: more */
+
+struct result {
+    long long *late;            /* Lateness of each wake-up (nanosecs) */
+    long numSamples;
+    long missed;                /* Periods skipped because of overruns */
+    long long drift;            /* Final wake-up minus ideal time */
+    long hist[NUM_BUCKETS];
+};
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void
+nsToTimespec(long long ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+/* Sleep until the absolute CLOCK_MONOTONIC time 'ns' */
+
+static void
+sleepUntil(long long ns)
+{
+    struct timespec ts;
+    int s;
+
+    nsToTimespec(ns, &ts);
+    do {
+        s = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    } while (s == EINTR);               /* No need to recalculate */
+    if (s != 0)
+        errExitEN(s, "clock_nanosleep");
+}
+
+/* Burn CPU for 'ns' nanoseconds, standing in for the periodic task */
+
+static void
+doWork(long long ns)
+{
+    long long end;
+
+    if (ns <= 0)
+        return;
+    end = nowNs() + ns;
+    while (nowNs() < end)
+        continue;
+}
+
+static int
+bucketOf(long long ns)
+{
+    long long us;
+    int b;
+
+    us = ns / 1000;
+    for (b = 0; us > 0 && b < NUM_BUCKETS - 1; b++)
+        us >>= 1;
+    return b;
+}
+
+static void
+runMode(int mode, long long period, long numPeriods, long long work,
+        long long spin, struct result *r)
+{
+    struct itimerspec its;
+    struct timespec req;
+    long long start, target, wake;
+    uint64_t numExp;
+    long k;
+    int tfd;
+
+    r->numSamples = 0;
+    r->missed = 0;
+    memset(r->hist, 0, sizeof(r->hist));
+
+    start = nowNs() + period;
+    target = start;
+
+    tfd = -1;
+    if (mode == MODE_TIMERFD) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (tfd == -1)
+            errExit("timerfd_create");
+        nsToTimespec(start, &its.it_value);
+        nsToTimespec(period, &its.it_interval);
+        if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+            errExit("timerfd_settime");
+    }
+
+    for (k = 0; k < numPeriods; k++) {
+        switch (mode) {
+        case MODE_NANOSLEEP:
+
+            /* The naive approach: 'target' is where this sleep intends to
+               wake, but the error in each sleep carries forward */
+
+            target = nowNs() + period;
+            nsToTimespec(period, &req);
+            while (nanosleep(&req, &req) == -1) {
+                if (errno != EINTR)
+                    errExit("nanosleep");
+            }
+            break;
+
+        case MODE_ABSTIME:
+            sleepUntil(target);
+            break;
+
+        case MODE_TIMERFD:
+            if (read(tfd, &numExp, sizeof(uint64_t)) != sizeof(uint64_t))
+                errExit("read-timerfd");
+
+            /* More than one expiration means that we missed some
+               periods; we are now serving the most recent one */
+
+            r->missed += numExp - 1;
+            target += (numExp - 1) * period;
+            break;
+
+        case MODE_BUSY:
+            if (target - spin > nowNs())
+                sleepUntil(target - spin);
+            while (nowNs() < target)
+                continue;
+            break;
+        }
+
+        wake = nowNs();
+        r->late[r->numSamples++] = wake - target;
+        r->hist[bucketOf(wake - target)]++;
+
+        doWork(work);
+
+        if (mode != MODE_NANOSLEEP) {
+            target += period;
+
+            /* For the timerfd, the kernel reports overruns via the
+               expiration count; otherwise, skip deadlines that have
+               already passed */
+
+            if (mode != MODE_TIMERFD) {
+                while (target < nowNs()) {
+                    r->missed++;
+                    target += period;
+                }
+            }
+        }
+    }
+
+    r->drift = wake - (start + (numPeriods - 1 + r->missed) * period);
+
+    if (tfd != -1)
+        close(tfd);
+}
+
+static int
+cmpLongLong(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+printResult(int mode, struct result *r)
+{
+    long long sum;
+    long j, n;
+
+    n = r->numSamples;
+    sum = 0;
+    for (j = 0; j < n; j++)
+        sum += r->late[j];
+    qsort(r->late, n, sizeof(long long), cmpLongLong);
+
+    printf("%-10s %9.1f %9.1f %9.1f %9.1f %8ld %12.1f\n", modeName[mode],
+            r->late[0] / 1e3, sum / 1e3 / n, r->late[(long) (n * 0.99)] / 1e3,
+            r->late[n - 1] / 1e3, r->missed, r->drift / 1e3);
+}
+
+static void
+printHistogram(int mode, struct result *r)
+{
+    int b;
+
+    printf("\n%s: wake-up latency histogram\n", modeName[mode]);
+    for (b = 0; b < NUM_BUCKETS; b++) {
+        if (r->hist[b] == 0)
+            continue;
+        if (b == 0)
+            printf("    %8s < %-8d", "", 1);
+        else if (b == NUM_BUCKETS - 1)
+            printf("    %8s >= %-7d", "", 1 << (b - 1));
+        else
+            printf("    %8d - %-8d", 1 << (b - 1), 1 << b);
+        printf(" us: %8ld  %5.1f%%\n", r->hist[b],
+                100.0 * r->hist[b] / r->numSamples);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct result res[NUM_MODES];
+    struct sched_param sp;
+    long long period, work, spin;
+    long numPeriods;
+    int mode, opt, prio, firstMode, lastMode;
+    Boolean lockMem;
+
+    period = 1000 * 1000;
+    numPeriods = 5000;
+    work = 0;
+    spin = 50 * 1000;
+    prio = -1;
+    lockMem = FALSE;
+    firstMode = 0;
+    lastMode = NUM_MODES - 1;
+
+    while ((opt = getopt(argc, argv, "m:p:n:w:s:f:l")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "all") == 0)
+                break;
+            for (mode = 0; mode < NUM_MODES; mode++)
+                if (strcmp(optarg, modeName[mode]) == 0)
+                    break;
+            if (mode == NUM_MODES)
+                usageErr("%s: unknown mode '%s'\n", argv[0], optarg);
+            firstMode = lastMode = mode;
+            break;
+
+        case 'p': period = getLong(optarg, GN_GT_0, "period") * 1000LL; break;
+        case 'n': numPeriods = getLong(optarg, GN_GT_0, "periods");    break;
+        case 'w': work = getLong(optarg, GN_NONNEG, "work") * 1000LL;  break;
+        case 's': spin = getLong(optarg, GN_NONNEG, "spin") * 1000LL;  break;
+        case 'f': prio = getInt(optarg, 0, "prio");                     break;
+        case 'l': lockMem = TRUE;                                       break;
+
+        default:
+            usageErr("%s [-m nanosleep|abstime|timerfd|busy|all] "
+                    "[-p period-usecs]\n\t[-n periods] [-w work-usecs] "
+                    "[-s spin-usecs] [-f prio] [-l]\n", argv[0]);
+        }
+    }
+
+    /* Allocate and touch all sample buffers before locking memory and
+       before any measurement starts, so that no page faults occur while
+       the task is running. calloc() alone won't do: a large allocation
+       comes from mmap(), and its zero pages aren't faulted in until they
+       are first written. */
+
+    for (mode = firstMode; mode <= lastMode; mode++) {
+        res[mode].late = malloc(numPeriods * sizeof(long long));
+        if (res[mode].late == NULL)
+            errExit("malloc");
+        memset(res[mode].late, 0, numPeriods * sizeof(long long));
+    }
+
+    if (lockMem && mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+        errExit("mlockall");
+
+    if (prio != -1) {
+        sp.sched_priority = prio;
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1)
+            errExit("sched_setscheduler");
+    }
+
+    printf("period %lld us, %ld periods, work %lld us, spin %lld us%s%s\n\n",
+            period / 1000, numPeriods, work / 1000, spin / 1000,
+            (prio != -1) ? ", SCHED_FIFO" : "", lockMem ? ", mlockall" : "");
+
+    for (mode = firstMode; mode <= lastMode; mode++)
+        runMode(mode, period, numPeriods, work, spin, &res[mode]);
+
+    printf("%-10s %9s %9s %9s %9s %8s %12s\n", "mode", "min(us)",
+            "mean(us)", "p99(us)", "max(us)", "missed", "drift(us)");
+    for (mode = firstMode; mode <= lastMode; mode++)
+        printResult(mode, &res[mode]);
+
+    for (mode = firstMode; mode <= lastMode; mode++)
+        printHistogram(mode, &res[mode]);
+
+    exit(EXIT_SUCCESS);
+}
@@ -14,6 +14,8 @@
 
    Demonstrate the use of a timer to place a timeout on a blocking system call
    (read(2) in this case).
+
+   See timeout_io.c for an approach that doesn't rely on signals.
 */
 #include <signal.h>
 #include "tlpi_hdr.h"
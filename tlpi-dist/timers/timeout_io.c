@@ -0,0 +1,224 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timeout_io.c
+
+   Functions that perform I/O with a timeout, without using signals.
+
+   timed_read.c places a timeout on read() by having a SIGALRM handler
+   interrupt the blocked call. That technique has several problems: there
+   is only one alarm timer per process, so it can't be used by multiple
+   threads or combined with other uses of alarm(); the signal may be
+   delivered to a thread other than the one that is blocked; and there is
+   a race if the signal arrives after alarm() but before read() blocks.
+
+   Instead, the functions here wait for the file descriptor to become
+   ready using ppoll(), whose timeout has nanosecond resolution, and then
+   perform the I/O. Timeouts are expressed as absolute CLOCK_MONOTONIC
+   deadlines, so that a caller can apply one deadline to a sequence of
+   operations (e.g., connect, write request, read reply), and a thread can
+   have any number of independent deadlines outstanding. Since no timer or
+   signal is involved, the functions are thread-safe, and are unaffected
+   by changes to the system clock.
+
+   Note that if 'fd' refers to a blocking file descriptor, a read() or
+   write() that follows a successful ppoll() can still block (e.g., if
+   another process consumed the available input, or if a write is larger
+   than the available buffer space). To guarantee that the deadline is
+   honored, use nonblocking descriptors; the functions handle EAGAIN by
+   waiting again.
+*/
+#define _GNU_SOURCE             /* For ppoll() */
+#include <poll.h>
+#include <fcntl.h>
+#include "timeout_io.h"         /* Declares functions defined here */
+#include "tlpi_hdr.h"
+
+#define NSEC_PER_SEC 1000000000L
+
+/* Set 'deadline' to the CLOCK_MONOTONIC time 'nsecs' nanoseconds from
+   now */
+
+void
+tioDeadline(long long nsecs, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += nsecs / NSEC_PER_SEC;
+    deadline->tv_nsec += nsecs % NSEC_PER_SEC;
+    if (deadline->tv_nsec >= NSEC_PER_SEC) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+/* Wait until 'fd' is ready for the I/O specified by 'events', or until
+   'deadline' passes. Return 0 if the descriptor is ready, or -1 on error
+   or timeout (in which case 'errno' is ETIMEDOUT). */
+
+static int
+waitReady(int fd, short events, const struct timespec *deadline)
+{
+    struct pollfd pfd;
+    struct timespec now, remain;
+    int ready;
+
+    pfd.fd = fd;
+    pfd.events = events;
+
+    for (;;) {
+        if (deadline != NULL) {
+            if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+                return -1;
+            remain.tv_sec = deadline->tv_sec - now.tv_sec;
+            remain.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+            if (remain.tv_nsec < 0) {
+                remain.tv_sec--;
+                remain.tv_nsec += NSEC_PER_SEC;
+            }
+            if (remain.tv_sec < 0) {
+                remain.tv_sec = 0;      /* Deadline passed: just check */
+                remain.tv_nsec = 0;
+            }
+        }
+
+        ready = ppoll(&pfd, 1, (deadline == NULL) ? NULL : &remain, NULL);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;               /* Recompute time remaining */
+            return -1;
+        }
+
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        /* Readiness, an error, or hangup: in each case, the subsequent
+           I/O call will report the details */
+
+        return 0;
+    }
+}
+
+/* Read up to 'len' bytes from 'fd', waiting no later than 'deadline'
+   for input to become available. Return the number of bytes read (0 on
+   end-of-file), or -1 on error or timeout. */
+
+ssize_t
+tioRead(int fd, void *buf, size_t len, const struct timespec *deadline)
+{
+    ssize_t numRead;
+
+    for (;;) {
+        if (waitReady(fd, POLLIN, deadline) == -1)
+            return -1;
+
+        numRead = read(fd, buf, len);
+        if (numRead != -1 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                              errno != EINTR))
+            return numRead;
+    }
+}
+
+/* Write all 'len' bytes to 'fd', unless 'deadline' passes first. Return
+   the number of bytes written, which is less than 'len' only if the
+   deadline passed or an error occurred part way through; if no bytes
+   could be written, return -1. */
+
+ssize_t
+tioWrite(int fd, const void *buf, size_t len,
+         const struct timespec *deadline)
+{
+    ssize_t numWritten;
+    size_t totWritten;
+
+    for (totWritten = 0; totWritten < len; ) {
+        if (waitReady(fd, POLLOUT, deadline) == -1)
+            return (totWritten > 0) ? (ssize_t) totWritten : -1;
+
+        numWritten = write(fd, (const char *) buf + totWritten,
+                           len - totWritten);
+        if (numWritten == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue;
+            return (totWritten > 0) ? (ssize_t) totWritten : -1;
+        }
+        totWritten += numWritten;
+    }
+
+    return totWritten;
+}
+
+/* Connect the socket 'sfd' to 'addr', giving up if the connection has
+   not been established by 'deadline'. The socket is temporarily placed
+   in nonblocking mode; its original file status flags are restored
+   before return. Return 0 on success, or -1 on error or timeout. */
+
+int
+tioConnect(int sfd, const struct sockaddr *addr, socklen_t addrlen,
+           const struct timespec *deadline)
+{
+    int flags, savedErrno, sockErr, status;
+    socklen_t optlen;
+
+    flags = fcntl(sfd, F_GETFL);
+    if (flags == -1)
+        return -1;
+    if (!(flags & O_NONBLOCK) && fcntl(sfd, F_SETFL, flags | O_NONBLOCK) == -1)
+        return -1;
+
+    status = connect(sfd, addr, addrlen);
+    if (status == -1 && errno == EINPROGRESS) {
+
+        /* The connection completes (successfully or otherwise) when the
+           socket becomes writable; SO_ERROR then tells us the outcome */
+
+        status = waitReady(sfd, POLLOUT, deadline);
+        if (status == 0) {
+            optlen = sizeof(sockErr);
+            status = getsockopt(sfd, SOL_SOCKET, SO_ERROR, &sockErr, &optlen);
+            if (status == 0 && sockErr != 0) {
+                errno = sockErr;
+                status = -1;
+            }
+        }
+    }
+
+    savedErrno = errno;
+    if (!(flags & O_NONBLOCK))
+        fcntl(sfd, F_SETFL, flags);
+    errno = savedErrno;
+
+    return status;
+}
+
+/* Accept a connection on the listening socket 'lfd', waiting no later
+   than 'deadline'. Arguments and return value are as for accept(). If
+   another process or thread takes the connection first, we wait again;
+   use a nonblocking 'lfd' if that is possible. */
+
+int
+tioAccept(int lfd, struct sockaddr *addr, socklen_t *addrlen,
+          const struct timespec *deadline)
+{
+    int cfd;
+
+    for (;;) {
+        if (waitReady(lfd, POLLIN, deadline) == -1)
+            return -1;
+
+        cfd = accept(lfd, addr, addrlen);
+        if (cfd != -1 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                          errno != EINTR && errno != ECONNABORTED))
+            return cfd;
+    }
+}
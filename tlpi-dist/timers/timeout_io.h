@@ -0,0 +1,42 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timeout_io.h
+
+   Header file for timeout_io.c.
+*/
+#ifndef TIMEOUT_IO_H
+#define TIMEOUT_IO_H            /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* All of the functions below take an absolute CLOCK_MONOTONIC deadline;
+   a NULL 'deadline' means "wait indefinitely". On timeout, they return
+   -1 with 'errno' set to ETIMEDOUT. */
+
+void tioDeadline(long long nsecs, struct timespec *deadline);
+
+ssize_t tioRead(int fd, void *buf, size_t len,
+                const struct timespec *deadline);
+
+ssize_t tioWrite(int fd, const void *buf, size_t len,
+                const struct timespec *deadline);
+
+int tioConnect(int sfd, const struct sockaddr *addr, socklen_t addrlen,
+                const struct timespec *deadline);
+
+int tioAccept(int lfd, struct sockaddr *addr, socklen_t *addrlen,
+                const struct timespec *deadline);
+
+#endif
@@ -0,0 +1,187 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timeout_io_bench.c
+
+   Measure the cost of the timeout-aware I/O functions in timeout_io.c.
+
+   Usage: timeout_io_bench [-n calls] [-s read-size] [-t timeout-usecs]
+                           [-k timeouts]
+
+   The first test measures the per-call cost of reading 'read-size'
+   (default: 1) bytes from a pipe that always has data available, using:
+
+        read        a plain blocking read()
+        tioRead     tioRead() with a deadline 10 seconds away
+        alarm       alarm() + read() + alarm(0), as in timed_read.c
+
+   Each variant performs 'calls' (default: 1000000) reads.
+
+   The second test measures the accuracy of timeouts: it performs
+   'timeouts' (default: 200) calls to tioRead() on an empty pipe, each with
+   a timeout of 'timeout-usecs' (default: 100), and reports by how much
+   the calls overshot their deadlines.
+*/
+#include <signal.h>
+#include <time.h>
+#include "timeout_io.h"
+#include "tlpi_hdr.h"
+
+#define CHUNK 4096              /* Bytes written to the pipe per round */
+
+enum { T_READ, T_TIO, T_ALARM };
+
+static void
+alarmHandler(int sig)
+{
+    return;                     /* Just interrupt read() */
+}
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Perform 'numCalls' reads of 'readSize' bytes from a pipe using the
+   method 'type', and return the time spent in the reads */
+
+static double
+timeReads(int type, long numCalls, size_t readSize)
+{
+    int pfd[2];
+    char buf[CHUNK];
+    struct timespec deadline;
+    double start, total;
+    long calls, j, perRound, n;
+    ssize_t numRead;
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    memset(buf, 'x', CHUNK);
+    perRound = CHUNK / readSize;
+
+    total = 0;
+    for (calls = 0; calls < numCalls; calls += n) {
+        n = (numCalls - calls < perRound) ? numCalls - calls : perRound;
+        if (write(pfd[1], buf, n * readSize) != n * readSize)
+            errExit("write");
+
+        tioDeadline(10 * 1000000000LL, &deadline);
+        start = nowSecs();
+
+        for (j = 0; j < n; j++) {
+            switch (type) {
+            case T_READ:
+                numRead = read(pfd[0], buf, readSize);
+                break;
+            case T_TIO:
+                numRead = tioRead(pfd[0], buf, readSize, &deadline);
+                break;
+            default:    /* T_ALARM */
+                alarm(10);
+                numRead = read(pfd[0], buf, readSize);
+                alarm(0);
+                break;
+            }
+            if (numRead != readSize)
+                errExit("read");
+        }
+
+        total += nowSecs() - start;
+    }
+
+    close(pfd[0]);
+    close(pfd[1]);
+    return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *typeName[] = { "read", "tioRead", "alarm" };
+    struct timespec deadline, now;
+    struct sigaction sa;
+    long numCalls, numTimeouts, timeoutUsecs, j;
+    double secs, base, over, sumOver, maxOver;
+    size_t readSize;
+    int pfd[2], opt, type;
+    char c;
+
+    numCalls = 1000000;
+    readSize = 1;
+    timeoutUsecs = 100;
+    numTimeouts = 200;
+
+    while ((opt = getopt(argc, argv, "n:s:t:k:")) != -1) {
+        switch (opt) {
+        case 'n': numCalls = getLong(optarg, GN_GT_0, "calls");         break;
+        case 's': readSize = getLong(optarg, GN_GT_0, "read-size");     break;
+        case 't': timeoutUsecs = getLong(optarg, GN_NONNEG, "timeout"); break;
+        case 'k': numTimeouts = getLong(optarg, GN_GT_0, "timeouts");   break;
+        default:
+            usageErr("%s [-n calls] [-s read-size] [-t timeout-usecs] "
+                    "[-k timeouts]\n", argv[0]);
+        }
+    }
+
+    if (readSize > CHUNK)
+        fatal("read-size must be no more than %d", CHUNK);
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = alarmHandler;
+    if (sigaction(SIGALRM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    /* Test 1: per-call overhead when data is available */
+
+    printf("%ld reads of %ld bytes from a pipe:\n", numCalls, (long) readSize);
+    printf("    %-8s %12s %12s\n", "method", "ns/call", "overhead");
+    base = 0;
+    for (type = T_READ; type <= T_ALARM; type++) {
+        secs = timeReads(type, numCalls, readSize);
+        if (type == T_READ)
+            base = secs;
+        printf("    %-8s %12.1f %11.1f%%\n", typeName[type],
+                secs * 1e9 / numCalls, (secs - base) / base * 100);
+    }
+
+    /* Test 2: accuracy of timeouts on an empty pipe */
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    sumOver = maxOver = 0;
+    for (j = 0; j < numTimeouts; j++) {
+        tioDeadline(timeoutUsecs * 1000LL, &deadline);
+        if (tioRead(pfd[0], &c, 1, &deadline) != -1 || errno != ETIMEDOUT)
+            fatal("tioRead() did not time out");
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+            errExit("clock_gettime");
+
+        over = (now.tv_sec - deadline.tv_sec) * 1e6 +
+               (now.tv_nsec - deadline.tv_nsec) / 1e3;
+        sumOver += over;
+        if (over > maxOver)
+            maxOver = over;
+    }
+
+    printf("\n%ld timeouts of %ld us: overshoot mean %.1f us, max %.1f us\n",
+            numTimeouts, timeoutUsecs, sumOver / numTimeouts, maxOver);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,58 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* pwcheck.h
+
+   Header file for pwcheck_sv.c and pwcheck_cl.c.
+
+   Clients connect to the server with a UNIX domain SOCK_SEQPACKET socket.
+   Each message from a client is a batch of between 1 and PWC_MAX_BATCH
+   'struct pwcRequest' records; the server replies to each batch with a
+   single message containing one 'struct pwcReply' for each request, in
+   the same order. A client may have several batches outstanding on one
+   connection; replies to different batches may arrive in any order, and
+   the 'id' field allows the client to match them up.
+
+   As with us_xfr.h, the socket is placed in /tmp for ease of
+   experimentation; a real-world service would use a directory that only
+   it can write to.
+*/
+#ifndef PWCHECK_H
+#define PWCHECK_H
+
+#include <stdint.h>
+
+#define PWC_SOCK_PATH "/tmp/pwcheck"
+
+#define PWC_NAME_LEN 33         /* Including terminating null byte */
+#define PWC_PASS_LEN 128        /* Including terminating null byte */
+#define PWC_MAX_BATCH 64
+
+struct pwcRequest {
+    uint32_t id;                /* Chosen by client; returned in reply */
+    char username[PWC_NAME_LEN];
+    char password[PWC_PASS_LEN];
+};
+
+enum pwcStatus {
+    PWC_OK,                     /* Password is correct */
+    PWC_FAIL,                   /* Wrong password, or no such user */
+    PWC_RATE_LIMITED,           /* Too many attempts for this user */
+    PWC_ERROR                   /* Malformed request or crypt_r() failed */
+};
+
+struct pwcReply {
+    uint32_t id;
+    int32_t status;             /* One of the 'enum pwcStatus' values */
+};
+
+#endif
@@ -0,0 +1,192 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* pwcheck_cl.c
+
+   A client for pwcheck_sv.c that can also measure the server's
+   throughput.
+
+   Usage: pwcheck_cl [-s path] [-n count] [-b batch] [-p depth] [-l]
+                     username [password]
+
+   The program asks the server to verify 'password' (which is prompted
+   for if not supplied) for 'username' 'count' times (default: 1), sending
+   'batch' (default: 1) requests per message, and keeping up to 'depth'
+   (default: 1) messages outstanding. It then displays the number of
+   replies of each kind, and the number of verifications per second.
+
+   With -l, the program instead performs the verifications itself, in
+   the same way as check_password.c: for each one, it looks up the user
+   with getpwnam() and getspnam(), and calls crypt(). This requires
+   permission to read the shadow password file. Comparing the two
+   figures shows what the server gains (from caching, and from using
+   several CPUs at once) and what it costs (the socket round trips).
+
+   Note that the server's per-user rate limiting applies; run the server
+   with "-r 0" when measuring throughput for a single user.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <shadow.h>
+#include <crypt.h>
+#include <pwd.h>
+#include <time.h>
+#include "pwcheck.h"
+#include "tlpi_hdr.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Verify 'password' for 'username' locally, as check_password.c does */
+
+static int
+checkLocal(const char *username, const char *password)
+{
+    struct passwd *pwd;
+    struct spwd *spwd;
+    char *encrypted;
+
+    pwd = getpwnam(username);
+    if (pwd == NULL)
+        return PWC_FAIL;
+    errno = 0;                  /* So that a stale EACCES isn't seen */
+    spwd = getspnam(username);
+    if (spwd == NULL && errno == EACCES)
+        fatal("no permission to read shadow password file");
+    if (spwd != NULL)
+        pwd->pw_passwd = spwd->sp_pwdp;
+
+    encrypted = crypt(password, pwd->pw_passwd);
+    if (encrypted == NULL)
+        return PWC_ERROR;
+    return (strcmp(encrypted, pwd->pw_passwd) == 0) ? PWC_OK : PWC_FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *statusName[] = { "ok", "fail", "rate-limited",
+                                        "error" };
+    struct pwcRequest req[PWC_MAX_BATCH];
+    struct pwcReply rep[PWC_MAX_BATCH];
+    struct sockaddr_un addr;
+    long count, sent, done, numStatus[PWC_ERROR + 1], j;
+    int opt, batch, depth, outstanding, n, sfd;
+    Boolean local;
+    char *path, *username, *password;
+    ssize_t numRead;
+    double start, secs;
+
+    path = PWC_SOCK_PATH;
+    count = 1;
+    batch = 1;
+    depth = 1;
+    local = FALSE;
+
+    while ((opt = getopt(argc, argv, "s:n:b:p:l")) != -1) {
+        switch (opt) {
+        case 's': path = optarg;                                    break;
+        case 'n': count = getLong(optarg, GN_GT_0, "count");        break;
+        case 'b': batch = getInt(optarg, GN_GT_0, "batch");         break;
+        case 'p': depth = getInt(optarg, GN_GT_0, "depth");         break;
+        case 'l': local = TRUE;                                     break;
+        default:  usageErr("%s [-s path] [-n count] [-b batch] [-p depth] "
+                          "[-l] username [password]\n", argv[0]);
+        }
+    }
+    if (optind >= argc || optind + 2 < argc)
+        usageErr("%s [-s path] [-n count] [-b batch] [-p depth] [-l] "
+                "username [password]\n", argv[0]);
+    if (batch > PWC_MAX_BATCH)
+        fatal("batch must be at most %d", PWC_MAX_BATCH);
+
+    username = argv[optind];
+    password = (optind + 1 < argc) ? argv[optind + 1] : getpass("Password: ");
+    if (password == NULL)
+        errExit("getpass");
+    if (strlen(username) >= PWC_NAME_LEN || strlen(password) >= PWC_PASS_LEN)
+        fatal("username or password too long");
+
+    for (j = 0; j <= PWC_ERROR; j++)
+        numStatus[j] = 0;
+
+    if (local) {
+        start = nowSecs();
+        for (j = 0; j < count; j++)
+            numStatus[checkLocal(username, password)]++;
+        secs = nowSecs() - start;
+
+    } else {
+        sfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (sfd == -1)
+            errExit("socket");
+        memset(&addr, 0, sizeof(struct sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        if (connect(sfd, (struct sockaddr *) &addr,
+                    sizeof(struct sockaddr_un)) == -1)
+            errExit("connect");
+
+        memset(req, 0, sizeof(req));
+        for (j = 0; j < batch; j++) {
+            strcpy(req[j].username, username);
+            strcpy(req[j].password, password);
+        }
+
+        /* Keep up to 'depth' batches in flight until all have been sent,
+           then collect the remaining replies */
+
+        start = nowSecs();
+        sent = done = 0;
+        outstanding = 0;
+        while (done < count) {
+            while (outstanding < depth && sent < count) {
+                n = (count - sent < batch) ? count - sent : batch;
+                for (j = 0; j < n; j++)
+                    req[j].id = sent + j;
+                if (send(sfd, req, n * sizeof(struct pwcRequest), 0) == -1)
+                    errExit("send");
+                sent += n;
+                outstanding++;
+            }
+
+            numRead = recv(sfd, rep, sizeof(rep), 0);
+            if (numRead == -1)
+                errExit("recv");
+            if (numRead == 0)
+                fatal("server closed connection");
+            n = numRead / sizeof(struct pwcReply);
+            for (j = 0; j < n; j++)
+                if (rep[j].status >= PWC_OK && rep[j].status <= PWC_ERROR)
+                    numStatus[rep[j].status]++;
+            done += n;
+            outstanding--;
+        }
+        secs = nowSecs() - start;
+        close(sfd);
+    }
+
+    for (j = 0; j <= PWC_ERROR; j++)
+        if (numStatus[j] > 0)
+            printf("%s: %ld  ", statusName[j], numStatus[j]);
+    printf("\n%ld verifications in %.3f s: %.1f/s\n", count, secs,
+            (secs > 0) ? count / secs : 0.0);
+
+    exit((numStatus[PWC_OK] == count) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
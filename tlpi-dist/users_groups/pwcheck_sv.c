@@ -0,0 +1,537 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* pwcheck_sv.c
+
+   A password verification server. Clients (see pwcheck_cl.c) send
+   batches of (username, password) pairs over a UNIX domain socket, and
+   the server replies saying whether each password is correct (see
+   pwcheck.h for the protocol).
+
+   Usage: pwcheck_sv [-s path] [-w workers] [-t ttl] [-r rate] [-B burst]
+
+   Hashing a password is deliberately expensive, so the hashing is done
+   by a pool of 'workers' threads (default: the number of online CPUs).
+   The threads use crypt_r(), each with its own 'struct crypt_data',
+   since crypt() returns its result in a static buffer and so is not
+   thread-safe. The requests in a batch are handed out to the workers
+   individually, so that one batch can keep all of the CPUs busy; the
+   reply is sent by the worker that completes the last request.
+
+   The main thread accepts connections and reads requests. It caches the
+   hashed password of each user for 'ttl' seconds (default: 30), so that
+   the shadow password file is not reread for every request. (So a
+   password change takes up to 'ttl' seconds to be noticed.) Requests
+   for unknown users are answered without hashing; note that this allows
+   a client to discover, by timing, which users exist.
+
+   Attempts are rate limited per user with a token bucket: a user may
+   make 'burst' (default: 10) attempts at once, and thereafter 'rate'
+   (default: 5) attempts per second; further attempts are answered with
+   PWC_RATE_LIMITED. A rate of 0 disables rate limiting. If the cache is
+   full and no idle entry can be evicted, requests for users not in the
+   cache are also rate limited.
+
+   The server must be able to read the shadow password file (e.g., it
+   must be run as root, or have the CAP_DAC_READ_SEARCH capability).
+   Any user can connect to the socket ('path', default PWC_SOCK_PATH).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <shadow.h>
+#include <crypt.h>
+#include <poll.h>
+#include <pwd.h>
+#include <time.h>
+#include "pwcheck.h"
+#include "tlpi_hdr.h"
+
+#define MAX_CONNS 128
+#define HASH_BUCKETS 1024
+#define MAX_USERS 8192          /* Maximum entries in user cache */
+
+struct conn {                   /* A client connection */
+    int fd;
+    int pendingBatches;         /* Batches queued for workers */
+    Boolean closed;             /* Client has disconnected */
+};
+
+struct batch {                  /* One request message from a client */
+    struct conn *conn;
+    struct batch *next;         /* Next batch in work queue */
+    int numReqs;
+    int numTodo;                /* Number of requests needing a hash */
+    int nextTodo;               /* Next of those to hand to a worker */
+    int pending;                /* Number of those not yet completed */
+    int todo[PWC_MAX_BATCH];    /* Indexes of those requests */
+    char *setting[PWC_MAX_BATCH];       /* Stored hash for each request */
+    struct pwcRequest req[PWC_MAX_BATCH];
+    struct pwcReply rep[PWC_MAX_BATCH];
+};
+
+struct user {                   /* User cache entry */
+    char name[PWC_NAME_LEN];
+    char *hash;                 /* Hashed password, or NULL if no user */
+    double fetched;             /* When 'hash' was looked up */
+    double tokens;              /* Attempts now allowed */
+    double lastRefill;          /* When 'tokens' was last updated */
+    struct user *next;          /* Next entry in hash bucket */
+};
+
+/* The work queue, shared by the main thread and the workers. 'qMtx' also
+   protects the 'pending' fields of each batch and the 'pendingBatches'
+   and 'closed' fields of each connection. */
+
+static pthread_mutex_t qMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qCond = PTHREAD_COND_INITIALIZER;
+static struct batch *qHead, *qTail;
+
+/* The user cache is used only by the main thread */
+
+static struct user *bucket[HASH_BUCKETS];
+static int numUsers;
+static double ttl, rate, burst;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int
+hashName(const char *name)
+{
+    unsigned int h;
+
+    for (h = 2166136261u; *name != '\0'; name++)        /* FNV-1a */
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    return h % HASH_BUCKETS;
+}
+
+/* Compare 's1' and 's2' in a time that depends on the length of 's1',
+   but not on where the strings first differ */
+
+static Boolean
+equalConstTime(const char *s1, const char *s2)
+{
+    size_t len, j;
+    unsigned char diff;
+
+    len = strlen(s1);
+    if (strlen(s2) != len)
+        return FALSE;
+    for (diff = 0, j = 0; j < len; j++)
+        diff |= s1[j] ^ s2[j];
+    return diff == 0;
+}
+
+/* Remove from the cache the entries whose cached hash has expired and
+   whose token bucket is full (so that removing them loses nothing) */
+
+static void
+evictIdle(double now)
+{
+    struct user **pp, *u;
+    int j;
+
+    for (j = 0; j < HASH_BUCKETS; j++) {
+        for (pp = &bucket[j]; *pp != NULL; ) {
+            u = *pp;
+            if (now - u->fetched > ttl &&
+                    (rate <= 0 || u->tokens +
+                        (now - u->lastRefill) * rate >= burst)) {
+                *pp = u->next;
+                free(u->hash);
+                free(u);
+                numUsers--;
+            } else {
+                pp = &u->next;
+            }
+        }
+    }
+}
+
+/* Return the cache entry for 'name', creating it or refreshing its hash
+   if necessary. Returns NULL if the cache is full. */
+
+static struct user *
+findUser(const char *name, double now)
+{
+    struct user *u;
+    struct passwd *pwd;
+    struct spwd *spwd;
+    unsigned int h;
+
+    h = hashName(name);
+    for (u = bucket[h]; u != NULL; u = u->next)
+        if (strcmp(u->name, name) == 0)
+            break;
+
+    if (u == NULL) {
+        if (numUsers >= MAX_USERS) {
+            evictIdle(now);
+            if (numUsers >= MAX_USERS)
+                return NULL;
+        }
+        u = calloc(1, sizeof(struct user));
+        if (u == NULL)
+            errExit("calloc");
+        strcpy(u->name, name);
+        u->tokens = burst;
+        u->lastRefill = now;
+        u->next = bucket[h];
+        bucket[h] = u;
+        numUsers++;
+    } else if (now - u->fetched <= ttl) {
+        return u;
+    }
+
+    /* Look up the hashed password, as check_password.c does */
+
+    free(u->hash);
+    u->hash = NULL;
+    pwd = getpwnam(name);
+    if (pwd != NULL) {
+        spwd = getspnam(name);
+        u->hash = strdup((spwd != NULL) ? spwd->sp_pwdp : pwd->pw_passwd);
+        if (u->hash == NULL)
+            errExit("strdup");
+    }
+    u->fetched = now;
+    return u;
+}
+
+/* Consume a token from the bucket of user 'u'. Returns TRUE if there was
+   a token to consume (i.e., the attempt is allowed). */
+
+static Boolean
+allowAttempt(struct user *u, double now)
+{
+    if (rate <= 0)
+        return TRUE;
+
+    u->tokens += (now - u->lastRefill) * rate;
+    if (u->tokens > burst)
+        u->tokens = burst;
+    u->lastRefill = now;
+
+    if (u->tokens < 1)
+        return FALSE;
+    u->tokens -= 1;
+    return TRUE;
+}
+
+static void
+closeConn(struct conn *c)
+{
+    if (close(c->fd) == -1)
+        errMsg("close");
+    free(c);
+}
+
+/* Send the reply for batch 'b' and free the batch. If the batch was
+   queued for the workers, also drop its reference to the connection. */
+
+static void
+finishBatch(struct batch *b, Boolean queued)
+{
+    struct conn *c;
+    Boolean closeNow;
+    int j;
+
+    c = b->conn;
+
+    /* If the client has gone away, the send() fails; that's fine */
+
+    send(c->fd, b->rep, b->numReqs * sizeof(struct pwcReply), MSG_NOSIGNAL);
+
+    if (queued) {
+        pthread_mutex_lock(&qMtx);
+        c->pendingBatches--;
+        closeNow = c->closed && c->pendingBatches == 0;
+        pthread_mutex_unlock(&qMtx);
+        if (closeNow)
+            closeConn(c);
+    }
+
+    for (j = 0; j < b->numReqs; j++)
+        free(b->setting[j]);
+    explicit_bzero(b->req, sizeof(b->req));
+    free(b);
+}
+
+static void *
+worker(void *arg)
+{
+    struct crypt_data *cd;
+    struct pwcRequest *r;
+    struct batch *b;
+    Boolean last, abandoned;
+    char *enc;
+    int j;
+
+    cd = calloc(1, sizeof(struct crypt_data));  /* Zeroing is required */
+    if (cd == NULL)
+        errExit("calloc");
+
+    for (;;) {
+        pthread_mutex_lock(&qMtx);
+        while (qHead == NULL)
+            pthread_cond_wait(&qCond, &qMtx);
+        b = qHead;
+        j = b->todo[b->nextTodo++];
+        if (b->nextTodo == b->numTodo) {        /* All handed out */
+            qHead = b->next;
+            if (qHead == NULL)
+                qTail = NULL;
+        }
+        abandoned = b->conn->closed;
+        pthread_mutex_unlock(&qMtx);
+
+        /* Don't spend CPU time on requests whose client has gone away */
+
+        r = &b->req[j];
+        enc = abandoned ? NULL : crypt_r(r->password, b->setting[j], cd);
+        explicit_bzero(r->password, PWC_PASS_LEN);
+        if (enc == NULL)
+            b->rep[j].status = PWC_ERROR;
+        else
+            b->rep[j].status = equalConstTime(enc, b->setting[j]) ?
+                                    PWC_OK : PWC_FAIL;
+        explicit_bzero(cd->output, sizeof(cd->output));
+
+        /* Because 'rep[j]' is set before the mutex is locked, the
+           worker that completes the batch sees all of the replies */
+
+        pthread_mutex_lock(&qMtx);
+        last = --b->pending == 0;
+        pthread_mutex_unlock(&qMtx);
+
+        if (last)
+            finishBatch(b, TRUE);
+    }
+
+    return NULL;
+}
+
+/* Read a batch of requests from 'c', and either reply to it at once (if
+   no request needs hashing) or queue it for the workers. Returns -1 if
+   the connection should be closed. */
+
+static int
+readBatch(struct conn *c)
+{
+    struct pwcRequest *r;
+    struct batch *b;
+    struct user *u;
+    ssize_t numRead;
+    double now;
+    int j;
+
+    b = malloc(sizeof(struct batch));
+    if (b == NULL)
+        errExit("malloc");
+
+    numRead = recv(c->fd, b->req, sizeof(b->req), 0);
+    if (numRead <= 0 || numRead % sizeof(struct pwcRequest) != 0) {
+        if (numRead > 0)
+            fprintf(stderr, "Malformed message on fd %d\n", c->fd);
+        explicit_bzero(b->req, sizeof(b->req));
+        free(b);
+        return -1;
+    }
+
+    b->conn = c;
+    b->next = NULL;
+    b->numReqs = numRead / sizeof(struct pwcRequest);
+    b->numTodo = 0;
+    b->nextTodo = 0;
+    now = nowSecs();
+
+    for (j = 0; j < b->numReqs; j++) {
+        r = &b->req[j];
+        b->rep[j].id = r->id;
+        b->setting[j] = NULL;
+
+        if (memchr(r->username, '\0', PWC_NAME_LEN) == NULL ||
+                memchr(r->password, '\0', PWC_PASS_LEN) == NULL) {
+            b->rep[j].status = PWC_ERROR;
+            continue;
+        }
+
+        u = findUser(r->username, now);
+        if (u == NULL || !allowAttempt(u, now)) {
+            b->rep[j].status = PWC_RATE_LIMITED;
+        } else if (u->hash == NULL) {
+            b->rep[j].status = PWC_FAIL;
+        } else {
+            b->setting[j] = strdup(u->hash);
+            if (b->setting[j] == NULL)
+                errExit("strdup");
+            b->todo[b->numTodo++] = j;
+        }
+    }
+
+    if (b->numTodo == 0) {
+        finishBatch(b, FALSE);
+        return 0;
+    }
+
+    b->pending = b->numTodo;
+    pthread_mutex_lock(&qMtx);
+    c->pendingBatches++;
+    if (qTail == NULL)
+        qHead = b;
+    else
+        qTail->next = b;
+    qTail = b;
+    if (b->numTodo > 1)
+        pthread_cond_broadcast(&qCond);
+    else
+        pthread_cond_signal(&qCond);
+    pthread_mutex_unlock(&qMtx);
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct pollfd pfd[MAX_CONNS + 1];
+    struct conn *conns[MAX_CONNS + 1];
+    struct sockaddr_un addr;
+    struct conn *c;
+    pthread_t thr;
+    Boolean closeNow;
+    char *path;
+    int opt, numWorkers, numConns, lfd, cfd, ready, s, j;
+
+    path = PWC_SOCK_PATH;
+    numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numWorkers < 1)
+        numWorkers = 1;
+    ttl = 30;
+    rate = 5;
+    burst = 10;
+
+    while ((opt = getopt(argc, argv, "s:w:t:r:B:")) != -1) {
+        switch (opt) {
+        case 's': path = optarg;                                    break;
+        case 'w': numWorkers = getInt(optarg, GN_GT_0, "workers");  break;
+        case 't': ttl = getInt(optarg, GN_NONNEG, "ttl");           break;
+        case 'r': rate = getInt(optarg, GN_NONNEG, "rate");         break;
+        case 'B': burst = getInt(optarg, GN_GT_0, "burst");         break;
+        default:
+            usageErr("%s [-s path] [-w workers] [-t ttl] [-r rate] "
+                    "[-B burst]\n", argv[0]);
+        }
+    }
+
+    /* Fail now, rather than on every request, if we can't read the
+       shadow password file */
+
+    errno = 0;
+    if (getspnam("root") == NULL && errno == EACCES)
+        fatal("no permission to read shadow password file");
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        fatal("Socket path too long");
+    if (remove(path) == -1 && errno != ENOENT)
+        errExit("remove-%s", path);
+
+    lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (lfd == -1)
+        errExit("socket");
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)
+        errExit("bind");
+    if (listen(lfd, 64) == -1)
+        errExit("listen");
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    for (j = 0; j < numWorkers; j++) {
+        s = pthread_create(&thr, NULL, worker, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    pfd[0].fd = lfd;
+    pfd[0].events = POLLIN;
+    numConns = 0;
+
+    for (;;) {
+        ready = poll(pfd, numConns + 1, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+
+        /* Requests on existing connections. Iterate downward, so that
+           a closed connection can be replaced by the last one. */
+
+        for (j = numConns; j >= 1; j--) {
+            if (pfd[j].revents == 0)
+                continue;
+            if (readBatch(conns[j]) == 0)
+                continue;
+
+            c = conns[j];
+            pthread_mutex_lock(&qMtx);
+            c->closed = TRUE;
+            closeNow = c->pendingBatches == 0;
+            pthread_mutex_unlock(&qMtx);
+            if (closeNow)
+                closeConn(c);
+
+            pfd[j] = pfd[numConns];
+            conns[j] = conns[numConns];
+            numConns--;
+        }
+
+        /* New connections */
+
+        if (pfd[0].revents & POLLIN) {
+            cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if (cfd == -1) {
+                errMsg("accept");
+                continue;
+            }
+            if (numConns == MAX_CONNS) {
+                fprintf(stderr, "Too many connections\n");
+                close(cfd);
+                continue;
+            }
+
+            c = calloc(1, sizeof(struct conn));
+            if (c == NULL)
+                errExit("calloc");
+            c->fd = cfd;
+            numConns++;
+            conns[numConns] = c;
+            pfd[numConns].fd = cfd;
+            pfd[numConns].events = POLLIN;
+        }
+    }
+}
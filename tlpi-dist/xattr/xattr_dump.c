@@ -0,0 +1,447 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* xattr_dump.c
+
+   Walk a directory tree using several threads, and write the extended
+   attributes (including ACLs) of all of the files in the tree to a
+   metadata stream in the format described in xattr_stream.h. The stream
+   can be restored with xattr_restore.c.
+
+   Usage: xattr_dump [-t threads] [-o file] dir
+
+   The stream is written to 'file', or to standard output. Statistics
+   (files per second, and system calls per file) are written to standard
+   error on completion.
+
+   Compared with xattr_view.c, which calls listxattr() and getxattr() on
+   a pathname, with a fixed-size buffer, this program:
+
+   * opens each file once, with openat() relative to its directory, and
+     then uses flistxattr() and fgetxattr() on the file descriptor, so
+     that the pathname is resolved only once per file;
+
+   * in each thread, uses one buffer for attribute lists and one for
+     values, which are sized by a size query (a call with 'size' 0) the
+     first time they are too small, and then reused for all later files,
+     so that most files need only one flistxattr() call and one
+     fgetxattr() call per attribute;
+
+   * accumulates records in a per-thread output buffer, which is written
+     (under a mutex) when it exceeds OUT_FLUSH bytes.
+
+   Only regular files and directories are examined. Symbolic links are
+   not followed, and their attributes (which can only be in the 'trusted'
+   and 'security' namespaces) are not saved; device files and FIFOs are
+   skipped because opening them may have side effects.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/xattr.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include "xattr_stream.h"
+#include "tlpi_hdr.h"
+
+#define OUT_FLUSH (1024 * 1024)
+
+struct scanner {                /* Per-thread state */
+    pthread_t tid;
+    char *list;                 /* Buffer for flistxattr() */
+    size_t listSize;
+    char *value;                /* Buffer for fgetxattr() */
+    size_t valueSize;
+    char *out;                  /* Records not yet written */
+    size_t outLen, outSize;
+    unsigned long files, withAttrs, attrs, syscalls, errors, skipped;
+    unsigned long long bytes;
+};
+
+static int rootFd;              /* Top of the tree */
+static int outFd;
+static pthread_mutex_t outMtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Stack of directories (pathnames relative to 'rootFd') waiting to be
+   scanned. The scan is complete when the stack is empty and no thread is
+   scanning a directory (which might add more). */
+
+static char **dirStack;
+static int dirTop, dirCap, activeScanners;
+static pthread_mutex_t dirMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dirCond = PTHREAD_COND_INITIALIZER;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+pushDir(char *path)
+{
+    pthread_mutex_lock(&dirMtx);
+    if (dirTop == dirCap) {
+        dirCap = (dirCap == 0) ? 1024 : dirCap * 2;
+        dirStack = realloc(dirStack, dirCap * sizeof(char *));
+        if (dirStack == NULL)
+            errExit("realloc");
+    }
+    dirStack[dirTop++] = path;
+    pthread_cond_signal(&dirCond);
+    pthread_mutex_unlock(&dirMtx);
+}
+
+/* Return the next directory to scan, or NULL when the scan is complete */
+
+static char *
+popDir(void)
+{
+    char *path;
+
+    pthread_mutex_lock(&dirMtx);
+    while (dirTop == 0 && activeScanners > 0)
+        pthread_cond_wait(&dirCond, &dirMtx);
+    if (dirTop == 0) {
+        path = NULL;
+    } else {
+        path = dirStack[--dirTop];
+        activeScanners++;
+    }
+    pthread_mutex_unlock(&dirMtx);
+    return path;
+}
+
+static void
+doneDir(void)
+{
+    pthread_mutex_lock(&dirMtx);
+    activeScanners--;
+    if (activeScanners == 0 && dirTop == 0)
+        pthread_cond_broadcast(&dirCond);       /* Wake idle threads */
+    pthread_mutex_unlock(&dirMtx);
+}
+
+/* Return a pointer to 'len' bytes at the end of the output buffer of
+   's', and add them to the buffer */
+
+static char *
+outAppend(struct scanner *s, size_t len)
+{
+    char *p;
+
+    if (s->outLen + len > s->outSize) {
+        s->outSize = (s->outLen + len) * 2;
+        s->out = realloc(s->out, s->outSize);
+        if (s->out == NULL)
+            errExit("realloc");
+    }
+    p = s->out + s->outLen;
+    s->outLen += len;
+    return p;
+}
+
+static void
+outFlush(struct scanner *s)
+{
+    size_t done;
+    ssize_t numWritten;
+
+    pthread_mutex_lock(&outMtx);
+    for (done = 0; done < s->outLen; done += numWritten) {
+        numWritten = write(outFd, s->out + done, s->outLen - done);
+        if (numWritten <= 0)
+            errExit("write");
+    }
+    pthread_mutex_unlock(&outMtx);
+    s->outLen = 0;
+}
+
+/* Call flistxattr() (if 'name' is NULL) or fgetxattr() on 'fd', placing
+   the result in the reusable buffer '*buf' of size '*size'. If the buffer
+   is too small, find the required size, and enlarge the buffer. Returns
+   the length of the result, or -1 on error. */
+
+static ssize_t
+fetch(struct scanner *s, int fd, const char *name, char **buf, size_t *size)
+{
+    ssize_t len;
+    size_t newSize;
+
+    for (;;) {
+        if (*size > 0) {
+            len = (name == NULL) ? flistxattr(fd, *buf, *size) :
+                                   fgetxattr(fd, name, *buf, *size);
+            s->syscalls++;
+            if (len != -1 || errno != ERANGE)
+                return len;
+        }
+
+        len = (name == NULL) ? flistxattr(fd, NULL, 0) :
+                               fgetxattr(fd, name, NULL, 0);
+        s->syscalls++;
+        if (len <= 0)
+            return len;
+
+        newSize = (len > *size * 2) ? len : *size * 2;
+        *buf = realloc(*buf, newSize);
+        if (*buf == NULL)
+            errExit("realloc");
+        *size = newSize;
+    }
+}
+
+/* Append a record for the attributes of the file open on 'fd' (whose
+   pathname is 'path') to the output buffer of 's' */
+
+static void
+scanFd(struct scanner *s, int fd, const char *path)
+{
+    struct xsFileHdr fh;
+    struct xsAttrHdr ah;
+    size_t hdrOffset;
+    ssize_t listLen, valueLen;
+    char *name;
+
+    listLen = fetch(s, fd, NULL, &s->list, &s->listSize);
+    if (listLen == -1) {
+        if (errno != ENOTSUP) {
+            errMsg("flistxattr: %s", path);
+            s->errors++;
+            return;
+        }
+        listLen = 0;            /* File system doesn't support xattrs */
+    }
+
+    s->files++;
+    if (listLen == 0)
+        return;
+
+    /* Reserve space for the file header; 'numAttrs' is filled in when
+       we know how many attributes could still be read */
+
+    fh.pathLen = strlen(path);
+    fh.numAttrs = 0;
+    hdrOffset = s->outLen;
+    outAppend(s, sizeof(fh));
+    memcpy(outAppend(s, fh.pathLen), path, fh.pathLen);
+
+    for (name = s->list; name < s->list + listLen;
+            name += strlen(name) + 1) {
+        valueLen = fetch(s, fd, name, &s->value, &s->valueSize);
+        if (valueLen == -1) {
+            if (errno != ENODATA) {     /* ENODATA: removed meanwhile */
+                errMsg("fgetxattr: %s: %s", path, name);
+                s->errors++;
+            }
+            continue;
+        }
+
+        ah.nameLen = strlen(name);
+        ah.valueLen = valueLen;
+        memcpy(outAppend(s, sizeof(ah)), &ah, sizeof(ah));
+        memcpy(outAppend(s, ah.nameLen), name, ah.nameLen);
+        memcpy(outAppend(s, valueLen), s->value, valueLen);
+        fh.numAttrs++;
+        s->bytes += valueLen;
+    }
+
+    if (fh.numAttrs == 0) {
+        s->outLen = hdrOffset;          /* Discard the header */
+        return;
+    }
+    memcpy(s->out + hdrOffset, &fh, sizeof(fh));
+    s->withAttrs++;
+    s->attrs += fh.numAttrs;
+
+    if (s->outLen >= OUT_FLUSH)
+        outFlush(s);
+}
+
+/* Record the attributes of the directory 'path', and of each regular
+   file in it, and add its subdirectories to the stack */
+
+static void
+scanDir(struct scanner *s, const char *path)
+{
+    struct dirent *dp;
+    struct stat sb;
+    DIR *dirp;
+    char *childPath;
+    int dfd, fd, type;
+
+    dfd = openat(rootFd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                               O_CLOEXEC);
+    s->syscalls++;
+    if (dfd == -1) {
+        errMsg("openat: %s", path);
+        s->errors++;
+        return;
+    }
+
+    scanFd(s, dfd, path);
+
+    dirp = fdopendir(dfd);
+    if (dirp == NULL)
+        errExit("fdopendir");
+
+    while ((dp = readdir(dirp)) != NULL) {
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+            continue;
+
+        type = dp->d_type;
+        if (type == DT_UNKNOWN) {       /* File system doesn't supply type */
+            s->syscalls++;
+            if (fstatat(dfd, dp->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR :
+                   S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type != DT_DIR && type != DT_REG) {
+            s->skipped++;
+            continue;
+        }
+
+        if (strcmp(path, ".") == 0)
+            childPath = strdup(dp->d_name);
+        else if (asprintf(&childPath, "%s/%s", path, dp->d_name) == -1)
+            childPath = NULL;
+        if (childPath == NULL)
+            errExit("asprintf");
+
+        if (type == DT_DIR) {
+            pushDir(childPath);         /* Stack takes ownership */
+            continue;
+        }
+
+        fd = openat(dfd, dp->d_name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK |
+                                     O_NOCTTY | O_CLOEXEC);
+        s->syscalls++;
+        if (fd == -1) {
+            errMsg("openat: %s", childPath);
+            s->errors++;
+        } else {
+            scanFd(s, fd, childPath);
+            close(fd);
+            s->syscalls++;
+        }
+        free(childPath);
+    }
+
+    closedir(dirp);
+    s->syscalls++;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct scanner *s = arg;
+    char *path;
+
+    while ((path = popDir()) != NULL) {
+        scanDir(s, path);
+        free(path);
+        doneDir();
+    }
+
+    outFlush(s);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct scanner *sc, tot;
+    struct xsHeader xh;
+    double start, secs;
+    char *rootPath;
+    int opt, numThreads, j, s;
+
+    numThreads = 4;
+    outFd = STDOUT_FILENO;
+
+    while ((opt = getopt(argc, argv, "t:o:")) != -1) {
+        switch (opt) {
+        case 't':
+            numThreads = getInt(optarg, GN_GT_0, "threads");
+            break;
+        case 'o':
+            outFd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                         S_IRUSR | S_IWUSR);
+            if (outFd == -1)
+                errExit("open %s", optarg);
+            break;
+        default:
+            usageErr("%s [-t threads] [-o file] dir\n", argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-t threads] [-o file] dir\n", argv[0]);
+
+    rootFd = open(argv[optind], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd == -1)
+        errExit("open %s", argv[optind]);
+
+    xh.magic = XS_MAGIC;
+    xh.version = XS_VERSION;
+    if (write(outFd, &xh, sizeof(xh)) != sizeof(xh))
+        errExit("write");
+
+    rootPath = strdup(".");
+    if (rootPath == NULL)
+        errExit("strdup");
+    pushDir(rootPath);
+
+    sc = calloc(numThreads, sizeof(struct scanner));
+    if (sc == NULL)
+        errExit("calloc");
+
+    start = nowSecs();
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_create(&sc[j].tid, NULL, threadFunc, &sc[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    memset(&tot, 0, sizeof(tot));
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_join(sc[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        tot.files += sc[j].files;
+        tot.withAttrs += sc[j].withAttrs;
+        tot.attrs += sc[j].attrs;
+        tot.bytes += sc[j].bytes;
+        tot.syscalls += sc[j].syscalls;
+        tot.errors += sc[j].errors;
+        tot.skipped += sc[j].skipped;
+    }
+    secs = nowSecs() - start;
+
+    fprintf(stderr, "%lu files (%lu with attributes: %lu attributes, "
+            "%llu value bytes)\n", tot.files, tot.withAttrs, tot.attrs,
+            tot.bytes);
+    fprintf(stderr, "%.3f seconds: %.0f files/s; %.2f syscalls/file; "
+            "%lu errors; %lu others skipped\n", secs,
+            (secs > 0) ? tot.files / secs : 0.0,
+            (tot.files > 0) ? (double) tot.syscalls / tot.files : 0.0,
+            tot.errors, tot.skipped);
+
+    exit(EXIT_SUCCESS);
+}
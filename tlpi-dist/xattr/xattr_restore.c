@@ -0,0 +1,263 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* xattr_restore.c
+
+   Restore the extended attributes recorded by xattr_dump.c.
+
+   Usage: xattr_restore [-n] [-i file] dir
+
+   The metadata stream is read from 'file', or from standard input, and
+   each attribute is set, with fsetxattr(), on the file of the same
+   pathname under 'dir'. Files that don't exist are reported and skipped.
+   With -n, the stream is read and checked, but nothing is changed.
+
+   Since the stream may have been crafted, a pathname must not lead
+   outside 'dir': absolute pathnames and ".." components are rejected,
+   and no symbolic link is followed in any component. Where the kernel
+   provides openat2(), RESOLVE_BENEATH and RESOLVE_NO_SYMLINKS enforce
+   this; otherwise, the pathname is walked one component at a time with
+   O_NOFOLLOW.
+
+   Restoring attributes in the 'trusted' namespace requires the
+   CAP_SYS_ADMIN capability, and restoring those in the 'security'
+   namespace may require privilege, depending on the security module.
+   Restoring an ACL (system.posix_acl_access or system.posix_acl_default)
+   requires that the caller owns the file.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+#include "xattr_stream.h"
+#include "tlpi_hdr.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Read 'len' bytes from 'fp' into the buffer '*buf' of size '*size',
+   enlarging the buffer if necessary, and adding a terminating null byte.
+   Terminates the program on error or premature end of file. */
+
+static void
+readInto(FILE *fp, char **buf, size_t *size, size_t len)
+{
+    if (len + 1 > *size) {
+        *size = (len + 1 > *size * 2) ? len + 1 : *size * 2;
+        *buf = realloc(*buf, *size);
+        if (*buf == NULL)
+            errExit("realloc");
+    }
+    if (fread(*buf, 1, len, fp) != len)
+        fatal("Truncated or unreadable stream");
+    (*buf)[len] = '\0';
+}
+
+/* Return TRUE if 'path' is relative and has no ".." component */
+
+static Boolean
+pathOk(const char *path)
+{
+    const char *p;
+
+    if (path[0] == '/' || path[0] == '\0')
+        return FALSE;
+    for (p = path; p != NULL; p = strchr(p, '/')) {
+        if (*p == '/')
+            p++;
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Open 'path' (already checked by pathOk()) relative to the directory
+   'rootFd', with 'flags', without following any symbolic link or
+   leaving the directory. '*syscalls' is incremented by the number of
+   system calls made. Returns a file descriptor, or -1 on error. */
+
+static int
+openBeneath(int rootFd, const char *path, int flags,
+            unsigned long *syscalls)
+{
+    char comp[NAME_MAX + 1];
+    const char *p, *end;
+    int dirFd, fd, savedErrno;
+    size_t len;
+
+#ifdef SYS_openat2
+    struct open_how how;
+
+    memset(&how, 0, sizeof(how));
+    how.flags = flags | O_NOFOLLOW;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+    (*syscalls)++;
+    fd = syscall(SYS_openat2, rootFd, path, &how, sizeof(how));
+    if (fd != -1 || errno != ENOSYS)
+        return fd;
+#endif
+
+    /* Kernel lacks openat2(): open each directory in turn. O_DIRECTORY
+       with O_NOFOLLOW fails (ENOTDIR) if a component is a symbolic link */
+
+    dirFd = rootFd;
+    for (p = path; ; p = end + 1) {
+        end = strchr(p, '/');
+        len = (end == NULL) ? strlen(p) : (size_t) (end - p);
+        if (len > NAME_MAX) {
+            fd = -1;
+            errno = ENAMETOOLONG;
+            break;
+        }
+        memcpy(comp, p, len);
+        comp[len] = '\0';
+        if (len == 0)
+            strcpy(comp, ".");          /* Repeated or trailing slash */
+
+        (*syscalls)++;
+        if (end == NULL) {
+            fd = openat(dirFd, comp, flags | O_NOFOLLOW);
+            break;
+        }
+        fd = openat(dirFd, comp, O_PATH | O_DIRECTORY | O_NOFOLLOW |
+                                 O_CLOEXEC);
+        if (fd == -1)
+            break;
+        if (dirFd != rootFd)
+            close(dirFd);
+        dirFd = fd;
+    }
+
+    if (dirFd != rootFd) {
+        savedErrno = errno;
+        close(dirFd);
+        errno = savedErrno;
+    }
+    return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct xsHeader xh;
+    struct xsFileHdr fh;
+    struct xsAttrHdr ah;
+    char *path, *name, *value;
+    size_t pathSize, nameSize, valueSize;
+    unsigned long files, attrs, syscalls, errors, missing, j;
+    Boolean dryRun;
+    double start, secs;
+    FILE *fp;
+    int opt, rootFd, fd;
+
+    dryRun = FALSE;
+    fp = stdin;
+
+    while ((opt = getopt(argc, argv, "ni:")) != -1) {
+        switch (opt) {
+        case 'n':
+            dryRun = TRUE;
+            break;
+        case 'i':
+            fp = fopen(optarg, "r");
+            if (fp == NULL)
+                errExit("fopen %s", optarg);
+            break;
+        default:
+            usageErr("%s [-n] [-i file] dir\n", argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-n] [-i file] dir\n", argv[0]);
+
+    rootFd = open(argv[optind], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd == -1)
+        errExit("open %s", argv[optind]);
+
+    if (fread(&xh, sizeof(xh), 1, fp) != 1 || xh.magic != XS_MAGIC)
+        fatal("Not an xattr_dump stream");
+    if (xh.version != XS_VERSION)
+        fatal("Unsupported stream version %u", (unsigned int) xh.version);
+
+    path = name = value = NULL;
+    pathSize = nameSize = valueSize = 0;
+    files = attrs = syscalls = errors = missing = 0;
+    start = nowSecs();
+
+    while (fread(&fh, sizeof(fh), 1, fp) == 1) {
+        readInto(fp, &path, &pathSize, fh.pathLen);
+        files++;
+
+        fd = -1;
+        if (!pathOk(path)) {
+            fprintf(stderr, "%s: pathname leads outside %s\n", path,
+                    argv[optind]);
+            errors++;
+        } else if (!dryRun) {
+            fd = openBeneath(rootFd, path, O_RDONLY | O_NONBLOCK |
+                             O_NOCTTY | O_CLOEXEC, &syscalls);
+            if (fd == -1) {
+                errMsg("openat: %s", path);
+                missing++;
+            }
+        }
+
+        /* Even if the file couldn't be opened, we must read its
+           attributes to reach the next record */
+
+        for (j = 0; j < fh.numAttrs; j++) {
+            if (fread(&ah, sizeof(ah), 1, fp) != 1)
+                fatal("Truncated stream");
+            readInto(fp, &name, &nameSize, ah.nameLen);
+            readInto(fp, &value, &valueSize, ah.valueLen);
+            attrs++;
+
+            if (fd == -1)
+                continue;
+            syscalls++;
+            if (fsetxattr(fd, name, value, ah.valueLen, 0) == -1) {
+                errMsg("fsetxattr: %s: %s", path, name);
+                errors++;
+            }
+        }
+
+        if (fd != -1) {
+            close(fd);
+            syscalls++;
+        }
+    }
+    if (ferror(fp))
+        errExit("fread");
+
+    secs = nowSecs() - start;
+    fprintf(stderr, "%lu files, %lu attributes%s\n", files, attrs,
+            dryRun ? " (not restored: -n)" : "");
+    fprintf(stderr, "%.3f seconds: %.0f files/s; %.2f syscalls/file; "
+            "%lu errors; %lu files not found\n", secs,
+            (secs > 0) ? files / secs : 0.0,
+            (files > 0) ? (double) syscalls / files : 0.0, errors, missing);
+
+    exit((errors > 0 || missing > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
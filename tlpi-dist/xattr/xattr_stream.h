@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2018.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* xattr_stream.h
+
+   Header file for xattr_dump.c and xattr_restore.c, defining the format
+   of the extended attribute metadata stream.
+
+   The stream begins with a 'struct xsHeader'. Then, for each file that
+   has at least one extended attribute, there is:
+
+        struct xsFileHdr        followed by 'pathLen' bytes of pathname
+                                (relative to the top of the tree, without
+                                a terminating null byte)
+
+   and then, 'numAttrs' times:
+
+        struct xsAttrHdr        followed by 'nameLen' bytes of attribute
+                                name (without a null byte) and 'valueLen'
+                                bytes of value
+
+   Records for different files may appear in any order. All integers are
+   in host byte order: the stream is intended to be restored on the same
+   kind of system on which it was created.
+
+   ACLs are included: Linux stores a file's access and default ACLs as
+   the extended attributes 'system.posix_acl_access' and
+   'system.posix_acl_default'.
+*/
+#ifndef XATTR_STREAM_H
+#define XATTR_STREAM_H
+
+#include <stdint.h>
+
+#define XS_MAGIC    0x53544158  /* "XATS" */
+#define XS_VERSION  1
+
+struct xsHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct xsFileHdr {
+    uint32_t pathLen;
+    uint32_t numAttrs;
+};
+
+struct xsAttrHdr {
+    uint32_t nameLen;
+    uint32_t valueLen;
+};
+
+#endif